@@ -139,6 +139,11 @@ Status ProtoBufParser::ParseServingModelInfoToBuf(
     int* output_size) {
   eas::ServingModelInfo info;
   *info.mutable_model_path() = model_info.model_path;
+  info.set_update_lag_seconds(model_info.update_lag_seconds);
+  info.set_last_update_timestamp(model_info.last_update_timestamp);
+  info.set_failed_update_count(model_info.failed_update_count);
+  info.set_imported_keys(model_info.imported_keys);
+  info.set_import_throttled_millis(model_info.import_throttled_millis);
   *output_size = info.ByteSize();
   *output_data = new char[*output_size];
   info.SerializeToArray(*output_data, *output_size);
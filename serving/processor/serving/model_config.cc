@@ -127,6 +127,62 @@ Status ModelConfigFactory::Create(const char* model_config, ModelConfig** config
     (*config)->model_update_intra_threads = 0;
   }
 
+  if (!json_config["model_update_thread_nice"].isNull()) {
+    (*config)->model_update_thread_nice =
+      json_config["model_update_thread_nice"].asInt();
+  }
+
+  if ((*config)->model_update_thread_nice < 0 ||
+      (*config)->model_update_thread_nice > 19) {
+    return Status(error::Code::INVALID_ARGUMENT,
+        "[TensorFlow] model_update_thread_nice must be in [0, 19].");
+  }
+
+  if ((*config)->model_update_thread_nice > 0 &&
+      (*config)->model_update_inter_threads <= 0 &&
+      (*config)->model_update_intra_threads <= 0) {
+    LOG(WARNING) << "[TensorFlow] model_update_thread_nice only applies to "
+                 << "the model update thread pools, set "
+                 << "model_update_inter_threads or model_update_intra_threads "
+                 << "to create them. Model updates run in the session thread "
+                 << "pools with the serving priority.";
+  }
+
+  if (!json_config["model_update_interval_seconds"].isNull()) {
+    (*config)->model_update_interval_seconds =
+      json_config["model_update_interval_seconds"].asInt();
+  }
+
+  if ((*config)->model_update_interval_seconds <= 0) {
+    return Status(error::Code::INVALID_ARGUMENT,
+        "[TensorFlow] model_update_interval_seconds must be positive.");
+  }
+
+  if (!json_config["delta_update_keys_per_second"].isNull()) {
+    (*config)->delta_update_keys_per_second =
+      json_config["delta_update_keys_per_second"].asInt64();
+  }
+
+  if ((*config)->delta_update_keys_per_second < 0) {
+    return Status(error::Code::INVALID_ARGUMENT,
+        "[TensorFlow] delta_update_keys_per_second can't be negative.");
+  }
+
+  if (!json_config["shared_weights_full_update"].isNull()) {
+    (*config)->shared_weights_full_update =
+      json_config["shared_weights_full_update"].asBool();
+  }
+
+  if (!json_config["shared_weights_update_chunk_mb"].isNull()) {
+    (*config)->shared_weights_update_chunk_mb =
+      json_config["shared_weights_update_chunk_mb"].asInt();
+  }
+
+  if ((*config)->shared_weights_update_chunk_mb <= 0) {
+    return Status(error::Code::INVALID_ARGUMENT,
+        "[TensorFlow] shared_weights_update_chunk_mb must be positive.");
+  }
+
   if (!json_config["init_timeout_minutes"].isNull()) {
     (*config)->init_timeout_minutes =
       json_config["init_timeout_minutes"].asInt();
@@ -233,6 +289,23 @@ Status ModelConfigFactory::Create(const char* model_config, ModelConfig** config
     } else {
       (*config)->update_thread_num = 2;
     }
+
+    if (!json_config["embedding_cache_size_mb"].isNull()) {
+      (*config)->embedding_cache_size_mb =
+        json_config["embedding_cache_size_mb"].asInt();
+    }
+
+    if (!json_config["embedding_cache_min_frequency"].isNull()) {
+      (*config)->embedding_cache_min_frequency =
+        json_config["embedding_cache_min_frequency"].asInt();
+    }
+
+    if ((*config)->embedding_cache_size_mb < 0 ||
+        (*config)->embedding_cache_min_frequency < 1) {
+      return Status(error::Code::INVALID_ARGUMENT,
+          "[TensorFlow] embedding_cache_size_mb can't be negative and "
+          "embedding_cache_min_frequency must be positive.");
+    }
   }
 
   if (!json_config["model_store_type"].isNull()) {
@@ -321,6 +394,36 @@ Status ModelConfigFactory::Create(const char* model_config, ModelConfig** config
         json_config["use_per_session_threads"].asBool();
   }
 
+  (*config)->enable_request_batching = false;
+  if (!json_config["enable_request_batching"].isNull()) {
+    (*config)->enable_request_batching =
+        json_config["enable_request_batching"].asBool();
+  }
+
+  if (!json_config["max_batch_size"].isNull()) {
+    (*config)->max_batch_size =
+        json_config["max_batch_size"].asInt();
+  }
+
+  if (!json_config["batch_timeout_micros"].isNull()) {
+    (*config)->batch_timeout_micros =
+        json_config["batch_timeout_micros"].asInt();
+  }
+
+  if (!json_config["max_inflight_batches"].isNull()) {
+    (*config)->max_inflight_batches =
+        json_config["max_inflight_batches"].asInt();
+  }
+
+  if ((*config)->enable_request_batching &&
+      ((*config)->max_batch_size <= 0 ||
+       (*config)->batch_timeout_micros < 0 ||
+       (*config)->max_inflight_batches < 0)) {
+    return Status(error::Code::INVALID_ARGUMENT,
+        "[TensorFlow] max_batch_size must be positive, "
+        "batch_timeout_micros and max_inflight_batches can't be negative.");
+  }
+
   (*config)->shard_embedding = false;
   bool shard_embedding = false;
   if (!json_config["shard_embedding"].isNull()) {
@@ -23,6 +23,22 @@ struct ModelConfig {
   int intra_threads = 1;
   int model_update_inter_threads = 0;
   int model_update_intra_threads = 0;
+  // Nice value of the model update threads, higher values leave more CPU
+  // to the serving threads. Only set on the pools created for
+  // model_update_inter_threads and model_update_intra_threads.
+  int model_update_thread_nice = 0;
+  // Seconds between two polls of the model store for a new version.
+  int model_update_interval_seconds = 60;
+  // EmbeddingVariable keys imported per second by a delta model update,
+  // 0 doesn't limit it. The budget is process-wide, the models of one
+  // process share it and the last update to set or clear it wins.
+  int64 delta_update_keys_per_second = 0;
+  // Restore full model updates into the serving session, only for the
+  // variables which changed, instead of loading a second copy of the
+  // model next to it.
+  bool shared_weights_full_update = false;
+  // Dense tensors restored at once by a shared weights full update.
+  int shared_weights_update_chunk_mb = 256;
 
   // Embedding Config
   std::string feature_store_type;
@@ -34,6 +50,11 @@ struct ModelConfig {
   int lock_timeout = 15 * 60;
   int read_thread_num = 1;
   int update_thread_num = 1;
+  // Size of the in-process cache of embedding rows read from the
+  // feature store, 0 disables it.
+  int embedding_cache_size_mb = 0;
+  // Times a row has to be missed before it is cached.
+  int embedding_cache_min_frequency = 2;
 
   // OSS Config
   std::string model_store_type;
@@ -59,6 +80,17 @@ struct ModelConfig {
   // session use self-owned thread pool
   bool use_per_session_threads = false;
 
+  // Merge concurrent requests of the same signature into one session run,
+  // see RequestBatcher.
+  bool enable_request_batching = false;
+  // Max rows (0th dimension of the inputs) of a merged batch.
+  int max_batch_size = 64;
+  // Max time a request waits for others to join its batch.
+  int batch_timeout_micros = 1000;
+  // Merged runs allowed in flight before requests queue up, 0 means
+  // session_num.
+  int max_inflight_batches = 0;
+
   // EmbeddingVariable Config
   embedding::StorageType storage_type = embedding::StorageType::INVALID;
   std::string storage_path;
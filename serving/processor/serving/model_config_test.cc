@@ -282,6 +282,52 @@ const std::string oss_config = " \
       ModelConfigFactory::Create(oss_config.c_str(), &config).code());
 }
 
+TEST_F(ModelConfigTest, ShouldSuccessWhenConfigModelUpdateSchedule) {
+const std::string oss_config = " \
+  { \
+    \"serialize_protocol\": \"protobuf\", \
+    \"init_timeout_minutes\" : 1, \
+    \"signature_name\": \"tensorflow_serving\", \
+    \"checkpoint_dir\" : \"oss://test_ckpt/1\", \
+    \"savedmodel_dir\" : \"oss://test_savedmodel/1\", \
+    \"feature_store_type\" : \"memory\", \
+    \"model_store_type\": \"oss\", \
+    \"oss_endpoint\": \"test.endpoint\", \
+    \"oss_access_id\" : \"test_id\", \
+    \"oss_access_key\" : \"test_key\", \
+    \"model_update_thread_nice\" : 10, \
+    \"model_update_interval_seconds\" : 5, \
+    \"delta_update_keys_per_second\" : 3000000000 \
+  }";
+
+  ModelConfig* config = nullptr;
+  EXPECT_TRUE(ModelConfigFactory::Create(oss_config.c_str(), &config).ok());
+  EXPECT_EQ(10, config->model_update_thread_nice);
+  EXPECT_EQ(5, config->model_update_interval_seconds);
+  EXPECT_EQ(3000000000, config->delta_update_keys_per_second);
+}
+
+TEST_F(ModelConfigTest, ShouldFailureWhenModelUpdateIntervalNotPositive) {
+const std::string oss_config = " \
+  { \
+    \"serialize_protocol\": \"protobuf\", \
+    \"init_timeout_minutes\" : 1, \
+    \"signature_name\": \"tensorflow_serving\", \
+    \"checkpoint_dir\" : \"oss://test_ckpt/1\", \
+    \"savedmodel_dir\" : \"oss://test_savedmodel/1\", \
+    \"feature_store_type\" : \"memory\", \
+    \"model_store_type\": \"oss\", \
+    \"oss_endpoint\": \"test.endpoint\", \
+    \"oss_access_id\" : \"test_id\", \
+    \"oss_access_key\" : \"test_key\", \
+    \"model_update_interval_seconds\" : 0 \
+  }";
+
+  ModelConfig* config = nullptr;
+  EXPECT_EQ(error::Code::INVALID_ARGUMENT,
+      ModelConfigFactory::Create(oss_config.c_str(), &config).code());
+}
+
 } // processor
 } // tensorflow
 
@@ -12,8 +12,10 @@
 #include "tensorflow/cc/saved_model/reader.h"
 #include "tensorflow/cc/saved_model/loader.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/embedding/import_rate_limiter.h"
 #include "tensorflow/cc/saved_model/constants.h"
 #include "tensorflow/cc/saved_model/signature_constants.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/protobuf_internal.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/util/tensor_bundle/naming.h"
@@ -23,7 +25,6 @@ using tensorflow::kPredictMethodName;
 namespace tensorflow {
 namespace processor {
 namespace {
-constexpr int _60_Seconds = 60;
 constexpr int MAX_TRY_COUNT = 10;
 constexpr int WARMUP_COUNT = 5;
 
@@ -219,6 +220,16 @@ void InternalGetSignatureInfo(
   }
 }
 
+IFeatureStoreMgr* CreateFeatureStoreMgr(ModelConfig* config) {
+  IFeatureStoreMgr* storage = new FeatureStoreMgr(config);
+  if (config->embedding_cache_size_mb > 0) {
+    storage = new CachedFeatureStoreMgr(storage,
+        static_cast<size_t>(config->embedding_cache_size_mb) << 20,
+        config->embedding_cache_min_frequency);
+  }
+  return storage;
+}
+
 } // namespace
 
 LocalSessionInstance::LocalSessionInstance(
@@ -398,6 +409,13 @@ const SignatureInfo* LocalSessionInstance::GetSignatureInfo() {
 
 Status LocalSessionInstance::FullModelUpdate(
     const Version& version, ModelConfig* model_config) {
+  if (model_config->shared_weights_full_update) {
+    TF_RETURN_IF_ERROR(
+        session_mgr_->SharedWeightsFullModelUpdate(version, model_config));
+    UpdateVersion(version);
+    return Status::OK();
+  }
+
   ModelSession* new_model_session = nullptr;
 
   TF_RETURN_IF_ERROR(
@@ -485,12 +503,12 @@ Status RemoteSessionInstance::Init(ModelConfig* model_config,
   ModelConfig serving_model_config(*model_config);
   serving_model_config.redis_db_idx =
       storage_options_->serving_storage_db_index_;
-  serving_storage_ = new FeatureStoreMgr(&serving_model_config);
+  serving_storage_ = CreateFeatureStoreMgr(&serving_model_config);
 
   ModelConfig backup_model_config(*model_config);
   backup_model_config.redis_db_idx =
       storage_options_->backup_storage_db_index_;
-  backup_storage_ = new FeatureStoreMgr(&backup_model_config);
+  backup_storage_ = CreateFeatureStoreMgr(&backup_model_config);
 
   warmup_file_name_ = model_config->warmup_file_name;
   parser_ = ParserFactory::GetInstance(model_config->serialize_protocol, 4);
@@ -596,6 +614,8 @@ Status RemoteSessionInstance::FullModelUpdate(
       version.full_ckpt_name.c_str(), backup_storage_,
       /*is_incr_ckpt*/false, /*is_initialize*/false,
       model_config, &new_model_session));
+  // The model may have been imported by another instance.
+  backup_storage_->InvalidateCache();
 
   // warmup model
   Warmup(new_model_session);
@@ -616,6 +636,8 @@ Status RemoteSessionInstance::DeltaModelUpdate(
           version.delta_ckpt_name.c_str(), serving_storage_,
           /*is_incr_ckpt*/true, /*is_initialize*/false,
           model_config, &new_model_session));
+  // Cached rows of the full model may be overwritten by the delta.
+  serving_storage_->InvalidateCache();
 
   // warmup model
   Warmup(new_model_session);
@@ -676,6 +698,7 @@ Status LocalSessionInstanceMgr::Predict(Request& req, Response& resp) {
 
 Status LocalSessionInstanceMgr::GetServingModelInfo(
     ServingModelInfo& model_info) {
+  GetUpdateInfo(model_info);
   return instance_->GetServingModelInfo(model_info);
 }
 
@@ -784,6 +807,7 @@ Status RemoteSessionInstanceMgr::Predict(Request& req, Response& resp) {
 
 Status RemoteSessionInstanceMgr::GetServingModelInfo(
     ServingModelInfo& model_info) {
+  GetUpdateInfo(model_info);
   return cur_instance_->GetServingModelInfo(model_info);
 }
 
@@ -876,7 +900,8 @@ void ModelUpdater::WorkLoop() {
       try_count++;
       LOG(ERROR) << "[Processor] Found a invalid model, "
                  << "please check other error message, "
-                 << "we will try 60 seconds later. status: " << status.error_message()
+                 << "we will try " << model_config_->model_update_interval_seconds
+                 << " seconds later. status: " << status.error_message()
                  << "version debug string: " << version.DebugString();
       if (try_count >= MAX_TRY_COUNT) {
         LOG(FATAL) << "Try to get the latest model failed " << try_count << " times, "
@@ -887,7 +912,9 @@ void ModelUpdater::WorkLoop() {
       if (!status.ok()) {
         LOG(WARNING) << "[Processor] Not found full model or incremental model directory. "
                      << "Please ignore this warning if you confirm it. "
-                     << "And we will try 60 seconds later. Warning message: "
+                     << "And we will try "
+                     << model_config_->model_update_interval_seconds
+                     << " seconds later. Warning message: "
                      << status.error_message();
       }
 
@@ -896,21 +923,42 @@ void ModelUpdater::WorkLoop() {
       bool new_full_ckpt_generated = version.IsValid() &&
           (pre_version.full_ckpt_name != version.full_ckpt_name);
       if (new_full_ckpt_generated || pre_version < version) {
+        int64 expected = 0;
+        pending_since_micros_.compare_exchange_strong(
+            expected, Env::Default()->NowMicros());
         LOG(INFO) << "Start to load new version model: " << version.DebugString();
         auto status = ModelUpdate(version, model_config_,
                                   new_full_ckpt_generated);
         if (!status.ok()) {
+          failed_update_count_++;
           LOG(ERROR) << "Load new version model failed: " << status.error_message()
                      << ", version info: " << version.DebugString();
         } else {
+          last_update_micros_ = Env::Default()->NowMicros();
+          pending_since_micros_ = 0;
           LOG(INFO) << "Load new version model successful: " << version.DebugString();
         }
       }
     }
 
-    sleep(_60_Seconds);
+    // Wake up every second to stop the updater without a full interval.
+    for (int i = 0;
+         i < model_config_->model_update_interval_seconds && !is_stop_; ++i) {
+      sleep(1);
+    }
   }
 }
 
+void ModelUpdater::GetUpdateInfo(ServingModelInfo& model_info) {
+  const int64 pending_since = pending_since_micros_;
+  model_info.update_lag_seconds = pending_since == 0 ? 0 :
+      (Env::Default()->NowMicros() - pending_since) / 1000000;
+  model_info.last_update_timestamp = last_update_micros_ / 1000000;
+  model_info.failed_update_count = failed_update_count_;
+  auto limiter = embedding::ImportRateLimiter::Global();
+  model_info.imported_keys = limiter->imported_keys();
+  model_info.import_throttled_millis = limiter->throttled_micros() / 1000;
+}
+
 } // processor
 } // tensorflow
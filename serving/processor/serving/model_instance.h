@@ -156,11 +156,20 @@ class ModelUpdater {
                      ModelConfig* model_config,
                      bool new_full_model_generated);
 
+  // Fills the progress of model updates into `model_info`.
+  void GetUpdateInfo(ServingModelInfo& model_info);
+
  protected:
   ModelStore* model_store_ = nullptr;
   ModelConfig* model_config_ = nullptr; // not owned
   volatile bool is_stop_ = false;
   std::thread* thread_ = nullptr;
+
+  // Time in micros the updater found a version newer than the serving
+  // one, 0 when the serving model is up to date.
+  std::atomic<int64> pending_since_micros_{0};
+  std::atomic<int64> last_update_micros_{0};
+  std::atomic<int64> failed_update_count_{0};
 };
 
 class LocalSessionInstanceMgr : public ModelUpdater, public IModelInstanceMgr {
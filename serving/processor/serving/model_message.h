@@ -47,6 +47,16 @@ struct BatchCall {
 
 struct ServingModelInfo {
   std::string model_path;
+  // Seconds since a newer model version was found and not loaded yet,
+  // 0 when the serving model is up to date.
+  int64 update_lag_seconds = 0;
+  // Unix time of the last successful model update, 0 if none.
+  int64 last_update_timestamp = 0;
+  int64 failed_update_count = 0;
+  // EmbeddingVariable keys imported by restores, and the time the imports
+  // waited for delta_update_keys_per_second.
+  int64 imported_keys = 0;
+  int64 import_throttled_millis = 0;
 };
 
 } // processor
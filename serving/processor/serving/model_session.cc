@@ -1,6 +1,11 @@
 #include <random>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include "serving/processor/serving/model_session.h"
 #include "serving/processor/serving/model_message.h"
+#include "serving/processor/serving/request_batcher.h"
+#include "serving/processor/serving/shared_restore.h"
 #include "serving/processor/serving/tracer.h"
 #include "serving/processor/serving/util.h"
 #include "serving/processor/storage/model_store.h"
@@ -11,10 +16,15 @@
 #include "tensorflow/cc/saved_model/reader.h"
 #include "tensorflow/cc/saved_model/constants.h"
 #include "tensorflow/core/common_runtime/custom_thread_pool.h"
+#include "tensorflow/core/common_runtime/device.h"
+#include "tensorflow/core/common_runtime/device_mgr.h"
+#include "tensorflow/core/framework/embedding/import_rate_limiter.h"
 #include "tensorflow/core/platform/protobuf_internal.h"
+#include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/random/random.h"
 #include "tensorflow/core/util/tensor_bundle/naming.h"
+#include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
 
 namespace tensorflow {
 namespace processor {
@@ -113,27 +123,66 @@ int LockOrWait(int64_t latest_version,
   return 0;
 }
 
+// Runs the model update ops at a lower priority than the serving threads,
+// each pool thread renices itself on its first task.
+class ModelUpdateThreadPool : public CustomThreadPoolImpl {
+ public:
+  ModelUpdateThreadPool(const std::string& name, int num_threads, int nice)
+      : CustomThreadPoolImpl(name, num_threads), nice_(nice) {}
+
+  void Schedule(std::function<void()> fn) override {
+    CustomThreadPoolImpl::Schedule(WithNice(std::move(fn)));
+  }
+
+  void ScheduleWithHint(std::function<void()> fn, int start,
+                        int end) override {
+    CustomThreadPoolImpl::ScheduleWithHint(WithNice(std::move(fn)),
+                                           start, end);
+  }
+
+ private:
+  std::function<void()> WithNice(std::function<void()> fn) {
+    if (nice_ == 0) return fn;
+    const int nice = nice_;
+    return [nice, fn]() {
+      static thread_local bool reniced = false;
+      if (!reniced) {
+        reniced = true;
+        if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice) != 0) {
+          LOG(WARNING) << "Can't set nice " << nice
+                       << " to the model update thread.";
+        }
+      }
+      fn();
+    };
+  }
+
+  const int nice_;
+};
+
 void CreateCustomThreadPool(CustomThreadPoolImpl** tp, mutex& mu,
-                            int num, const std::string& name) {
+                            int num, int nice, const std::string& name) {
   mutex_lock lock(mu);
   if (!(*tp)) {
-    *tp = new CustomThreadPoolImpl(name, num);
+    *tp = new ModelUpdateThreadPool(name, num, nice);
   }
 }
 
-static CustomThreadPoolImpl* GetModelUpdateInterThreadPool(int num) {
+static CustomThreadPoolImpl* GetModelUpdateInterThreadPool(int num,
+                                                           int nice) {
   static CustomThreadPoolImpl* tp = nullptr;
   static mutex mu;
   if (tp) return tp;
-  CreateCustomThreadPool(&tp, mu, num, "user_model_update_inter");
+  CreateCustomThreadPool(&tp, mu, num, nice, "user_model_update_inter");
   return tp;
 }
 
-static CustomThreadPoolImpl* GetModelUpdateIntraThreadPool(int num) {
+static CustomThreadPoolImpl* GetModelUpdateIntraThreadPool(int num,
+                                                           int nice) {
   static CustomThreadPoolImpl* tp = nullptr;
   static mutex mu;
   if (tp) return tp;
-  CreateCustomThreadPool(&tp, mu, num, "user_model_update_intra");
+  CreateCustomThreadPool(&tp, mu, num, nice, "user_model_update_intra");
   return tp;
 }
 
@@ -269,6 +318,8 @@ ModelSession::ModelSession(SessionGroup* s,
 }
 
 ModelSession::~ModelSession() {
+  delete batcher_;
+  batcher_ = nullptr;
   if (session_group_) {
     delete session_group_;
     session_group_ = nullptr;
@@ -279,6 +330,51 @@ Session* ModelSession::GetSession() {
   return session_group_->GetLeaderSession();
 }
 
+void ModelSession::MaybeEnableRequestBatching(const ModelConfig* config) {
+  if (!config->enable_request_batching) {
+    return;
+  }
+  int max_inflight_batches = config->max_inflight_batches > 0
+      ? config->max_inflight_batches : session_group_->GetSessionNum();
+  // The merged request runs on the session picked for the leader thread.
+  batcher_ = new RequestBatcher(config->max_batch_size,
+      config->batch_timeout_micros, max_inflight_batches,
+      [this](Request& req, Response& resp) {
+        return is_local_
+            ? InternalLocalPredict(req, resp, GetServingSessionId())
+            : InternalPredict(req, resp, GetServingSessionId());
+      });
+  LOG(INFO) << "[ModelSession] Request batching enabled, max_batch_size: "
+            << config->max_batch_size << ", batch_timeout_micros: "
+            << config->batch_timeout_micros << ", max_inflight_batches: "
+            << max_inflight_batches;
+}
+
+int64 ModelSession::BeginStep() {
+  while (true) {
+    const int64 epoch = step_epoch_.load();
+    ++epoch_steps_[epoch & 1];
+    // WaitForEarlierSteps may have seen no step of this epoch yet and
+    // started the next one, count the step there instead.
+    if (step_epoch_.load() == epoch) return epoch;
+    --epoch_steps_[epoch & 1];
+  }
+}
+
+void ModelSession::EndStep(int64 epoch) {
+  --epoch_steps_[epoch & 1];
+}
+
+void ModelSession::WaitForEarlierSteps() {
+  // One wait at a time, so that the parity of an epoch is not reused while
+  // its steps are still counted.
+  mutex_lock lock(epoch_mu_);
+  const int64 epoch = step_epoch_.fetch_add(1);
+  while (epoch_steps_[epoch & 1] > 0) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+}
+
 int ModelSession::GetServingSessionId() {
   if (select_session_policy_ ==
       SelectSessionPolicy::RR) {
@@ -293,6 +389,13 @@ int ModelSession::GetServingSessionId() {
 }
 
 Status ModelSession::Predict(Request& req, Response& resp) {
+  if (batcher_ != nullptr && !is_local_) {
+    // Keep the session alive while the request waits in the batcher.
+    ++counter_;
+    Status status = batcher_->Predict(req, resp);
+    --counter_;
+    return status;
+  }
   return InternalPredict(req, resp, GetServingSessionId());
 }
 
@@ -311,6 +414,7 @@ Status ModelSession::InternalPredict(Request& req, Response& resp,
   req.inputs.emplace_back(sparse_storage_name_, sparse_storage_tensor_);
   req.inputs.emplace_back(model_version_name_, model_version_tensor_);
   ++counter_;
+  const int64 epoch = BeginStep();
   Status status;
   if (Tracer::GetTracer()->NeedTracing()) {
     tensorflow::RunOptions run_options;
@@ -325,12 +429,19 @@ Status ModelSession::InternalPredict(Request& req, Response& resp,
     status = session_group_->Run(req.inputs, req.output_tensor_names,
         {}, &resp.outputs, sess_id);
   }
+  EndStep(epoch);
   --counter_;
   return status;
 }
 
 Status ModelSession::LocalPredict(Request& req,
                                   Response& resp) {
+  if (batcher_ != nullptr && is_local_) {
+    ++counter_;
+    Status status = batcher_->Predict(req, resp);
+    --counter_;
+    return status;
+  }
   return InternalLocalPredict(req, resp,
       GetServingSessionId());
 }
@@ -349,6 +460,7 @@ Status ModelSession::InternalLocalPredict(Request& req,
         "Remote sparse storage, please use Predict.");
   }
   ++counter_;
+  const int64 epoch = BeginStep();
   Status status;
   if (Tracer::GetTracer()->NeedTracing()) {
     tensorflow::RunOptions run_options;
@@ -363,6 +475,7 @@ Status ModelSession::InternalLocalPredict(Request& req,
     status = session_group_->Run(req.inputs, req.output_tensor_names,
         {}, &resp.outputs, sess_id);
   }
+  EndStep(epoch);
   --counter_;
   return status;
 }
@@ -491,6 +604,7 @@ Status ModelSessionMgr::CreateModelSession(
   *new_model_session = new ModelSession(
       session_group, config->select_session_policy,
       version, sparse_storage);
+  (*new_model_session)->MaybeEnableRequestBatching(config);
 
   return Status::OK();
 }
@@ -520,6 +634,7 @@ Status ModelSessionMgr::CreateModelSession(
 
   auto new_model_session = new ModelSession(
       session_group, config->select_session_policy, version);
+  new_model_session->MaybeEnableRequestBatching(config);
   ResetServingSession(new_model_session);
 
   return Status::OK();
@@ -567,20 +682,41 @@ Status ModelSessionMgr::CreateModelSession(
   thread::ThreadPoolOptions thread_opt = thread::ThreadPoolOptions();
   if (!is_initialize && config->model_update_intra_threads > 0) {
     thread_opt.intra_op_threadpool =
-        GetModelUpdateIntraThreadPool(config->model_update_intra_threads);
+        GetModelUpdateIntraThreadPool(config->model_update_intra_threads,
+                                      config->model_update_thread_nice);
   }
 
   if (!is_initialize && config->model_update_inter_threads > 0) {
     thread_opt.inter_op_threadpool =
-        GetModelUpdateInterThreadPool(config->model_update_inter_threads);
+        GetModelUpdateInterThreadPool(config->model_update_inter_threads,
+                                      config->model_update_thread_nice);
   }
 
-  TF_RETURN_IF_ERROR(util::RunRestoreCheckpoint(
-      is_incr_ckpt, *run_options_, full_ckpt_name,
-      incr_ckpt_name, version.savedmodel_dir.c_str(),
-      restore_op_name, filename_tensor_name,
-      incr_filename_tensor_name, asset_file_defs_, session,
-      thread_opt));
+  {
+    // Delta models are imported next to the serving traffic, at the
+    // configured keys/s budget.
+    const int64 keys_per_second = (is_incr_ckpt && !is_initialize) ?
+        config->delta_update_keys_per_second : 0;
+    auto limiter = embedding::ImportRateLimiter::Global();
+    const int64 imported_keys = limiter->imported_keys();
+    const int64 throttled_micros = limiter->throttled_micros();
+    const int64 start_micros = Env::Default()->NowMicros();
+    embedding::ScopedImportRateLimit rate_limit(keys_per_second);
+    TF_RETURN_IF_ERROR(util::RunRestoreCheckpoint(
+        is_incr_ckpt, *run_options_, full_ckpt_name,
+        incr_ckpt_name, version.savedmodel_dir.c_str(),
+        restore_op_name, filename_tensor_name,
+        incr_filename_tensor_name, asset_file_defs_, session,
+        thread_opt));
+    if (is_incr_ckpt) {
+      LOG(INFO) << "Delta model " << incr_ckpt_name << " imported "
+                << limiter->imported_keys() - imported_keys << " keys in "
+                << (Env::Default()->NowMicros() - start_micros) / 1000
+                << "ms, throttled "
+                << (limiter->throttled_micros() - throttled_micros) / 1000
+                << "ms.";
+    }
+  }
 
   if (util::HasMainOp(meta_graph_def_)) {
     TF_RETURN_IF_ERROR(util::RunMainOp(*run_options_,
@@ -598,6 +734,7 @@ Status ModelSessionMgr::CreateModelSession(
     // ResetServingSession(session, version);
     *new_model_session = new ModelSession(
       session_group, config->select_session_policy, version);
+    (*new_model_session)->MaybeEnableRequestBatching(config);
   } else {
     serving_session_->UpdateVersion(version);
   }
@@ -605,6 +742,124 @@ Status ModelSessionMgr::CreateModelSession(
   return Status::OK();
 }
 
+Status ModelSessionMgr::SharedWeightsFullModelUpdate(
+    const Version& version, ModelConfig* config) {
+  const Version serving_version = serving_session_->GetVersion();
+  SharedRestorePlan plan;
+  TF_RETURN_IF_ERROR(SharedRestorePlan::Create(meta_graph_def_.graph_def(),
+      meta_graph_def_.saver_def().restore_op_name(), &plan));
+  TF_RETURN_IF_ERROR(plan.DiffCheckpoints(serving_version.full_ckpt_name,
+                                          serving_version.delta_ckpt_name,
+                                          version.full_ckpt_name));
+  BundleReader reader(Env::Default(), version.full_ckpt_name);
+  TF_RETURN_IF_ERROR(reader.status());
+
+  thread::ThreadPoolOptions thread_opt = thread::ThreadPoolOptions();
+  if (config->model_update_intra_threads > 0) {
+    thread_opt.intra_op_threadpool =
+        GetModelUpdateIntraThreadPool(config->model_update_intra_threads,
+                                      config->model_update_thread_nice);
+  }
+  if (config->model_update_inter_threads > 0) {
+    thread_opt.inter_op_threadpool =
+        GetModelUpdateInterThreadPool(config->model_update_inter_threads,
+                                      config->model_update_thread_nice);
+  }
+
+  // Changed variables are restored a chunk at a time, so that no more than
+  // shared_weights_update_chunk_mb of new dense tensors are held besides
+  // the model.
+  Session* session = serving_session_->GetSession();
+  Tensor variables_path_tensor(DT_STRING, TensorShape({}));
+  variables_path_tensor.scalar<string>()() = version.full_ckpt_name;
+  std::vector<std::pair<std::string, Tensor>> inputs = {
+      {meta_graph_def_.saver_def().filename_tensor_name(),
+       variables_path_tensor}};
+  util::AddAssetsTensorsToInputs(version.savedmodel_dir, asset_file_defs_,
+                                 &inputs);
+  const size_t num_fixed_inputs = inputs.size();
+  const int64 chunk_bytes =
+      static_cast<int64>(config->shared_weights_update_chunk_mb) << 20;
+  std::vector<std::string> chunk_targets;
+  int64 chunk_size = 0;
+  // Every chunk feeds and runs its own set of tensors. RunOnce makes a
+  // callable for it and releases it after the run, so the session keeps
+  // no executor per chunk, unlike Session::Run which caches the executors
+  // of every signature it ran.
+  auto run_chunk = [&]() {
+    if (chunk_targets.empty()) return Status::OK();
+    RunMetadata run_metadata;
+    Status s = util::RunOnce(*run_options_, inputs, {}, chunk_targets,
+                             nullptr, &run_metadata, session, thread_opt);
+    inputs.resize(num_fixed_inputs);
+    chunk_targets.clear();
+    chunk_size = 0;
+    return s;
+  };
+
+  int shared = 0;
+  std::vector<const RestoreTarget*> imported_evs;
+  for (const RestoreTarget& target : plan.targets()) {
+    if (!plan.Changed(target)) {
+      ++shared;
+      continue;
+    }
+    if (target.is_prefix) imported_evs.push_back(&target);
+    if (!target.feed_name.empty()) {
+      Tensor value;
+      TF_RETURN_IF_ERROR(reader.Lookup(target.tensor_key, &value));
+      chunk_size += value.TotalBytes();
+      inputs.emplace_back(target.feed_name, value);
+    }
+    chunk_targets.emplace_back(target.node_name);
+    if (chunk_size >= chunk_bytes) {
+      TF_RETURN_IF_ERROR(run_chunk());
+    }
+  }
+  TF_RETURN_IF_ERROR(run_chunk());
+  LOG(INFO) << "Full model update restored "
+            << plan.targets().size() - shared << " variables in place and "
+            << "shared " << shared << " unchanged ones, version: "
+            << version.full_ckpt_name;
+
+  // The imports left the EmbeddingVariable keys dropped from the new
+  // checkpoint with the values of the serving model.
+  // Their entries are freed on return, also on error, but only once every
+  // step that started before they were removed has finished: such a step
+  // may still read an entry it looked up. Later steps can't reach them.
+  std::vector<std::function<void()>> deferred_frees;
+  auto free_removed_entries = gtl::MakeCleanup([this, &deferred_frees]() {
+    if (deferred_frees.empty()) return;
+    serving_session_->WaitForEarlierSteps();
+    for (auto& free_entries : deferred_frees) free_entries();
+  });
+  if (!imported_evs.empty()) {
+    const DeviceMgr* device_mgr = nullptr;
+    Device* device = nullptr;
+    TF_RETURN_IF_ERROR(session->LocalDeviceManager(&device_mgr));
+    TF_RETURN_IF_ERROR(device_mgr->LookupDevice("/device:CPU:0", &device));
+    for (const RestoreTarget* target : imported_evs) {
+      TF_RETURN_IF_ERROR(RemoveStaleEmbeddingKeys(
+          *target, &reader, device->resource_manager(), &deferred_frees));
+    }
+  }
+
+  if (util::HasMainOp(meta_graph_def_)) {
+    TF_RETURN_IF_ERROR(util::RunMainOp(*run_options_,
+        version.savedmodel_dir.c_str(),
+        meta_graph_def_, asset_file_defs_,
+        session, kSavedModelMainOpKey));
+  } else {
+    TF_RETURN_IF_ERROR(util::RunMainOp(
+        *run_options_, version.savedmodel_dir.c_str(),
+        meta_graph_def_, asset_file_defs_, session,
+        kSavedModelLegacyInitOpKey));
+  }
+
+  serving_session_->UpdateVersion(version);
+  return Status::OK();
+}
+
 Status ModelSessionMgr::CleanupModelSession() {
   mutex_lock lock(mu_);
   sessions_.erase(
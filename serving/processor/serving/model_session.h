@@ -7,6 +7,7 @@
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/protobuf/meta_graph.pb.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/platform/mutex.h"
 #include <thread>
 #include <atomic>
 
@@ -20,6 +21,7 @@ class Tensor;
 namespace processor {
 class IFeatureStoreMgr;
 class Request;
+class RequestBatcher;
 class Response;
 enum SelectSessionPolicy {
   MOD = 1,
@@ -40,6 +42,12 @@ struct ModelSession {
   void UpdateVersion(const Version& v) { version_ = v; }
   Session* GetSession();
   Status Warmup(Request& req, Response& resp, bool local=true);
+  // Merges concurrent Predict/LocalPredict requests when
+  // config->enable_request_batching is set.
+  void MaybeEnableRequestBatching(const ModelConfig* config);
+  // Returns once every step that started before the call has finished.
+  // Steps started later don't delay it.
+  void WaitForEarlierSteps();
 
   SessionGroup* session_group_ = nullptr;
   SelectSessionPolicy select_session_policy_ =
@@ -54,11 +62,21 @@ struct ModelSession {
   // Local storage or remote storage for sparse variable.
   bool is_local_ = true;
   Version version_;
+  RequestBatcher* batcher_ = nullptr;
 
  private:
+  // Counts a step in the current epoch, returns the epoch to end it with.
+  int64 BeginStep();
+  void EndStep(int64 epoch);
   int GetServingSessionId();
   Status InternalPredict(Request& req, Response& resp, int sess_id);
   Status InternalLocalPredict(Request& req, Response& resp, int sess_id);
+
+  // Steps in flight of the current and of the previous epoch, indexed by
+  // the parity of the epoch. WaitForEarlierSteps starts a new epoch.
+  std::atomic<int64> step_epoch_{0};
+  std::atomic<int64> epoch_steps_[2] = {{0}, {0}};
+  mutex epoch_mu_;
 };
 
 class ModelSessionMgr {
@@ -100,6 +118,11 @@ class ModelSessionMgr {
       bool is_initialize, ModelConfig* config,
       ModelSession** new_model_session);
 
+  // Restores the full checkpoint of `version` into the variables of the
+  // serving session instead of a new session, see SharedRestorePlan.
+  Status SharedWeightsFullModelUpdate(const Version& version,
+                                      ModelConfig* config);
+
   Status CleanupModelSession();
 
   void ResetServingSession(ModelSession* model_session);
@@ -4,6 +4,8 @@
 #include "serving/processor/serving/model_config.h"
 #include "serving/processor/serving/model_message.h"
 #include "tensorflow/core/common_runtime/direct_session_group.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/public/session.h"
 
 namespace tensorflow {
@@ -113,6 +115,26 @@ class FakeSession : public Session {
   }
 };
 
+// Its step notifies `started` and runs until `release` is notified.
+class BlockingSession : public FakeSession {
+ public:
+  BlockingSession(Notification* started, Notification* release)
+      : started_(started), release_(release) {}
+
+  Status Run(const std::vector<std::pair<string, Tensor> >& inputs,
+             const std::vector<string>& output_tensor_names,
+             const std::vector<string>& target_node_names,
+             std::vector<Tensor>* outputs) override {
+    started_->Notify();
+    release_->WaitForNotification();
+    return Status::OK();
+  }
+
+ private:
+  Notification* started_;
+  Notification* release_;
+};
+
 class FakeFeatureStoreMgr : public IFeatureStoreMgr {
  public:
   FakeFeatureStoreMgr(ModelConfig* config) {
@@ -291,5 +313,34 @@ TEST_F(ModelSessionMgrTest, CleanupModelSessionWhenNoRequest) {
   EXPECT_EQ(1, mgr.GetModelSessionSize());
 }
 
+TEST_F(ModelSessionMgrTest, WaitForEarlierStepsWaitsForRunningSteps) {
+  Notification started;
+  Notification release;
+  SessionGroup* sess_group = new DirectSessionGroup();
+  sess_group->CreateLeaderSession(new BlockingSession(&started, &release));
+  ModelSession model_session(sess_group, "MOD", Version());
+  // No step runs yet.
+  model_session.WaitForEarlierSteps();
+
+  std::unique_ptr<Thread> step(Env::Default()->StartThread(
+      ThreadOptions(), "step", [&model_session]() {
+        Request req;
+        Response resp;
+        EXPECT_TRUE(model_session.LocalPredict(req, resp).ok());
+      }));
+  started.WaitForNotification();
+
+  Notification waited;
+  std::unique_ptr<Thread> waiter(Env::Default()->StartThread(
+      ThreadOptions(), "waiter", [&model_session, &waited]() {
+        model_session.WaitForEarlierSteps();
+        waited.Notify();
+      }));
+  // The step started before the wait holds it.
+  EXPECT_FALSE(WaitForNotificationWithTimeout(&waited, 100000));
+  release.Notify();
+  waited.WaitForNotification();
+}
+
 } // processor
 } // tensorflow
@@ -0,0 +1,243 @@
+#include "serving/processor/serving/request_batcher.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+namespace processor {
+
+namespace {
+constexpr uint64 kStatsLogIntervalMicros = 60 * 1000 * 1000;
+
+// Builds the key of requests that can share a batch, and returns the
+// number of rows of the request. Returns false when the inputs have no
+// common 0th dimension to batch on.
+bool GetBatchKey(const Request& req, std::string* key, int64* rows) {
+  if (req.inputs.empty()) {
+    return false;
+  }
+  *rows = -1;
+  for (auto& input : req.inputs) {
+    const Tensor& t = input.second;
+    if (t.dims() < 1 || (*rows >= 0 && t.dim_size(0) != *rows)) {
+      return false;
+    }
+    *rows = t.dim_size(0);
+    strings::StrAppend(key, input.first, ":", t.dtype());
+    for (int i = 1; i < t.dims(); ++i) {
+      strings::StrAppend(key, ",", t.dim_size(i));
+    }
+    strings::StrAppend(key, ";");
+  }
+  for (auto& name : req.output_tensor_names) {
+    strings::StrAppend(key, name, ";");
+  }
+  return *rows > 0;
+}
+} // namespace
+
+struct RequestBatcher::Task {
+  Request* req = nullptr;
+  Response* resp = nullptr;
+  int64 rows = 0;
+  std::chrono::steady_clock::time_point deadline;
+  Status status;
+  bool done = false;
+  bool leader = false;
+  std::condition_variable cv;
+};
+
+struct RequestBatcher::Queue {
+  // The front task, if any, is the leader of the next batch.
+  std::deque<Task*> tasks;
+  int64 rows = 0;
+};
+
+RequestBatcher::RequestBatcher(int max_batch_size,
+    int64 batch_timeout_micros, int max_inflight_batches, RunFn run_fn)
+    : max_batch_size_(max_batch_size),
+      batch_timeout_(batch_timeout_micros),
+      max_inflight_batches_(std::max(max_inflight_batches, 1)),
+      run_fn_(std::move(run_fn)),
+      last_log_micros_(Env::Default()->NowMicros()) {
+}
+
+RequestBatcher::~RequestBatcher() {
+}
+
+Status RequestBatcher::Predict(Request& req, Response& resp) {
+  const uint64 start_micros = Env::Default()->NowMicros();
+  std::string key;
+  int64 rows = 0;
+  if (!GetBatchKey(req, &key, &rows) || rows >= max_batch_size_) {
+    Status s = run_fn_(req, resp);
+    batch_size_.Add(std::max<int64>(rows, 1));
+    latency_micros_.Add(Env::Default()->NowMicros() - start_micros);
+    return s;
+  }
+
+  Task task;
+  task.req = &req;
+  task.resp = &resp;
+  task.rows = rows;
+  task.deadline = std::chrono::steady_clock::now() + batch_timeout_;
+
+  std::unique_lock<std::mutex> lock(mu_);
+  auto& queue = queues_[key];
+  if (queue == nullptr) {
+    queue.reset(new Queue);
+  }
+  queue->tasks.push_back(&task);
+  queue->rows += rows;
+  if (queue->tasks.size() == 1) {
+    task.leader = true;
+  } else if (queue->rows >= max_batch_size_) {
+    queue->tasks.front()->cv.notify_one();
+  }
+
+  task.cv.wait(lock, [&task]() { return task.done || task.leader; });
+  if (!task.done) {
+    RunAsLeader(&lock, key, queue.get(), &task);
+  }
+  lock.unlock();
+
+  latency_micros_.Add(Env::Default()->NowMicros() - start_micros);
+  MaybeLogStats();
+  return task.status;
+}
+
+void RequestBatcher::RunAsLeader(std::unique_lock<std::mutex>* lock,
+    const std::string& key, Queue* queue, Task* leader) {
+  leader->cv.wait_until(*lock, leader->deadline, [this, queue]() {
+    return queue->rows >= max_batch_size_ ||
+           num_inflight_batches_ < max_inflight_batches_;
+  });
+
+  std::vector<Task*> batch;
+  int64 batch_rows = 0;
+  while (!queue->tasks.empty()) {
+    Task* t = queue->tasks.front();
+    if (!batch.empty() && batch_rows + t->rows > max_batch_size_) {
+      break;
+    }
+    batch.push_back(t);
+    batch_rows += t->rows;
+    queue->tasks.pop_front();
+  }
+  queue->rows -= batch_rows;
+  // Requests that did not fit wait for the next batch, led by the oldest.
+  // A drained queue is dropped, the next request of the signature makes
+  // a new one.
+  if (!queue->tasks.empty()) {
+    queue->tasks.front()->leader = true;
+    queue->tasks.front()->cv.notify_one();
+  } else {
+    queues_.erase(key);
+  }
+  ++num_inflight_batches_;
+  lock->unlock();
+
+  RunBatch(batch, batch_rows);
+  batch_size_.Add(batch_rows);
+
+  lock->lock();
+  --num_inflight_batches_;
+  for (auto t : batch) {
+    t->done = true;
+    if (t != leader) {
+      t->cv.notify_one();
+    }
+  }
+  // A run slot is free, let the waiting leaders check again.
+  for (auto& it : queues_) {
+    if (!it.second->tasks.empty()) {
+      it.second->tasks.front()->cv.notify_one();
+    }
+  }
+}
+
+void RequestBatcher::RunBatch(const std::vector<Task*>& batch,
+    int64 batch_rows) {
+  if (batch.size() == 1) {
+    batch[0]->status = run_fn_(*batch[0]->req, *batch[0]->resp);
+    return;
+  }
+
+  Request batched_request;
+  const Request& first = *batch[0]->req;
+  for (size_t i = 0; i < first.inputs.size(); ++i) {
+    std::vector<Tensor> parts;
+    parts.reserve(batch.size());
+    for (auto t : batch) {
+      parts.push_back(t->req->inputs[i].second);
+    }
+    Tensor batched_tensor;
+    if (!tensor::Concat(parts, &batched_tensor).ok()) {
+      RunOneByOne(batch);
+      return;
+    }
+    batched_request.inputs.emplace_back(first.inputs[i].first,
+                                        batched_tensor);
+  }
+  batched_request.output_tensor_names = first.output_tensor_names;
+
+  Response batched_response;
+  if (!run_fn_(batched_request, batched_response).ok()) {
+    // Do not let one bad request fail the others.
+    RunOneByOne(batch);
+    return;
+  }
+
+  std::vector<int64> sizes;
+  sizes.reserve(batch.size());
+  for (auto t : batch) {
+    sizes.push_back(t->rows);
+  }
+  const size_t num_outputs = batched_response.outputs.size();
+  std::vector<std::vector<Tensor>> split_outputs(num_outputs);
+  for (size_t i = 0; i < num_outputs; ++i) {
+    const Tensor& output = batched_response.outputs[i];
+    if (output.dims() < 1 || output.dim_size(0) != batch_rows ||
+        !tensor::Split(output, sizes, &split_outputs[i]).ok()) {
+      RunOneByOne(batch);
+      return;
+    }
+  }
+  for (size_t j = 0; j < batch.size(); ++j) {
+    auto& outputs = batch[j]->resp->outputs;
+    outputs.clear();
+    outputs.reserve(num_outputs);
+    for (size_t i = 0; i < num_outputs; ++i) {
+      outputs.push_back(std::move(split_outputs[i][j]));
+    }
+    batch[j]->status = Status::OK();
+  }
+}
+
+void RequestBatcher::RunOneByOne(const std::vector<Task*>& batch) {
+  for (auto t : batch) {
+    t->resp->outputs.clear();
+    t->status = run_fn_(*t->req, *t->resp);
+  }
+}
+
+void RequestBatcher::MaybeLogStats() {
+  uint64 now = Env::Default()->NowMicros();
+  uint64 last = last_log_micros_.load(std::memory_order_relaxed);
+  if (now - last < kStatsLogIntervalMicros ||
+      !last_log_micros_.compare_exchange_strong(last, now)) {
+    return;
+  }
+  LOG(INFO) << "[RequestBatcher] " << DebugString();
+}
+
+std::string RequestBatcher::DebugString() {
+  return strings::StrCat("request latency (us):\n",
+                         latency_micros_.ToString(),
+                         "batch size (rows):\n", batch_size_.ToString());
+}
+
+} // processor
+} // tensorflow
@@ -0,0 +1,81 @@
+#ifndef SERVING_PROCESSOR_SERVING_REQUEST_BATCHER_H
+#define SERVING_PROCESSOR_SERVING_REQUEST_BATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "serving/processor/serving/model_message.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/histogram/histogram.h"
+
+namespace tensorflow {
+namespace processor {
+
+// Merges concurrent requests with the same signature into one session run.
+//
+// Requests match when they feed the same inputs with the same dtypes and
+// the same shapes except for the 0th (batch) dimension, and fetch the same
+// outputs. The first request of a group leads the next batch: it waits
+// until the batch holds max_batch_size rows, until a run slot is free
+// (fewer than max_inflight_batches merged runs in flight), or until
+// batch_timeout_micros after it arrived, whichever comes first. So under
+// light load a request runs right away, and under heavy load the batch
+// grows while the sessions are busy. The leader concatenates the inputs
+// along dimension 0, runs them in its own thread and splits the outputs
+// back along dimension 0.
+//
+// Requests without a common batch dimension are run on their own. If the
+// outputs of a merged run are not batch-major, or the merged run fails,
+// the requests of the batch are run one by one instead.
+class RequestBatcher {
+ public:
+  typedef std::function<Status(Request&, Response&)> RunFn;
+
+  RequestBatcher(int max_batch_size, int64 batch_timeout_micros,
+                 int max_inflight_batches, RunFn run_fn);
+  ~RequestBatcher();
+
+  RequestBatcher(const RequestBatcher&) = delete;
+  RequestBatcher& operator=(const RequestBatcher&) = delete;
+
+  Status Predict(Request& req, Response& resp);
+
+  // Latency (microseconds) and batch size (rows) histograms.
+  std::string DebugString();
+
+ private:
+  struct Task;
+  struct Queue;
+
+  void RunAsLeader(std::unique_lock<std::mutex>* lock,
+                   const std::string& key, Queue* queue, Task* leader);
+  void RunBatch(const std::vector<Task*>& batch, int64 batch_rows);
+  void RunOneByOne(const std::vector<Task*>& batch);
+  void MaybeLogStats();
+
+  const int max_batch_size_;
+  const std::chrono::microseconds batch_timeout_;
+  const int max_inflight_batches_;
+  RunFn run_fn_;
+
+  std::mutex mu_;
+  std::unordered_map<std::string, std::unique_ptr<Queue>> queues_;
+  int num_inflight_batches_ = 0;
+
+  histogram::ThreadSafeHistogram latency_micros_;
+  histogram::ThreadSafeHistogram batch_size_;
+  std::atomic<uint64> last_log_micros_;
+};
+
+} // processor
+} // tensorflow
+
+#endif // SERVING_PROCESSOR_SERVING_REQUEST_BATCHER_H
@@ -0,0 +1,168 @@
+#include "gtest/gtest.h"
+#include "serving/processor/serving/request_batcher.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/platform/env.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace tensorflow {
+namespace processor {
+namespace {
+Request CreateRequest(int64 rows, float value) {
+  Tensor t(DT_FLOAT, TensorShape({rows, 2}));
+  t.flat<float>().setConstant(value);
+  Request req;
+  req.inputs.emplace_back("input:0", t);
+  req.output_tensor_names.emplace_back("output:0");
+  return req;
+}
+}
+
+class RequestBatcherTest : public ::testing::Test {
+};
+
+TEST_F(RequestBatcherTest, MergeConcurrentRequests) {
+  std::atomic<int> num_runs(0);
+  std::atomic<int64> max_rows(0);
+  // output = 2 * input, slow enough for requests to pile up.
+  RequestBatcher batcher(16, 100 * 1000, 1,
+      [&num_runs, &max_rows](Request& req, Response& resp) {
+        ++num_runs;
+        const Tensor& in = req.inputs[0].second;
+        int64 rows = in.dim_size(0);
+        if (rows > max_rows) max_rows = rows;
+        Tensor out(DT_FLOAT, in.shape());
+        out.flat<float>() = in.flat<float>() * 2.0f;
+        resp.outputs.emplace_back(out);
+        Env::Default()->SleepForMicroseconds(5 * 1000);
+        return Status::OK();
+      });
+
+  const int kThreads = 8;
+  const int kRequestsPerThread = 20;
+  std::vector<std::thread> threads;
+  std::atomic<int> num_failures(0);
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([i, &batcher, &num_failures]() {
+      for (int j = 0; j < kRequestsPerThread; ++j) {
+        int64 rows = 1 + (i + j) % 3;
+        float value = i * 100 + j;
+        Request req = CreateRequest(rows, value);
+        Response resp;
+        Status s = batcher.Predict(req, resp);
+        if (!s.ok() || resp.outputs.size() != 1 ||
+            resp.outputs[0].dim_size(0) != rows ||
+            resp.outputs[0].flat<float>()(0) != 2 * value ||
+            resp.outputs[0].flat<float>()(rows * 2 - 1) != 2 * value) {
+          ++num_failures;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(0, num_failures);
+  EXPECT_LT(num_runs, kThreads * kRequestsPerThread);
+  EXPECT_LE(max_rows, 16);
+}
+
+TEST_F(RequestBatcherTest, RunOneByOneWhenOutputsNotBatchMajor) {
+  std::atomic<int> num_runs(0);
+  // Returns the sum of the input, which can't be split by rows.
+  RequestBatcher batcher(16, 100 * 1000, 1,
+      [&num_runs](Request& req, Response& resp) {
+        ++num_runs;
+        auto in = req.inputs[0].second.flat<float>();
+        float sum = 0;
+        for (int64 i = 0; i < in.size(); ++i) {
+          sum += in(i);
+        }
+        Tensor out(DT_FLOAT, TensorShape({}));
+        out.scalar<float>()() = sum;
+        resp.outputs.emplace_back(out);
+        Env::Default()->SleepForMicroseconds(5 * 1000);
+        return Status::OK();
+      });
+
+  std::vector<std::thread> threads;
+  std::atomic<int> num_failures(0);
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([i, &batcher, &num_failures]() {
+      for (int j = 0; j < 10; ++j) {
+        Request req = CreateRequest(1, i + 1);
+        Response resp;
+        Status s = batcher.Predict(req, resp);
+        if (!s.ok() || resp.outputs.size() != 1 ||
+            resp.outputs[0].scalar<float>()() != 2 * (i + 1)) {
+          ++num_failures;
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(0, num_failures);
+}
+
+TEST_F(RequestBatcherTest, DifferentSignaturesNotMerged) {
+  // Requests of "output:0" and "output:1" would concat fine, only their
+  // signatures tell them apart. A "blocker:0" run holds the only run slot
+  // while both queues fill up to a full batch of 4 rows.
+  std::mutex mu;
+  std::map<std::string, std::vector<int64>> runs;
+  RequestBatcher batcher(4, 10 * 1000 * 1000, 1,
+      [&mu, &runs](Request& req, Response& resp) {
+        const std::string& output = req.output_tensor_names[0];
+        {
+          std::lock_guard<std::mutex> l(mu);
+          runs[output].push_back(req.inputs[0].second.dim_size(0));
+        }
+        if (output == "blocker:0") {
+          Env::Default()->SleepForMicroseconds(300 * 1000);
+        }
+        const Tensor& in = req.inputs[0].second;
+        Tensor out(DT_FLOAT, in.shape());
+        out.flat<float>() = in.flat<float>() * 2.0f;
+        resp.outputs.emplace_back(out);
+        return Status::OK();
+      });
+
+  std::thread blocker([&batcher]() {
+    Request req = CreateRequest(1, 0);
+    req.output_tensor_names[0] = "blocker:0";
+    Response resp;
+    EXPECT_TRUE(batcher.Predict(req, resp).ok());
+  });
+  Env::Default()->SleepForMicroseconds(50 * 1000);
+
+  std::vector<std::thread> threads;
+  std::atomic<int> num_failures(0);
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([i, &batcher, &num_failures]() {
+      Request req = CreateRequest(1, i + 1);
+      req.output_tensor_names[0] = i % 2 ? "output:1" : "output:0";
+      Response resp;
+      Status s = batcher.Predict(req, resp);
+      if (!s.ok() || resp.outputs.size() != 1 ||
+          resp.outputs[0].flat<float>()(0) != 2 * (i + 1)) {
+        ++num_failures;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  blocker.join();
+  EXPECT_EQ(0, num_failures);
+  EXPECT_EQ(std::vector<int64>({1}), runs["blocker:0"]);
+  EXPECT_EQ(std::vector<int64>({4}), runs["output:0"]);
+  EXPECT_EQ(std::vector<int64>({4}), runs["output:1"]);
+}
+
+} // processor
+} // tensorflow
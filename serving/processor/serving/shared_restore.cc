@@ -0,0 +1,372 @@
+#include "serving/processor/serving/shared_restore.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_map>
+
+#include "tensorflow/core/framework/embedding/embedding_var.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/protobuf/tensor_bundle.pb.h"
+#include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
+
+namespace tensorflow {
+namespace processor {
+
+namespace {
+typedef std::unordered_map<std::string, const NodeDef*> NodeMap;
+
+// Splits an input like "^node" or "node:1" into its node name and output.
+void ParseInput(const std::string& input, std::string* node, int* output) {
+  StringPiece name(input);
+  str_util::ConsumePrefix(&name, "^");
+  *output = 0;
+  const size_t colon = name.rfind(':');
+  if (colon != StringPiece::npos &&
+      strings::safe_strto32(name.substr(colon + 1), output)) {
+    name = name.substr(0, colon);
+  }
+  *node = std::string(name);
+}
+
+const NodeDef* FindNode(const NodeMap& nodes, const std::string& input) {
+  std::string name;
+  int output;
+  ParseInput(input, &name, &output);
+  auto it = nodes.find(name);
+  return it == nodes.end() ? nullptr : it->second;
+}
+
+bool ReadStringConst(const NodeDef* node, std::vector<std::string>* values) {
+  if (node == nullptr || node->op() != "Const") return false;
+  auto it = node->attr().find("value");
+  Tensor t;
+  if (it == node->attr().end() || !t.FromProto(it->second.tensor()) ||
+      t.dtype() != DT_STRING) {
+    return false;
+  }
+  auto flat = t.flat<string>();
+  values->assign(flat.data(), flat.data() + flat.size());
+  return true;
+}
+
+// Follows `input` of an assign op back through Identity ops to the
+// RestoreV2 output it reads, and returns the checkpoint key restored
+// there. Sliced tensors are only restored by RestoreV2 itself.
+bool ResolveRestoredKey(const NodeMap& nodes, std::string input,
+                        std::string* key) {
+  for (int depth = 0; depth < 8; ++depth) {
+    std::string name;
+    int output;
+    ParseInput(input, &name, &output);
+    const NodeDef* node = FindNode(nodes, name);
+    if (node == nullptr) return false;
+    if (node->op() == "Identity" && node->input_size() > 0) {
+      input = node->input(0);
+      continue;
+    }
+    if (node->op() != "RestoreV2" || node->input_size() < 3) return false;
+    std::vector<std::string> names, slices;
+    if (!ReadStringConst(FindNode(nodes, node->input(1)), &names) ||
+        !ReadStringConst(FindNode(nodes, node->input(2)), &slices) ||
+        output >= static_cast<int>(names.size()) ||
+        output >= static_cast<int>(slices.size()) ||
+        !slices[output].empty()) {
+      return false;
+    }
+    *key = names[output];
+    return true;
+  }
+  return false;
+}
+
+// Records the KvVarHandleOp an EmbeddingVariable import restores into.
+void ResolveEmbeddingVar(const NodeMap& nodes, const NodeDef& import_op,
+                         RestoreTarget* target) {
+  auto key_dtype = import_op.attr().find("Tkeys");
+  auto value_dtype = import_op.attr().find("dtype");
+  if (key_dtype == import_op.attr().end() ||
+      value_dtype == import_op.attr().end()) {
+    return;
+  }
+  std::string input = import_op.input(1);
+  for (int depth = 0; depth < 8; ++depth) {
+    const NodeDef* node = FindNode(nodes, input);
+    if (node == nullptr) return;
+    if (node->op() == "Identity" && node->input_size() > 0) {
+      input = node->input(0);
+      continue;
+    }
+    if (node->op() != "KvVarHandleOp") return;
+    auto container = node->attr().find("container");
+    auto shared_name = node->attr().find("shared_name");
+    if (container != node->attr().end()) {
+      target->ev_container = container->second.s();
+    }
+    target->ev_shared_name = shared_name != node->attr().end()
+        ? shared_name->second.s() : node->name();
+    target->ev_key_dtype = key_dtype->second.type();
+    target->ev_value_dtype = value_dtype->second.type();
+    return;
+  }
+}
+
+// Appends to `keys` the keys saved for the EmbeddingVariable `name`,
+// including the ones held back by a feature filter. A partitioned
+// variable may import keys from every saved part, so all of them are
+// read.
+template <typename K>
+Status ReadSavedKeys(BundleReader* reader, const std::string& name,
+                     std::vector<K>* keys) {
+  std::vector<std::string> tensor_names;
+  const size_t part = name.find("part_");
+  if (part == std::string::npos) {
+    tensor_names.push_back(name);
+  } else {
+    size_t post = part + strlen("part_");
+    while (post < name.size() && isdigit(name[post])) ++post;
+    for (int i = 0; ; ++i) {
+      std::string tensor_name = strings::StrCat(
+          name.substr(0, part), "part_", i, name.substr(post));
+      if (!reader->Contains(tensor_name + "-keys")) break;
+      tensor_names.push_back(tensor_name);
+    }
+  }
+  for (const std::string& tensor_name : tensor_names) {
+    for (const char* suffix : {"-keys", "-keys_filtered"}) {
+      const std::string key = tensor_name + suffix;
+      if (!reader->Contains(key)) continue;
+      Tensor saved;
+      TF_RETURN_IF_ERROR(reader->Lookup(key, &saved));
+      if (saved.dtype() != DataTypeToEnum<K>::v()) {
+        return errors::InvalidArgument(
+            "Expect ", DataTypeString(DataTypeToEnum<K>::v()), " keys in ",
+            key, ", got ", DataTypeString(saved.dtype()));
+      }
+      auto flat = saved.flat<K>();
+      keys->insert(keys->end(), flat.data(), flat.data() + flat.size());
+    }
+  }
+  return Status::OK();
+}
+
+template <typename K, typename V>
+Status RemoveStaleKeys(const RestoreTarget& target, BundleReader* reader,
+                       ResourceMgr* resource_mgr,
+                       std::vector<std::function<void()>>* deferred_frees) {
+  EmbeddingVar<K, V>* ev = nullptr;
+  const std::string& container = target.ev_container.empty()
+      ? resource_mgr->default_container() : target.ev_container;
+  TF_RETURN_IF_ERROR(resource_mgr->Lookup(
+      container, target.ev_shared_name, &ev));
+  core::ScopedUnref unref(ev);
+
+  std::vector<K> saved_keys;
+  TF_RETURN_IF_ERROR(ReadSavedKeys(
+      reader,
+      target.tensor_key.substr(0, target.tensor_key.size() - 1),
+      &saved_keys));
+  std::sort(saved_keys.begin(), saved_keys.end());
+
+  std::vector<K> keys;
+  std::vector<ValuePtr<V>*> value_ptrs;
+  TF_RETURN_IF_ERROR(ev->storage_manager()->GetSnapshot(&keys, &value_ptrs));
+  const bool free_value_ptrs =
+      !ev->IsMultiLevel() && value_ptrs.size() == keys.size();
+  std::vector<ValuePtr<V>*> stale;
+  int64 removed = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (std::binary_search(saved_keys.begin(), saved_keys.end(), keys[i])) {
+      continue;
+    }
+    TF_RETURN_IF_ERROR(ev->storage_manager()->Remove(keys[i]));
+    if (free_value_ptrs) stale.push_back(value_ptrs[i]);
+    ++removed;
+  }
+  if (!stale.empty()) {
+    Allocator* alloc = ev->GetAllocator();
+    ev->Ref();
+    deferred_frees->emplace_back([ev, alloc, stale]() {
+      for (ValuePtr<V>* value_ptr : stale) {
+        value_ptr->Destroy(alloc);
+        delete value_ptr;
+      }
+      ev->Unref();
+    });
+  }
+  LOG(INFO) << "Removed " << removed << " keys missing from the checkpoint "
+            << "of " << target.ev_shared_name;
+  return Status::OK();
+}
+
+bool SameEntry(const BundleEntryProto& a, const BundleEntryProto& b) {
+  return a.slices_size() == 0 && b.slices_size() == 0 &&
+         a.dtype() == b.dtype() && a.size() == b.size() &&
+         a.crc32c() == b.crc32c() &&
+         TensorShape(a.shape()) == TensorShape(b.shape());
+}
+
+} // namespace
+
+Status SharedRestorePlan::Create(const GraphDef& graph_def,
+                                 const std::string& restore_op_name,
+                                 SharedRestorePlan* plan) {
+  NodeMap nodes;
+  for (const NodeDef& node : graph_def.node()) {
+    nodes[node.name()] = &node;
+  }
+  const NodeDef* restore_op = FindNode(nodes, restore_op_name);
+  if (restore_op == nullptr) {
+    return errors::NotFound("Restore op ", restore_op_name,
+                            " not found in the graph.");
+  }
+
+  plan->targets_.clear();
+  std::vector<const NodeDef*> stack = {restore_op};
+  std::set<std::string> visited = {restore_op->name()};
+  while (!stack.empty()) {
+    const NodeDef* node = stack.back();
+    stack.pop_back();
+    if (node->op() == "NoOp") {
+      for (const std::string& input : node->input()) {
+        const NodeDef* dep = FindNode(nodes, input);
+        if (dep != nullptr && visited.insert(dep->name()).second) {
+          stack.push_back(dep);
+        }
+      }
+      continue;
+    }
+
+    RestoreTarget target;
+    target.node_name = node->name();
+    std::vector<std::string> names;
+    if ((node->op() == "Assign" || node->op() == "AssignVariableOp") &&
+        node->input_size() > 1) {
+      if (ResolveRestoredKey(nodes, node->input(1), &target.tensor_key)) {
+        std::string name;
+        int output;
+        ParseInput(node->input(1), &name, &output);
+        target.feed_name = strings::StrCat(name, ":", output);
+      }
+    } else if (node->op() == "KvResourceImportV2" &&
+               node->input_size() > 4 &&
+               ReadStringConst(FindNode(nodes, node->input(4)), &names) &&
+               names.size() == 1) {
+      target.tensor_key = names[0] + "-";
+      target.is_prefix = true;
+      ResolveEmbeddingVar(nodes, *node, &target);
+    } else if (node->op() == "KvResourceImportV3" &&
+               node->input_size() > 2 &&
+               ReadStringConst(FindNode(nodes, node->input(2)), &names) &&
+               names.size() == 1) {
+      target.tensor_key = names[0] + "-";
+      target.is_prefix = true;
+      ResolveEmbeddingVar(nodes, *node, &target);
+    }
+    plan->targets_.push_back(target);
+  }
+  return Status::OK();
+}
+
+Status SharedRestorePlan::DiffCheckpoints(const std::string& old_ckpt,
+                                          const std::string& delta_ckpt,
+                                          const std::string& new_ckpt) {
+  changed_keys_.clear();
+  all_changed_ = false;
+  BundleReader new_reader(Env::Default(), new_ckpt);
+  TF_RETURN_IF_ERROR(new_reader.status());
+  BundleReader old_reader(Env::Default(), old_ckpt);
+  if (!old_reader.status().ok()) {
+    LOG(WARNING) << "Can't read the serving checkpoint " << old_ckpt
+                 << ", restore every variable. "
+                 << old_reader.status().error_message();
+    all_changed_ = true;
+    return Status::OK();
+  }
+
+  // Both bundles iterate their keys in order, so they are merged in one
+  // pass.
+  int64 entries = 0;
+  old_reader.Seek(kHeaderEntryKey);
+  for (new_reader.Seek(kHeaderEntryKey); new_reader.Valid();
+       new_reader.Next()) {
+    const StringPiece key = new_reader.key();
+    if (key == kHeaderEntryKey) continue;
+    ++entries;
+    while (old_reader.Valid() && old_reader.key() < key) {
+      old_reader.Next();
+    }
+    BundleEntryProto new_entry, old_entry;
+    if (!old_reader.Valid() || old_reader.key() != key ||
+        !new_entry.ParseFromArray(new_reader.value().data(),
+                                  new_reader.value().size()) ||
+        !old_entry.ParseFromArray(old_reader.value().data(),
+                                  old_reader.value().size()) ||
+        !SameEntry(new_entry, old_entry)) {
+      changed_keys_.insert(std::string(key));
+    }
+  }
+
+  if (!delta_ckpt.empty()) {
+    BundleReader delta_reader(Env::Default(), delta_ckpt);
+    if (!delta_reader.status().ok()) {
+      LOG(WARNING) << "Can't read the delta checkpoint " << delta_ckpt
+                   << ", restore every variable. "
+                   << delta_reader.status().error_message();
+      all_changed_ = true;
+      return Status::OK();
+    }
+    for (delta_reader.Seek(kHeaderEntryKey); delta_reader.Valid();
+         delta_reader.Next()) {
+      const std::string key(delta_reader.key());
+      if (key != kHeaderEntryKey) changed_keys_.insert(key);
+    }
+  }
+
+  LOG(INFO) << changed_keys_.size() << " of " << entries
+            << " checkpoint tensors changed since " << old_ckpt;
+  return Status::OK();
+}
+
+bool SharedRestorePlan::Changed(const RestoreTarget& target) const {
+  if (all_changed_ || target.tensor_key.empty()) return true;
+  if (!target.is_prefix) return changed_keys_.count(target.tensor_key) > 0;
+  auto it = changed_keys_.lower_bound(target.tensor_key);
+  return it != changed_keys_.end() &&
+         str_util::StartsWith(*it, target.tensor_key);
+}
+
+Status RemoveStaleEmbeddingKeys(
+    const RestoreTarget& target, BundleReader* reader,
+    ResourceMgr* resource_mgr,
+    std::vector<std::function<void()>>* deferred_frees) {
+  if (!target.is_prefix || target.ev_shared_name.empty()) {
+    return Status::OK();
+  }
+#define HANDLE_TYPES(ktype, vtype)                                       \
+  if (target.ev_key_dtype == DataTypeToEnum<ktype>::v() &&              \
+      target.ev_value_dtype == DataTypeToEnum<vtype>::v()) {            \
+    return RemoveStaleKeys<ktype, vtype>(target, reader, resource_mgr,  \
+                                         deferred_frees);               \
+  }
+  HANDLE_TYPES(int32, float)
+  HANDLE_TYPES(int64, float)
+  HANDLE_TYPES(int32, double)
+  HANDLE_TYPES(int64, double)
+#undef HANDLE_TYPES
+  LOG(WARNING) << "Keep the keys missing from the checkpoint of "
+               << target.ev_shared_name << ", unsupported types "
+               << DataTypeString(target.ev_key_dtype) << " and "
+               << DataTypeString(target.ev_value_dtype);
+  return Status::OK();
+}
+
+} // processor
+} // tensorflow
@@ -0,0 +1,90 @@
+#ifndef SERVING_PROCESSOR_SERVING_SHARED_RESTORE_H
+#define SERVING_PROCESSOR_SERVING_SHARED_RESTORE_H
+
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/resource_mgr.h"
+#include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
+
+namespace tensorflow {
+namespace processor {
+
+// One op run by the saver restore op to restore a variable.
+struct RestoreTarget {
+  std::string node_name;
+  // The input of an Assign/AssignVariableOp which carries the restored
+  // value. The tensor read from the checkpoint is fed here, so that only
+  // the variables of a chunk are read rather than the whole RestoreV2
+  // shard. Empty when the target reads the checkpoint itself, like the
+  // EmbeddingVariable imports and sliced (partitioned) variables.
+  std::string feed_name;
+  // Checkpoint key of the variable, or the key prefix of an
+  // EmbeddingVariable when `is_prefix` is set. Empty when unknown, such a
+  // target is always restored.
+  std::string tensor_key;
+  bool is_prefix = false;
+  // The KvVarHandleOp resource an EmbeddingVariable import restores into
+  // and its key and value types, DT_INVALID when unknown.
+  std::string ev_container;
+  std::string ev_shared_name;
+  DataType ev_key_dtype = DT_INVALID;
+  DataType ev_value_dtype = DT_INVALID;
+};
+
+// Restores a full checkpoint into the variables of a serving session
+// instead of into a new session, so that an update holds a single copy
+// of the model plus one chunk of changed tensors.
+//
+// Variables whose checkpoint entries (dtype, shape and crc32c) did not
+// change since the serving checkpoint are shared as they are. Changed
+// dense variables are read a chunk at a time and assigned in place,
+// changed EmbeddingVariables are imported into the live storage, and
+// their keys missing from the new checkpoint are removed afterwards with
+// RemoveStaleEmbeddingKeys.
+class SharedRestorePlan {
+ public:
+  // Collects the restore targets of `restore_op_name` in `graph_def`.
+  static Status Create(const GraphDef& graph_def,
+                       const std::string& restore_op_name,
+                       SharedRestorePlan* plan);
+
+  // Records the keys of `new_ckpt` whose saved tensors differ from the
+  // ones in `old_ckpt`, and every key updated by `delta_ckpt` on top of
+  // `old_ckpt`. All the keys are changed when `old_ckpt` can't be read.
+  Status DiffCheckpoints(const std::string& old_ckpt,
+                         const std::string& delta_ckpt,
+                         const std::string& new_ckpt);
+
+  bool Changed(const RestoreTarget& target) const;
+
+  const std::vector<RestoreTarget>& targets() const { return targets_; }
+
+ private:
+  std::vector<RestoreTarget> targets_;
+  std::set<std::string> changed_keys_;
+  bool all_changed_ = false;
+};
+
+// An import only writes the keys saved in the checkpoint. Removes the
+// other keys of the EmbeddingVariable restored by `target`, found in
+// `resource_mgr`, so that they don't keep the values of the serving
+// model. Entries taken out of single tier storage are still readable by
+// the lookups in flight, so the closure freeing them is appended to
+// `deferred_frees` and must only run once the steps started before the
+// removal have finished. Keys held in an SSD or LevelDB tier can't be
+// listed and are left in place.
+Status RemoveStaleEmbeddingKeys(
+    const RestoreTarget& target, BundleReader* reader,
+    ResourceMgr* resource_mgr,
+    std::vector<std::function<void()>>* deferred_frees);
+
+} // processor
+} // tensorflow
+
+#endif // SERVING_PROCESSOR_SERVING_SHARED_RESTORE_H
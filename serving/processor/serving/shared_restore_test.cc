@@ -0,0 +1,213 @@
+#include "gtest/gtest.h"
+#include "serving/processor/serving/shared_restore.h"
+#include "tensorflow/core/framework/embedding/embedding_var.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
+
+namespace tensorflow {
+namespace processor {
+namespace {
+NodeDef* AddNode(GraphDef* graph, const std::string& name,
+                 const std::string& op,
+                 const std::vector<std::string>& inputs) {
+  NodeDef* node = graph->add_node();
+  node->set_name(name);
+  node->set_op(op);
+  for (const std::string& input : inputs) {
+    node->add_input(input);
+  }
+  return node;
+}
+
+void AddStringConst(GraphDef* graph, const std::string& name,
+                    const std::vector<std::string>& values) {
+  Tensor t(DT_STRING, TensorShape({static_cast<int64>(values.size())}));
+  for (size_t i = 0; i < values.size(); ++i) {
+    t.flat<string>()(i) = values[i];
+  }
+  NodeDef* node = AddNode(graph, name, "Const", {});
+  t.AsProtoTensorContent((*node->mutable_attr())["value"].mutable_tensor());
+}
+
+// The restore graph a sharded Saver builds for a ref variable, a resource
+// variable, a partitioned variable and an EmbeddingVariable.
+GraphDef CreateRestoreGraph() {
+  GraphDef graph;
+  AddStringConst(&graph, "save/Const", {""});
+  AddStringConst(&graph, "save/RestoreV2/tensor_names",
+                 {"dense", "resource", "part"});
+  AddStringConst(&graph, "save/RestoreV2/shape_and_slices",
+                 {"", "", "4 0,2"});
+  AddNode(&graph, "save/RestoreV2", "RestoreV2",
+          {"save/Const", "save/RestoreV2/tensor_names",
+           "save/RestoreV2/shape_and_slices"});
+  AddNode(&graph, "save/Assign", "Assign", {"dense", "save/RestoreV2"});
+  AddNode(&graph, "save/Identity", "Identity", {"save/RestoreV2:1"});
+  AddNode(&graph, "save/AssignVariableOp", "AssignVariableOp",
+          {"resource", "save/Identity"});
+  AddNode(&graph, "save/Assign_1", "Assign", {"part", "save/RestoreV2:2"});
+  NodeDef* handle = AddNode(&graph, "ev", "KvVarHandleOp", {});
+  (*handle->mutable_attr())["container"].set_s("");
+  (*handle->mutable_attr())["shared_name"].set_s("ev");
+  AddStringConst(&graph, "save/KvResourceImportV3/tensor_names", {"ev"});
+  NodeDef* import_op = AddNode(
+      &graph, "save/KvResourceImportV3", "KvResourceImportV3",
+      {"save/Const", "ev", "save/KvResourceImportV3/tensor_names",
+       "save/KvResourceImportV3/empty_key"});
+  (*import_op->mutable_attr())["Tkeys"].set_type(DT_INT64);
+  (*import_op->mutable_attr())["dtype"].set_type(DT_FLOAT);
+  AddNode(&graph, "save/restore_shard", "NoOp",
+          {"^save/Assign", "^save/AssignVariableOp", "^save/Assign_1",
+           "^save/KvResourceImportV3"});
+  AddNode(&graph, "save/restore_all", "NoOp", {"^save/restore_shard"});
+  return graph;
+}
+
+const RestoreTarget* FindTarget(const SharedRestorePlan& plan,
+                                const std::string& node_name) {
+  for (const RestoreTarget& target : plan.targets()) {
+    if (target.node_name == node_name) return &target;
+  }
+  return nullptr;
+}
+
+Tensor FloatTensor(const std::vector<float>& values) {
+  Tensor t(DT_FLOAT, TensorShape({static_cast<int64>(values.size())}));
+  for (size_t i = 0; i < values.size(); ++i) {
+    t.flat<float>()(i) = values[i];
+  }
+  return t;
+}
+
+void WriteCheckpoint(
+    const std::string& prefix,
+    const std::vector<std::pair<std::string, Tensor>>& tensors) {
+  BundleWriter writer(Env::Default(), prefix);
+  for (const auto& tensor : tensors) {
+    EXPECT_TRUE(writer.Add(tensor.first, tensor.second).ok());
+  }
+  EXPECT_TRUE(writer.Finish().ok());
+}
+}
+
+class SharedRestorePlanTest : public ::testing::Test {
+};
+
+TEST_F(SharedRestorePlanTest, CollectRestoreTargets) {
+  SharedRestorePlan plan;
+  EXPECT_TRUE(SharedRestorePlan::Create(CreateRestoreGraph(),
+                                        "save/restore_all", &plan).ok());
+  EXPECT_EQ(4u, plan.targets().size());
+
+  const RestoreTarget* dense = FindTarget(plan, "save/Assign");
+  ASSERT_TRUE(dense != nullptr);
+  EXPECT_EQ("save/RestoreV2:0", dense->feed_name);
+  EXPECT_EQ("dense", dense->tensor_key);
+
+  const RestoreTarget* resource = FindTarget(plan, "save/AssignVariableOp");
+  ASSERT_TRUE(resource != nullptr);
+  EXPECT_EQ("save/Identity:0", resource->feed_name);
+  EXPECT_EQ("resource", resource->tensor_key);
+
+  // Slices are left to RestoreV2.
+  const RestoreTarget* part = FindTarget(plan, "save/Assign_1");
+  ASSERT_TRUE(part != nullptr);
+  EXPECT_TRUE(part->feed_name.empty());
+  EXPECT_TRUE(part->tensor_key.empty());
+
+  const RestoreTarget* ev = FindTarget(plan, "save/KvResourceImportV3");
+  ASSERT_TRUE(ev != nullptr);
+  EXPECT_TRUE(ev->feed_name.empty());
+  EXPECT_EQ("ev-", ev->tensor_key);
+  EXPECT_TRUE(ev->is_prefix);
+  EXPECT_TRUE(ev->ev_container.empty());
+  EXPECT_EQ("ev", ev->ev_shared_name);
+  EXPECT_EQ(DT_INT64, ev->ev_key_dtype);
+  EXPECT_EQ(DT_FLOAT, ev->ev_value_dtype);
+
+  EXPECT_FALSE(SharedRestorePlan::Create(CreateRestoreGraph(),
+                                         "save/missing", &plan).ok());
+}
+
+TEST_F(SharedRestorePlanTest, OnlyChangedTensorsAreRestored) {
+  const std::string dir = testing::TmpDir();
+  const std::string old_ckpt = io::JoinPath(dir, "model.ckpt-1");
+  const std::string new_ckpt = io::JoinPath(dir, "model.ckpt-2");
+  WriteCheckpoint(old_ckpt, {{"dense", FloatTensor({1, 2})},
+                             {"ev-keys", FloatTensor({1})},
+                             {"resource", FloatTensor({3})}});
+  WriteCheckpoint(new_ckpt, {{"dense", FloatTensor({1, 2})},
+                             {"ev-keys", FloatTensor({2})},
+                             {"resource", FloatTensor({3})}});
+
+  SharedRestorePlan plan;
+  EXPECT_TRUE(SharedRestorePlan::Create(CreateRestoreGraph(),
+                                        "save/restore_all", &plan).ok());
+  EXPECT_TRUE(plan.DiffCheckpoints(old_ckpt, "", new_ckpt).ok());
+  EXPECT_FALSE(plan.Changed(*FindTarget(plan, "save/Assign")));
+  EXPECT_FALSE(plan.Changed(*FindTarget(plan, "save/AssignVariableOp")));
+  EXPECT_TRUE(plan.Changed(*FindTarget(plan, "save/Assign_1")));
+  EXPECT_TRUE(plan.Changed(*FindTarget(plan, "save/KvResourceImportV3")));
+
+  // The serving session got "resource" from a delta checkpoint since.
+  const std::string delta_ckpt =
+      io::JoinPath(dir, "incremental_model.ckpt-1");
+  WriteCheckpoint(delta_ckpt, {{"resource", FloatTensor({4})}});
+  EXPECT_TRUE(plan.DiffCheckpoints(old_ckpt, delta_ckpt, new_ckpt).ok());
+  EXPECT_FALSE(plan.Changed(*FindTarget(plan, "save/Assign")));
+  EXPECT_TRUE(plan.Changed(*FindTarget(plan, "save/AssignVariableOp")));
+
+  // Without the serving checkpoint every variable is restored.
+  EXPECT_TRUE(plan.DiffCheckpoints(io::JoinPath(dir, "missing"), "",
+                                   new_ckpt).ok());
+  EXPECT_TRUE(plan.Changed(*FindTarget(plan, "save/Assign")));
+}
+
+TEST_F(SharedRestorePlanTest, RemoveStaleEmbeddingKeys) {
+  const std::string ckpt =
+      io::JoinPath(testing::TmpDir(), "model.ckpt-stale");
+  WriteCheckpoint(ckpt, {{"ev-keys", test::AsTensor<int64>({1, 3})},
+                         {"ev-keys_filtered", test::AsTensor<int64>({4})}});
+  BundleReader reader(Env::Default(), ckpt);
+  ASSERT_TRUE(reader.status().ok());
+
+  Tensor value(DT_FLOAT, TensorShape({2}));
+  test::FillValues<float>(&value, {1.0, 1.0});
+  auto storage_manager = new embedding::StorageManager<int64, float>(
+      "ev", embedding::StorageConfig());
+  auto ev = new EmbeddingVar<int64, float>("ev", storage_manager);
+  EXPECT_TRUE(ev->Init(value, 1).ok());
+  for (int64 key = 1; key <= 4; ++key) {
+    ValuePtr<float>* value_ptr = nullptr;
+    EXPECT_TRUE(ev->LookupOrCreateKey(key, &value_ptr).ok());
+  }
+  ResourceMgr resource_mgr;
+  EXPECT_TRUE(resource_mgr.Create(resource_mgr.default_container(),
+                                  "ev", ev).ok());
+
+  SharedRestorePlan plan;
+  EXPECT_TRUE(SharedRestorePlan::Create(CreateRestoreGraph(),
+                                        "save/restore_all", &plan).ok());
+  std::vector<std::function<void()>> deferred_frees;
+  EXPECT_TRUE(RemoveStaleEmbeddingKeys(
+      *FindTarget(plan, "save/KvResourceImportV3"), &reader, &resource_mgr,
+      &deferred_frees).ok());
+  EXPECT_EQ(3, ev->Size());
+  ValuePtr<float>* value_ptr = nullptr;
+  EXPECT_FALSE(ev->LookupKey(2, &value_ptr).ok());
+  EXPECT_TRUE(ev->LookupKey(4, &value_ptr).ok());
+  EXPECT_EQ(1u, deferred_frees.size());
+  for (auto& free_entries : deferred_frees) free_entries();
+
+  // Dense targets have no keys to remove.
+  EXPECT_TRUE(RemoveStaleEmbeddingKeys(
+      *FindTarget(plan, "save/Assign"), &reader, &resource_mgr,
+      &deferred_frees).ok());
+}
+
+} // processor
+} // tensorflow
@@ -0,0 +1,193 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "serving/processor/storage/embedding_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+
+namespace tensorflow {
+namespace processor {
+
+namespace {
+// Approximate memory of an entry besides its value: list node, index
+// node and bucket.
+constexpr size_t kEntryOverheadBytes = 96;
+
+constexpr int kSketchDepth = 4;
+constexpr uint32 kSketchWidth = 1 << 12;
+constexpr uint8 kMaxFrequency = 15;
+// Counters are halved after this many misses, old hot rows fade out.
+constexpr uint32 kSketchResetAdditions = 10 * kSketchWidth;
+
+uint64 Hash(uint64 model_version, uint64 feature2id, uint64 key) {
+  return Hash64Combine(Hash64Combine(model_version, feature2id),
+                       key * 0x9E3779B97F4A7C15ULL);
+}
+} // namespace
+
+size_t EmbeddingCache::KeyHash::operator()(const Key& k) const {
+  return Hash(k.model_version, k.feature2id, k.key);
+}
+
+EmbeddingCache::EmbeddingCache(size_t capacity_bytes,
+    int min_admit_frequency, int num_shards)
+    : shard_capacity_bytes_(capacity_bytes / std::max(num_shards, 1)),
+      min_admit_frequency_(std::min<int>(min_admit_frequency, kMaxFrequency)),
+      generation_(0), hits_(0), misses_(0), admitted_(0), rejected_(0),
+      evicted_(0), bytes_(0), entries_(0) {
+  shards_.reserve(std::max(num_shards, 1));
+  for (int i = 0; i < std::max(num_shards, 1); ++i) {
+    shards_.emplace_back(new Shard);
+    shards_.back()->sketch.resize(kSketchDepth * kSketchWidth, 0);
+  }
+}
+
+EmbeddingCache::~EmbeddingCache() {
+}
+
+EmbeddingCache::Shard* EmbeddingCache::GetShard(uint64 hash) const {
+  return shards_[(hash >> 32) % shards_.size()].get();
+}
+
+uint8* EmbeddingCache::SketchCounter(Shard* shard, uint64 hash, int row) {
+  const uint64 step = (hash >> 32) | 1;
+  return &shard->sketch[row * kSketchWidth +
+                        ((hash + row * step) & (kSketchWidth - 1))];
+}
+
+void EmbeddingCache::IncrementFrequency(Shard* shard, uint64 hash) {
+  if (++shard->sketch_additions >= kSketchResetAdditions) {
+    for (auto& c : shard->sketch) {
+      c >>= 1;
+    }
+    shard->sketch_additions = 0;
+  }
+  for (int i = 0; i < kSketchDepth; ++i) {
+    uint8* c = SketchCounter(shard, hash, i);
+    if (*c < kMaxFrequency) {
+      ++*c;
+    }
+  }
+}
+
+int EmbeddingCache::EstimateFrequency(Shard* shard, uint64 hash) {
+  int estimate = kMaxFrequency;
+  for (int i = 0; i < kSketchDepth; ++i) {
+    estimate = std::min<int>(estimate, *SketchCounter(shard, hash, i));
+  }
+  return estimate;
+}
+
+bool EmbeddingCache::Lookup(uint64 model_version, uint64 feature2id,
+    uint64 key, char* value, size_t value_bytes) {
+  const Key k{model_version, feature2id, key};
+  const uint64 hash = KeyHash()(k);
+  Shard* shard = GetShard(hash);
+  std::lock_guard<std::mutex> lock(shard->mu);
+  auto it = shard->index.find(k);
+  if (it == shard->index.end() ||
+      it->second->value.size() != value_bytes) {
+    IncrementFrequency(shard, hash);
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+  memcpy(value, it->second->value.data(), value_bytes);
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void EmbeddingCache::Insert(uint64 generation, uint64 model_version,
+    uint64 feature2id, uint64 key, const char* value, size_t value_bytes) {
+  const size_t entry_bytes = value_bytes + kEntryOverheadBytes;
+  if (entry_bytes > shard_capacity_bytes_) {
+    return;
+  }
+  const Key k{model_version, feature2id, key};
+  const uint64 hash = KeyHash()(k);
+  Shard* shard = GetShard(hash);
+  std::lock_guard<std::mutex> lock(shard->mu);
+  // Invalidate() bumps the generation before it clears the shards.
+  if (generation != generation_.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto it = shard->index.find(k);
+  if (it != shard->index.end()) {
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+    it->second->value.assign(value, value_bytes);
+    return;
+  }
+
+  // The miss was already counted by Lookup().
+  if (EstimateFrequency(shard, hash) < min_admit_frequency_) {
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  while (shard->bytes + entry_bytes > shard_capacity_bytes_ &&
+         !shard->lru.empty()) {
+    Entry& victim = shard->lru.back();
+    const size_t victim_bytes = victim.value.size() + kEntryOverheadBytes;
+    shard->index.erase(victim.key);
+    shard->lru.pop_back();
+    shard->bytes -= victim_bytes;
+    bytes_.fetch_sub(victim_bytes, std::memory_order_relaxed);
+    entries_.fetch_sub(1, std::memory_order_relaxed);
+    evicted_.fetch_add(1, std::memory_order_relaxed);
+  }
+  shard->lru.push_front(Entry{k, std::string(value, value_bytes)});
+  shard->index[k] = shard->lru.begin();
+  shard->bytes += entry_bytes;
+  bytes_.fetch_add(entry_bytes, std::memory_order_relaxed);
+  entries_.fetch_add(1, std::memory_order_relaxed);
+  admitted_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EmbeddingCache::EraseAll(Shard* shard) {
+  std::lock_guard<std::mutex> lock(shard->mu);
+  bytes_.fetch_sub(shard->bytes, std::memory_order_relaxed);
+  entries_.fetch_sub(shard->index.size(), std::memory_order_relaxed);
+  shard->index.clear();
+  shard->lru.clear();
+  shard->bytes = 0;
+}
+
+void EmbeddingCache::Invalidate() {
+  generation_.fetch_add(1, std::memory_order_acq_rel);
+  for (auto& shard : shards_) {
+    EraseAll(shard.get());
+  }
+}
+
+std::string EmbeddingCache::DebugString() const {
+  const int64 hits = hits_.load(std::memory_order_relaxed);
+  const int64 misses = misses_.load(std::memory_order_relaxed);
+  const double hit_rate =
+      hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0;
+  return strings::StrCat(
+      "hits: ", hits, ", misses: ", misses, ", hit rate: ", hit_rate,
+      ", entries: ", entries_.load(std::memory_order_relaxed),
+      ", bytes: ", bytes_.load(std::memory_order_relaxed),
+      ", admitted: ", admitted_.load(std::memory_order_relaxed),
+      ", rejected: ", rejected_.load(std::memory_order_relaxed),
+      ", evicted: ", evicted_.load(std::memory_order_relaxed));
+}
+
+} // processor
+} // tensorflow
@@ -0,0 +1,130 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef SERVING_PROCESSOR_STORAGE_EMBEDDING_CACHE_H_
+#define SERVING_PROCESSOR_STORAGE_EMBEDDING_CACHE_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace processor {
+
+// In-process cache of embedding rows read from the feature store.
+//
+// Rows are keyed by (model version, feature id, key). The cache is split
+// into shards, each one with its own lock, LRU list and byte budget. A
+// missed row is only admitted once it was missed at least
+// min_admit_frequency times, counted by a small count-min sketch per shard
+// which is halved from time to time, so one-off ids don't push hot rows
+// out.
+//
+// Invalidate() drops every row, it is called when a model update has
+// written new values to the feature store. Rows read from the store
+// before the call are not inserted after it: Insert() takes the
+// generation() read before the lookup and drops the row if it changed.
+class EmbeddingCache {
+ public:
+  EmbeddingCache(size_t capacity_bytes, int min_admit_frequency,
+                 int num_shards = 64);
+  ~EmbeddingCache();
+
+  EmbeddingCache(const EmbeddingCache&) = delete;
+  EmbeddingCache& operator=(const EmbeddingCache&) = delete;
+
+  uint64 generation() const {
+    return generation_.load(std::memory_order_acquire);
+  }
+
+  // Copies the row into value and returns true on a hit. Counts a miss
+  // toward the admission frequency of the row otherwise.
+  bool Lookup(uint64 model_version, uint64 feature2id, uint64 key,
+              char* value, size_t value_bytes);
+
+  void Insert(uint64 generation, uint64 model_version, uint64 feature2id,
+              uint64 key, const char* value, size_t value_bytes);
+
+  void Invalidate();
+
+  int64 hits() const { return hits_.load(std::memory_order_relaxed); }
+  int64 misses() const { return misses_.load(std::memory_order_relaxed); }
+  int64 bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+  std::string DebugString() const;
+
+ private:
+  struct Key {
+    uint64 model_version;
+    uint64 feature2id;
+    uint64 key;
+
+    bool operator==(const Key& other) const {
+      return model_version == other.model_version &&
+             feature2id == other.feature2id && key == other.key;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const;
+  };
+
+  struct Entry {
+    Key key;
+    std::string value;
+  };
+
+  struct Shard {
+    std::mutex mu;
+    // Most recently used first.
+    std::list<Entry> lru;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    size_t bytes = 0;
+    // Count-min sketch of recent misses, kSketchDepth rows.
+    std::vector<uint8> sketch;
+    uint32 sketch_additions = 0;
+  };
+
+  Shard* GetShard(uint64 hash) const;
+  uint8* SketchCounter(Shard* shard, uint64 hash, int row);
+  // Counts one miss of the row.
+  void IncrementFrequency(Shard* shard, uint64 hash);
+  int EstimateFrequency(Shard* shard, uint64 hash);
+  void EraseAll(Shard* shard);
+
+  const size_t shard_capacity_bytes_;
+  const int min_admit_frequency_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint64> generation_;
+
+  std::atomic<int64> hits_;
+  std::atomic<int64> misses_;
+  std::atomic<int64> admitted_;
+  std::atomic<int64> rejected_;
+  std::atomic<int64> evicted_;
+  std::atomic<int64> bytes_;
+  std::atomic<int64> entries_;
+};
+
+} // processor
+} // tensorflow
+
+#endif // SERVING_PROCESSOR_STORAGE_EMBEDDING_CACHE_H_
@@ -0,0 +1,211 @@
+/* Copyright 2020 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <map>
+#include "gtest/gtest.h"
+#include "serving/processor/storage/embedding_cache.h"
+#include "serving/processor/storage/feature_store_mgr.h"
+
+namespace tensorflow {
+namespace processor {
+
+namespace {
+
+const int kDim = 4;
+
+// In-memory stand-in of the Redis storage, float rows of kDim values.
+class LocalFeatureStoreMgr : public IFeatureStoreMgr {
+ public:
+  Status GetValues(uint64_t model_version,
+                   uint64_t feature2id,
+                   const char* const keys,
+                   char* const values,
+                   size_t bytes_per_key,
+                   size_t bytes_per_values,
+                   size_t N,
+                   const char* default_value,
+                   BatchGetCallback cb) override {
+    ++num_get_calls;
+    for (size_t i = 0; i < N; ++i) {
+      int64 key = ((const int64*)keys)[i];
+      requested_keys.push_back(key);
+      auto it = rows.find(std::make_pair(model_version, key));
+      memcpy(values + i * bytes_per_values,
+             it == rows.end() ? default_value
+                              : (const char*)it->second.data(),
+             bytes_per_values);
+    }
+    Status s;
+    cb(s);
+    return s;
+  }
+
+  Status SetValues(uint64_t model_version,
+                   uint64_t feature2id,
+                   const char* const keys,
+                   const char* const values,
+                   size_t bytes_per_key,
+                   size_t bytes_per_values,
+                   size_t N,
+                   BatchSetCallback cb) override {
+    for (size_t i = 0; i < N; ++i) {
+      SetRow(model_version, ((const int64*)keys)[i],
+             ((const float*)values)[i * kDim]);
+    }
+    Status s;
+    cb(s);
+    return s;
+  }
+
+  void SetRow(uint64_t model_version, int64 key, float value) {
+    rows[std::make_pair(model_version, key)].assign(kDim, value);
+  }
+
+  Status Reset() override { return Status::OK(); }
+  Status GetStorageMeta(StorageMeta* meta) override { return Status::OK(); }
+  void GetStorageOptions(StorageMeta& meta,
+                         StorageOptions** cur_opt,
+                         StorageOptions** bak_opt) override {}
+  Status SetStorageActiveStatus(bool active) override { return Status::OK(); }
+  Status GetModelVersion(int64_t* full_version,
+                         int64_t* latest_version) override {
+    return Status::OK();
+  }
+  Status SetModelVersion(int64_t full_version,
+                         int64_t latest_version) override {
+    return Status::OK();
+  }
+  Status GetStorageLock(int value, int timeout, bool* success) override {
+    return Status::OK();
+  }
+  Status ReleaseStorageLock(int value) override { return Status::OK(); }
+
+  std::map<std::pair<uint64_t, int64>, std::vector<float>> rows;
+  int num_get_calls = 0;
+  std::vector<int64> requested_keys;
+};
+
+std::vector<float> Lookup(IFeatureStoreMgr* mgr, uint64_t model_version,
+                          const std::vector<int64>& keys) {
+  std::vector<float> values(keys.size() * kDim);
+  std::vector<float> default_value(kDim, -1.0f);
+  bool done = false;
+  Status s = mgr->GetValues(model_version, 7, (const char*)keys.data(),
+      (char*)values.data(), sizeof(int64), sizeof(float) * kDim,
+      keys.size(), (const char*)default_value.data(),
+      [&done](const Status& s) {
+        EXPECT_TRUE(s.ok());
+        done = true;
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_TRUE(done);
+  return values;
+}
+
+} // namespace
+
+TEST(EmbeddingCacheTest, AdmitByFrequencyAndHit) {
+  LocalFeatureStoreMgr* local = new LocalFeatureStoreMgr;
+  for (int64 key = 0; key < 10; ++key) {
+    local->SetRow(1, key, key * 10.0f);
+  }
+  CachedFeatureStoreMgr mgr(local, 1 << 20, 2);
+
+  // Missed once, not admitted yet.
+  Lookup(&mgr, 1, {1, 2, 3});
+  // Missed twice, admitted.
+  Lookup(&mgr, 1, {1, 2, 3});
+  EXPECT_EQ(2, local->num_get_calls);
+  std::vector<float> values = Lookup(&mgr, 1, {3, 1, 2});
+  EXPECT_EQ(2, local->num_get_calls);
+  EXPECT_EQ(30.0f, values[0]);
+  EXPECT_EQ(10.0f, values[kDim]);
+  EXPECT_EQ(20.0f, values[2 * kDim + kDim - 1]);
+
+  // Only the missed key goes to the storage, the rows stay in order.
+  local->requested_keys.clear();
+  values = Lookup(&mgr, 1, {1, 5, 2});
+  EXPECT_EQ(3, local->num_get_calls);
+  ASSERT_EQ(1, local->requested_keys.size());
+  EXPECT_EQ(5, local->requested_keys[0]);
+  EXPECT_EQ(10.0f, values[0]);
+  EXPECT_EQ(50.0f, values[kDim]);
+  EXPECT_EQ(20.0f, values[2 * kDim]);
+
+  EXPECT_EQ(5, mgr.cache()->hits());
+  EXPECT_EQ(7, mgr.cache()->misses());
+  EXPECT_GT(mgr.cache()->bytes(), 0);
+}
+
+TEST(EmbeddingCacheTest, InvalidateOnModelUpdate) {
+  LocalFeatureStoreMgr* local = new LocalFeatureStoreMgr;
+  local->SetRow(1, 1, 1.0f);
+  CachedFeatureStoreMgr mgr(local, 1 << 20, 1);
+  EXPECT_EQ(1.0f, Lookup(&mgr, 1, {1})[0]);
+  EXPECT_EQ(1.0f, Lookup(&mgr, 1, {1})[0]);
+  EXPECT_EQ(1, local->num_get_calls);
+
+  // Written by another instance, seen after the model update.
+  local->SetRow(1, 1, 2.0f);
+  EXPECT_EQ(1.0f, Lookup(&mgr, 1, {1})[0]);
+  mgr.InvalidateCache();
+  EXPECT_EQ(2.0f, Lookup(&mgr, 1, {1})[0]);
+  EXPECT_GT(mgr.cache()->bytes(), 0);
+
+  // Written through the cached storage.
+  int64 key = 1;
+  std::vector<float> row(kDim, 3.0f);
+  EXPECT_TRUE(mgr.SetValues(1, 7, (const char*)&key, (const char*)row.data(),
+                            sizeof(int64), sizeof(float) * kDim, 1,
+                            [](const Status& s) {}).ok());
+  EXPECT_EQ(3.0f, Lookup(&mgr, 1, {1})[0]);
+
+  // Rows of another model version are not shared.
+  local->SetRow(2, 1, 4.0f);
+  EXPECT_EQ(4.0f, Lookup(&mgr, 2, {1})[0]);
+}
+
+TEST(EmbeddingCacheTest, DefaultValueNotCached) {
+  LocalFeatureStoreMgr* local = new LocalFeatureStoreMgr;
+  CachedFeatureStoreMgr mgr(local, 1 << 20, 1);
+  EXPECT_EQ(-1.0f, Lookup(&mgr, 1, {8})[0]);
+  EXPECT_EQ(-1.0f, Lookup(&mgr, 1, {8})[0]);
+  EXPECT_EQ(2, local->num_get_calls);
+  EXPECT_EQ(0, mgr.cache()->bytes());
+}
+
+TEST(EmbeddingCacheTest, BoundedSize) {
+  const size_t capacity = 64 << 10;
+  EmbeddingCache cache(capacity, 1, 4);
+  std::vector<char> value(256, 'x');
+  for (uint64 key = 0; key < 10000; ++key) {
+    EXPECT_FALSE(cache.Lookup(1, 0, key, value.data(), value.size()));
+    cache.Insert(cache.generation(), 1, 0, key, value.data(), value.size());
+    EXPECT_LE(cache.bytes(), capacity);
+  }
+  // The most recent keys are kept.
+  EXPECT_TRUE(cache.Lookup(1, 0, 9999, value.data(), value.size()));
+  EXPECT_FALSE(cache.Lookup(1, 0, 0, value.data(), value.size()));
+
+  // Rows read before an invalidation are dropped.
+  uint64 generation = cache.generation();
+  cache.Invalidate();
+  EXPECT_EQ(0, cache.bytes());
+  cache.Insert(generation, 1, 0, 1, value.data(), value.size());
+  EXPECT_FALSE(cache.Lookup(1, 0, 1, value.data(), value.size()));
+}
+
+} // namespace processor
+} // namespace tensorflow
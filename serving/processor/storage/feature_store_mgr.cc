@@ -16,6 +16,7 @@ limitations under the License.
 #include "serving/processor/storage/feature_store_mgr.h"
 #include "serving/processor/serving/model_config.h"
 #include "absl/synchronization/mutex.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/logging.h"
 
 namespace tensorflow {
@@ -474,5 +475,180 @@ Status FeatureStoreMgr::ReleaseStorageLock(int value) {
   CALL_BY_UPDATE_THREAD(ReleaseStorageLock, value);
 }
 
+namespace {
+constexpr uint64_t kCacheStatsLogIntervalMicros = 60 * 1000 * 1000;
+
+uint64_t LoadKey(const char* key, size_t bytes_per_key) {
+  uint64_t k = 0;
+  memcpy(&k, key, bytes_per_key);
+  return k;
+}
+
+// Keys and values of the keys missed in the cache, alive until the
+// storage has answered.
+struct MissedLookup {
+  std::vector<size_t> indices;
+  std::unique_ptr<char[]> keys;
+  std::unique_ptr<char[]> values;
+};
+} // namespace
+
+CachedFeatureStoreMgr::CachedFeatureStoreMgr(IFeatureStoreMgr* base,
+    size_t capacity_bytes, int min_admit_frequency)
+    : base_(base), cache_(capacity_bytes, min_admit_frequency),
+      last_log_micros_(Env::Default()->NowMicros()) {
+}
+
+CachedFeatureStoreMgr::~CachedFeatureStoreMgr() {
+  LOG(INFO) << "[EmbeddingCache] " << cache_.DebugString();
+}
+
+Status CachedFeatureStoreMgr::GetValues(
+    uint64_t model_version,
+    uint64_t feature2id,
+    const char* const keys,
+    char* const values,
+    size_t bytes_per_key,
+    size_t bytes_per_values,
+    size_t N,
+    const char* default_value,
+    BatchGetCallback cb) {
+  if (bytes_per_key > sizeof(uint64_t) || N == 0) {
+    return base_->GetValues(model_version, feature2id, keys, values,
+        bytes_per_key, bytes_per_values, N, default_value, std::move(cb));
+  }
+  MaybeLogStats();
+
+  // Read before the lookups, see EmbeddingCache::Insert.
+  const uint64_t generation = cache_.generation();
+  auto missed = std::make_shared<MissedLookup>();
+  for (size_t i = 0; i < N; ++i) {
+    if (!cache_.Lookup(model_version, feature2id,
+                       LoadKey(keys + i * bytes_per_key, bytes_per_key),
+                       values + i * bytes_per_values, bytes_per_values)) {
+      missed->indices.push_back(i);
+    }
+  }
+  if (missed->indices.empty()) {
+    Status s;
+    cb(s);
+    return s;
+  }
+
+  const size_t num_missed = missed->indices.size();
+  const bool all_missed = num_missed == N;
+  if (!all_missed) {
+    missed->keys.reset(new char[num_missed * bytes_per_key]);
+    missed->values.reset(new char[num_missed * bytes_per_values]);
+    for (size_t j = 0; j < num_missed; ++j) {
+      memcpy(missed->keys.get() + j * bytes_per_key,
+             keys + missed->indices[j] * bytes_per_key, bytes_per_key);
+    }
+  }
+
+  EmbeddingCache* cache = &cache_;
+  return base_->GetValues(
+      model_version, feature2id,
+      all_missed ? keys : missed->keys.get(),
+      all_missed ? values : missed->values.get(),
+      bytes_per_key, bytes_per_values, num_missed, default_value,
+      [cache, missed, generation, model_version, feature2id, keys, values,
+       bytes_per_key, bytes_per_values, default_value,
+       all_missed, cb = std::move(cb)](const Status& s) {
+    if (s.ok()) {
+      for (size_t j = 0; j < missed->indices.size(); ++j) {
+        const size_t i = missed->indices[j];
+        char* value = values + i * bytes_per_values;
+        if (!all_missed) {
+          memcpy(value, missed->values.get() + j * bytes_per_values,
+                 bytes_per_values);
+        }
+        if (default_value != nullptr &&
+            memcmp(value, default_value, bytes_per_values) == 0) {
+          continue;
+        }
+        cache->Insert(generation, model_version, feature2id,
+                      LoadKey(keys + i * bytes_per_key, bytes_per_key),
+                      value, bytes_per_values);
+      }
+    }
+    cb(s);
+  });
+}
+
+Status CachedFeatureStoreMgr::SetValues(
+    uint64_t model_version,
+    uint64_t feature2id,
+    const char* const keys,
+    const char* const values,
+    size_t bytes_per_key,
+    size_t bytes_per_values,
+    size_t N,
+    BatchSetCallback cb) {
+  EmbeddingCache* cache = &cache_;
+  return base_->SetValues(model_version, feature2id, keys, values,
+      bytes_per_key, bytes_per_values, N,
+      [cache, cb = std::move(cb)](const Status& s) {
+    // Rows read before the write completed are stale now.
+    cache->Invalidate();
+    cb(s);
+  });
+}
+
+Status CachedFeatureStoreMgr::Reset() {
+  Status s = base_->Reset();
+  cache_.Invalidate();
+  return s;
+}
+
+void CachedFeatureStoreMgr::InvalidateCache() {
+  cache_.Invalidate();
+  base_->InvalidateCache();
+}
+
+void CachedFeatureStoreMgr::MaybeLogStats() {
+  uint64_t now = Env::Default()->NowMicros();
+  uint64_t last = last_log_micros_.load(std::memory_order_relaxed);
+  if (now - last < kCacheStatsLogIntervalMicros ||
+      !last_log_micros_.compare_exchange_strong(last, now)) {
+    return;
+  }
+  LOG(INFO) << "[EmbeddingCache] " << cache_.DebugString();
+}
+
+Status CachedFeatureStoreMgr::GetStorageMeta(StorageMeta* meta) {
+  return base_->GetStorageMeta(meta);
+}
+
+void CachedFeatureStoreMgr::GetStorageOptions(
+    StorageMeta& meta,
+    StorageOptions** cur_opt,
+    StorageOptions** bak_opt) {
+  base_->GetStorageOptions(meta, cur_opt, bak_opt);
+}
+
+Status CachedFeatureStoreMgr::SetStorageActiveStatus(bool active) {
+  return base_->SetStorageActiveStatus(active);
+}
+
+Status CachedFeatureStoreMgr::GetModelVersion(int64_t* full_version,
+                                              int64_t* latest_version) {
+  return base_->GetModelVersion(full_version, latest_version);
+}
+
+Status CachedFeatureStoreMgr::SetModelVersion(
+    int64_t full_version, int64_t latest_version) {
+  return base_->SetModelVersion(full_version, latest_version);
+}
+
+Status CachedFeatureStoreMgr::GetStorageLock(
+    int value, int timeout, bool* success) {
+  return base_->GetStorageLock(value, timeout, success);
+}
+
+Status CachedFeatureStoreMgr::ReleaseStorageLock(int value) {
+  return base_->ReleaseStorageLock(value);
+}
+
 } // processor
 } // tensorflow
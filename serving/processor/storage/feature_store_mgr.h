@@ -25,6 +25,7 @@ limitations under the License.
 #include "concurrentqueue.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "serving/processor/storage/embedding_cache.h"
 #include "serving/processor/storage/redis_feature_store.h"
 
 namespace tensorflow {
@@ -157,6 +158,10 @@ class IFeatureStoreMgr {
                            BatchSetCallback cb) = 0;
 
   virtual Status Reset() = 0;
+
+  // Called after a model update wrote new values to the storage,
+  // drops the values cached in the process if any.
+  virtual void InvalidateCache() {}
 };
 
 class FeatureStoreMgr : public IFeatureStoreMgr {
@@ -211,6 +216,63 @@ class FeatureStoreMgr : public IFeatureStoreMgr {
   std::string storage_type_;
 };
 
+// Serves GetValues from an EmbeddingCache first and only reads the
+// missed keys from the wrapped storage. Keys wider than 8 bytes bypass
+// the cache. Rows equal to the default value are not cached, the storage
+// returns the default for missing keys and those may be written later.
+class CachedFeatureStoreMgr : public IFeatureStoreMgr {
+ public:
+  // Takes the ownership of base.
+  CachedFeatureStoreMgr(IFeatureStoreMgr* base, size_t capacity_bytes,
+                        int min_admit_frequency);
+  ~CachedFeatureStoreMgr() override;
+
+  Status GetStorageMeta(StorageMeta* meta) override;
+
+  void GetStorageOptions(StorageMeta& meta,
+                         StorageOptions** cur_opt,
+                         StorageOptions** bak_opt) override;
+
+  Status SetStorageActiveStatus(bool active) override;
+  Status GetModelVersion(int64_t* full_version,
+                         int64_t* latest_version) override;
+  Status SetModelVersion(int64_t full_version,
+                         int64_t latest_version) override;
+
+  Status GetStorageLock(int value, int timeout,
+                        bool* success) override;
+  Status ReleaseStorageLock(int value) override;
+
+  Status GetValues(uint64_t model_version,
+                   uint64_t feature2id,
+                   const char* const keys,
+                   char* const values,
+                   size_t bytes_per_key,
+                   size_t bytes_per_values,
+                   size_t N,
+                   const char* default_value,
+                   BatchGetCallback cb) override;
+  Status SetValues(uint64_t model_version,
+                   uint64_t feature2id,
+                   const char* const keys,
+                   const char* const values,
+                   size_t bytes_per_key,
+                   size_t bytes_per_values,
+                   size_t N,
+                   BatchSetCallback cb) override;
+  Status Reset() override;
+  void InvalidateCache() override;
+
+  EmbeddingCache* cache() { return &cache_; }
+
+ private:
+  void MaybeLogStats();
+
+  std::unique_ptr<IFeatureStoreMgr> base_;
+  EmbeddingCache cache_;
+  std::atomic<uint64_t> last_log_micros_;
+};
+
 } // processor
 } // tensorflow
 
@@ -1598,9 +1598,9 @@ void CostExecutorState<PropagatorStateType>::CostScheduleReady(
   } else {
     // sort ready nodes
     // key path priority schedule
+    auto accumulative_cost = this->kernel_stats_->GetAccumulativeCostArray();
     std::sort(ready->begin(), ready->end(),
-        SortTaggedNode<PropagatorStateType>(
-            this->kernel_stats_->GetAccumulativeCostArray()));
+        SortTaggedNode<PropagatorStateType>(accumulative_cost.get()));
 
     // TODO: FIXME 50us or 100 ops
     // Use cost model here
@@ -19,15 +19,20 @@ limitations under the License.
 
 #include "tensorflow/core/common_runtime/device.h"
 #include "tensorflow/core/common_runtime/device_factory.h"
+#include "tensorflow/core/common_runtime/graph_view.h"
+#include "tensorflow/core/common_runtime/kernel_stat.h"
 #include "tensorflow/core/common_runtime/kernel_benchmark_testlib.h"
 #include "tensorflow/core/common_runtime/process_util.h"
 #include "tensorflow/core/common_runtime/step_stats_collector.h"
+#include "tensorflow/core/framework/cost_graph.pb.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/rendezvous.h"
 #include "tensorflow/core/framework/step_stats.pb.h"
 #include "tensorflow/core/framework/versions.pb.h"
 #include "tensorflow/core/graph/graph_constructor.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/gtl/cleanup.h"
+#include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/logging.h"
@@ -421,6 +426,69 @@ TEST_F(ExecutorTest, RecvInvalidRefDtype) {
   rendez->Unref();
 }
 
+TEST_F(ExecutorTest, PersistCostModel) {
+  const string dir = io::JoinPath(testing::TmpDir(), "persist_cost_model");
+  int64 undeleted_files, undeleted_dirs;
+  Env::Default()->DeleteRecursively(dir, &undeleted_files, &undeleted_dirs)
+      .IgnoreError();
+  setenv("START_NODE_STATS_STEP", "1", 1);
+  setenv("STOP_NODE_STATS_STEP", "3", 1);
+  setenv("EXECUTE_COST_MODEL_DIR", dir.c_str(), 1);
+  auto unset_env = gtl::MakeCleanup([] {
+    unsetenv("START_NODE_STATS_STEP");
+    unsetenv("STOP_NODE_STATS_STEP");
+    unsetenv("EXECUTE_COST_MODEL_DIR");
+  });
+
+  auto make_graph = []() {
+    auto g = absl::make_unique<Graph>(OpRegistry::Global());
+    auto v = test::graph::Recv(g.get(), "a", "float", ALICE, 1, BOB);
+    for (int i = 0; i < 4; ++i) {
+      v = test::graph::Add(g.get(), v, v);
+    }
+    test::graph::Send(g.get(), v, "b", BOB, 1, ALICE);
+    return g;
+  };
+
+  int num_nodes = 0;
+  for (int executor = 0; executor < 2; ++executor) {
+    auto g = make_graph();
+    num_nodes = g->num_nodes();
+    if (executor > 0) {
+      rendez_->Unref();
+      // The costs are available before any step is traced.
+      GraphView gview;
+      TF_ASSERT_OK(gview.Initialize(g.get()));
+      ExecutorInternal::KernelStats stats;
+      stats.Initialize(gview, g.get());
+      EXPECT_TRUE(stats.CollectStatsDone());
+    }
+    Create(std::move(g));
+
+    for (int step = 0; step < 5; ++step) {
+      Rendezvous::Args args;
+      TF_ASSERT_OK(rendez_->Send(Key(ALICE, kIncarnation, BOB, "a"), args,
+                                 V(1.0), false));
+      TF_ASSERT_OK(Run(rendez_));
+      Tensor out = V(-1);
+      bool is_dead = false;
+      TF_ASSERT_OK(rendez_->Recv(Key(BOB, kIncarnation, ALICE, "b"), args,
+                                 &out, &is_dead));
+      EXPECT_EQ(16.0, V(out));
+    }
+
+    // The same graph is keyed by the same fingerprint, the second executor
+    // warm starts from the costs the first one saved.
+    std::vector<string> files;
+    TF_ASSERT_OK(Env::Default()->GetMatchingPaths(
+        io::JoinPath(dir, "execute_cost_*.pb"), &files));
+    ASSERT_EQ(1, files.size());
+    CostGraphDef cost_graph;
+    TF_ASSERT_OK(ReadBinaryProto(Env::Default(), files[0], &cost_graph));
+    EXPECT_EQ(num_nodes, cost_graph.node_size());
+  }
+}
+
 // Create a graph that is 'depth' deep. At each level, fan-in and fan-out a
 // maximum of 'width' nodes. All nodes are no-ops and all dependencies are
 // control dependencies.
@@ -0,0 +1,169 @@
+/* Copyright 2015 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/kernel_stat.h"
+
+#include <cstdlib>
+#include <unordered_map>
+
+#include "tensorflow/core/framework/cost_graph.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/random/random.h"
+#include "tensorflow/core/lib/strings/proto_serialization.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/fingerprint.h"
+
+namespace tensorflow {
+namespace ExecutorInternal {
+
+namespace {
+
+// Fingerprints the nodes and edges of `g`, regardless of the order of the
+// node ids and of the task the graph is placed on, so that restarted or
+// replicated jobs find the costs persisted for the same graph.
+uint64 GraphFingerprint(const Graph* g) {
+  std::vector<uint64> node_fingerprints;
+  node_fingerprints.reserve(g->num_nodes());
+  for (const Node* n : g->nodes()) {
+    NodeDef def = n->def();
+    def.clear_device();
+    def.clear_input();
+    string serialized;
+    SerializeToStringDeterministic(def, &serialized);
+    uint64 fp = Fingerprint64(serialized);
+
+    std::vector<string> inputs;
+    for (const Edge* e : n->in_edges()) {
+      inputs.push_back(strings::StrCat(e->src()->name(), ":", e->src_output(),
+                                       ":", e->dst_input()));
+    }
+    std::sort(inputs.begin(), inputs.end());
+    for (const string& input : inputs) {
+      fp = FingerprintCat64(fp, Fingerprint64(input));
+    }
+    node_fingerprints.push_back(fp);
+  }
+
+  std::sort(node_fingerprints.begin(), node_fingerprints.end());
+  uint64 fp = Fingerprint64("execute_cost_model");
+  for (uint64 node_fp : node_fingerprints) {
+    fp = FingerprintCat64(fp, node_fp);
+  }
+  return fp;
+}
+
+}  // namespace
+
+string KernelStats::CostStatsFileName() const {
+  return io::JoinPath(
+      cost_model_dir_,
+      strings::StrCat("execute_cost_",
+                      strings::Hex(graph_fingerprint_, strings::kZeroPad16),
+                      ".pb"));
+}
+
+void KernelStats::MaybeWarmStart() {
+  graph_fingerprint_ = GraphFingerprint(g_);
+  const string fname = CostStatsFileName();
+  Env* env = Env::Default();
+  if (!env->FileExists(fname).ok()) {
+    VLOG(1) << "No execute cost model found at " << fname;
+    return;
+  }
+
+  CostGraphDef cost_graph;
+  Status s = ReadBinaryProto(env, fname, &cost_graph);
+  if (!s.ok()) {
+    LOG(WARNING) << "Read execute cost model " << fname << " failed. "
+                 << s.error_message();
+    return;
+  }
+
+  std::unordered_map<string, const CostGraphDef::Node*> costs;
+  for (const CostGraphDef::Node& cost : cost_graph.node()) {
+    costs.emplace(cost.name(), &cost);
+  }
+  std::vector<std::pair<int, const CostGraphDef::Node*>> matched;
+  matched.reserve(g_->num_nodes());
+  for (const Node* n : g_->nodes()) {
+    auto it = costs.find(n->name());
+    if (it == costs.end() || n->id() >= nodes_count_) {
+      LOG(WARNING) << "Execute cost model " << fname
+                   << " does not match the graph, node " << n->name()
+                   << " is missing. Ignore it.";
+      return;
+    }
+    matched.emplace_back(n->id(), it->second);
+  }
+
+  for (const auto& m : matched) {
+    immutable_avg_cost_[m.first] = m.second->compute_time();
+    task_count_[m.first] = m.second->intra_task_count();
+    if (is_expensive_[m.first] && m.second->compute_cost() > 0) {
+      cost_estimates_[m.first] = m.second->compute_cost();
+    }
+  }
+  CalculateAccumulativeCost();
+  warm_started_ = true;
+  LOG(INFO) << "Warm start execute cost model from " << fname;
+}
+
+Status KernelStats::SaveCostStats() const {
+  CostGraphDef cost_graph;
+  for (const Node* n : g_->nodes()) {
+    const int id = n->id();
+    if (id >= nodes_count_) continue;
+    CostGraphDef::Node* cost = cost_graph.add_node();
+    cost->set_name(n->name());
+    cost->set_id(id);
+    cost->set_compute_time(immutable_avg_cost_[id]);
+    cost->set_intra_task_count(task_count_[id]);
+    if (is_expensive_[id]) {
+      cost->set_compute_cost(
+          cost_estimates_[id].load(std::memory_order_relaxed));
+    }
+  }
+
+  // Written aside and renamed, so that a concurrent reader never sees a
+  // partial file.
+  Env* env = Env::Default();
+  TF_RETURN_IF_ERROR(env->RecursivelyCreateDir(cost_model_dir_));
+  const string fname = CostStatsFileName();
+  const string tmp_fname = strings::StrCat(fname, ".tmp", random::New64());
+  TF_RETURN_IF_ERROR(WriteBinaryProto(env, tmp_fname, cost_graph));
+  TF_RETURN_IF_ERROR(env->RenameFile(tmp_fname, fname));
+  LOG(INFO) << "Save execute cost model to " << fname;
+  return Status::OK();
+}
+
+bool KernelStats::CostDrifted(const std::vector<int64>& avg_cost) const {
+  int64 total_cost = 0;
+  int64 drift_cost = 0;
+  for (size_t i = 0; i < nodes_count_; ++i) {
+    if (node_stats_count_[i] == 0) continue;
+    const int64 cost = immutable_avg_cost_[i];
+    total_cost += cost;
+    drift_cost += std::abs(avg_cost[i] - cost);
+  }
+  const bool drifted = drift_cost * 100 > total_cost * drift_percent_;
+  LOG(INFO) << "Execute cost model drifted " << drift_cost << "ns of "
+            << total_cost << "ns traced, "
+            << (drifted ? "re-learn it." : "keep the warm started one.");
+  return drifted;
+}
+
+}  // end namespace ExecutorInternal
+}  // end namespace tensorflow
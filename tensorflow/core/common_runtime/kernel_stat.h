@@ -16,9 +16,11 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_COMMON_RUNTIME_KERNEL_STAT_H_
 #define TENSORFLOW_CORE_COMMON_RUNTIME_KERNEL_STAT_H_
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <queue>
+#include <string>
 #include <vector>
 
 #include "absl/memory/memory.h"
@@ -42,6 +44,10 @@ static const std::string start_node_stats_step_env_name =
     "START_NODE_STATS_STEP";
 static const std::string stop_node_stats_step_env_name =
     "STOP_NODE_STATS_STEP";
+static const std::string cost_model_dir_env_name =
+    "EXECUTE_COST_MODEL_DIR";
+static const std::string cost_model_drift_env_name =
+    "EXECUTE_COST_MODEL_DRIFT_PERCENT";
 }
 
 // Hold stats info
@@ -74,6 +80,16 @@ class KernelStats {
       VLOG(1) << "User collect node stats, start_step is " << start_step_
               << ", stop_step is " << stop_step_;
     }    
+    s = ReadStringFromEnvVar(cost_model_dir_env_name, "", &cost_model_dir_);
+    if (!s.ok()) {
+      LOG(WARNING) << "Read EXECUTE_COST_MODEL_DIR envrionment error. "
+                   << s.error_message();
+    }
+    s = ReadInt64FromEnvVar(cost_model_drift_env_name, 30, &drift_percent_);
+    if (!s.ok()) {
+      LOG(WARNING) << "Read EXECUTE_COST_MODEL_DRIFT_PERCENT envrionment error. "
+                   << s.error_message();
+    }
   }    
 
   void Initialize(const GraphView& gview,
@@ -89,6 +105,8 @@ class KernelStats {
         absl::make_unique<std::atomic<int64_t>[]>(gview.num_nodes());
     node_stats_count_ =
         absl::make_unique<std::atomic<int32_t>[]>(gview.num_nodes());
+    node_cost_sum_ =
+        absl::make_unique<std::atomic<int64_t>[]>(gview.num_nodes());
     task_count_ =
         absl::make_unique<std::atomic<int32_t>[]>(gview.num_nodes());
     for (int32_t i = 0; i < gview.num_nodes(); ++i) {
@@ -98,9 +116,14 @@ class KernelStats {
         cost_estimates_[i] = kInitialCostEstimateCycles;
         immutable_avg_cost_[i] = 0;
         node_stats_count_[i] = 0;
+        node_cost_sum_[i] = 0;
         task_count_[i] = 0;
       }
     }
+
+    if (!cost_model_dir_.empty()) {
+      MaybeWarmStart();
+    }
   }
 
   // Returns true iff the given node is considered "expensive". The
@@ -144,18 +167,19 @@ class KernelStats {
       }
     }
 
-    immutable_accumulative_cost_.resize(nodes_count_);
+    // Computed aside and published at once, a warm started cost model may
+    // be read by running steps while it is re-learned.
+    std::vector<int64> accumulative_cost(nodes_count_, 0);
     while (!q.empty()) {
       Node* curr = q.front();
       q.pop();
-      immutable_accumulative_cost_[curr->id()] =
-          immutable_avg_cost_[curr->id()];
+      accumulative_cost[curr->id()] = immutable_avg_cost_[curr->id()];
       for (auto edge : curr->out_edges()) {
         int dest_id = edge->dst()->id();
         int64 tmp = immutable_avg_cost_[curr->id()] +
-            immutable_accumulative_cost_[dest_id];
-        if (immutable_accumulative_cost_[curr->id()] < tmp) {
-          immutable_accumulative_cost_[curr->id()] = tmp;
+            accumulative_cost[dest_id];
+        if (accumulative_cost[curr->id()] < tmp) {
+          accumulative_cost[curr->id()] = tmp;
         }
       }
 
@@ -165,16 +189,33 @@ class KernelStats {
         }
       }
     }
+
+    std::atomic_store(&immutable_accumulative_cost_,
+        std::shared_ptr<const std::vector<int64>>(
+            new std::vector<int64>(std::move(accumulative_cost))));
   }
 
   void StopCollection() {
     collect_op_cost_ = false;
 
     // 1.calculate average cost
+    std::vector<int64> avg_cost(nodes_count_, 0);
     for (size_t i = 0; i < nodes_count_; ++i) {
       int32_t count = node_stats_count_[i];
       if (count > 0) {
-        immutable_avg_cost_[i] = immutable_avg_cost_[i] / count;
+        avg_cost[i] = node_cost_sum_[i] / count;
+      }
+    }
+
+    // A warm started cost model keeps serving unless the costs traced
+    // in this run drifted away from it.
+    if (warm_started_ && !CostDrifted(avg_cost)) {
+      collect_stats_done_ = true;
+      return;
+    }
+    for (size_t i = 0; i < nodes_count_; ++i) {
+      if (node_stats_count_[i] > 0) {
+        immutable_avg_cost_[i] = avg_cost[i];
       }
     }
 
@@ -183,6 +224,14 @@ class KernelStats {
 
     // 3. calculate other metrics here
 
+    if (!cost_model_dir_.empty()) {
+      Status s = SaveCostStats();
+      if (!s.ok()) {
+        LOG(WARNING) << "Save execute cost model failed. "
+                     << s.error_message();
+      }
+    }
+
     collect_stats_done_ = true;
   }
 
@@ -234,7 +283,7 @@ class KernelStats {
                    << item->node->id() << " VS " << nodes_count_;
     }
 
-    immutable_avg_cost_[item->node->id()] +=
+    node_cost_sum_[item->node->id()] +=
         (stat->op_stop_time_ - stat->op_start_time_);
 
     node_stats_count_[item->node->id()]++;
@@ -275,19 +324,22 @@ class KernelStats {
       LOG(WARNING) << "Item node is exceed nodes_count_, "
                  << item->node->id() << " VS " << nodes_count_;
     }
-    return immutable_accumulative_cost_[item->node->id()];
+    return (*GetAccumulativeCostArray())[item->node->id()];
   }
 
-  const std::vector<int64>* GetAccumulativeCostArray() {
-    return &immutable_accumulative_cost_;
+  // The returned costs stay valid while they are re-learned.
+  std::shared_ptr<const std::vector<int64>> GetAccumulativeCostArray() const {
+    return std::atomic_load(&immutable_accumulative_cost_);
   }
 
   const int64 GetNodeCount() {
     return nodes_count_;
   }
 
+  // Returns true once node costs are available, either traced by this
+  // executor or warm started from EXECUTE_COST_MODEL_DIR.
   bool CollectStatsDone() const {
-    return collect_stats_done_;
+    return collect_stats_done_ || warm_started_;
   }
 
  private:
@@ -298,6 +350,19 @@ class KernelStats {
   static constexpr uint64 kOpIsExpensiveThresholdCycles = 8000;
   static constexpr uint64 kCostDecay = 10;
 
+  // Loads the node costs persisted for this graph from cost_model_dir_,
+  // if any.
+  void MaybeWarmStart();
+
+  // Writes the node costs to cost_model_dir_, keyed by graph_fingerprint_.
+  Status SaveCostStats() const;
+
+  // Returns true if the traced `avg_cost` differs from the warm started
+  // costs by more than drift_percent_ of their total.
+  bool CostDrifted(const std::vector<int64>& avg_cost) const;
+
+  string CostStatsFileName() const;
+
   std::vector<bool> is_expensive_;
   std::unique_ptr<std::atomic_uint_fast64_t[]> cost_estimates_;
 
@@ -317,6 +382,8 @@ class KernelStats {
   // Average execution time of nodes
   std::unique_ptr<std::atomic<int64_t>[]> immutable_avg_cost_;
   std::unique_ptr<std::atomic<int32_t>[]> node_stats_count_;
+  // Total execution time of nodes traced in the collect window
+  std::unique_ptr<std::atomic<int64_t>[]> node_cost_sum_;
   // The max total execute time of the graph execute path,
   // which from current node to the sink node.
   // Example:
@@ -324,11 +391,21 @@ class KernelStats {
   //   |                   | -> sink(0)
   //   --> D(3) ------------
   // the max total execute time of A is MAX(1+1+1+0, 1+3+0) = 4
-  std::vector<int64> immutable_accumulative_cost_;
+  std::shared_ptr<const std::vector<int64>> immutable_accumulative_cost_ =
+      std::make_shared<const std::vector<int64>>();
 
   // number of tasks scheduled by the operator to the thread pool
   std::unique_ptr<std::atomic<int32_t>[]> task_count_;
 
+  // Directory the node costs are persisted to, keyed by the graph
+  // fingerprint. User can set envrionment 'EXECUTE_COST_MODEL_DIR'.
+  string cost_model_dir_;
+  uint64 graph_fingerprint_ = 0;
+  // Costs loaded from cost_model_dir_ are re-learned when the traced
+  // costs drift by more than this percent.
+  int64 drift_percent_ = 30;
+  bool warm_started_ = false;
+
   GraphView* gv_ = nullptr; // not owned
   Graph* g_ = nullptr; // not owned
 };
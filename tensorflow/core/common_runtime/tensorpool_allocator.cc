@@ -2,6 +2,9 @@
 #include "tensorflow/core/common_runtime/tensorpool_allocator.h"
 #include "tensorflow/core/framework/allocator_registry.h"
 #include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/numa.h"
+#include "tensorflow/core/util/env_var.h"
+#include <sched.h>
 #include <sys/time.h>
 
 #define likely(x) __builtin_expect(!!(x), 1)
@@ -94,6 +97,60 @@ class DefaultCPUSubAllocator : public SubAllocator {
     port::AlignedFree(ptr);
   }
 };
+
+// Backs the bins of one NUMA node with memory bound to that node.
+class NumaSubAllocator : public SubAllocator {
+ public:
+  explicit NumaSubAllocator(int numa_node)
+    : SubAllocator({}, {}), numa_node_(numa_node) {}
+  ~NumaSubAllocator() override {}
+
+  void* Alloc(size_t alignment, size_t num_bytes) override {
+    return port::NUMAMalloc(numa_node_, num_bytes, alignment);
+  }
+
+  void Free(void* ptr, size_t num_bytes) override {
+    port::NUMAFree(ptr, num_bytes);
+  }
+
+ private:
+  int numa_node_;
+};
+
+const size_t kMaxMagazineSize = 16;
+
+// Free chunks a thread keeps for one bin. Bins are never destroyed, so the
+// magazines of an exiting thread can always be handed back to their bins.
+struct Magazine {
+  TensorPoolAllocator::Bin* bin = nullptr;
+  std::vector<void*> chunks;
+};
+
+struct ThreadMagazines {
+  ~ThreadMagazines() {
+    for (auto& magazine : magazines) {
+      if (magazine.bin != nullptr) {
+        magazine.bin->FlushMagazine(&magazine.chunks);
+      }
+    }
+  }
+
+  // Indexed by the id of the bin.
+  std::vector<Magazine> magazines;
+};
+
+Magazine* GetMagazine(TensorPoolAllocator::Bin* bin, size_t id) {
+  static thread_local ThreadMagazines thread_magazines;
+  auto& magazines = thread_magazines.magazines;
+  if (unlikely(id >= magazines.size())) {
+    magazines.resize(id + 1);
+  }
+  auto magazine = &magazines[id];
+  magazine->bin = bin;
+  return magazine;
+}
+
+std::atomic<size_t> next_bin_id(0);
 }
 
 TensorPoolAllocator::TensorPoolAllocator() :
@@ -105,7 +162,27 @@ TensorPoolAllocator::TensorPoolAllocator() :
     large_bin_index_(0),
     null_bin_counter_(0),
     hit_counter_(0),
-    missed_counter_(0) {
+    missed_counter_(0),
+    cross_node_free_counter_(0) {
+  Status s = ReadBoolFromEnvVar("ENABLE_TENSORPOOL_NUMA_AWARE",
+      false, &numa_aware_);
+  if (!s.ok()) {
+    LOG(FATAL) << "Read ENABLE_TENSORPOOL_NUMA_AWARE envrionment error. "
+               << s.error_message();
+  }
+  if (numa_aware_ && port::NUMAEnabled()) {
+    for (int node = 0; node < port::NUMANumNodes(); ++node) {
+      std::vector<unsigned> cpus;
+      port::NUMANodeCPUs(node, &cpus);
+      for (auto cpu : cpus) {
+        if (cpu >= cpu_to_numa_node_.size()) {
+          cpu_to_numa_node_.resize(cpu + 1, 0);
+        }
+        cpu_to_numa_node_[cpu] = node;
+      }
+      numa_sub_allocators_.emplace_back(new NumaSubAllocator(node));
+    }
+  }
   mem_planner_->SetAllocator(this);
 }
 
@@ -118,36 +195,81 @@ void TensorPoolAllocator::Init() {
 
     alignment_ = lifetime_policy->Alignment();
     alignment_offset_ = lifetime_policy->AlignmentOffset();
+    large_bin_index_ = lifetime_policy->GetBins().size();
 
-    auto policy_large_bins = lifetime_policy->GetLargeBins();
-    for (auto rit = policy_large_bins.rbegin();
-        rit != policy_large_bins.rend(); ++rit) {
-      auto bin_info = rit->second;
-      auto bin = new Bin(bin_info->BlockSize(), bin_info->ChunkSize(),
-          bin_info->Alignment(), bin_info->VBlocks(), 
-          sub_allocator_.get(), this);
-      large_lifetime_bins_.emplace(rit->first, bin);
-    }
-    auto policy_bins = lifetime_policy->GetBins();
-    large_bin_index_ = policy_bins.size();
-    lifetime_bins_.resize(large_bin_index_);
-
-    // create bigger bin first
-    for (auto it = policy_bins.rbegin(); it != policy_bins.rend();
-        ++it) {
-      Bin* bin = nullptr;
-      if ((*it)->BlockSize() > 0 || (*it)->VBlocks().size() > 0) {
-        bin = new Bin((*it)->BlockSize(), (*it)->ChunkSize(),
-            (*it)->Alignment(), (*it)->VBlocks(), 
-            sub_allocator_.get(), this);
+    if (numa_sub_allocators_.empty()) {
+      numa_node_bins_.resize(1);
+      CreateBins(0, lifetime_policy, sub_allocator_.get());
+    } else {
+      numa_node_bins_.resize(numa_sub_allocators_.size());
+      for (size_t node = 0; node < numa_sub_allocators_.size(); ++node) {
+        CreateBins(node, lifetime_policy, numa_sub_allocators_[node].get());
       }
-      lifetime_bins_[(*it)->BinIndex()] = bin;
     }
-    LOG(INFO) << "TensorPoolAllocator enabled";
+    if (numa_aware_) {
+      LOG(INFO) << "TensorPoolAllocator enabled, NUMA-aware with "
+                << numa_node_bins_.size() << " node(s)";
+    } else {
+      LOG(INFO) << "TensorPoolAllocator enabled";
+    }
     inited_ = true;
   }
 }
 
+void TensorPoolAllocator::CreateBins(int numa_node,
+    LifetimePolicy* lifetime_policy, SubAllocator* sub_allocator) {
+  auto& node_bins = numa_node_bins_[numa_node];
+  auto magazine_size = [this](size_t len) -> size_t {
+    // Leave most chunks of a small bin in the shared buffer.
+    return numa_aware_ ? std::min(kMaxMagazineSize, len / 8) : 0;
+  };
+
+  auto policy_large_bins = lifetime_policy->GetLargeBins();
+  for (auto rit = policy_large_bins.rbegin();
+      rit != policy_large_bins.rend(); ++rit) {
+    auto bin_info = rit->second;
+    auto bin = new Bin(bin_info->BlockSize(), bin_info->ChunkSize(),
+        bin_info->Alignment(), bin_info->VBlocks(),
+        sub_allocator, this, numa_node,
+        magazine_size(bin_info->BlockSize()));
+    node_bins.large_lifetime_bins.emplace(rit->first, bin);
+  }
+  auto policy_bins = lifetime_policy->GetBins();
+  node_bins.lifetime_bins.resize(policy_bins.size());
+
+  // create bigger bin first
+  for (auto it = policy_bins.rbegin(); it != policy_bins.rend();
+      ++it) {
+    Bin* bin = nullptr;
+    if ((*it)->BlockSize() > 0 || (*it)->VBlocks().size() > 0) {
+      bin = new Bin((*it)->BlockSize(), (*it)->ChunkSize(),
+          (*it)->Alignment(), (*it)->VBlocks(),
+          sub_allocator, this, numa_node,
+          magazine_size((*it)->BlockSize()));
+    }
+    node_bins.lifetime_bins[(*it)->BinIndex()] = bin;
+  }
+}
+
+int TensorPoolAllocator::CurrentNumaNode() const {
+  if (likely(numa_node_bins_.size() <= 1)) {
+    return 0;
+  }
+  // Inter-op threads pinned to a node keep it, other threads are mapped
+  // from the CPU they currently run on.
+  static thread_local int pinned_node = port::NUMAGetThreadNodeAffinity();
+  if (pinned_node >= 0 &&
+      static_cast<size_t>(pinned_node) < numa_node_bins_.size()) {
+    return pinned_node;
+  }
+  int cpu = sched_getcpu();
+  if (unlikely(cpu < 0 ||
+      static_cast<size_t>(cpu) >= cpu_to_numa_node_.size())) {
+    return 0;
+  }
+  return cpu_to_numa_node_[cpu];
+}
+
 void* TensorPoolAllocator::AllocateRaw(size_t alignment,
     size_t num_bytes) {
   if (SmallAlloc(num_bytes)) {
@@ -181,31 +303,41 @@ void TensorPoolAllocator::DeallocateRaw(void* ptr) {
 
 TensorPoolAllocator::Bin* TensorPoolAllocator::GetBin(
     size_t bin_index) {
+  return GetBin(CurrentNumaNode(), bin_index);
+}
+
+TensorPoolAllocator::Bin* TensorPoolAllocator::GetBin(
+    int numa_node, size_t bin_index) {
   if (unlikely(bin_index < 0)) {
     return nullptr;
   }
 
+  auto& node_bins = numa_node_bins_[numa_node];
   if (unlikely(bin_index >= large_bin_index_)) {
-    auto it = large_lifetime_bins_.find(bin_index);
-    if (it == large_lifetime_bins_.end()) {
+    auto it = node_bins.large_lifetime_bins.find(bin_index);
+    if (it == node_bins.large_lifetime_bins.end()) {
       return nullptr;
     } else {
       return it->second;
     }
   }
-  return lifetime_bins_[bin_index];
+  return node_bins.lifetime_bins[bin_index];
 }
 
 TensorPoolAllocator::Bin::Bin(size_t len,
     size_t chunk_size, size_t alignment,
     std::vector<VirtualAllocBlock*>& vblocks,
-    SubAllocator* sub_allocator, TensorPoolAllocator* tp) :
+    SubAllocator* sub_allocator, TensorPoolAllocator* tp,
+    int numa_node, size_t magazine_size) :
   buffer_(len, chunk_size, alignment, sub_allocator),
-  virtual_buffer_(vblocks, tp), sub_allocator_(sub_allocator) {
+  virtual_buffer_(vblocks, numa_node, tp), sub_allocator_(sub_allocator),
+  numa_node_(numa_node), magazine_size_(magazine_size),
+  id_(next_bin_id++) {
 }
 
 void* TensorPoolAllocator::Bin::Allocate(size_t total, size_t header_size) {
-  auto ptr = buffer_.Allocate();
+  auto ptr = magazine_size_ > 0 ? AllocateFromMagazine()
+                                : buffer_.Allocate();
   if (ptr != nullptr) {
     return SetHeader(ptr, total, header_size, (void*)this, nullptr);
   } 
@@ -217,9 +349,14 @@ void* TensorPoolAllocator::Bin::Allocate(size_t total, size_t header_size) {
   return nullptr;
 }
 
-void TensorPoolAllocator::Bin::Deallocate(Header* header) {
+void TensorPoolAllocator::Bin::Deallocate(Header* header,
+    bool is_local_node) {
   if (header->internal_bin == nullptr) {
-    buffer_.Deallocate(header->raw_ptr);
+    if (magazine_size_ > 0 && is_local_node) {
+      DeallocateToMagazine(header->raw_ptr);
+    } else {
+      buffer_.Deallocate(header->raw_ptr);
+    }
   } else {
     virtual_buffer_.Deallocate(header->raw_ptr,
         (TensorPoolAllocator::Bin*)(header->internal_bin));
@@ -234,6 +371,37 @@ void TensorPoolAllocator::Bin::DeallocateRaw(void* p) {
   buffer_.Deallocate(p);
 }
 
+// An empty magazine is refilled with half of its size from the shared
+// buffer, and a full one gives half of its chunks back, so a thread that
+// alternates allocations and frees touches the spin lock rarely.
+void* TensorPoolAllocator::Bin::AllocateFromMagazine() {
+  auto& chunks = GetMagazine(this, id_)->chunks;
+  if (chunks.empty()) {
+    buffer_.AllocateBatch(std::max<size_t>(magazine_size_ / 2, 1), &chunks);
+    if (unlikely(chunks.empty())) {
+      return nullptr;
+    }
+  }
+  auto ptr = chunks.back();
+  chunks.pop_back();
+  return ptr;
+}
+
+void TensorPoolAllocator::Bin::DeallocateToMagazine(void* p) {
+  auto& chunks = GetMagazine(this, id_)->chunks;
+  if (chunks.size() >= magazine_size_) {
+    auto n = std::max<size_t>(magazine_size_ / 2, 1);
+    buffer_.DeallocateBatch(chunks.data() + chunks.size() - n, n);
+    chunks.resize(chunks.size() - n);
+  }
+  chunks.emplace_back(p);
+}
+
+void TensorPoolAllocator::Bin::FlushMagazine(std::vector<void*>* chunks) {
+  buffer_.DeallocateBatch(chunks->data(), chunks->size());
+  chunks->clear();
+}
+
 TensorPoolAllocator::Buffer::Buffer(size_t len, size_t chunk_size,
     size_t alignment, SubAllocator* sub_allocator) {
   auto rounded_bytes = RoundedBytes(chunk_size, alignment);
@@ -265,12 +433,31 @@ void TensorPoolAllocator::Buffer::Deallocate(void* p) {
   buffer_.emplace(p);
 }
 
+size_t TensorPoolAllocator::Buffer::AllocateBatch(size_t n,
+    std::vector<void*>* chunks) {
+  std::lock_guard<spin_lock> l(lock_);
+  size_t i = 0;
+  for (; i < n && !buffer_.empty(); ++i) {
+    chunks->emplace_back(buffer_.top());
+    buffer_.pop();
+  }
+  return i;
+}
+
+void TensorPoolAllocator::Buffer::DeallocateBatch(void* const* chunks,
+    size_t n) {
+  std::lock_guard<spin_lock> l(lock_);
+  for (size_t i = 0; i < n; ++i) {
+    buffer_.emplace(chunks[i]);
+  }
+}
+
 TensorPoolAllocator::VirtualBuffer::VirtualBuffer(
     std::vector<VirtualAllocBlock*>& vblocks,
-    TensorPoolAllocator* tp) {
+    int numa_node, TensorPoolAllocator* tp) {
   for (auto vblock : vblocks) {
     auto bin_index = vblock->BinIndex();
-    auto internal_bin = tp->GetBin(bin_index);
+    auto internal_bin = tp->GetBin(numa_node, bin_index);
     if (internal_bin == nullptr) {
       LOG(WARNING) << "logic error or not allocate correctly";
     }
@@ -313,12 +500,14 @@ void TensorPoolAllocator::DumpStats() {
       << "], missed_counter[" << missed_counter_
       << "], null_bin_counter[" << null_bin_counter_
       << "], hit_rate[" << hit_rate
+      << "], cross_node_free_counter[" << cross_node_free_counter_
       << "]";
 
     stats_ = false;
     hit_counter_ = 0;
     missed_counter_ = 0;
     null_bin_counter_ = 0;
+    cross_node_free_counter_ = 0;
   } else {
     stats_ = true;
     LOG(INFO) << "Start counting TensorPoolAllocator";
@@ -404,6 +593,12 @@ void TensorPoolAllocator::BigDeallocate(Header* header) {
   }
 
   auto bin = (Bin*) (header->bin);
+  if (unlikely(numa_node_bins_.size() > 1) &&
+      bin->NumaNode() != CurrentNumaNode()) {
+    ++cross_node_free_counter_;
+    bin->Deallocate(header, false);
+    return;
+  }
   bin->Deallocate(header);
 }
 
@@ -37,6 +37,7 @@ struct LightHeader {
   }
 };
 
+class LifetimePolicy;
 class MemoryPlannerBase;
 class VirtualAllocBlock;
 
@@ -57,12 +58,14 @@ class TensorPoolAllocator : public Allocator {
   void DumpStats();
 
   class Bin;
+  // Returns the bin of the NUMA node the calling thread runs on.
   Bin* GetBin(size_t bin_index);
+  Bin* GetBin(int numa_node, size_t bin_index);
 
   class VirtualBuffer {
    public:
     VirtualBuffer(std::vector<VirtualAllocBlock*>& vblocks,
-        TensorPoolAllocator* tp);
+        int numa_node, TensorPoolAllocator* tp);
     virtual ~VirtualBuffer() {}
 
     std::pair<void*, Bin*> Allocate();
@@ -81,6 +84,11 @@ class TensorPoolAllocator : public Allocator {
     void* Allocate();
     void Deallocate(void* p);
 
+    // Moves up to n chunks into chunks under a single lock acquisition,
+    // returns the number of chunks moved.
+    size_t AllocateBatch(size_t n, std::vector<void*>* chunks);
+    void DeallocateBatch(void* const* chunks, size_t n);
+
    private:
     mutable spin_lock lock_;
     std::stack<void*> buffer_;
@@ -92,29 +100,47 @@ class TensorPoolAllocator : public Allocator {
    public:
     Bin(size_t len, size_t chunk_size, size_t alignment,
         std::vector<VirtualAllocBlock*>& vblocks,
-        SubAllocator* sub_allocator, TensorPoolAllocator* tp);
+        SubAllocator* sub_allocator, TensorPoolAllocator* tp,
+        int numa_node = 0, size_t magazine_size = 0);
     virtual ~Bin(){}
 
     Bin(const Bin&) = delete;
     Bin& operator=(const Bin&) = delete;
 
     void* Allocate(size_t total, size_t header_size);
-    void Deallocate(Header* header);
+    // Chunks freed by a thread of another NUMA node bypass the magazine
+    // and go straight back to the shared buffer.
+    void Deallocate(Header* header, bool is_local_node = true);
 
     void* AllocateRaw();
     void DeallocateRaw(void* p);
-   
+
+    int NumaNode() const { return numa_node_; }
+    // Returns the chunks of a thread's magazine to the shared buffer.
+    void FlushMagazine(std::vector<void*>* chunks);
+
    private:
+    void* AllocateFromMagazine();
+    void DeallocateToMagazine(void* p);
+
     Buffer buffer_;
     VirtualBuffer virtual_buffer_;
     SubAllocator* sub_allocator_;
+    int numa_node_;
+    // Max number of free chunks a thread keeps for this bin, 0 disables
+    // the thread-local magazines.
+    size_t magazine_size_;
+    size_t id_;
   };
 
  private:
   void* BigAllocate(size_t alignment, size_t num_bytes);
   void* BigAllocateStatistic(size_t alignment, size_t num_bytes);
   void BigDeallocate(Header* header);
-  
+  int CurrentNumaNode() const;
+  void CreateBins(int numa_node, LifetimePolicy* lifetime_policy,
+      SubAllocator* sub_allocator);
+
  private:
   bool stats_;
   std::atomic_bool inited_;
@@ -122,10 +148,20 @@ class TensorPoolAllocator : public Allocator {
 
   std::unique_ptr<SubAllocator> sub_allocator_;
   MemoryPlannerBase* mem_planner_;
- 
+
+  // NUMA-aware mode (ENABLE_TENSORPOOL_NUMA_AWARE=1): every NUMA node gets
+  // its own bins backed by node-local memory, and threads serve chunks
+  // from thread-local magazines.
+  bool numa_aware_;
+  std::vector<int> cpu_to_numa_node_;
+  std::vector<std::unique_ptr<SubAllocator>> numa_sub_allocators_;
+
   size_t large_bin_index_;
-  std::vector<Bin*> lifetime_bins_;
-  std::map<size_t, Bin*> large_lifetime_bins_;
+  struct NumaNodeBins {
+    std::vector<Bin*> lifetime_bins;
+    std::map<size_t, Bin*> large_lifetime_bins;
+  };
+  std::vector<NumaNodeBins> numa_node_bins_;
 
   size_t alignment_;
   size_t alignment_offset_;
@@ -134,6 +170,7 @@ class TensorPoolAllocator : public Allocator {
   std::atomic<int64_t> null_bin_counter_;
   std::atomic<int64_t> hit_counter_;
   std::atomic<int64_t> missed_counter_;
+  std::atomic<int64_t> cross_node_free_counter_;
 };
 
 }
@@ -12,6 +12,7 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
+#include <mutex>
 #include <thread>
 #include "tensorflow/core/common_runtime/memory_planner.h"
 #include "tensorflow/core/common_runtime/tensorpool_allocator.h"
@@ -275,5 +276,67 @@ TEST(TensorPoolAllocatorTest, HugeMemoryAllocation) {
   sleep(1);
 }
 
+TEST(TensorPoolAllocatorTest, NumaAwareMultipleThreadAllocation) {
+  setenv("ENABLE_TENSORPOOL_NUMA_AWARE", "1", 1);
+  thread::ThreadPool* threads = new thread::ThreadPool(Env::Default(), "test", 2);
+  MemoryPlannerFactory::GetMemoryPlanner()->Reset();
+  MemoryPlannerFactory::GetMemoryPlanner()->SetThreadPool(threads);
+  TensorPoolAllocator allocator;
+  unsetenv("ENABLE_TENSORPOOL_NUMA_AWARE");
+  for (int i = 0; i < 2000; ++i) {
+    ScopedMemoryCollector c;
+    std::vector<int> sizes = {128*1024, 64*1024};
+    std::vector<void*> vec;
+    for (int i = 0; i < 16; ++i) {
+      for (auto size : sizes) {
+        void* p = allocator.AllocateRaw(64, size);
+        EXPECT_TRUE(p != nullptr);
+        vec.emplace_back(p);
+      }
+    }
+    for (auto p : vec) {
+      allocator.DeallocateRaw(p);
+    }
+  }
+  sleep(1);
+
+  // Threads allocate from magazines and free chunks allocated by others.
+  std::mutex mu;
+  std::vector<void*> shared(64, nullptr);
+  auto func = [&allocator, &mu, &shared](int tid) {
+    for (int i = 0; i < 1000; ++i) {
+      std::vector<void*> vec;
+      for (int j = 0; j < 8; ++j) {
+        void* p = allocator.AllocateRaw(64, (j % 2 ? 128 : 64) * 1024);
+        EXPECT_TRUE(p != nullptr);
+        memset(p, tid, 64 * 1024);
+        vec.emplace_back(p);
+      }
+      for (int j = 0; j < 8; ++j) {
+        EXPECT_EQ(tid, static_cast<char*>(vec[j])[64 * 1024 - 1]);
+        if (j == 0) {
+          std::lock_guard<std::mutex> l(mu);
+          std::swap(vec[j], shared[(tid * 7 + i) % shared.size()]);
+        }
+        if (vec[j] != nullptr) {
+          allocator.DeallocateRaw(vec[j]);
+        }
+      }
+    }
+  };
+  std::vector<std::thread> ths;
+  for (int i = 0; i < 4; ++i) {
+    ths.emplace_back(func, i);
+  }
+  for (auto& th : ths) {
+    th.join();
+  }
+  for (auto p : shared) {
+    if (p != nullptr) {
+      allocator.DeallocateRaw(p);
+    }
+  }
+}
+
 }
 }  // namespace tensorflow
@@ -16,21 +16,187 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_BLOOM_FILTER_POLICY_H_
 #define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_BLOOM_FILTER_POLICY_H_
 
+#include <algorithm>
+
 #include "tensorflow/core/framework/embedding/embedding_config.h"
 #include "tensorflow/core/framework/embedding/filter_policy.h"
+#include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/prefetch.h"
 
 namespace tensorflow {
 namespace embedding{
 template <class K, class V>
 class StorageManager;
-}
 
-namespace {
-const static std::vector<int64> default_seeds = {
- 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41,
- 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97
+// Counting bloom filter over a flat array of counters. The counter type
+// is a template argument so that no per-probe dispatch is needed.
+template <typename K>
+class BloomCounter {
+ public:
+  virtual ~BloomCounter() {}
+  virtual int64 GetFreq(K key) const = 0;
+  // Adds count to the counters of key which are less than max_freq.
+  virtual void AddFreq(K key, int64 count, int64 max_freq) = 0;
+  virtual void SetFreq(K key, int64 freq) = 0;
+  virtual void BatchGetFreq(const K* keys, int64 num, int64* freqs) const = 0;
+  // counts may be nullptr, in which case every key is counted once.
+  virtual void BatchAddFreq(const K* keys, int64 num,
+                            const int32* counts, int64 max_freq) = 0;
+  virtual void* GetCounter() const = 0;
 };
-}
+
+// Blocked counting bloom filter: the counters are grouped into blocks of
+// kBlockCounters and all probes of a key land in one block, so a lookup
+// touches a single cache line (two adjacent ones for uint64 counters)
+// instead of kHashFunc random lines. Probes inside a block are generated
+// by double hashing with an odd stride, so they never collide as long as
+// kHashFunc <= kBlockCounters.
+template <typename K, typename VBloom>
+class BlockedBloomCounter : public BloomCounter<K> {
+ public:
+  static const int64 kCacheLineSize = 64;
+  static const int64 kBlockCounters =
+      (kCacheLineSize / sizeof(VBloom) > 16) ?
+      kCacheLineSize / sizeof(VBloom) : 16;
+
+  BlockedBloomCounter(int64 num_counter, int64 num_hash_func)
+      : num_blocks_(std::max(int64{1},
+          (num_counter + kBlockCounters - 1) / kBlockCounters)),
+        num_probes_(std::min(num_hash_func, kBlockCounters)) {
+    size_t bytes = num_blocks_ * kBlockCounters * sizeof(VBloom);
+    counter_ = (VBloom*)port::AlignedMalloc(bytes, kCacheLineSize);
+    memset(counter_, 0, bytes);
+  }
+
+  ~BlockedBloomCounter() override {
+    port::AlignedFree(counter_);
+  }
+
+  int64 GetFreq(K key) const override {
+    Probe probe = GetProbe(key);
+    return MinFreq(probe);
+  }
+
+  void AddFreq(K key, int64 count, int64 max_freq) override {
+    Probe probe = GetProbe(key);
+    AddFreq(probe, count, max_freq);
+  }
+
+  void SetFreq(K key, int64 freq) override {
+    Probe probe = GetProbe(key);
+    for (int64 i = 0; i < num_probes_; ++i) {
+      probe.block[probe.Offset(i)] = freq;
+    }
+  }
+
+  void BatchGetFreq(const K* keys, int64 num,
+                    int64* freqs) const override {
+    Probe probes[kBatchSize];
+    for (int64 start = 0; start < num; start += kBatchSize) {
+      int64 n = std::min(kBatchSize, num - start);
+      // Hash the whole window first so that the blocks are fetched in
+      // parallel before they are probed.
+      for (int64 j = 0; j < n; ++j) {
+        probes[j] = GetProbe(keys[start + j]);
+        port::prefetch<port::PREFETCH_HINT_T0>(probes[j].block);
+      }
+      for (int64 j = 0; j < n; ++j) {
+        freqs[start + j] = MinFreq(probes[j]);
+      }
+    }
+  }
+
+  void BatchAddFreq(const K* keys, int64 num, const int32* counts,
+                    int64 max_freq) override {
+    Probe probes[kBatchSize];
+    for (int64 start = 0; start < num; start += kBatchSize) {
+      int64 n = std::min(kBatchSize, num - start);
+      for (int64 j = 0; j < n; ++j) {
+        probes[j] = GetProbe(keys[start + j]);
+        port::prefetch<port::PREFETCH_HINT_T0>(probes[j].block);
+      }
+      for (int64 j = 0; j < n; ++j) {
+        AddFreq(probes[j],
+            (counts == nullptr) ? 1 : counts[start + j], max_freq);
+      }
+    }
+  }
+
+  void* GetCounter() const override {
+    return counter_;
+  }
+
+ private:
+  static const int64 kBatchSize = 16;
+
+  struct Probe {
+    VBloom* block;
+    uint32 base;
+    uint32 stride;
+
+    int64 Offset(int64 i) const {
+      return (base + i * stride) & (kBlockCounters - 1);
+    }
+  };
+
+  static uint64 Mix(uint64 h) {
+    h ^= h >> 23;
+    h *= 0x2127599bf4325c37ULL;
+    h ^= h >> 47;
+    return h;
+  }
+
+  static uint64 FastHash64(K key, uint64 seed) {
+    const uint64 m = 0x880355f21e6d1965ULL;
+    uint64 h = seed ^ (8 * m);
+    h ^= Mix(static_cast<uint64>(key));
+    h *= m;
+    h ^= Mix(0);
+    h *= m;
+    return Mix(h);
+  }
+
+  Probe GetProbe(K key) const {
+    uint64 block_hash = FastHash64(key, kBlockSeed);
+    uint64 probe_hash = FastHash64(key, kProbeSeed);
+    Probe probe;
+    probe.block = counter_ + (block_hash % num_blocks_) * kBlockCounters;
+    probe.base = static_cast<uint32>(probe_hash);
+    probe.stride = static_cast<uint32>(probe_hash >> 32) | 1;
+    return probe;
+  }
+
+  int64 MinFreq(const Probe& probe) const {
+    VBloom min_freq = probe.block[probe.Offset(0)];
+    for (int64 i = 1; i < num_probes_; ++i) {
+      min_freq = std::min(probe.block[probe.Offset(i)], min_freq);
+    }
+    return min_freq;
+  }
+
+  void AddFreq(const Probe& probe, int64 count, int64 max_freq) {
+    for (int64 i = 0; i < num_probes_; ++i) {
+      VBloom* c = probe.block + probe.Offset(i);
+      if (*c < max_freq)
+        __sync_fetch_and_add(c, count);
+    }
+  }
+
+  static const uint64 kBlockSeed = 2;
+  static const uint64 kProbeSeed = 3;
+
+  VBloom* counter_;
+  const int64 num_blocks_;
+  const int64 num_probes_;
+};
+
+template <typename K, typename VBloom>
+const int64 BlockedBloomCounter<K, VBloom>::kCacheLineSize;
+template <typename K, typename VBloom>
+const int64 BlockedBloomCounter<K, VBloom>::kBlockCounters;
+template <typename K, typename VBloom>
+const int64 BlockedBloomCounter<K, VBloom>::kBatchSize;
+} // embedding
 
 template<typename K, typename V, typename EV>
 class BloomFilterPolicy : public FilterPolicy<K, V, EV> {
@@ -41,25 +207,28 @@ class BloomFilterPolicy : public FilterPolicy<K, V, EV> {
     switch (config_.counter_type){
       case DT_UINT64:
         VLOG(2) << "The type of bloom counter is uint64";
-        bloom_counter_ = (void *)calloc(config_.num_counter, sizeof(long));
+        bloom_counter_ = CreateCounter<uint64>();
         break;
       case DT_UINT32:
         VLOG(2) << "The type of bloom counter is uint32";
-        bloom_counter_ = (void *)calloc(config_.num_counter, sizeof(int));
+        bloom_counter_ = CreateCounter<uint32>();
         break;
       case DT_UINT16:
         VLOG(2) << "The type of bloom counter is uint16";
-        bloom_counter_ = (void *)calloc(config_.num_counter, sizeof(int16));
+        bloom_counter_ = CreateCounter<uint16>();
         break;
       case DT_UINT8:
         VLOG(2) << "The type of bloom counter is uint8";
-        bloom_counter_ = (void *)calloc(config_.num_counter, sizeof(bool));
+        bloom_counter_ = CreateCounter<uint8>();
         break;
       default:
         VLOG(2) << "defualt type of counter is uint64";
-        bloom_counter_ = (void *)calloc(config_.num_counter, sizeof(long));
+        bloom_counter_ = CreateCounter<uint64>();
     }
-    GenerateSeed(config.kHashFunc);
+  }
+
+  ~BloomFilterPolicy() {
+    delete bloom_counter_;
   }
 
   Status Lookup(EV* ev, K key, V* val, const V* default_value_ptr,
@@ -80,6 +249,33 @@ class BloomFilterPolicy : public FilterPolicy<K, V, EV> {
     }
   }
 
+  // The frequencies of the whole batch are read in one pass over the
+  // counters, then the keys under filter_freq are counted in another one.
+  // Admission is thus decided on the frequencies before the batch, which is
+  // the same as the per-key path as long as keys are unique in the batch.
+  void BatchLookupOrCreate(const K* keys, V* val_base, int64 num,
+      int64 value_len, V** default_values, ValuePtr<V>** value_ptrs,
+      const int32* counts, const V* default_value_no_permission) override {
+    std::vector<int64> freqs(num);
+    bloom_counter_->BatchGetFreq(keys, num, freqs.data());
+    std::vector<K> filtered_keys;
+    std::vector<int32> filtered_counts;
+    for (int64 i = 0; i < num; ++i) {
+      V* val = val_base + i * value_len;
+      if (freqs[i] >= config_.filter_freq) {
+        TF_CHECK_OK(ev_->LookupOrCreateKey(keys[i], &value_ptrs[i]));
+        V* mem_val = ev_->LookupOrCreateEmb(value_ptrs[i], default_values[i]);
+        memcpy(val, mem_val, sizeof(V) * value_len);
+      } else {
+        filtered_keys.emplace_back(keys[i]);
+        filtered_counts.emplace_back((counts == nullptr) ? 1 : counts[i]);
+        memcpy(val, default_value_no_permission, sizeof(V) * value_len);
+      }
+    }
+    bloom_counter_->BatchAddFreq(filtered_keys.data(), filtered_keys.size(),
+        filtered_counts.data(), config_.filter_freq);
+  }
+
   void CopyEmbeddingsToBuffer(
       V* val_base, int64 size,
       int64 slice_elems, int64 value_len,
@@ -105,97 +301,22 @@ class BloomFilterPolicy : public FilterPolicy<K, V, EV> {
   }
 
   void* GetBloomCounter() const {
-    return bloom_counter_;
+    return bloom_counter_->GetCounter();
   }
 
  private:
-  int64 GetBloomFreq(K key) {
-    std::vector<int64> hash_val;
-    for (int64 i = 0; i < config_.kHashFunc; i++) {
-      hash_val.emplace_back(
-          FastHash64(key, seeds_[i]) % config_.num_counter);
-    }
-    int64 min_freq;
-    switch (config_.counter_type){
-      case DT_UINT64:
-        min_freq = GetMinFreq<uint64>(hash_val);
-        break;
-      case DT_UINT32:
-        min_freq = GetMinFreq<uint32>(hash_val);
-        break;
-      case DT_UINT16:
-        min_freq = GetMinFreq<uint16>(hash_val);
-        break;
-      case DT_UINT8:
-        min_freq = GetMinFreq<uint8>(hash_val);
-        break;
-      default:
-        min_freq = GetMinFreq<uint64>(hash_val);
-    }
-    return min_freq;
-  }
-
-#define mix(h) ({                                 \
-                   (h) ^= (h) >> 23;              \
-                   (h) *= 0x2127599bf4325c37ULL;  \
-                   (h) ^= (h) >> 47;              \
-                })
-
-  uint64_t FastHash64(K key, uint64_t seed) {
-    const uint64_t    m = 0x880355f21e6d1965ULL;
-
-    uint64_t h = seed ^ (8 * m);
-    uint64_t v;
-    v = key;
-    h ^= mix(v);
-    h *= m;
-
-    v = 0;
-    h ^= mix(v);
-    h *= m;
-
-    return mix(h);
-  }
-
   template<typename VBloom>
-  int64 GetMinFreq(std::vector<int64> hash_val) {
-    VBloom min_freq = *((VBloom*)bloom_counter_ + hash_val[0]);
-    for (auto it : hash_val) {
-      min_freq = std::min(*((VBloom*)bloom_counter_ + it), min_freq);
-    }
-    return min_freq;
+  embedding::BloomCounter<K>* CreateCounter() {
+    return new embedding::BlockedBloomCounter<K, VBloom>(
+        config_.num_counter, config_.kHashFunc);
   }
 
-  template<typename VBloom>
-  void SetMinFreq(std::vector<int64> hash_val, int64 freq) {
-    for (auto it : hash_val) {
-      *((VBloom*)bloom_counter_ + it) = freq;
-    }
+  int64 GetBloomFreq(K key) {
+    return bloom_counter_->GetFreq(key);
   }
 
   void SetBloomFreq(K key, int64 freq) {
-    std::vector<int64> hash_val;
-    for (int64 i = 0; i < config_.kHashFunc; i++) {
-      hash_val.emplace_back(
-          FastHash64(key, seeds_[i]) % config_.num_counter);
-    }
-   int64 min_freq;
-    switch (config_.counter_type){
-      case DT_UINT64:
-        SetMinFreq<uint64>(hash_val, freq);
-        break;
-      case DT_UINT32:
-        SetMinFreq<uint32>(hash_val, freq);
-        break;
-      case DT_UINT16:
-        SetMinFreq<uint16>(hash_val, freq);
-        break;
-      case DT_UINT8:
-        SetMinFreq<uint8>(hash_val, freq);
-        break;
-      default:
-        SetMinFreq<uint64>(hash_val, freq);
-    }
+    bloom_counter_->SetFreq(key, freq);
   }
 
   Status Import(RestoreBuffer& restore_buff,
@@ -248,103 +369,17 @@ class BloomFilterPolicy : public FilterPolicy<K, V, EV> {
   }
 
   void AddFreq(K key) {
-    std::vector<int64> hash_val;
-    for (int64 i = 0; i < config_.kHashFunc; i++) {
-      hash_val.emplace_back(
-          FastHash64(key, seeds_[i]) % config_.num_counter);
-    }
-
-    for (auto it : hash_val){
-      switch (config_.counter_type){
-        case DT_UINT64:
-          if (*((uint64*)bloom_counter_ + it) < config_.filter_freq)
-            __sync_fetch_and_add((uint64*)bloom_counter_ + it, 1);
-          break;
-        case DT_UINT32:
-          if (*((uint32*)bloom_counter_ +it) < config_.filter_freq)
-            __sync_fetch_and_add((uint32*)bloom_counter_ + it, 1);
-          break;
-        case DT_UINT16:
-          if (*((uint16*)bloom_counter_ +it) < config_.filter_freq)
-            __sync_fetch_and_add((uint16*)bloom_counter_ + it, 1);
-          break;
-        case DT_UINT8:
-          if (*((uint8*)bloom_counter_ + it) < config_.filter_freq)
-            __sync_fetch_and_add((uint8*)bloom_counter_ + it, 1);
-          break;
-        default:
-          if (*((uint64*)bloom_counter_ + it) < config_.filter_freq)
-            __sync_fetch_and_add((uint64*)bloom_counter_ + it, 1);
-      }
-    }
+    bloom_counter_->AddFreq(key, 1, config_.filter_freq);
   }
 
   void AddFreq(K key, int64 count) {
-    std::vector<int64> hash_val;
-    for (int64 i = 0; i < config_.kHashFunc; i++) {
-      hash_val.emplace_back(
-          FastHash64(key, seeds_[i]) % config_.num_counter);
-    }
-
-    for (auto it : hash_val){
-      switch (config_.counter_type){
-        case DT_UINT64:
-          if (*((uint64*)bloom_counter_ + it) < config_.filter_freq)
-            __sync_fetch_and_add((uint64*)bloom_counter_ + it, count);
-          break;
-        case DT_UINT32:
-          if (*((uint32*)bloom_counter_ +it) < config_.filter_freq)
-            __sync_fetch_and_add((uint32*)bloom_counter_ + it, count);
-          break;
-        case DT_UINT16:
-          if (*((uint16*)bloom_counter_ +it) < config_.filter_freq)
-            __sync_fetch_and_add((uint16*)bloom_counter_ + it, count);
-          break;
-        case DT_UINT8:
-          if (*((uint8*)bloom_counter_ + it) < config_.filter_freq)
-            __sync_fetch_and_add((uint8*)bloom_counter_ + it, count);
-          break;
-        default:
-          if (*((uint64*)bloom_counter_ + it) < config_.filter_freq)
-            __sync_fetch_and_add((uint64*)bloom_counter_ + it, count);
-      }
-    }
-  }
-
-  void GenerateSeed(int64 kHashFunc) {
-    if (kHashFunc < default_seeds.size()) {
-      for (int64 i = 0; i < kHashFunc; i++) {
-        seeds_.emplace_back(default_seeds[i]);
-      }
-    } else {
-      for (int64 i = 0; i < default_seeds.size(); i++) {
-        seeds_.emplace_back(default_seeds[i]);
-      }
-      int64 last_seed = 98;
-      for (int64 i = default_seeds.size(); i < kHashFunc; i++) {
-        for (int64 j = last_seed; ; j++) {
-          if (j % 2 == 0)
-            continue;
-          bool is_prime = true;
-          for (int64 k = 0; k <= std::sqrt(j) + 1; k++) {
-            if (j % k == 0)
-              is_prime = false;
-          }
-          if (is_prime) {
-            seeds_.emplace_back(j);
-            last_seed = j;
-            break;
-          }
-        }
-      }
-    }
+    bloom_counter_->AddFreq(key, count, config_.filter_freq);
   }
 
  private:
-  void* bloom_counter_;
+  embedding::BloomCounter<K>* bloom_counter_;
   EmbeddingConfig config_;
   EV* ev_;
-  std::vector<int64> seeds_;
   embedding::StorageManager<K, V>* storage_manager_;
 };
 } // tensorflow
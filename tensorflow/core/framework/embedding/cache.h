@@ -1,11 +1,14 @@
 #ifndef TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_CACHE_H_
 #define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_CACHE_H_
+#include <atomic>
 #include <iostream>
 #include <map>
 #include <unordered_map>
 #include <set>
 #include <list>
 #include <limits>
+#include <vector>
+#include "sparsehash/dense_hash_map"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/platform/mutex.h"
@@ -33,7 +36,7 @@ class BatchCache {
      num_hit = 0;
      num_miss = 0;
   }
-  std::string DebugString() {
+  virtual std::string DebugString() {
     float hit_rate = 0.0;
     if (num_hit > 0 || num_miss > 0) {
       hit_rate = num_hit * 100.0 / (num_hit + num_miss);
@@ -272,6 +275,244 @@ class LFUCache : public BatchCache<K> {
   mutex mu_;
 };
 
+// Hash-sharded CLOCK cache. Each shard owns a dense_hash_map from id to a
+// slot of a flat node pool, so a batch only takes every shard lock once and
+// no node is allocated per id. Every node keeps a small saturating counter:
+// with max_count == 1 the policy is plain CLOCK (one reference bit), with a
+// larger max_count it is a generalized CLOCK that approximates LFU, the
+// sweeping hand decrements counters and thereby ages old frequencies.
+template <class K>
+class ShardedClockCache : public BatchCache<K> {
+ public:
+  explicit ShardedClockCache(uint8 max_count, int num_shards = kDefaultShards)
+      : max_count_(max_count), num_shards_(num_shards), evict_cursor_(0) {
+    shards_ = new Shard[num_shards_];
+    for (int i = 0; i < num_shards_; ++i) {
+      shards_[i].index.set_empty_key(EMPTY_KEY_);
+      shards_[i].index.set_deleted_key(DELETED_KEY_);
+    }
+    BatchCache<K>::num_hit = 0;
+    BatchCache<K>::num_miss = 0;
+  }
+
+  ~ShardedClockCache() override {
+    delete []shards_;
+  }
+
+  size_t size() {
+    size_t total = 0;
+    for (int i = 0; i < num_shards_; ++i) {
+      mutex_lock l(shards_[i].mu);
+      total += NumIds(&shards_[i]);
+    }
+    return total;
+  }
+
+  size_t get_evic_ids(K* evic_ids, size_t k_size) {
+    size_t true_size = 0;
+    int start = evict_cursor_.fetch_add(1) % num_shards_;
+    // Spread the request over all shards, then take the remainder from
+    // shards which still have ids when some shard ran out.
+    bool progress = true;
+    while (true_size < k_size && progress) {
+      progress = false;
+      for (int i = 0; i < num_shards_ && true_size < k_size; ++i) {
+        size_t quota = (k_size - true_size + num_shards_ - i - 1)
+                       / (num_shards_ - i);
+        Shard* shard = &shards_[(start + i) % num_shards_];
+        mutex_lock l(shard->mu);
+        size_t evicted = EvictFromShard(shard, evic_ids + true_size, quota);
+        true_size += evicted;
+        progress |= (evicted > 0);
+      }
+    }
+    return true_size;
+  }
+
+  void add_to_rank(const K* batch_ids, size_t batch_size) {
+    add_to_rank(batch_ids, batch_size, nullptr, nullptr);
+  }
+
+  void add_to_rank(const K* batch_ids, size_t batch_size,
+                   const int64* batch_versions,
+                   const int64* batch_freqs) {
+    // Bucket the positions of the batch by shard (counting sort), so that
+    // each shard is locked once per batch.
+    std::vector<int64> offsets(num_shards_ + 1, 0);
+    std::vector<int> shard_ids(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+      shard_ids[i] = ShardOf(batch_ids[i]);
+      offsets[shard_ids[i] + 1]++;
+    }
+    for (int i = 0; i < num_shards_; ++i) {
+      offsets[i + 1] += offsets[i];
+    }
+    std::vector<int64> positions(batch_size);
+    {
+      std::vector<int64> cursor(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < batch_size; ++i) {
+        positions[cursor[shard_ids[i]]++] = i;
+      }
+    }
+
+    int64 hit = 0;
+    int64 miss = 0;
+    for (int s = 0; s < num_shards_; ++s) {
+      if (offsets[s] == offsets[s + 1]) {
+        continue;
+      }
+      Shard* shard = &shards_[s];
+      mutex_lock l(shard->mu);
+      for (int64 j = offsets[s]; j < offsets[s + 1]; ++j) {
+        int64 pos = positions[j];
+        int64 freq = (batch_freqs == nullptr) ? 1 : batch_freqs[pos];
+        int64 found = FindSlot(shard, batch_ids[pos]);
+        if (found >= 0) {
+          Touch(&shard->nodes[found], freq);
+          ++hit;
+        } else {
+          int64 slot = AllocateNode(shard);
+          ClockNode* node = &shard->nodes[slot];
+          node->id = batch_ids[pos];
+          node->valid = true;
+          node->count = 0;
+          // A restored id carries its history in batch_freqs.
+          if (batch_freqs != nullptr) {
+            Touch(node, freq - 1);
+          }
+          SetSlot(shard, batch_ids[pos], slot);
+          ++miss;
+        }
+      }
+    }
+    mutex_lock l(stats_mu_);
+    BatchCache<K>::num_hit += hit;
+    BatchCache<K>::num_miss += miss;
+  }
+
+  void reset_status() override {
+    mutex_lock l(stats_mu_);
+    BatchCache<K>::reset_status();
+  }
+
+  std::string DebugString() override {
+    mutex_lock l(stats_mu_);
+    return BatchCache<K>::DebugString();
+  }
+
+ private:
+  struct ClockNode {
+    K id;
+    uint8 count;
+    bool valid;
+  };
+
+  struct Shard {
+    mutex mu;
+    google::dense_hash_map<K, int64> index;
+    // Flat node pool, freed slots are recycled through free_slots.
+    std::vector<ClockNode> nodes;
+    std::vector<int64> free_slots;
+    size_t hand = 0;
+    // The slots of EMPTY_KEY_ and DELETED_KEY_, which dense_hash_map can't
+    // hold, or -1.
+    int64 reserved_slots[2] = {-1, -1};
+  };
+
+  static inline int ReservedIndex(K id) {
+    return (id == EMPTY_KEY_) ? 0 : ((id == DELETED_KEY_) ? 1 : -1);
+  }
+
+  // Returns the node slot of id, or -1 if id is not cached.
+  int64 FindSlot(Shard* shard, K id) {
+    int reserved = ReservedIndex(id);
+    if (reserved >= 0) {
+      return shard->reserved_slots[reserved];
+    }
+    auto it = shard->index.find(id);
+    return (it == shard->index.end()) ? -1 : it->second;
+  }
+
+  void SetSlot(Shard* shard, K id, int64 slot) {
+    int reserved = ReservedIndex(id);
+    if (reserved >= 0) {
+      shard->reserved_slots[reserved] = slot;
+    } else {
+      shard->index[id] = slot;
+    }
+  }
+
+  void EraseSlot(Shard* shard, K id) {
+    int reserved = ReservedIndex(id);
+    if (reserved >= 0) {
+      shard->reserved_slots[reserved] = -1;
+    } else {
+      shard->index.erase(id);
+    }
+  }
+
+  size_t NumIds(Shard* shard) {
+    return shard->index.size() + (shard->reserved_slots[0] >= 0) +
+           (shard->reserved_slots[1] >= 0);
+  }
+
+  inline int ShardOf(K id) const {
+    // Fibonacci hashing keeps consecutive ids in different shards.
+    uint64 h = static_cast<uint64>(id) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<int>((h >> 32) % num_shards_);
+  }
+
+  inline void Touch(ClockNode* node, int64 freq) {
+    if (freq <= 0) {
+      return;
+    }
+    int64 count = node->count + freq;
+    node->count = (count > max_count_) ? max_count_ : count;
+  }
+
+  int64 AllocateNode(Shard* shard) {
+    if (!shard->free_slots.empty()) {
+      int64 slot = shard->free_slots.back();
+      shard->free_slots.pop_back();
+      return slot;
+    }
+    shard->nodes.emplace_back();
+    return shard->nodes.size() - 1;
+  }
+
+  size_t EvictFromShard(Shard* shard, K* evic_ids, size_t k_size) {
+    size_t true_size = 0;
+    size_t num_nodes = shard->nodes.size();
+    while (true_size < k_size && NumIds(shard) > 0) {
+      if (shard->hand >= num_nodes) {
+        shard->hand = 0;
+      }
+      ClockNode* node = &shard->nodes[shard->hand];
+      if (node->valid) {
+        if (node->count == 0) {
+          evic_ids[true_size++] = node->id;
+          EraseSlot(shard, node->id);
+          node->valid = false;
+          shard->free_slots.emplace_back(shard->hand);
+        } else {
+          node->count--;
+        }
+      }
+      shard->hand++;
+    }
+    return true_size;
+  }
+
+  static const int kDefaultShards = 64;
+  static const K EMPTY_KEY_ = -1;
+  static const K DELETED_KEY_ = -2;
+  const uint8 max_count_;
+  const int num_shards_;
+  Shard* shards_;
+  std::atomic<int> evict_cursor_;
+  mutex stats_mu_;
+};
+
 } // embedding
 } // tensorflow
 
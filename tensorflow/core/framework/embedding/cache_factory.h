@@ -15,12 +15,16 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_CACHE_FACTORY_H_
 #define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_CACHE_FACTORY_H_
 
-#include "cache.h"
+#include "tensorflow/core/framework/embedding/cache.h"
+#include "tensorflow/core/framework/embedding/config.pb.h"
 
 namespace tensorflow {
 namespace embedding {
 class CacheFactory {
  public:
+  // Saturation value of the per-id counter used by APPROX_LFU.
+  static const uint8 kApproxLFUMaxCount = 15;
+
   template<typename K>
   static BatchCache<K>* Create(CacheStrategy cache_strategy, std::string name) {
     switch (cache_strategy) {
@@ -32,6 +36,14 @@ class CacheFactory {
         LOG(INFO) << " Use StorageManager::LFU in multi-tier EmbeddingVariable "
                 << name;
         return new LFUCache<K>();
+      case CacheStrategy::CLOCK:
+        LOG(INFO) << " Use StorageManager::CLOCK in multi-tier EmbeddingVariable "
+                << name;
+        return new ShardedClockCache<K>(/*max_count = */1);
+      case CacheStrategy::APPROX_LFU:
+        LOG(INFO) << " Use StorageManager::APPROX_LFU in multi-tier "
+                  << "EmbeddingVariable " << name;
+        return new ShardedClockCache<K>(kApproxLFUMaxCount);
       default:
         LOG(INFO) << " Invalid Cache strategy, \
                        use LFU in multi-tier EmbeddingVariable "
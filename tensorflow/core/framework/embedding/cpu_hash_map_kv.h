@@ -73,6 +73,21 @@ class LocklessHashMap : public KVInterface<K, V> {
     }
   } 
 
+  Status BatchLookup(const K* keys, size_t size,
+                     ValuePtr<V>** value_ptrs) override {
+    // Missing keys are reported as nullptr so that the caller can create
+    // them in a second pass.
+    for (size_t i = 0; i < size; ++i) {
+      auto iter = hash_map_.find_wait_free(keys[i]);
+      if (iter.first == LocklessHashMap<K, V>::EMPTY_KEY_) {
+        value_ptrs[i] = nullptr;
+      } else {
+        value_ptrs[i] = iter.second;
+      }
+    }
+    return Status::OK();
+  }
+
   // Other Method
   int64 Size() const override {
     return hash_map_.size_lockless();
@@ -20,6 +20,7 @@ limitations under the License.
 #include "tensorflow/core/framework/typed_allocator.h"
 #include "tensorflow/core/lib/core/spin_rw_lock.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/prefetch.h"
 #include "tensorflow/core/framework/embedding/kv_interface.h"
 
 namespace tensorflow {
@@ -58,6 +59,26 @@ class DenseHashMap : public KVInterface<K, V> {
     }
   }
 
+  Status BatchLookup(const K* keys, size_t size,
+                     ValuePtr<V>** value_ptrs) override {
+    constexpr size_t kPrefetchDistance = 8;
+    for (size_t i = 0; i < size; ++i) {
+      if (i + kPrefetchDistance < size) {
+        port::prefetch<port::PREFETCH_HINT_T0>(
+            &hash_map_[std::abs(keys[i + kPrefetchDistance]) % partition_num_]);
+      }
+      int64 l_id = std::abs(keys[i]) % partition_num_;
+      spin_rd_lock l(hash_map_[l_id].mu);
+      auto iter = hash_map_[l_id].hash_map.find(keys[i]);
+      if (iter == hash_map_[l_id].hash_map.end()) {
+        value_ptrs[i] = nullptr;
+      } else {
+        value_ptrs[i] = iter->second;
+      }
+    }
+    return Status::OK();
+  }
+
   Status Contains(K key) override {
     int64 l_id = std::abs(key)%partition_num_;
     spin_rd_lock l(hash_map_[l_id].mu);
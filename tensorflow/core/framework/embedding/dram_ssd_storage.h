@@ -85,17 +85,41 @@ class DramSsdHashStorage : public MultiTierStorage<K, V> {
       return s;
     }
     s = ssd_kv_->Lookup(key, value_ptr);
-    if (!s.ok()) {
+    if (errors::IsNotFound(s)) {
       *value_ptr = layout_creator_->Create(alloc_, size);
-    }
-    s = dram_kv_->Insert(key, *value_ptr);
-    if (s.ok()) {
+    } else if (!s.ok()) {
       return s;
     }
-    // Insert Failed, key already exist
-    (*value_ptr)->Destroy(alloc_);
-    delete *value_ptr;
-    return dram_kv_->Lookup(key, value_ptr);
+    return InsertToDram(key, value_ptr);
+  }
+
+  Status BatchGetOrCreate(const K* keys, int64 num,
+      ValuePtr<V>** value_ptrs, size_t size) override {
+    TF_RETURN_IF_ERROR(dram_kv_->BatchLookup(keys, num, value_ptrs));
+    std::vector<int64> miss_index;
+    std::vector<K> miss_keys;
+    for (int64 i = 0; i < num; ++i) {
+      if (value_ptrs[i] == nullptr) {
+        miss_index.emplace_back(i);
+        miss_keys.emplace_back(keys[i]);
+      }
+    }
+    if (miss_keys.empty()) {
+      return Status::OK();
+    }
+    // All keys missing in DRAM are read from SSD in one batch.
+    std::vector<ValuePtr<V>*> ssd_value_ptrs(miss_keys.size());
+    TF_RETURN_IF_ERROR(ssd_kv_->BatchLookup(
+        miss_keys.data(), miss_keys.size(), ssd_value_ptrs.data()));
+    for (size_t j = 0; j < miss_keys.size(); ++j) {
+      ValuePtr<V>* value_ptr = ssd_value_ptrs[j];
+      if (value_ptr == nullptr) {
+        value_ptr = layout_creator_->Create(alloc_, size);
+      }
+      TF_RETURN_IF_ERROR(InsertToDram(miss_keys[j], &value_ptr));
+      value_ptrs[miss_index[j]] = value_ptr;
+    }
+    return Status::OK();
   }
 
   Status Remove(K key) override {
@@ -141,6 +165,17 @@ class DramSsdHashStorage : public MultiTierStorage<K, V> {
   }
 
  private:
+  Status InsertToDram(K key, ValuePtr<V>** value_ptr) {
+    Status s = dram_kv_->Insert(key, *value_ptr);
+    if (s.ok()) {
+      return s;
+    }
+    // Insert Failed, key already exist
+    (*value_ptr)->Destroy(alloc_);
+    delete *value_ptr;
+    return dram_kv_->Lookup(key, value_ptr);
+  }
+
   KVInterface<K, V>* dram_kv_;
   KVInterface<K, V>* ssd_kv_;
   Allocator* alloc_;
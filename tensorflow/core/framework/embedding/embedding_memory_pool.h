@@ -15,13 +15,94 @@ limitations under the License.
 
 #ifndef TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_EMBEDDING_MEMORY_POOL_H_
 #define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_EMBEDDING_MEMORY_POOL_H_
+#include <algorithm>
+#include <atomic>
 #include <deque>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace tensorflow {
 template <class V>
 class ValuePtr;
 
 namespace embedding {
+// A group of free embedding slots. Batches are the unit that moves
+// between the per-thread caches and the global free list.
+template<typename V>
+struct SlotBatch {
+  static const int64 kCapacity = 64;
+  V* slots[kCapacity];
+  int64 size = 0;
+  std::atomic<SlotBatch<V>*> next{nullptr};
+};
+
+// Lock-free (Treiber) stack of SlotBatch. Nodes are recycled but never
+// freed while the stack is in use, the upper 16 bits of the head carry
+// a version tag to avoid ABA.
+template<typename V>
+class SlotBatchStack {
+ public:
+  void Push(SlotBatch<V>* batch) {
+    uint64 old_head = head_.load(std::memory_order_relaxed);
+    while (true) {
+      batch->next.store(Pointer(old_head), std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(old_head,
+              Pack(batch, Tag(old_head) + 1),
+              std::memory_order_release,
+              std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+
+  SlotBatch<V>* Pop() {
+    uint64 old_head = head_.load(std::memory_order_acquire);
+    while (Pointer(old_head) != nullptr) {
+      SlotBatch<V>* batch = Pointer(old_head);
+      SlotBatch<V>* next = batch->next.load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(old_head,
+              Pack(next, Tag(old_head) + 1),
+              std::memory_order_acquire,
+              std::memory_order_acquire)) {
+        return batch;
+      }
+    }
+    return nullptr;
+  }
+
+  bool Empty() const {
+    return Pointer(head_.load(std::memory_order_acquire)) == nullptr;
+  }
+
+ private:
+  static const int kTagShift = 48;
+  static const uint64 kPointerMask = (1ULL << kTagShift) - 1;
+
+  static uint64 Pack(SlotBatch<V>* batch, uint64 tag) {
+    return (reinterpret_cast<uint64>(batch) & kPointerMask) |
+           (tag << kTagShift);
+  }
+  static SlotBatch<V>* Pointer(uint64 head) {
+    return reinterpret_cast<SlotBatch<V>*>(head & kPointerMask);
+  }
+  static uint64 Tag(uint64 head) {
+    return head >> kTagShift;
+  }
+
+  std::atomic<uint64> head_{0};
+};
+
+// Fixed-size slot allocator for embedding values. Callers draw from a
+// small per-thread cache which is refilled a batch at a time from a
+// lock-free global list; freed slots go back to the global list, so
+// Allocate/AllocateBatch may be called concurrently. Deallocated
+// ValuePtrs are held back until more than embs_per_block_ others have
+// been released after them, in case an in-flight kernel still reads the
+// old slot.
 template<typename V>
 class EmbeddingMemoryPool {
  public:
@@ -31,7 +112,11 @@ class EmbeddingMemoryPool {
       int64 block_size): alloc_(alloc),
                          value_len_(value_len),
                          block_size_(block_size) {
-    embs_per_block_ = block_size_ / (sizeof(V) * value_len_);
+    static_assert(sizeof(void*) == 8,
+        "EmbeddingMemoryPool requires 64-bit pointers");
+    embs_per_block_ = std::max(
+        block_size_ / static_cast<int64>(sizeof(V) * value_len_),
+        static_cast<int64>(1));
     CreateBlock();
   }
 
@@ -39,54 +124,222 @@ class EmbeddingMemoryPool {
     for (auto it : block_list_) {
       alloc_->DeallocateRaw(it);
     }
+    for (auto it : batch_list_) {
+      delete it;
+    }
   }
 
   V* Allocate() {
-    if (free_ptr_queue_.size() == 0) {
-      CreateBlock();
-    }
-    V* ptr = free_ptr_queue_.front();
-    free_ptr_queue_.pop_front();
+    V* ptr = nullptr;
+    AllocateBatch(1, &ptr);
     return ptr;
   }
 
-  void Deallocate(std::vector<ValuePtr<V>*> value_ptrs) {
-    int64 prev_size = value_ptrs_queue_.size();
-    for (auto it : value_ptrs) {
-      value_ptrs_queue_.emplace_back(it);
+  void AllocateBatch(int64 n, V** ptrs) {
+    LocalCache* cache = GetLocalCache();
+    mutex_lock l(cache->mu);
+    int64 i = 0;
+    while (i < n) {
+      if (cache->slots.empty()) {
+        Refill(cache);
+      }
+      int64 m = std::min(n - i, static_cast<int64>(cache->slots.size()));
+      for (int64 j = 0; j < m; j++) {
+        ptrs[i++] = cache->slots.back();
+        cache->slots.pop_back();
+      }
     }
-    if (value_ptrs_queue_.size() > embs_per_block_) {
-      int64 n = value_ptrs_queue_.size() - embs_per_block_;
-      n = std::min(prev_size, n);
-      for (int64 i = 0; i < n; i++) {
-        ValuePtr<V>* val = value_ptrs_queue_.front();
-        free_ptr_queue_.emplace_back(val->GetValue(0, 0));
-        delete val;
-        value_ptrs_queue_.pop_front();
+    num_allocated_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  std::vector<V*> AllocateBatch(int64 n) {
+    std::vector<V*> ptrs(n);
+    AllocateBatch(n, ptrs.data());
+    return ptrs;
+  }
+
+  void Deallocate(std::vector<ValuePtr<V>*> value_ptrs) {
+    DeallocateBatch(value_ptrs);
+  }
+
+  void DeallocateBatch(const std::vector<ValuePtr<V>*>& value_ptrs) {
+    std::vector<V*> released;
+    {
+      mutex_lock l(pending_mu_);
+      int64 prev_size = value_ptrs_queue_.size();
+      for (auto it : value_ptrs) {
+        value_ptrs_queue_.emplace_back(it);
+      }
+      if (value_ptrs_queue_.size() > embs_per_block_) {
+        int64 n = value_ptrs_queue_.size() - embs_per_block_;
+        n = std::min(prev_size, n);
+        released.reserve(n);
+        for (int64 i = 0; i < n; i++) {
+          ValuePtr<V>* val = value_ptrs_queue_.front();
+          released.emplace_back(val->GetValue(0, 0));
+          delete val;
+          value_ptrs_queue_.pop_front();
+        }
       }
     }
+    ReleaseSlots(released.data(), released.size());
+  }
+
+  // Returns raw slots to the pool immediately, bypassing the deferred
+  // reuse of Deallocate.
+  void DeallocateBatch(V* const* ptrs, int64 n) {
+    ReleaseSlots(ptrs, n);
+  }
+
+  int64 NumBlocks() const {
+    return num_blocks_.load(std::memory_order_relaxed);
+  }
+
+  int64 NumSlots() const {
+    return NumBlocks() * embs_per_block_;
+  }
+
+  // Slots handed out and not yet returned to the free lists, including
+  // the ones waiting in the deferred reuse queue.
+  int64 NumAllocated() const {
+    return num_allocated_.load(std::memory_order_relaxed);
+  }
+
+  int64 NumCached() {
+    int64 total = 0;
+    for (int i = 0; i < kNumLocalCaches; i++) {
+      mutex_lock l(local_caches_[i].mu);
+      total += local_caches_[i].slots.size();
+    }
+    return total;
+  }
+
+  // Fraction of the pool's slots that are in use.
+  double Occupancy() const {
+    int64 total = NumSlots();
+    return total == 0 ? 0.0 : static_cast<double>(NumAllocated()) / total;
+  }
+
+  // Fraction of the free slots that sit in per-thread caches, where
+  // they are only reusable by the threads mapped to that cache.
+  double Fragmentation() {
+    int64 free_slots = NumSlots() - NumAllocated();
+    return free_slots <= 0 ?
+        0.0 : static_cast<double>(NumCached()) / free_slots;
+  }
+
+  string DebugString() {
+    int64 pending = 0;
+    {
+      mutex_lock l(pending_mu_);
+      pending = value_ptrs_queue_.size();
+    }
+    return strings::StrCat(
+        "EmbeddingMemoryPool: blocks=", NumBlocks(),
+        ", slots=", NumSlots(),
+        ", allocated=", NumAllocated(),
+        ", pending=", pending,
+        ", cached=", NumCached(),
+        ", occupancy=", Occupancy(),
+        ", fragmentation=", Fragmentation());
   }
 
  private:
+  static const int kNumLocalCaches = 64;
+
+  struct LocalCache {
+    mutex mu;
+    std::vector<V*> slots;
+  };
+
+  LocalCache* GetLocalCache() {
+    static thread_local size_t cache_id =
+        std::hash<std::thread::id>()(std::this_thread::get_id());
+    return &local_caches_[cache_id % kNumLocalCaches];
+  }
+
+  void Refill(LocalCache* cache) {
+    SlotBatch<V>* batch = free_batches_.Pop();
+    while (batch == nullptr) {
+      CreateBlock();
+      batch = free_batches_.Pop();
+    }
+    // Reverse so that slots are handed out in address order.
+    cache->slots.insert(cache->slots.end(),
+        std::reverse_iterator<V**>(batch->slots + batch->size),
+        std::reverse_iterator<V**>(batch->slots));
+    batch->size = 0;
+    empty_batches_.Push(batch);
+  }
+
+  void ReleaseSlots(V* const* ptrs, int64 n) {
+    int64 i = 0;
+    while (i < n) {
+      SlotBatch<V>* batch = GetEmptyBatch();
+      int64 m = std::min(n - i, SlotBatch<V>::kCapacity);
+      std::copy(ptrs + i, ptrs + i + m, batch->slots);
+      batch->size = m;
+      free_batches_.Push(batch);
+      i += m;
+    }
+    num_allocated_.fetch_sub(n, std::memory_order_relaxed);
+  }
+
+  SlotBatch<V>* GetEmptyBatch() {
+    SlotBatch<V>* batch = empty_batches_.Pop();
+    if (batch == nullptr) {
+      batch = new SlotBatch<V>();
+      mutex_lock l(block_mu_);
+      batch_list_.emplace_back(batch);
+    }
+    return batch;
+  }
+
   void CreateBlock() {
+    mutex_lock l(block_mu_);
+    // Another thread may have refilled the global list meanwhile.
+    if (!block_list_.empty() && !free_batches_.Empty()) {
+      return;
+    }
     V* dev_addr =
         (V*)alloc_->AllocateRaw(
             Allocator::kAllocatorAlignment,
             sizeof(V) * value_len_ * embs_per_block_);
     block_list_.emplace_back(dev_addr);
-    for (int64 i = 0; i < embs_per_block_; i++) {
-      free_ptr_queue_.emplace_back(dev_addr + i * value_len_);
+    for (int64 i = 0; i < embs_per_block_; i += SlotBatch<V>::kCapacity) {
+      SlotBatch<V>* batch = empty_batches_.Pop();
+      if (batch == nullptr) {
+        batch = new SlotBatch<V>();
+        batch_list_.emplace_back(batch);
+      }
+      int64 m = std::min(embs_per_block_ - i, SlotBatch<V>::kCapacity);
+      for (int64 j = 0; j < m; j++) {
+        batch->slots[j] = dev_addr + (i + j) * value_len_;
+      }
+      batch->size = m;
+      free_batches_.Push(batch);
     }
+    num_blocks_.fetch_add(1, std::memory_order_relaxed);
   }
 
   int64 block_size_;
   int64 value_len_;
   int64 embs_per_block_;
   Allocator* alloc_;
-  std::deque<V*> free_ptr_queue_;
+  LocalCache local_caches_[kNumLocalCaches];
+  SlotBatchStack<V> free_batches_;
+  SlotBatchStack<V> empty_batches_;
+  std::atomic<int64> num_blocks_{0};
+  std::atomic<int64> num_allocated_{0};
+  mutex pending_mu_;
   std::deque<ValuePtr<V>*> value_ptrs_queue_;
+  mutex block_mu_;
   std::vector<V*> block_list_;
+  std::vector<SlotBatch<V>*> batch_list_;
 };
+
+template<typename V>
+const int64 SlotBatch<V>::kCapacity;
 } //embedding
 } //tensorflow
 
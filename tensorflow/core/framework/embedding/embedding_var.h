@@ -31,6 +31,7 @@ limitations under the License.
 #include "tensorflow/core/framework/embedding/value_ptr.h"
 #include "tensorflow/core/framework/embedding/filter_factory.h"
 #include "tensorflow/core/framework/embedding/gpu_hash_map_kv.h"
+#include "tensorflow/core/framework/embedding/import_rate_limiter.h"
 #include "tensorflow/core/framework/embedding/embedding_config.h"
 #include "tensorflow/core/framework/embedding/storage_manager.h"
 #include "tensorflow/core/framework/typed_allocator.h"
@@ -86,7 +87,8 @@ class EmbeddingVar : public ResourceBase {
         default_tensor.NumElements() / emb_config_.default_value_dim;
 
     if (LayoutType::NORMAL_CONTIGUOUS == storage_manager_->GetLayoutType() ||
-        LayoutType::NORMAL_CONTIGUOUS_GPU == storage_manager_->GetLayoutType()) {
+        LayoutType::NORMAL_CONTIGUOUS_GPU == storage_manager_->GetLayoutType() ||
+        LayoutType::COMPACT == storage_manager_->GetLayoutType()) {
       storage_manager_->SetAllocLen(value_len_, emb_config_.slot_num + 1);
     }
 
@@ -149,6 +151,12 @@ class EmbeddingVar : public ResourceBase {
     return s;
   }
 
+  Status BatchLookupOrCreateKey(const K* keys, int64 num,
+      ValuePtr<V>** value_ptrs) {
+    return storage_manager_->BatchGetOrCreate(keys, num, value_ptrs,
+        emb_config_.total_num(storage_manager_->GetAllocLen()));
+  }
+
   void UpdateVersion(ValuePtr<V>* value_ptr, int64 gs) {
     update_version_fn_(value_ptr, gs);
   }
@@ -201,6 +209,85 @@ class EmbeddingVar : public ResourceBase {
     add_freq_fn_(value_ptr, count, emb_config_.filter_freq);
   }
 
+  // Batched LookupOrCreate for EVs without feature filter. The ValuePtrs of
+  // the whole batch are resolved by the storage first, then the rows are
+  // copied into output while the following ValuePtrs are prefetched.
+  // default_values and counts (may be nullptr) are indexed like keys.
+  void BatchLookupOrCreate(const K* keys, V* output, int64 num,
+                           V** default_values, const int32* counts) {
+    constexpr int64 kPrefetchDistance = 4;
+    std::vector<ValuePtr<V>*> value_ptrs(num);
+    TF_CHECK_OK(BatchLookupOrCreateKey(keys, num, value_ptrs.data()));
+    const int emb_index = emb_config_.emb_index;
+    const int64 offset = storage_manager_->GetOffset(emb_index);
+    for (int64 i = 0; i < num; ++i) {
+      if (i + kPrefetchDistance < num) {
+        value_ptrs[i + kPrefetchDistance]->Prefetch();
+      }
+      V* mem_val = value_ptrs[i]->GetOrAllocate(alloc_, value_len_,
+          default_values[i], emb_index, offset);
+      memcpy(output + i * value_len_, mem_val, sizeof(V) * value_len_);
+    }
+    if (IsMultiLevel() || emb_config_.record_freq) {
+      for (int64 i = 0; i < num; ++i) {
+        value_ptrs[i]->AddFreq(counts == nullptr ? 1 : counts[i]);
+      }
+    }
+  }
+
+  // Like BatchLookupOrCreate, but returns the address of each row in the
+  // storage instead of copying it, for kernels which only read the rows.
+  void BatchLookupOrCreateRows(const K* keys, V** rows, int64 num,
+                               V** default_values, const int32* counts) {
+    std::vector<ValuePtr<V>*> value_ptrs(num);
+    TF_CHECK_OK(BatchLookupOrCreateKey(keys, num, value_ptrs.data()));
+    const int emb_index = emb_config_.emb_index;
+    const int64 offset = storage_manager_->GetOffset(emb_index);
+    for (int64 i = 0; i < num; ++i) {
+      rows[i] = value_ptrs[i]->GetOrAllocate(alloc_, value_len_,
+          default_values[i], emb_index, offset);
+    }
+    if (IsMultiLevel() || emb_config_.record_freq) {
+      for (int64 i = 0; i < num; ++i) {
+        value_ptrs[i]->AddFreq(counts == nullptr ? 1 : counts[i]);
+      }
+    }
+  }
+
+  // Batched Lookup for EVs without feature filter, which returns the
+  // address of each row in the storage like BatchLookupOrCreateRows.
+  // Missing keys get the default value of keys without permission.
+  void BatchLookupRows(const K* keys, const V** rows, int64 num) {
+    for (int64 i = 0; i < num; ++i) {
+      ValuePtr<V>* value_ptr = nullptr;
+      if (LookupKey(keys[i], &value_ptr).ok()) {
+        rows[i] = LookupPrimaryEmb(value_ptr);
+      } else {
+        rows[i] = default_value_no_permission_;
+      }
+    }
+  }
+
+  // Batched LookupOrCreate for EVs with feature filter, admission of the
+  // whole batch is checked by the filter before the keys are created.
+  void BatchLookupOrCreateWithFilter(const K* keys, V* output, int64 num,
+                                     V** default_values, const int32* counts) {
+    std::vector<ValuePtr<V>*> value_ptrs(num, nullptr);
+    filter_->BatchLookupOrCreate(keys, output, num, value_len_,
+        default_values, value_ptrs.data(), counts,
+        default_value_no_permission_);
+    for (int64 i = 0; i < num; ++i) {
+      if (value_ptrs[i] != nullptr) {
+        add_freq_fn_(value_ptrs[i], (counts == nullptr) ? 1 : counts[i],
+                     emb_config_.filter_freq);
+      }
+    }
+  }
+
+  bool HasFeatureFilter() const {
+    return emb_config_.filter_freq > 0;
+  }
+
   void LookupWithFreqBatch(const K* keys,
       V** memcpy_address, int64 start, int64 limit,
       std::list<int64>& init_cursor,
@@ -439,6 +526,16 @@ class EmbeddingVar : public ResourceBase {
     return storage_manager_->IsMultiLevel();
   }
 
+  // Whether snapshots carry the version and the freq of every key.
+  bool RecordsVersion() const {
+    return emb_config_.steps_to_live != 0 || emb_config_.record_version;
+  }
+
+  bool RecordsFreq() {
+    return IsMultiLevel() || emb_config_.filter_freq != 0 ||
+           emb_config_.record_freq;
+  }
+
   bool IsUseHbm() {
     return storage_manager_->IsUseHbm();
   }
@@ -457,6 +554,7 @@ class EmbeddingVar : public ResourceBase {
                 int64 partition_id,
                 int64 partition_num,
                 bool is_filter) {
+    embedding::ImportRateLimiter::Global()->Acquire(key_num);
     return filter_->Import(restore_buff, key_num, bucket_num,
         partition_id, partition_num, is_filter);
   }
@@ -18,6 +18,8 @@ limitations under the License.
 
 #include "tensorflow/core/util/env_var.h"
 #include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace tensorflow {
 
@@ -25,16 +27,38 @@ namespace embedding {
 template<typename K, typename V>
 class MultiTierStorage;
 
+struct EvictionMetrics {
+  int64 num_evictions = 0;
+  int64 evicted_keys = 0;
+  int64 eviction_micros = 0;
+  // Time from the storage being seen above its high watermark
+  // until it is brought back to its low watermark.
+  int64 last_lag_micros = 0;
+  int64 max_lag_micros = 0;
+
+  double EvictedKeysPerSecond() const {
+    return (eviction_micros > 0) ? evicted_keys * 1e6 / eviction_micros : 0.0;
+  }
+};
+
 template<typename K, typename V>
 struct StorageItem {
   volatile bool is_occupied;
   volatile bool is_deleted;
+  uint64 over_watermark_micros = 0;
+  EvictionMetrics metrics;
 
   StorageItem(bool is_occupied,
               volatile bool is_deleted) : is_occupied(is_occupied),
                                           is_deleted(is_deleted) {}
 };
 
+// Evicts the DRAM tier of the registered multi-tier storages. A scheduler
+// thread wakes up when a storage reports that its cache is above the high
+// watermark (or every TF_MULTI_TIER_EV_EVICTION_INTERVAL_US), and evicts
+// such storages down to the low watermark on up to
+// TF_MULTI_TIER_EV_EVICTION_THREADS threads in parallel. The watermarks
+// are percents of the cache capacity of a storage.
 template<typename K, typename V>
 class EvictionManager {
  public:
@@ -42,12 +66,34 @@ class EvictionManager {
     num_of_threads_ = 1;
     TF_CHECK_OK(ReadInt64FromEnvVar("TF_MULTI_TIER_EV_EVICTION_THREADS", 1,
           &num_of_threads_));
+    TF_CHECK_OK(ReadInt64FromEnvVar(
+          "TF_MULTI_TIER_EV_EVICTION_HIGH_WATERMARK", 100,
+          &high_watermark_));
+    TF_CHECK_OK(ReadInt64FromEnvVar(
+          "TF_MULTI_TIER_EV_EVICTION_LOW_WATERMARK", 100,
+          &low_watermark_));
+    TF_CHECK_OK(ReadInt64FromEnvVar(
+          "TF_MULTI_TIER_EV_EVICTION_INTERVAL_US", 1000,
+          &check_interval_us_));
+    num_of_threads_ = std::max(num_of_threads_, int64{1});
+    low_watermark_ = std::min(low_watermark_, high_watermark_);
+    // The threads are shared by the scheduler loop, started by the first
+    // AddStorage, at most num_of_threads_ running evictions and the tasks
+    // of Schedule(), which get the remaining thread when both are busy.
     thread_pool_.reset(
         new thread::ThreadPool(Env::Default(), ThreadOptions(),
-          "EVICTION_MANAGER", 3, /*low_latency_hint=*/false));
+          "EVICTION_MANAGER", num_of_threads_ + 2,
+          /*low_latency_hint=*/false));
   }
   
   ~EvictionManager() {
+    {
+      mutex_lock l(mu_);
+      shutdown_ = true;
+    }
+    cv_.notify_all();
+    // Joins the scheduler and the running evictions.
+    thread_pool_.reset();
   }
 
   TF_DISALLOW_COPY_AND_ASSIGN(EvictionManager);
@@ -60,74 +106,158 @@ class EvictionManager {
     mutex_lock l(mu_);
     auto ret = storage_table_.emplace(std::make_pair(storage,
                            new StorageItem<K, V>(false, false)));
-    if (ret.second && num_of_active_threads_ < num_of_threads_)
-      StartThread();
+    if (ret.second && !scheduler_running_) {
+      scheduler_running_ = true;
+      thread_pool_->Schedule([this]() {
+        SchedulerLoop();
+      });
+    }
   }
 
   void DeleteStorage(MultiTierStorage<K,V>* storage) {
-    auto storage_item = storage_table_[storage];
-    bool delete_flag = false;
-    while (!delete_flag) {
-      volatile bool* occupy_flag = &storage_item->is_occupied;
-      delete_flag = __sync_bool_compare_and_swap(occupy_flag, false, true);
-      if (delete_flag) {
-        storage_item->is_deleted = true;
+    StorageItem<K, V>* storage_item = nullptr;
+    {
+      mutex_lock l(mu_);
+      auto it = storage_table_.find(storage);
+      if (it == storage_table_.end()) {
+        return;
       }
-      *occupy_flag = false;
+      storage_item = it->second;
+    }
+    // Wait for the running eviction of the storage, the item is released
+    // by the scheduler once it is marked as deleted.
+    volatile bool* occupy_flag = &storage_item->is_occupied;
+    while (!__sync_bool_compare_and_swap(occupy_flag, false, true)) {
+      Env::Default()->SleepForMicroseconds(100);
     }
+    storage_item->is_deleted = true;
+    *occupy_flag = false;
+    cv_.notify_all();
   }
 
- private:
-  void StartThread() {
-    while(this->flag_.test_and_set(std::memory_order_acquire));
-    if (num_of_active_threads_ < num_of_threads_) {
-      __sync_fetch_and_add(&num_of_active_threads_, 1);
-      thread_pool_->Schedule([this]() {
-        EvictionLoop();
-      });
+  bool NeedEviction(MultiTierStorage<K,V>* storage) const {
+    int64 capacity = storage->CacheSize();
+    return capacity >= 0 && storage->Cache() != nullptr &&
+           storage->Cache()->size() > capacity * high_watermark_ / 100;
+  }
+
+  // Wakes up the scheduler, called when a storage may be above its
+  // high watermark.
+  void Notify() {
+    cv_.notify_one();
+  }
+
+  bool GetEvictionMetrics(MultiTierStorage<K,V>* storage,
+                          EvictionMetrics* metrics) {
+    mutex_lock l(mu_);
+    auto it = storage_table_.find(storage);
+    if (it == storage_table_.end() || it->second->is_deleted) {
+      return false;
     }
-    this->flag_.clear(std::memory_order_release);
+    *metrics = it->second->metrics;
+    return true;
   }
 
-  bool CheckStorages() {
+  std::string DebugString() {
     mutex_lock l(mu_);
+    std::string ret;
+    for (auto it : storage_table_) {
+      if (it.second->is_deleted) continue;
+      const EvictionMetrics& m = it.second->metrics;
+      strings::StrAppend(&ret, it.first->GetName(),
+          ": evictions: ", m.num_evictions,
+          ", evicted keys: ", m.evicted_keys,
+          ", evicted keys/s: ", m.EvictedKeysPerSecond(),
+          ", last lag(us): ", m.last_lag_micros,
+          ", max lag(us): ", m.max_lag_micros, "\n");
+    }
+    return ret;
+  }
+
+ private:
+  void SchedulerLoop() {
+    mutex_lock l(mu_);
+    while (!shutdown_ && !storage_table_.empty()) {
+      ScheduleEvictions();
+      cv_.wait_for(l, std::chrono::microseconds(check_interval_us_));
+    }
+    scheduler_running_ = false;
+  }
+
+  // Starts the eviction of every storage above its high watermark which
+  // is not being evicted, as long as there are idle eviction threads.
+  void ScheduleEvictions() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
     for (auto it = storage_table_.begin(); it != storage_table_.end();) {
-      if (!(it->second)->is_deleted) 
-        return true;
-      else 
+      if (num_of_running_ >= num_of_threads_) {
+        break;
+      }
+      auto storage = it->first;
+      auto storage_item = it->second;
+      volatile bool* occupy_flag = &storage_item->is_occupied;
+      if (!__sync_bool_compare_and_swap(occupy_flag, false, true)) {
+        ++it;
+        continue;
+      }
+      if (storage_item->is_deleted) {
+        delete storage_item;
         it = storage_table_.erase(it);
+        continue;
+      }
+      if (NeedEviction(storage)) {
+        if (storage_item->over_watermark_micros == 0) {
+          storage_item->over_watermark_micros = Env::Default()->NowMicros();
+        }
+        ++num_of_running_;
+        thread_pool_->Schedule([this, storage, storage_item]() {
+          RunEviction(storage, storage_item);
+        });
+      } else {
+        *occupy_flag = false;
+      }
+      ++it;
     }
-    return false;
   }
 
-  void EvictionLoop() {
-    while (CheckStorages()) {
+  void RunEviction(MultiTierStorage<K,V>* storage,
+                   StorageItem<K, V>* storage_item) {
+    uint64 start = Env::Default()->NowMicros();
+    int64 target = storage->CacheSize() * low_watermark_ / 100;
+    int64 evicted = 0;
+    while (!shutdown_ && storage->Cache()->size() > target) {
+      int64 n = storage->BatchEviction(target);
+      if (n <= 0) break;
+      evicted += n;
+    }
+    uint64 end = Env::Default()->NowMicros();
+    {
       mutex_lock l(mu_);
-      int index = 0;
-      for (auto it : storage_table_) {
-        auto storage = it.first;
-        auto storage_item = it.second;
-        volatile bool* occupy_flag = &storage_item->is_occupied;
-        if (__sync_bool_compare_and_swap(occupy_flag, false, true)) {
-          if (storage_item->is_deleted) {
-            *occupy_flag = false;
-            continue; 
-          }
-          storage->BatchEviction();
-          *occupy_flag = false;
-        }
-        Env::Default()->SleepForMicroseconds(1);
-      }
+      EvictionMetrics& m = storage_item->metrics;
+      m.num_evictions++;
+      m.evicted_keys += evicted;
+      m.eviction_micros += end - start;
+      m.last_lag_micros = end - storage_item->over_watermark_micros;
+      m.max_lag_micros = std::max(m.max_lag_micros, m.last_lag_micros);
+      storage_item->over_watermark_micros = 0;
+      VLOG(1) << "Evicted " << evicted << " keys of " << storage->GetName()
+              << " in " << end - start << "us, lag: "
+              << m.last_lag_micros << "us";
+      storage_item->is_occupied = false;
+      --num_of_running_;
     }
-    __sync_fetch_and_sub(&num_of_active_threads_, 1);
+    cv_.notify_all();
   }
 
   int64 num_of_threads_;
-  int64 num_of_active_threads_;
-  std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+  int64 num_of_running_ GUARDED_BY(mu_) = 0;
+  int64 high_watermark_;
+  int64 low_watermark_;
+  int64 check_interval_us_;
+  bool scheduler_running_ GUARDED_BY(mu_) = false;
+  volatile bool shutdown_ = false;
   std::unique_ptr<thread::ThreadPool> thread_pool_;
   std::map<MultiTierStorage<K,V>*, StorageItem<K, V>*> storage_table_;
   mutex mu_;
+  condition_variable cv_;
 };
 
 class EvictionManagerCreator {
@@ -44,6 +44,19 @@ class FilterPolicy {
   virtual Status Lookup(EV* ev, K key, V* val, const V* default_value_ptr,
     const V* default_value_no_permission) = 0;
 
+  // Batched LookupOrCreate, the row of keys[i] is written to
+  // val_base + i * value_len. value_ptrs[i] is left untouched for keys
+  // which are not admitted by the filter.
+  virtual void BatchLookupOrCreate(const K* keys, V* val_base, int64 num,
+      int64 value_len, V** default_values, ValuePtr<V>** value_ptrs,
+      const int32* counts, const V* default_value_no_permission) {
+    for (int64 i = 0; i < num; ++i) {
+      LookupOrCreate(keys[i], val_base + i * value_len, default_values[i],
+          &value_ptrs[i], (counts == nullptr) ? 1 : counts[i],
+          default_value_no_permission);
+    }
+  }
+
   virtual Status LookupOrCreateKey(K key, ValuePtr<V>** val,
       bool* is_filter) = 0;
   virtual void CopyEmbeddingsToBuffer(
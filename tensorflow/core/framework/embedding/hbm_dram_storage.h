@@ -205,8 +205,10 @@ class HbmDramStorage : public MultiTierStorage<K, V> {
 
   void AllocateMemoryForNewFeatures(
       const std::vector<ValuePtr<V>*>& value_ptr_list) override {
-    for (auto it : value_ptr_list) {
-      it->SetPtr(embedding_mem_pool_->Allocate());
+    std::vector<V*> ptrs =
+        embedding_mem_pool_->AllocateBatch(value_ptr_list.size());
+    for (int64 i = 0; i < value_ptr_list.size(); i++) {
+      value_ptr_list[i]->SetPtr(ptrs[i]);
     }
   }
 
@@ -228,21 +230,22 @@ class HbmDramStorage : public MultiTierStorage<K, V> {
     }
   }
 
-  void BatchEviction() override {
+  int64 BatchEviction(int64 target_size) override {
     constexpr int EvictionSize = 10000;
     K evic_ids[EvictionSize];
     if (!MultiTierStorage<K, V>::ready_eviction_) {
-      return;
+      return 0;
     }
     mutex_lock l(hbm_mu_);
     mutex_lock l1(dram_mu_);
 
     int64 cache_count = MultiTierStorage<K, V>::cache_->size();
-    if (cache_count > MultiTierStorage<K, V>::cache_capacity_) {
+    size_t true_size = 0;
+    if (cache_count > target_size) {
       // eviction
-      int k_size = cache_count - MultiTierStorage<K, V>::cache_capacity_;
-      k_size = std::min(k_size, EvictionSize);
-      size_t true_size =
+      int64 k_size = cache_count - target_size;
+      k_size = std::min(k_size, static_cast<int64>(EvictionSize));
+      true_size =
           MultiTierStorage<K, V>::cache_->get_evic_ids(evic_ids, k_size);
       ValuePtr<V>* value_ptr;
       std::vector<K> keys;
@@ -260,6 +263,7 @@ class HbmDramStorage : public MultiTierStorage<K, V> {
         TF_CHECK_OK(hbm_kv_->Remove(it));
       }
     }
+    return true_size;
   }
 
  protected:
@@ -0,0 +1,109 @@
+/* Copyright 2022 The DeepRec Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_IMPORT_RATE_LIMITER_H_
+#define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_IMPORT_RATE_LIMITER_H_
+
+#include <algorithm>
+#include <atomic>
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace embedding {
+
+// Paces the keys imported into EmbeddingVariables to a keys/s budget.
+// Restores import a buffer of keys at a time, and each buffer waits for
+// its share of the budget first, so a model update applied next to online
+// inference leaves it CPU and memory bandwidth. There is no budget by
+// default; serving sets one while it applies delta models.
+//
+// The limiter is process-global: every EmbeddingVariable of every model
+// loaded in the process imports through Global(), so models updated at
+// the same time share one budget, and a budget set or cleared for one
+// update applies to all of them.
+class ImportRateLimiter {
+ public:
+  static ImportRateLimiter* Global() {
+    static ImportRateLimiter limiter;
+    return &limiter;
+  }
+
+  // A budget of 0 keys/s disables the pacing.
+  void SetKeysPerSecond(int64 keys_per_second) {
+    mutex_lock l(mu_);
+    keys_per_second_ = keys_per_second;
+    next_free_micros_ = 0;
+    enabled_.store(keys_per_second > 0, std::memory_order_relaxed);
+  }
+
+  // Counts `num_keys` keys about to be imported, after waiting until the
+  // budget has room for them.
+  void Acquire(int64 num_keys) {
+    imported_keys_.fetch_add(num_keys, std::memory_order_relaxed);
+    if (!enabled_.load(std::memory_order_relaxed)) return;
+
+    uint64 wait_micros = 0;
+    {
+      mutex_lock l(mu_);
+      if (keys_per_second_ <= 0) return;
+      const uint64 now = Env::Default()->NowMicros();
+      const uint64 start = std::max(now, next_free_micros_);
+      next_free_micros_ = start + num_keys * 1000000 / keys_per_second_;
+      wait_micros = start - now;
+    }
+    if (wait_micros > 0) {
+      throttled_micros_.fetch_add(wait_micros, std::memory_order_relaxed);
+      Env::Default()->SleepForMicroseconds(wait_micros);
+    }
+  }
+
+  int64 imported_keys() const {
+    return imported_keys_.load(std::memory_order_relaxed);
+  }
+
+  int64 throttled_micros() const {
+    return throttled_micros_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  mutex mu_;
+  int64 keys_per_second_ GUARDED_BY(mu_) = 0;
+  uint64 next_free_micros_ GUARDED_BY(mu_) = 0;
+  std::atomic<bool> enabled_{false};
+  std::atomic<int64> imported_keys_{0};
+  std::atomic<int64> throttled_micros_{0};
+};
+
+// Sets the keys/s budget of ImportRateLimiter::Global() for its lifetime.
+class ScopedImportRateLimit {
+ public:
+  explicit ScopedImportRateLimit(int64 keys_per_second) {
+    ImportRateLimiter::Global()->SetKeysPerSecond(keys_per_second);
+  }
+  ~ScopedImportRateLimit() {
+    ImportRateLimiter::Global()->SetKeysPerSecond(0);
+  }
+
+ private:
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedImportRateLimit);
+};
+
+}  // namespace embedding
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_IMPORT_RATE_LIMITER_H_
@@ -75,6 +75,9 @@ class KVInterface {
   // KV Size
   virtual int64 Size() const = 0;
 
+  // Length of the values of one slot, set before SetTotalDims.
+  virtual void SetAllocLen(int64 alloc_len) {}
+
   virtual void SetTotalDims(int total_dims) {}
 
   virtual void FreeValuePtr(ValuePtr<V>* value_ptr) {}
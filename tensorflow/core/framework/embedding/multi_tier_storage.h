@@ -62,6 +62,9 @@ class MultiTierStorage : public Storage<K, V> {
     int64 temp = Storage<K, V>::alloc_len_ * slot_num;
     if (temp > Storage<K, V>::total_dims_) {
       Storage<K, V>::total_dims_ = temp;
+      for (auto& kv : kvs_) {
+        kv.kv_->SetAllocLen(Storage<K, V>::alloc_len_);
+      }
       SetTotalDims(Storage<K, V>::total_dims_);
 
       cache_capacity_ = Storage<K, V>::storage_config_.size[0]
@@ -183,6 +186,22 @@ class MultiTierStorage : public Storage<K, V> {
     return Status::OK();
   }
 
+  Status BatchGetOrCreate(const K* keys, int64 num,
+      ValuePtr<V>** value_ptrs, size_t size) override {
+    // Hits in the first tier are resolved in one batched probe, only the
+    // misses go through the per-key path which also checks lower tiers.
+    if (this->IsUseHbm() ||
+        !kvs_[0].kv_->BatchLookup(keys, num, value_ptrs).ok()) {
+      return Storage<K, V>::BatchGetOrCreate(keys, num, value_ptrs, size);
+    }
+    for (int64 i = 0; i < num; ++i) {
+      if (value_ptrs[i] == nullptr) {
+        TF_RETURN_IF_ERROR(this->GetOrCreate(keys[i], &value_ptrs[i], size));
+      }
+    }
+    return Status::OK();
+  }
+
   int64 Size(int level) const override {
     return kvs_[level].kv_->Size();
   }
@@ -213,26 +232,40 @@ class MultiTierStorage : public Storage<K, V> {
     return;
   }
 
+  // The tasks update the cache, so the eviction manager is woken up
+  // once the cache goes above its high watermark.
   void Schedule(std::function<void()> fn) override {
-    cache_thread_pool_->Schedule(std::move(fn));
+    cache_thread_pool_->Schedule([this, fn]() {
+      fn();
+      if (eviction_manager_->NeedEviction(this)) {
+        eviction_manager_->Notify();
+      }
+    });
+  }
+
+  const std::string& GetName() const {
+    return name_;
   }
 
-  virtual void BatchEviction() {
+  // Evicts at most EvictionSize keys from the first tier so that the cache
+  // gets closer to target_size, returns the number of evicted keys.
+  virtual int64 BatchEviction(int64 target_size) {
     constexpr int EvictionSize = 10000;
     K evic_ids[EvictionSize];
     if (!ready_eviction_)
-      return;
+      return 0;
     mutex_lock l(kvs_[0].mu_);
     mutex_lock l1(kvs_[1].mu_);
     //Release the memory of invlid valuetprs
     ReleaseInvalidValuePtr();
 
-    int cache_count = cache_->size();
-    if (cache_count > cache_capacity_) {
+    int64 cache_count = cache_->size();
+    size_t true_size = 0;
+    if (cache_count > target_size) {
       // eviction
-      int k_size = cache_count - cache_capacity_;
-      k_size = std::min(k_size, EvictionSize);
-      size_t true_size = cache_->get_evic_ids(evic_ids, k_size);
+      int64 k_size = cache_count - target_size;
+      k_size = std::min(k_size, static_cast<int64>(EvictionSize));
+      true_size = cache_->get_evic_ids(evic_ids, k_size);
       ValuePtr<V>* value_ptr;
       if (Storage<K, V>::storage_config_.type == StorageType::HBM_DRAM) {
         std::vector<K> keys;
@@ -256,6 +289,7 @@ class MultiTierStorage : public Storage<K, V> {
         }
       }
     }
+    return true_size;
   }
 
  protected:
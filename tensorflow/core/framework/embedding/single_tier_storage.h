@@ -81,19 +81,25 @@ class SingleTierStorage : public Storage<K, V> {
   Status GetOrCreate(K key, ValuePtr<V>** value_ptr,
       size_t size) override {
     Status s = kv_->Lookup(key, value_ptr);
-    if (s.ok()) {
+    if (!errors::IsNotFound(s)) {
       return s;
     }
+    return CreateAndInsert(key, value_ptr, size);
+  }
 
-    *value_ptr = layout_creator_->Create(alloc_, size);
-    s = kv_->Insert(key, *value_ptr);
-    if (s.ok()) {
-      return s;
+  Status BatchGetOrCreate(const K* keys, int64 num,
+      ValuePtr<V>** value_ptrs, size_t size) override {
+    Status s = kv_->BatchLookup(keys, num, value_ptrs);
+    if (s.code() == error::UNIMPLEMENTED) {
+      return Storage<K, V>::BatchGetOrCreate(keys, num, value_ptrs, size);
     }
-    // Insert Failed, key already exist
-    (*value_ptr)->Destroy(alloc_);
-    delete *value_ptr;
-    return kv_->Lookup(key, value_ptr);
+    TF_RETURN_IF_ERROR(s);
+    for (int64 i = 0; i < num; ++i) {
+      if (value_ptrs[i] == nullptr) {
+        TF_RETURN_IF_ERROR(CreateAndInsert(keys[i], &value_ptrs[i], size));
+      }
+    }
+    return Status::OK();
   }
 
   Status GetOrCreate(K key, ValuePtr<V>** value_ptr,
@@ -243,6 +249,7 @@ class SingleTierStorage : public Storage<K, V> {
     int64 temp = Storage<K, V>::alloc_len_ * slot_num;
     if (temp > Storage<K, V>::total_dims_) {
       Storage<K, V>::total_dims_ = temp;
+      kv_->SetAllocLen(Storage<K, V>::alloc_len_);
       SetTotalDims(Storage<K, V>::total_dims_);
     }
     Storage<K, V>::flag_.clear(std::memory_order_release);
@@ -271,6 +278,18 @@ class SingleTierStorage : public Storage<K, V> {
  protected:
   virtual void SetTotalDims(int64 total_dims) = 0;
 
+  Status CreateAndInsert(K key, ValuePtr<V>** value_ptr, size_t size) {
+    *value_ptr = layout_creator_->Create(alloc_, size);
+    Status s = kv_->Insert(key, *value_ptr);
+    if (s.ok()) {
+      return s;
+    }
+    // Insert Failed, key already exist
+    (*value_ptr)->Destroy(alloc_);
+    delete *value_ptr;
+    return kv_->Lookup(key, value_ptr);
+  }
+
  protected:
   KVInterface<K, V>* kv_;
   Allocator* alloc_;
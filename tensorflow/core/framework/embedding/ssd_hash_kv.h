@@ -17,10 +17,18 @@ limitations under the License.
 #define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_SSD_HASH_KV_H_
 
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <map>
 #include <vector>
@@ -29,7 +37,9 @@ limitations under the License.
 #include "sparsehash/dense_hash_map_lockless"
 #include "sparsehash/dense_hash_set_lockless"
 #include "tensorflow/core/framework/embedding/kv_interface.h"
+#include "tensorflow/core/framework/embedding/value_codec.h"
 #include "tensorflow/core/framework/embedding/value_ptr.h"
+#include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/io/path.h"
@@ -127,11 +137,51 @@ class EmbFile {
     }
   }
 
-  void Read(char* val, const size_t val_len, const size_t offset) {
-    char* file_addr_tmp =
-        (char*)mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
-    memcpy(val, file_addr_tmp + offset, val_len);
-    munmap((void*)file_addr_tmp, file_size_);
+  Status Read(char* val, const size_t val_len, const size_t offset) {
+    size_t done = 0;
+    while (done < val_len) {
+      ssize_t n = pread(fd_, val + done, val_len - done, offset + done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        return errors::DataLoss(
+            "Failed to read ", val_len, " bytes at offset ", offset,
+            " from ", filepath_, ": ",
+            n < 0 ? strerror(errno) : "unexpected end of file");
+      }
+      done += n;
+    }
+    return Status::OK();
+  }
+
+  // Reads num records of val_len bytes into vals[i] from offsets[i].
+  // offsets must be sorted ascending. Records which are stored back to
+  // back in the file are fetched with a single preadv. Adds the number
+  // of read syscalls issued to num_ops.
+  Status ReadBatch(char** vals, const size_t val_len,
+      const size_t* offsets, const size_t num, int64* num_ops) {
+    std::vector<struct iovec> iov;
+    iov.reserve(std::min(num, static_cast<size_t>(IOV_MAX)));
+    size_t i = 0;
+    while (i < num) {
+      size_t start = i;
+      iov.clear();
+      do {
+        iov.push_back({vals[i], val_len});
+        ++i;
+      } while (i < num && iov.size() < IOV_MAX &&
+               offsets[i] == offsets[i - 1] + val_len);
+      size_t total = iov.size() * val_len;
+      ssize_t n = preadv(fd_, iov.data(), iov.size(), offsets[start]);
+      ++*num_ops;
+      if (n < 0 || static_cast<size_t>(n) != total) {
+        // Short read, fall back to reading the records one by one.
+        for (size_t j = start; j < i; ++j) {
+          TF_RETURN_IF_ERROR(Read(vals[j], val_len, offsets[j]));
+          ++*num_ops;
+        }
+      }
+    }
+    return Status::OK();
   }
 
  public:
@@ -149,14 +199,22 @@ class EmbFile {
 template <class K>
 class SSDIterator : public Iterator {
  public:
+  // decode_fn expands an encoded record in place into decoded_len bytes,
+  // it is empty when the values are stored uncompressed.
   SSDIterator(google::dense_hash_map_lockless<K, EmbPosition*>* hash_map,
               const std::vector<EmbFile*>& emb_files, int64 value_len,
-              char* write_buffer)
+              char* write_buffer,
+              std::function<void(char*)> decode_fn = nullptr,
+              int64 decoded_len = 0)
       : emb_files_(emb_files),
         curr_file_(0),
         curr_vec_(0),
         value_len_(value_len),
-        write_buffer_(write_buffer) {
+        write_buffer_(write_buffer),
+        decode_fn_(decode_fn) {
+    if (decode_fn_) {
+      decode_buffer_.resize(decoded_len);
+    }
     for (auto it : *hash_map) {
       EmbPosition* posi = it.second;
       if (!posi->invalid_) {
@@ -206,6 +264,18 @@ class SSDIterator : public Iterator {
   virtual void Value(char* val, int64 dim, int64 value_offset) {
     int64 f_id = file_id_vec_[curr_file_];
     EmbPosition* posi = (file_map_[f_id])[curr_vec_].second;
+    if (decode_fn_) {
+      char* record = decode_buffer_.data();
+      if (posi->flushed_) {
+        emb_files_[posi->version_]->
+            ReadWithoutMap(record, value_len_, posi->offset_);
+      } else {
+        memcpy(record, write_buffer_ + posi->buffer_offset_, value_len_);
+      }
+      decode_fn_(record);
+      memcpy(val, record + sizeof(FixedLengthHeader) + value_offset, dim);
+      return;
+    }
     if (posi->flushed_) {
       emb_files_[posi->version_]->
           ReadWithoutMap(val, dim,
@@ -252,6 +322,8 @@ class SSDIterator : public Iterator {
   int64 curr_file_;
   int64 curr_vec_;
   char* write_buffer_;
+  std::function<void(char*)> decode_fn_;
+  std::vector<char> decode_buffer_;
   std::map<int64, std::vector<std::pair<K, EmbPosition*>>> file_map_;
   std::vector<int64> file_id_vec_;
   std::vector<EmbFile*> emb_files_;
@@ -285,6 +357,10 @@ class SSDHashKV : public KVInterface<K, V> {
     new_value_ptr_fn_ = [this](size_t size) {
       return new NormalContiguousValuePtr<V>(alloc_, size);
     };
+    std::string value_type;
+    TF_CHECK_OK(ReadStringFromEnvVar("TF_SSDHASH_VALUE_TYPE", "fp32",
+          &value_type));
+    codec_ = ValueCodec<V>(ParseValueCodecType(value_type), 0);
     is_async_compaction_ = true;
     TF_CHECK_OK(ReadBoolFromEnvVar("TF_SSDHASH_ASYNC_COMPACTION", true,
           &is_async_compaction_));
@@ -313,9 +389,13 @@ class SSDHashKV : public KVInterface<K, V> {
     }
   }
 
+  void SetAllocLen(int64 alloc_len) override {
+    codec_.SetRowLen(alloc_len);
+  }
+
   void SetTotalDims(int total_dims) override {
     total_dims_ = total_dims;
-    val_len_ = sizeof(FixedLengthHeader) + total_dims_ * sizeof(V);
+    val_len_ = sizeof(FixedLengthHeader) + codec_.EncodedSize(total_dims_);
     max_app_count_ = BUFFER_SIZE / val_len_;
     write_buffer_ = new char[BUFFER_SIZE];
     unsigned int max_key_count = 1 + int(BUFFER_SIZE / val_len_);
@@ -324,8 +404,13 @@ class SSDHashKV : public KVInterface<K, V> {
   }
 
   Iterator* GetIterator() override {
+    if (codec_.IsIdentity()) {
+      return new SSDIterator<K>(&hash_map_, emb_files_, val_len_,
+          write_buffer_);
+    }
     return new SSDIterator<K>(&hash_map_, emb_files_, val_len_,
-        write_buffer_);
+        write_buffer_, [this](char* record) { DecodeRecord(record); },
+        sizeof(FixedLengthHeader) + total_dims_ * sizeof(V));
   }
 
   ~SSDHashKV() override {
@@ -376,18 +461,101 @@ class SSDHashKV : public KVInterface<K, V> {
       ValuePtr<V>* val = new_value_ptr_fn_(total_dims_);
       EmbPosition* posi = iter.second;
       if (posi->flushed_) {
-        emb_files_[posi->version_]->Read((char*)(val->GetPtr()),
+        uint64 start_time = Env::Default()->NowMicros();
+        Status s = emb_files_[posi->version_]->Read((char*)(val->GetPtr()),
             val_len_, posi->offset_);
+        if (!s.ok()) {
+          val->Destroy(alloc_);
+          delete val;
+          return s;
+        }
+        read_ops_.fetch_add(1, std::memory_order_relaxed);
+        read_keys_.fetch_add(1, std::memory_order_relaxed);
+        read_bytes_.fetch_add(val_len_, std::memory_order_relaxed);
+        read_micros_.fetch_add(Env::Default()->NowMicros() - start_time,
+                               std::memory_order_relaxed);
       } else {
         memcpy((char*)val->GetPtr(),
             write_buffer_ + posi->buffer_offset_, val_len_);
       }
+      DecodeRecord((char*)val->GetPtr());
       *value_ptr = val;
       posi->invalid_ = true;
       return Status::OK();
     }
   }
 
+  // Looks up a batch of keys, missing keys are reported as nullptr.
+  // Values which are already flushed are grouped by file and read with
+  // coalesced positioned reads instead of one file access per key.
+  Status BatchLookup(const K* keys, size_t size,
+                     ValuePtr<V>** value_ptrs) override {
+    // (version, offset, index of the key)
+    std::vector<std::tuple<size_t, size_t, size_t>> reads;
+    for (size_t i = 0; i < size; ++i) {
+      auto iter = hash_map_.find_wait_free(keys[i]);
+      if (iter.first == EMPTY_KEY) {
+        value_ptrs[i] = nullptr;
+        continue;
+      }
+      ValuePtr<V>* val = new_value_ptr_fn_(total_dims_);
+      EmbPosition* posi = iter.second;
+      if (posi->flushed_) {
+        reads.emplace_back(posi->version_, posi->offset_, i);
+      } else {
+        memcpy((char*)val->GetPtr(),
+            write_buffer_ + posi->buffer_offset_, val_len_);
+        DecodeRecord((char*)val->GetPtr());
+      }
+      value_ptrs[i] = val;
+      posi->invalid_ = true;
+    }
+    if (reads.empty()) {
+      return Status::OK();
+    }
+
+    std::sort(reads.begin(), reads.end());
+    std::vector<char*> vals(reads.size());
+    std::vector<size_t> offsets(reads.size());
+    int64 num_ops = 0;
+    // Only the file reads are timed, not the index lookups or decoding.
+    uint64 start_time = Env::Default()->NowMicros();
+    Status s;
+    size_t begin = 0;
+    while (s.ok() && begin < reads.size()) {
+      size_t version = std::get<0>(reads[begin]);
+      size_t end = begin;
+      while (end < reads.size() && std::get<0>(reads[end]) == version) {
+        vals[end] = (char*)value_ptrs[std::get<2>(reads[end])]->GetPtr();
+        offsets[end] = std::get<1>(reads[end]);
+        ++end;
+      }
+      s = emb_files_[version]->ReadBatch(vals.data() + begin,
+          val_len_, offsets.data() + begin, end - begin, &num_ops);
+      begin = end;
+    }
+    if (!s.ok()) {
+      // No value is handed back when any read failed.
+      for (size_t i = 0; i < size; ++i) {
+        if (value_ptrs[i] != nullptr) {
+          value_ptrs[i]->Destroy(alloc_);
+          delete value_ptrs[i];
+          value_ptrs[i] = nullptr;
+        }
+      }
+      return s;
+    }
+    read_micros_.fetch_add(Env::Default()->NowMicros() - start_time,
+                           std::memory_order_relaxed);
+    for (auto val : vals) {
+      DecodeRecord(val);
+    }
+    read_ops_.fetch_add(num_ops, std::memory_order_relaxed);
+    read_keys_.fetch_add(reads.size(), std::memory_order_relaxed);
+    read_bytes_.fetch_add(reads.size() * val_len_, std::memory_order_relaxed);
+    return Status::OK();
+  }
+
   Status Contains(K key) override {
     auto iter = hash_map_.find_wait_free(key);
     if (iter.first == EMPTY_KEY) {
@@ -447,6 +615,34 @@ class SSDHashKV : public KVInterface<K, V> {
     delete value_ptr;
   }
 
+
+  std::string DebugString() const override {
+    int64 read_ops = read_ops_.load(std::memory_order_relaxed);
+    int64 read_keys = read_keys_.load(std::memory_order_relaxed);
+    int64 read_bytes = read_bytes_.load(std::memory_order_relaxed);
+    int64 read_micros = read_micros_.load(std::memory_order_relaxed);
+    double avg_read_latency_us =
+        (read_ops > 0) ? 1.0 * read_micros / read_ops : 0.0;
+    double read_throughput_mb =
+        (read_micros > 0) ? read_bytes / 1.048576 / read_micros : 0.0;
+    return strings::StrCat("map info size:", Size(),
+                           ", map info bucket_count:",
+                           hash_map_.load_factor(),
+                           ",map info load_factor:",
+                           hash_map_.load_factor(),
+                           ", map info max_load_factor:",
+                           hash_map_.max_load_factor(),
+                           ", map info min_load_factor: ",
+                           hash_map_.min_load_factor(),
+                           ", evict_version: ", evict_version_,
+                           ", compaction_version: ", compaction_version_,
+                           ", read keys: ", read_keys,
+                           ", read ops: ", read_ops,
+                           ", read bytes: ", read_bytes,
+                           ", avg read latency(us): ", avg_read_latency_us,
+                           ", read throughput(MB/s): ", read_throughput_mb);
+  }
+
  private:
   void WriteFile(size_t version, size_t curr_buffer_offset) {
     emb_files_[version]->Write(write_buffer_, curr_buffer_offset);
@@ -535,11 +731,28 @@ class SSDHashKV : public KVInterface<K, V> {
     }
   }
 
+  // Expands the values of a record read from file in place, the record
+  // buffer must have room for the uncompressed values.
+  void DecodeRecord(char* record) {
+    if (!codec_.IsIdentity()) {
+      char* values = record + sizeof(FixedLengthHeader);
+      codec_.Decode(values, total_dims_, (V*)values);
+    }
+  }
+
   void AppendToWriteBuffer(size_t curr_buffer_offset, K key,
                             const ValuePtr<V>* value_ptr) {
     current_offset_ += val_len_;
-    memcpy(write_buffer_ + curr_buffer_offset,
-        (char*)value_ptr->GetPtr(), val_len_);
+    if (codec_.IsIdentity()) {
+      memcpy(write_buffer_ + curr_buffer_offset,
+          (char*)value_ptr->GetPtr(), val_len_);
+    } else {
+      char* record = write_buffer_ + curr_buffer_offset;
+      const char* src = (char*)value_ptr->GetPtr();
+      memcpy(record, src, sizeof(FixedLengthHeader));
+      codec_.Encode((const V*)(src + sizeof(FixedLengthHeader)),
+          total_dims_, record + sizeof(FixedLengthHeader));
+    }
     key_buffer_[buffer_cur_] = key;
     ++buffer_cur_;
   }
@@ -674,6 +887,7 @@ class SSDHashKV : public KVInterface<K, V> {
         EmbPosition* posi = it_vec.second;
         file->ReadWithoutMap((char*)(val->GetPtr()), val_len_,
             posi->offset_);
+        DecodeRecord((char*)(val->GetPtr()));
         CheckBuffer();
         SaveKV(it_vec.first, val, true);
       }
@@ -766,20 +980,6 @@ class SSDHashKV : public KVInterface<K, V> {
     }
   }
 
-  std::string DebugString() const {
-    return strings::StrCat("map info size:", Size(),
-                           ", map info bucket_count:",
-                           hash_map_.load_factor(),
-                           ",map info load_factor:",
-                           hash_map_.load_factor(),
-                           ", map info max_load_factor:",
-                           hash_map_.max_load_factor(),
-                           ", map info min_load_factor: ",
-                           hash_map_.min_load_factor(),
-                           ", evict_version: ", evict_version_,
-                           ", compaction_version: ", compaction_version_);
-  }
-
  private:
   size_t val_len_;
   size_t current_version_;
@@ -796,6 +996,7 @@ class SSDHashKV : public KVInterface<K, V> {
   Allocator* alloc_;
 
   int total_dims_;
+  ValueCodec<V> codec_;
   std::string path_;
   std::function<ValuePtr<V>*(size_t)> new_value_ptr_fn_;
 
@@ -821,6 +1022,12 @@ class SSDHashKV : public KVInterface<K, V> {
   volatile bool done_ = false;
   // std::atomic_flag flag_ = ATOMIC_FLAG_INIT; unused
 
+  // Statistics of the reads from SSD, reported by DebugString.
+  std::atomic<int64> read_ops_{0};
+  std::atomic<int64> read_keys_{0};
+  std::atomic<int64> read_bytes_{0};
+  std::atomic<int64> read_micros_{0};
+
   std::function<void()> compaction_fn_;
   std::function<void()> check_buffer_fn_;
   std::function<void(K, const ValuePtr<V>*, bool)> save_kv_fn_;
@@ -63,6 +63,15 @@ class Storage {
       size_t size) = 0;
   virtual Status GetOrCreate(K key, ValuePtr<V>** value_ptr,
       size_t size, CopyBackFlag &need_copyback) = 0;
+  // Batched GetOrCreate, value_ptrs must have room for num entries.
+  // Storages without a batched path fall back to per-key GetOrCreate.
+  virtual Status BatchGetOrCreate(const K* keys, int64 num,
+      ValuePtr<V>** value_ptrs, size_t size) {
+    for (int64 i = 0; i < num; ++i) {
+      TF_RETURN_IF_ERROR(GetOrCreate(keys[i], &value_ptrs[i], size));
+    }
+    return Status::OK();
+  }
   virtual int LookupTier(K key) const = 0;
   virtual Status Remove(K key) = 0;
   virtual int64 Size() const = 0;
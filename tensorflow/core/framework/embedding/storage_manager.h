@@ -111,6 +111,11 @@ class StorageManager {
     return storage_->GetOrCreate(key, value_ptr, size);
   }
 
+  Status BatchGetOrCreate(const K* keys, int64 num,
+      ValuePtr<V>** value_ptrs, size_t size) {
+    return storage_->BatchGetOrCreate(keys, num, value_ptrs, size);
+  }
+
   Status GetOrCreate(K key, ValuePtr<V>** value_ptr,
       size_t size, CopyBackFlag &need_copyback) {
     return storage_->GetOrCreate(key, value_ptr, size, need_copyback);
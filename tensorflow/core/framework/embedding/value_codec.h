@@ -0,0 +1,199 @@
+/* Copyright 2022 The DeepRec Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=======================================================================*/
+
+#ifndef TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_VALUE_CODEC_H_
+#define TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_VALUE_CODEC_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "tensorflow/core/framework/numeric_types.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace embedding {
+
+enum class ValueCodecType {
+  FP32,
+  BF16,
+  FP16,
+  INT8
+};
+
+inline ValueCodecType ParseValueCodecType(const std::string& type) {
+  if (type.empty() || type == "fp32") {
+    return ValueCodecType::FP32;
+  } else if (type == "bf16") {
+    return ValueCodecType::BF16;
+  } else if (type == "fp16") {
+    return ValueCodecType::FP16;
+  } else if (type == "int8") {
+    return ValueCodecType::INT8;
+  }
+  LOG(WARNING) << "Unknown value type: " << type
+               << ", values are stored without compression.";
+  return ValueCodecType::FP32;
+}
+
+// Converts the embedding values of a record to and from the compact
+// form kept by a cold storage tier.
+//  FP32: values are stored as V.
+//  BF16/FP16: one 16-bit float per value.
+//  INT8: one int8 per value, followed by a float scale for every row of
+//        row_len values (symmetric, scale = max|x| / 127).
+// Decode may be done in place (src == dst) since the encoded form is
+// never larger than the decoded one.
+template<typename V>
+class ValueCodec {
+ public:
+  ValueCodec() : type_(ValueCodecType::FP32), row_len_(0) {}
+
+  ValueCodec(ValueCodecType type, int64 row_len)
+      : type_(type), row_len_(row_len) {}
+
+  ValueCodecType type() const { return type_; }
+
+  bool IsIdentity() const { return type_ == ValueCodecType::FP32; }
+
+  void SetRowLen(int64 row_len) { row_len_ = row_len; }
+
+  // Bytes needed for num values, num must be a multiple of row_len.
+  int64 EncodedSize(int64 num) const {
+    switch (type_) {
+      case ValueCodecType::BF16:
+      case ValueCodecType::FP16:
+        return num * sizeof(uint16);
+      case ValueCodecType::INT8:
+        return num * sizeof(int8) + NumRows(num) * sizeof(float);
+      default:
+        return num * sizeof(V);
+    }
+  }
+
+  void Encode(const V* src, int64 num, char* dst) const {
+    switch (type_) {
+      case ValueCodecType::BF16: {
+        uint16* out = reinterpret_cast<uint16*>(dst);
+        for (int64 i = 0; i < num; ++i) {
+          out[i] = FloatToBF16(static_cast<float>(src[i]));
+        }
+        break;
+      }
+      case ValueCodecType::FP16: {
+        Eigen::half* out = reinterpret_cast<Eigen::half*>(dst);
+        for (int64 i = 0; i < num; ++i) {
+          out[i] = Eigen::half(static_cast<float>(src[i]));
+        }
+        break;
+      }
+      case ValueCodecType::INT8: {
+        int8* out = reinterpret_cast<int8*>(dst);
+        float* scales = reinterpret_cast<float*>(dst + num);
+        int64 row_len = RowLen(num);
+        for (int64 r = 0; r * row_len < num; ++r) {
+          const V* row = src + r * row_len;
+          float max_abs = 0.0;
+          for (int64 i = 0; i < row_len; ++i) {
+            max_abs = std::max(max_abs,
+                               std::fabs(static_cast<float>(row[i])));
+          }
+          float scale = max_abs / 127.0f;
+          float inv_scale = scale > 0.0f ? 1.0f / scale : 0.0f;
+          for (int64 i = 0; i < row_len; ++i) {
+            out[r * row_len + i] = static_cast<int8>(
+                std::lrint(static_cast<float>(row[i]) * inv_scale));
+          }
+          memcpy(scales + r, &scale, sizeof(float));
+        }
+        break;
+      }
+      default:
+        memcpy(dst, src, num * sizeof(V));
+    }
+  }
+
+  // Values are decoded from the last to the first one so that an
+  // encoded value is always read before its bytes are overwritten.
+  void Decode(const char* src, int64 num, V* dst) const {
+    switch (type_) {
+      case ValueCodecType::BF16: {
+        const uint16* in = reinterpret_cast<const uint16*>(src);
+        for (int64 i = num - 1; i >= 0; --i) {
+          dst[i] = static_cast<V>(BF16ToFloat(in[i]));
+        }
+        break;
+      }
+      case ValueCodecType::FP16: {
+        const Eigen::half* in = reinterpret_cast<const Eigen::half*>(src);
+        for (int64 i = num - 1; i >= 0; --i) {
+          dst[i] = static_cast<V>(static_cast<float>(in[i]));
+        }
+        break;
+      }
+      case ValueCodecType::INT8: {
+        const int8* in = reinterpret_cast<const int8*>(src);
+        int64 row_len = RowLen(num);
+        std::vector<float> scales(NumRows(num));
+        memcpy(scales.data(), src + num, scales.size() * sizeof(float));
+        for (int64 i = num - 1; i >= 0; --i) {
+          dst[i] = static_cast<V>(in[i] * scales[i / row_len]);
+        }
+        break;
+      }
+      default:
+        if (reinterpret_cast<const char*>(dst) != src) {
+          memcpy(dst, src, num * sizeof(V));
+        }
+    }
+  }
+
+ private:
+  int64 RowLen(int64 num) const {
+    return (row_len_ > 0 && num % row_len_ == 0) ? row_len_ : num;
+  }
+
+  int64 NumRows(int64 num) const {
+    return num == 0 ? 0 : num / RowLen(num);
+  }
+
+  static uint16 FloatToBF16(float v) {
+    uint32 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    if (std::isnan(v)) {
+      return static_cast<uint16>((bits >> 16) | 0x0040);
+    }
+    // Round to nearest even.
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return static_cast<uint16>(bits >> 16);
+  }
+
+  static float BF16ToFloat(uint16 v) {
+    uint32 bits = static_cast<uint32>(v) << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+
+  ValueCodecType type_;
+  int64 row_len_;
+};
+
+}  // namespace embedding
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_FRAMEWORK_EMBEDDING_VALUE_CODEC_H_
@@ -7,6 +7,7 @@
 #include <memory>
 
 #include "tensorflow/core/framework/typed_allocator.h"
+#include "tensorflow/core/platform/prefetch.h"
 #if GOOGLE_CUDA
 #include <cuda_runtime.h>
 #endif  // GOOGLE_CUDA
@@ -18,7 +19,8 @@ enum class LayoutType {
   NORMAL,
   LEVELDB,
   NORMAL_CONTIGUOUS,
-  NORMAL_CONTIGUOUS_GPU
+  NORMAL_CONTIGUOUS_GPU,
+  COMPACT
 };
 
 namespace {
@@ -194,6 +196,85 @@ struct FixedLengthHeader {
         freq_counter, freq_counter + count);
   }
 };
+
+struct CompactHeader {
+/*______________________________________________________________________________
+  |                embeddings                |  slot  |  freq   |   global   |
+  |                    V                     |  flag  | counter |    step    |
+  |              actually value              |        | (satu-  |            |
+  |       (aligned alloc_len per slot)       | 8 bits | rating) |   uint32   |
+  |     (sizeof(V) * slot_num * alloc_len)   |        | 24 bits |            |
+  ------------------------------------------------------------------------------
+  The header is one 8-byte word placed after the embeddings, so the
+  embeddings keep the 16-byte alignment the apply ops rely on.
+*/
+  uint64 word;
+
+  static const int kFreqShift = 32;
+  static const int kFlagShift = 56;
+  static const uint64 kStepMask = 0x00000000ffffffffULL;
+  static const uint64 kFreqMask = 0x00ffffff00000000ULL;
+  static const uint64 kMaxStep = kStepMask;
+  static const uint64 kMaxFreq = kFreqMask >> kFreqShift;
+
+  CompactHeader() : word(0) {}
+
+  inline uint64 Load() {
+    return __atomic_load_n(&word, __ATOMIC_ACQUIRE);
+  }
+
+  inline int64 GetGlobalStep() {
+    return Load() & kStepMask;
+  }
+
+  inline void SetGlobalStep(int64 gs) {
+    uint64 step = gs < 0 ? 0 : static_cast<uint64>(gs);
+    step = step > kMaxStep ? kMaxStep : step;
+    uint64 old_word = Load();
+    while (!__sync_bool_compare_and_swap(&word, old_word,
+               (old_word & ~kStepMask) | step)) {
+      old_word = Load();
+    }
+  }
+
+  inline int64 GetFreqCounter() {
+    return (Load() & kFreqMask) >> kFreqShift;
+  }
+
+  inline void SetFreqCounter(int64 fc) {
+    uint64 freq = fc < 0 ? 0 : static_cast<uint64>(fc);
+    freq = freq > kMaxFreq ? kMaxFreq : freq;
+    uint64 old_word = Load();
+    while (!__sync_bool_compare_and_swap(&word, old_word,
+               (old_word & ~kFreqMask) | (freq << kFreqShift))) {
+      old_word = Load();
+    }
+  }
+
+  inline void AddFreq(int64 count) {
+    uint64 old_word = Load();
+    while (true) {
+      uint64 freq = (old_word & kFreqMask) >> kFreqShift;
+      if (freq == kMaxFreq) {
+        return;
+      }
+      freq = freq + count > kMaxFreq ? kMaxFreq : freq + count;
+      if (__sync_bool_compare_and_swap(&word, old_word,
+              (old_word & ~kFreqMask) | (freq << kFreqShift))) {
+        return;
+      }
+      old_word = Load();
+    }
+  }
+
+  inline bool IsInitialized(int64 emb_index) {
+    return (Load() >> (kFlagShift + emb_index)) & 1;
+  }
+
+  inline void SetInitialized(int64 emb_index) {
+    __sync_fetch_and_or(&word, 1ULL << (kFlagShift + emb_index));
+  }
+};
 } // namespace
 
 template <class V>
@@ -270,6 +351,12 @@ class ValuePtr {
     return ptr_;
   }
 
+  // Bring the header (and for contiguous layouts the head of the values)
+  // into cache ahead of a batched access.
+  inline void Prefetch() const {
+    port::prefetch<port::PREFETCH_HINT_T0>(ptr_);
+  }
+
   // Global Step
   virtual int64 GetStep() {
     LOG(FATAL) << "Unsupport GlobalStep in subclass of ValuePtrBase";
@@ -456,6 +543,91 @@ class NormalContiguousValuePtr : public ValuePtr<V>{
   }
 };
 
+// Fixed-width layout for large DRAM EVs: the embeddings of all slots
+// are stored inline and step, frequency and the slot flags share one
+// 8-byte word, so the per-key overhead is 8 bytes plus this object.
+template <class V>
+class CompactValuePtr : public ValuePtr<V> {
+ public:
+  CompactValuePtr(Allocator* allocator, size_t size)
+      : header_offset_(sizeof(V) * size) {
+    this->ptr_ = allocator->AllocateRaw(Allocator::kAllocatorAlignment,
+        header_offset_ + sizeof(CompactHeader));
+    memset(this->ptr_, 0, header_offset_);
+    new ((char*)this->ptr_ + header_offset_) CompactHeader();
+  }
+
+  ~CompactValuePtr() {
+  }
+
+  V* GetOrAllocate(Allocator* allocator, int64 value_len,
+      const V* default_v, int emb_index, int offset) override {
+    V* tensor_val = (V*)this->ptr_ + offset;
+    if (!Header()->IsInitialized(emb_index)) {
+      while(this->flag_.test_and_set(std::memory_order_acquire));
+      if (!Header()->IsInitialized(emb_index)) {
+        memcpy(tensor_val, default_v, sizeof(V) * value_len);
+        Header()->SetInitialized(emb_index);
+      }
+      this->flag_.clear(std::memory_order_release);
+    }
+    return tensor_val;
+  }
+
+  V* GetValue(int emb_index, int offset) override {
+    if (Header()->IsInitialized(emb_index)) {
+      return (V*)this->ptr_ + offset;
+    } else {
+      return nullptr;
+    }
+  }
+
+  void Destroy(Allocator* allocator) override {
+    allocator->DeallocateRaw(this->ptr_);
+  }
+
+  int64 GetStep() override {
+    return Header()->GetGlobalStep();
+  }
+
+  void SetStep(int64 gs) override {
+    Header()->SetGlobalStep(gs);
+  }
+
+  int64 GetFreq() override {
+    return Header()->GetFreqCounter();
+  }
+
+  void SetFreq(int64 freq) override {
+    Header()->SetFreqCounter(freq);
+  }
+
+  void AddFreq() override {
+    Header()->AddFreq(1);
+  }
+
+  void AddFreq(int count) override {
+    Header()->AddFreq(count);
+  }
+
+  void SetValue(V val, size_t size) override {
+    for (int i = 0; i < size; ++i) {
+      *((V*)this->ptr_ + i) = val;
+    }
+  }
+
+  void SetInitialized(int64 emb_index) override {
+    Header()->SetInitialized(emb_index);
+  }
+
+ private:
+  inline CompactHeader* Header() {
+    return (CompactHeader*)((char*)this->ptr_ + header_offset_);
+  }
+
+  uint32 header_offset_;
+};
+
 template <class V>
 class NormalGPUValuePtr : public ValuePtr<V> {
  public:
@@ -22,12 +22,22 @@ limitations under the License.
 #include "tensorflow/core/framework/hash_table/status_collector.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/random/random.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/util/env_var.h"
 
 namespace {
 static constexpr float kMaxLoadFactor = 0.5;
 static constexpr tensorflow::int64 kPartitionBlockSize = 65536;
 static constexpr int kPreAllocIds = 256;
+// Smaller splits rehash in place, it is fast enough.
+static constexpr tensorflow::int64 kMinMigrateBuckets = 1 << 20;
+// A larger map is prepared once a split is this full.
+static constexpr float kGrowLoadFactor = 0.75 * kMaxLoadFactor;
+// Entries moved to the larger map on each insert.
+static constexpr int kMigrateStep = 16;
+// The tensibles are grown ahead by 1/8 of their size, at most this many
+// slices.
+static constexpr tensorflow::int64 kMaxGrowAheadSlices = 16;
 static const int64_t kPreseverdEmptyKey =
     tensorflow::random::New64Configuable();
 }
@@ -105,6 +115,118 @@ void HashTable::IdsAllocator::Clear() {
   counter_ = 0;
 }
 
+HashTable::IdTable::IdTable() : map_(NewMap(0)) {
+}
+
+std::unique_ptr<HashTable::IdMap> HashTable::IdTable::NewMap(int64 size) {
+  std::unique_ptr<IdMap> map(new IdMap);
+  map->max_load_factor(kMaxLoadFactor);
+  map->set_empty_key(kPreseverdEmptyKey);
+  map->set_deleted_key(kPreseverdEmptyKey + 1);
+  if (size > 0) {
+    map->resize(size);
+  }
+  return map;
+}
+
+const int64* HashTable::IdTable::Find(int64 key) const {
+  auto iter = map_->find(key);
+  if (iter != map_->end()) {
+    return &iter->second;
+  }
+  if (old_map_ != nullptr) {
+    iter = old_map_->find(key);
+    if (iter != old_map_->end()) {
+      return &iter->second;
+    }
+  }
+  return nullptr;
+}
+
+void HashTable::IdTable::Insert(int64 key, int64 id) {
+  if (old_map_ != nullptr) {
+    Migrate(kMigrateStep);
+  } else if (map_->bucket_count() >= kMinMigrateBuckets &&
+             map_->size() + 1 > map_->bucket_count() * kMaxLoadFactor) {
+    // No larger map was prepared, allocate it here.
+    Grow(NewMap(2 * map_->bucket_count() * kMaxLoadFactor));
+  }
+  auto inserted = map_->insert(std::make_pair(key, id));
+  if (!inserted.second) {
+    inserted.first->second = id;
+  } else if (old_map_ != nullptr) {
+    // A not admitted key may still wait in old_map_, it is replaced.
+    EraseOld(key, false);
+  }
+}
+
+bool HashTable::IdTable::Erase(int64 key) {
+  bool erased = map_->erase(key) > 0;
+  if (old_map_ != nullptr) {
+    erased = EraseOld(key, erased) || erased;
+  }
+  return erased;
+}
+
+bool HashTable::IdTable::EraseOld(int64 key, bool migrated) {
+  auto iter = old_map_->find(key);
+  if (iter == old_map_->end()) {
+    return false;
+  }
+  if (IdMap::const_iterator(iter) == migrate_pos_) {
+    ++migrate_pos_;
+  }
+  if (!migrated) {
+    --old_remaining_;
+  }
+  // Erasing never rehashes, migrate_pos_ stays valid.
+  old_map_->erase(iter);
+  return true;
+}
+
+void HashTable::IdTable::Clear() {
+  map_->clear();
+  old_map_.reset();
+  old_remaining_ = 0;
+}
+
+int64 HashTable::IdTable::Size() const {
+  return map_->size() + old_remaining_;
+}
+
+int64 HashTable::IdTable::GrowSize() const {
+  if (old_map_ != nullptr || map_->bucket_count() < kMinMigrateBuckets ||
+      map_->size() < map_->bucket_count() * kGrowLoadFactor) {
+    return 0;
+  }
+  return 2 * map_->bucket_count() * kMaxLoadFactor;
+}
+
+void HashTable::IdTable::Grow(std::unique_ptr<IdMap> map) {
+  if (old_map_ != nullptr || map->bucket_count() <= map_->bucket_count()) {
+    // Grown by another thread in the meantime.
+    return;
+  }
+  old_map_ = std::move(map_);
+  map_ = std::move(map);
+  migrate_pos_ = old_map_->begin();
+  old_remaining_ = old_map_->size();
+}
+
+void HashTable::IdTable::Migrate(int64 count) {
+  // Nothing is inserted into old_map_, so it never rehashes and
+  // migrate_pos_ stays valid.
+  for (; count > 0 && migrate_pos_ != old_map_->end(); --count) {
+    map_->insert(*migrate_pos_);
+    ++migrate_pos_;
+    --old_remaining_;
+  }
+  if (migrate_pos_ == old_map_->end()) {
+    old_map_.reset();
+    old_remaining_ = 0;
+  }
+}
+
 HashTable::HashTable(int num_worker_threads, bool concurrent_read,
     int slice_size, int id_block_size)
   : slice_size_(slice_size), id_block_size_(id_block_size),
@@ -118,12 +240,7 @@ HashTable::HashTable(int num_worker_threads, bool concurrent_read,
         kPreseverdEmptyKey << " and " << kPreseverdEmptyKey + 1;
     return '\0';
   }();
-  for (int64 i = 0; i < num_tables_; ++i) {
-    tables_.emplace_back();
-    tables_.back().max_load_factor(kMaxLoadFactor);
-    tables_.back().set_empty_key(kPreseverdEmptyKey);
-    tables_.back().set_deleted_key(kPreseverdEmptyKey + 1);
-  }
+  tables_.resize(num_tables_);
 }
 
 void HashTable::AddTensible(
@@ -141,6 +258,12 @@ void HashTable::AddTensible(
 }
 
 HashTable::~HashTable() {
+  {
+    mutex_lock lock(grow_mu_);
+    while (grow_scheduled_) {
+      grow_cv_.wait(lock);
+    }
+  }
   for (auto tensor : tensors_) {
     tensor->Unref();
   }
@@ -304,6 +427,7 @@ void HashTable::GetIdsSimpleForConcurrentRead(
   int64 new_id_size = 0;
   int64 sizex = 0;
   int64 cur_idx;
+  int64 grow_size = 0;
   {
     tf_shared_lock rlock(table_locks_[table_idx]);
     for (int64 i = 0; i < partition_threads; ++i) {
@@ -312,9 +436,9 @@ void HashTable::GetIdsSimpleForConcurrentRead(
       while(next_idx != -1) {
         cur_idx = next_idx;
         next_idx = ids[next_idx];
-        auto iter = tables_[table_idx].find(keys[cur_idx]);
-        if (iter != tables_[table_idx].end() && iter->second != kNotAdmitted) {
-          ids[cur_idx] = iter->second;
+        const int64* id = tables_[table_idx].Find(keys[cur_idx]);
+        if (id != nullptr && *id != kNotAdmitted) {
+          ids[cur_idx] = *id;
           sizex = std::max(sizex, ids[cur_idx]);
         } else {
           // do admit
@@ -330,10 +454,21 @@ void HashTable::GetIdsSimpleForConcurrentRead(
         }
       }
     }
+    if (new_id_list != -1) {
+      grow_size = tables_[table_idx].GrowSize();
+    }
   }
   // do alloc ids
   if (new_id_list != -1) {
+    // allocate the grown map before blocking the readers
+    std::unique_ptr<IdMap> grown_map;
+    if (grow_size > 0) {
+      grown_map = IdTable::NewMap(grow_size);
+    }
     mutex_lock wlock(table_locks_[table_idx]);
+    if (grown_map != nullptr) {
+      tables_[table_idx].Grow(std::move(grown_map));
+    }
     {
       mutex_lock lock(update_mu_);
       ids_allocator_.GetIds(new_id_size, &ids_container_[table_idx]);
@@ -341,13 +476,13 @@ void HashTable::GetIdsSimpleForConcurrentRead(
     while (new_id_list != -1) {
       cur_idx = new_id_list;
       new_id_list = ids[new_id_list];
-      auto iter = tables_[table_idx].find(keys[cur_idx]);
-      if (iter != tables_[table_idx].end() && iter->second != kNotAdmitted) {
-        ids[cur_idx] = iter->second;
+      const int64* id = tables_[table_idx].Find(keys[cur_idx]);
+      if (id != nullptr && *id != kNotAdmitted) {
+        ids[cur_idx] = *id;
       } else {
         CHECK(ids_container_[table_idx].GetNext(&ids[cur_idx])) <<
             "new_id_size: " << new_id_size;
-        tables_[table_idx][keys[cur_idx]] = ids[cur_idx];
+        tables_[table_idx].Insert(keys[cur_idx], ids[cur_idx]);
       }
       sizex = std::max(sizex, ids[cur_idx]);
     }
@@ -361,21 +496,34 @@ void HashTable::GetIdsSimpleForExclusiveAccess(
     int64* partitions, int64 partition_threads, int64 table_idx,
     HashTableAdmitStrategy* admit_strategy,
     std::function<void(Status)> done) {
+  // allocate the grown map before locking the split
+  std::unique_ptr<IdMap> grown_map;
+  int64 grow_size = 0;
+  {
+    tf_shared_lock rlock(table_locks_[table_idx]);
+    grow_size = tables_[table_idx].GrowSize();
+  }
+  if (grow_size > 0) {
+    grown_map = IdTable::NewMap(grow_size);
+  }
   // do find
   int64 sizex = 0;
   int64 cur_idx;
   {
     mutex_lock lock(table_locks_[table_idx]);
+    if (grown_map != nullptr) {
+      tables_[table_idx].Grow(std::move(grown_map));
+    }
     for (int64 i = 0; i < partition_threads; ++i) {
       int64 next_idx = *(partitions + table_idx);
       partitions += num_tables_;
       while(next_idx != -1) {
         cur_idx = next_idx;
         next_idx = ids[next_idx];
-        auto iter = tables_[table_idx].find(keys[cur_idx]);
+        const int64* id = tables_[table_idx].Find(keys[cur_idx]);
         // item found
-        if (iter != tables_[table_idx].end() && iter->second != kNotAdmitted) {
-          ids[cur_idx] = iter->second;
+        if (id != nullptr && *id != kNotAdmitted) {
+          ids[cur_idx] = *id;
           sizex = std::max(sizex, ids[cur_idx]);
           continue;
         }
@@ -392,7 +540,7 @@ void HashTable::GetIdsSimpleForExclusiveAccess(
           ids_allocator_.GetIds(kPreAllocIds, &ids_container_[table_idx]);
           CHECK(ids_container_[table_idx].GetNext(&ids[cur_idx]));
         }
-        tables_[table_idx][keys[cur_idx]] = ids[cur_idx];
+        tables_[table_idx].Insert(keys[cur_idx], ids[cur_idx]);
         sizex = std::max(sizex, ids[cur_idx]);
       }
     }
@@ -405,29 +553,67 @@ void HashTable::GetIdsSimpleForExclusiveAccess(
 void HashTable::Resize(int64 size, std::function<void(Status)> done) {
   if (size_ >= size) {
     done(Status::OK());
+    MaybeGrowAhead(size);
     return;
   }
   AddTask([size, done, this] {
-    if (size_ >= size) {
-      done(Status::OK());
+    ResizeTensibles(size, [this, done] (Status st) {
+      done(st);
       RunNext();
-      return;
-    } else {
-      StatusCollector* stc = new StatusCollector(tensors_.size(),
-      [this, size, done] (Status st) {
-        if (st.ok()) {
-          size_ = std::max(size_.load(), size);
+    });
+  });
+}
+
+void HashTable::ResizeTensibles(int64 size,
+                                std::function<void(Status)> done) {
+  if (size_ >= size) {
+    done(Status::OK());
+    return;
+  }
+  StatusCollector* stc = new StatusCollector(tensors_.size(),
+  [this, size, done] (Status st) {
+    if (st.ok()) {
+      size_ = std::max(size_.load(), size);
+    }
+    done(st);
+  });
+  for (auto tensor : tensors_) {
+    tensor->Resize(size, [stc] (Status st) {
+      stc->AddStatus(st);
+    });
+  }
+  stc->Start();
+}
+
+void HashTable::MaybeGrowAhead(int64 size) {
+  int64 allocated = size_;
+  int64 ahead = std::min(allocated / 8, kMaxGrowAheadSlices * slice_size_);
+  ahead = ahead / slice_size_ * slice_size_;
+  if (ahead == 0 || size <= allocated - ahead ||
+      growing_ahead_.exchange(true)) {
+    return;
+  }
+  // AddTask runs the resize inline when no other resize is queued, so
+  // move it off the GetIds caller.
+  {
+    mutex_lock lock(grow_mu_);
+    grow_scheduled_ = true;
+  }
+  Env::Default()->SchedClosure([this, allocated, ahead] {
+    AddTask([this, allocated, ahead] {
+      ResizeTensibles(allocated + ahead, [this] (Status st) {
+        if (!st.ok()) {
+          LOG(WARNING) << "HashTable grow ahead failed: " << st.ToString();
         }
-        done(st);
+        growing_ahead_ = false;
         RunNext();
+        // The table may be freed as soon as grow_scheduled_ is cleared,
+        // nothing touches it after this.
+        mutex_lock lock(grow_mu_);
+        grow_scheduled_ = false;
+        grow_cv_.notify_all();
       });
-      for (auto tensor : tensors_) {
-        tensor->Resize(size, [stc] (Status st) {
-          stc->AddStatus(st);
-        });
-      }
-      stc->Start();
-    }
+    });
   });
 }
 
@@ -476,7 +662,7 @@ void HashTable::DeleteKeysSimple(
     mutex_lock lock(update_mu_);
     for (int64 i = 0; i < size; ++i) {
       int64 table_idx =  KeyToTableIdx(keys + i);
-      if (tables_[table_idx].erase(keys[i]) && ids[i] != kNotAdmitted) {
+      if (tables_[table_idx].Erase(keys[i]) && ids[i] != kNotAdmitted) {
         ids_allocator_.FreeId(ids[i]);
       }
     }
@@ -506,7 +692,7 @@ void HashTable::Clear(const std::function<void(Status)>& done) {
         tensor->Clear();
       }
       for (int64 i = 0; i < num_tables_; ++i) {
-        tables_[i].clear();
+        tables_[i].Clear();
       }
       ids_allocator_.Clear();
       for (int64 i = 0; i < num_tables_; ++i) {
@@ -514,6 +700,8 @@ void HashTable::Clear(const std::function<void(Status)>& done) {
       }
       size_ = 0;
     }
+    // a pending grow ahead task is dropped with the others
+    growing_ahead_ = false;
     done(Status::OK());
     ClearAllTask();
   });
@@ -524,11 +712,11 @@ std::vector<std::pair<int64, int64>> HashTable::Snapshot() {
   int64 size = size_;
   std::vector<std::pair<int64, int64>> ret;
   for (int64 i = 0; i < num_tables_; ++i) {
-    for (auto iter = tables_[i].begin(); iter != tables_[i].end(); ++iter) {
-      if (iter->second < size) {
-        ret.emplace_back(iter->first, iter->second);
+    tables_[i].ForEach([size, &ret](int64 key, int64 id) {
+      if (id < size) {
+        ret.emplace_back(key, id);
       }
-    }
+    });
   }
   return ret;
 }
@@ -540,12 +728,12 @@ void HashTable::Snapshot(std::vector<int64>* keys,
   keys->reserve(size);
   ids->reserve(size);
   for (int64 i = 0; i < num_tables_; ++i) {
-    for (auto iter = tables_[i].begin(); iter != tables_[i].end(); ++iter) {
-      if (iter->second < size) {
-        keys->push_back(iter->first);
-        ids->push_back(iter->second);
+    tables_[i].ForEach([size, keys, ids](int64 key, int64 id) {
+      if (id < size) {
+        keys->push_back(key);
+        ids->push_back(id);
       }
-    }
+    });
   }
 }
 
@@ -553,14 +741,14 @@ int64 HashTable::GetIdsWithoutResize(int64* keys, int64* ids, int64 size) {
   mutex_lock lock(update_mu_);
   for (int64 i = 0; i < size; i++) {
     int64 table_idx = KeyToTableIdx(keys + i);
-    auto iter = tables_[table_idx].find(keys[i]);
-    if (iter != tables_[table_idx].end() && iter->second != kNotAdmitted) {
-      ids[i] = iter->second;
+    const int64* id = tables_[table_idx].Find(keys[i]);
+    if (id != nullptr && *id != kNotAdmitted) {
+      ids[i] = *id;
     } else {
       int64 new_id;
       ids_allocator_.GetId(&new_id);
       size_++;
-      tables_[table_idx][keys[i]] = new_id;
+      tables_[table_idx].Insert(keys[i], new_id);
       ids[i] = new_id;
     }
   }
@@ -608,11 +796,11 @@ Status CoalescedHashTable::ChildSnapshot(
   string child_name = ChildName(name);
   int64 index = index_map_[child_name];
   for (int64 i = 0; i < num_tables_; ++i) {
-    for (auto iter = tables_[i].begin(); iter != tables_[i].end(); ++iter) {
-      if (iter->second < size && Match(iter->first, index)) {
-        output->emplace_back(Decode(iter->first), iter->second);
+    tables_[i].ForEach([size, index, output](int64 key, int64 id) {
+      if (id < size && Match(key, index)) {
+        output->emplace_back(Decode(key), id);
       }
-    }
+    });
   }
   return Status::OK();
 }
@@ -658,17 +846,22 @@ void CoalescedHashTable::ClearMatchedKeys(
     const std::function<void(Status)>& done) {
   mutex_lock lock(update_mu_);
   std::vector<int64> ids;
+  std::vector<int64> matched_keys;
   for (int64 i = 0; i < num_tables_; ++i) {
-    for (auto iter = tables_[i].begin(); iter != tables_[i].end(); ) {
-      if (match(iter->first)) {
-        ids.push_back(iter->second);
-        iter = tables_[i].erase(iter);
-        if (ids.back() != kNotAdmitted) {
-          ids_allocator_.FreeId(ids.back());
-        }
-      } else {
-        ++iter;
+    matched_keys.clear();
+    tables_[i].ForEach([&match, &matched_keys, &ids](int64 key, int64 id) {
+      if (match(key)) {
+        matched_keys.push_back(key);
+        ids.push_back(id);
       }
+    });
+    for (auto key : matched_keys) {
+      tables_[i].Erase(key);
+    }
+  }
+  for (auto id : ids) {
+    if (id != kNotAdmitted) {
+      ids_allocator_.FreeId(id);
     }
   }
   StatusCollector* stc = new StatusCollector(tensors_.size(), done);
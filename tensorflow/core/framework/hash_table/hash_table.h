@@ -90,6 +90,12 @@ class HashTable {
       HashTableAdmitStrategy* admit_strategy,
       std::function<void(Status)> done);
   void Resize(int64 size, std::function<void(Status)> done);
+  // Grows the tensibles to size from within a task, done runs before the
+  // next task does.
+  void ResizeTensibles(int64 size, std::function<void(Status)> done);
+  // Grows the tensibles in the background when size gets close to the
+  // allocated size, so GetIds rarely waits for the allocation.
+  void MaybeGrowAhead(int64 size);
 
   void AddTask(std::function<void()> task);
   void RunNext();
@@ -117,7 +123,61 @@ class HashTable {
         return x;
       }
   };
-  std::vector<google::dense_hash_map<int64, int64, IdHash>> tables_;
+  typedef google::dense_hash_map<int64, int64, IdHash> IdMap;
+
+  // One split of the key to id map. A dense_hash_map rehashes all of its
+  // entries at once when it grows, which blocks the split for seconds
+  // when it holds hundreds of millions of keys. IdTable grows into a
+  // second map instead: new keys go to the larger map, lookups check both
+  // and every insert moves a few entries of the old map over, so growth
+  // is spread over the inserts that follow it. The larger map is
+  // allocated outside of the split lock.
+  class IdTable {
+   public:
+    IdTable();
+
+    // Returns the id of key or nullptr. Needs the split lock, shared.
+    const int64* Find(int64 key) const;
+    // Inserts or updates key. Needs the split lock, exclusive.
+    void Insert(int64 key, int64 id);
+    bool Erase(int64 key);
+    void Clear();
+    int64 Size() const;
+
+    // Size of the larger map to prepare for the coming inserts, 0 if the
+    // table needs none. Needs the split lock, shared.
+    int64 GrowSize() const;
+    // Starts growing into map, which NewMap(GrowSize()) allocated without
+    // the split lock. Needs the split lock, exclusive.
+    void Grow(std::unique_ptr<IdMap> map);
+    static std::unique_ptr<IdMap> NewMap(int64 size);
+
+    // Calls fn(key, id) once for each key.
+    template <typename Fn>
+    void ForEach(const Fn& fn) const {
+      for (auto iter = map_->begin(); iter != map_->end(); ++iter) {
+        fn(iter->first, iter->second);
+      }
+      if (old_map_ != nullptr) {
+        for (auto iter = migrate_pos_; iter != old_map_->end(); ++iter) {
+          fn(iter->first, iter->second);
+        }
+      }
+    }
+
+   private:
+    void Migrate(int64 count);
+    // Drops key from old_map_, migrated tells whether it was moved to map_
+    // already. Returns false if it was not there.
+    bool EraseOld(int64 key, bool migrated);
+
+    std::unique_ptr<IdMap> map_;
+    // Entries of old_map_ from migrate_pos_ on are not in map_ yet.
+    std::unique_ptr<IdMap> old_map_;
+    IdMap::const_iterator migrate_pos_;
+    int64 old_remaining_ = 0;
+  };
+  std::vector<IdTable> tables_;
 
   class IdsContainer {
    public:
@@ -153,6 +213,12 @@ class HashTable {
   mutex task_mu_;
   std::queue<std::function<void()>> tasks_;
   std::atomic<int64> size_;
+  std::atomic<bool> growing_ahead_{false};
+  // Set from scheduling a grow ahead until its resize completed and ran
+  // the next task, so the destructor does not free the table under it.
+  mutex grow_mu_;
+  condition_variable grow_cv_;
+  bool grow_scheduled_ = false;
 
   std::vector<TensibleVariable*> tensors_;
 
@@ -13,12 +13,17 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
 #include <utility>
 
 #include "tensorflow/core/framework/hash_table/hash_table.h"
 #include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
 
 #include "gmock/gmock.h"
 
@@ -96,6 +101,132 @@ TEST(HashTable, Simple) {
   }
 }
 
+TEST(HashTable, GrowLargeSplit) {
+  // One split, large enough to be grown by migrating into a second map.
+  HashTable ht(1, true);
+  const int64 kNumKeys = 1500000;
+  const int64 kBatch = 4096;
+  std::vector<int64> keys(kNumKeys), ids(kNumKeys);
+  for (int64 i = 0; i < kNumKeys; i++) {
+    keys[i] = i * 7 + 3;
+  }
+  for (int64 i = 0; i < kNumKeys; i += kBatch) {
+    int64 size = std::min(kBatch, kNumKeys - i);
+    ht.GetIdsWithoutResize(&keys[i], &ids[i], size);
+    // Keys inserted before keep their ids while the split grows.
+    int64 j = i / 2;
+    int64 id;
+    ht.GetIdsWithoutResize(&keys[j], &id, 1);
+    EXPECT_EQ(ids[j], id);
+  }
+
+  std::vector<int64> again(kNumKeys);
+  ht.GetIdsWithoutResize(keys.data(), again.data(), kNumKeys);
+  EXPECT_EQ(ids, again);
+  EXPECT_EQ(kNumKeys, ht.Snapshot().size());
+
+  Status rst_status;
+  ht.DeleteKeysSimple(keys.data(), ids.data(), kNumKeys / 2,
+                      [&](Status st) { rst_status = st; });
+  TF_ASSERT_OK(rst_status);
+  std::vector<std::pair<int64, int64>> snapshot = ht.Snapshot();
+  EXPECT_EQ(kNumKeys - kNumKeys / 2, snapshot.size());
+  std::sort(snapshot.begin(), snapshot.end());
+  for (int64 i = kNumKeys / 2; i < kNumKeys; i++) {
+    EXPECT_EQ(keys[i], snapshot[i - kNumKeys / 2].first);
+    EXPECT_EQ(ids[i], snapshot[i - kNumKeys / 2].second);
+  }
+}
+
+namespace {
+
+class GrowAheadHashTable : public HashTable {
+ public:
+  using HashTable::HashTable;
+  using HashTable::Resize;
+};
+
+}
+
+TEST(HashTable, DestroyWhileGrowingAhead) {
+  // Slices are generated asynchronously and slowly, so the grow ahead is
+  // still waiting for them when the table is destroyed.
+  TensorGenerator* generator = new TensorGenerator(
+  [](TensorGenerator::Consumer consumer) {
+    Env::Default()->SchedClosure([consumer] {
+      Env::Default()->SleepForMicroseconds(10 * 1000);
+      Tensor t(DT_INT64, TensorShape({4, 2}));
+      t.flat<int64>().setZero();
+      consumer(Status::OK(), t);
+    });
+  });
+  TensibleVariable* tv = new TensibleVariable(
+      generator, TensorShape({4, 2}), DT_INT64);
+  generator->Unref();
+  GrowAheadHashTable* ht = new GrowAheadHashTable(1, true, 4, 4);
+  Notification added;
+  ht->AddTensible(tv, [&added](Status st) {
+    TF_EXPECT_OK(st);
+    added.Notify();
+  });
+  added.WaitForNotification();
+  Notification resized;
+  ht->Resize(512, [&resized](Status st) {
+    TF_EXPECT_OK(st);
+    resized.Notify();
+  });
+  resized.WaitForNotification();
+  EXPECT_EQ(512, tv->Size());
+
+  // Close to the allocated size, grows 16 slices ahead in the background.
+  ht->Resize(500, [](Status st) { TF_EXPECT_OK(st); });
+  delete ht;
+  // The destructor waited for the grow ahead to finish.
+  EXPECT_EQ(576, tv->Size());
+  tv->Unref();
+}
+
+// Latency of GetIds while the table keeps growing, half of each batch are
+// new keys.
+static void BM_HashTableGetIdsWhileGrowing(int iters, int batch_size) {
+  testing::StopTiming();
+  TensorGenerator* generator = new TensorGenerator(
+  [](TensorGenerator::Consumer consumer) {
+    Tensor t(DT_FLOAT, TensorShape({4096, 8}));
+    t.flat<float>().setZero();
+    consumer(Status::OK(), t);
+  });
+  TensibleVariable* tv = new TensibleVariable(
+      generator, TensorShape({4096, 8}), DT_FLOAT);
+  generator->Unref();
+  HashTable ht(8, true);
+  ht.AddTensible(tv, [](Status st) { TF_CHECK_OK(st); });
+  tv->Unref();
+
+  std::vector<int64> keys(batch_size), ids(batch_size);
+  std::vector<uint64> micros;
+  micros.reserve(iters);
+  int64 next_key = 0;
+  testing::StartTiming();
+  for (int i = 0; i < iters; i++) {
+    for (int j = 0; j < batch_size; j++) {
+      keys[j] = (j % 2 == 0 || next_key == 0) ? next_key++
+                                              : (keys[j - 1] * 31) % next_key;
+    }
+    uint64 start = Env::Default()->NowMicros();
+    ht.GetIds(keys.data(), nullptr, ids.data(), batch_size, nullptr,
+              nullptr, [](Status st) { TF_CHECK_OK(st); }, false);
+    micros.push_back(Env::Default()->NowMicros() - start);
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * batch_size);
+  std::sort(micros.begin(), micros.end());
+  testing::SetLabel(strings::StrCat(
+      "p50: ", micros[micros.size() / 2], "us p99: ",
+      micros[micros.size() * 99 / 100], "us max: ", micros.back(), "us"));
+}
+BENCHMARK(BM_HashTableGetIdsWhileGrowing)->Arg(1024)->Arg(16384);
+
 }  // namespace tensorflow
 
 
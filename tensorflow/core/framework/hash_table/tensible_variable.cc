@@ -34,7 +34,7 @@ TensibleVariable::TensibleVariable(
   all_ptr_vec_.emplace_back();
   all_ptr_vec_.back().size = kPtrStartSize;
   all_ptr_vec_.back().ptr.reset(new char*[kPtrStartSize]);
-  ptrs_ = all_ptr_vec_.back().ptr.get();
+  ptrs_.store(all_ptr_vec_.back().ptr.get(), std::memory_order_release);
   generator_->Ref();
 }
 
@@ -51,7 +51,7 @@ void TensibleVariable::Resize(
   int64_t segment_count = (size - size_ - 1) / segment_size_ + 1;
   StatusCollector* stc = new StatusCollector(segment_count, [this, done](Status st) {
     if (st.ok()) {
-      ptrs_ = all_ptr_vec_.back().ptr.get();
+      ptrs_.store(all_ptr_vec_.back().ptr.get(), std::memory_order_release);
       size_ = tensors_.size() * segment_size_;
     }
     done(st);
@@ -111,7 +111,7 @@ void TensibleVariable::ZeroCostResize(int64 size) {
       const_cast<char*>(tensors_.back().tensor_data().data());
   }
   size_ = tensors_.size() * segment_size_;
-  ptrs_ = all_ptr_vec_.back().ptr.get();
+  ptrs_.store(all_ptr_vec_.back().ptr.get(), std::memory_order_release);
 }
 
 void TensibleVariable::Pad(
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_FRAMEWORK_HASH_TABLE_TENSIBLE_VARIABLE_H_
 #define TENSORFLOW_CORE_FRAMEWORK_HASH_TABLE_TENSIBLE_VARIABLE_H_
 
+#include <atomic>
 #include <vector>
 #include <deque>
 #include <memory>
@@ -39,8 +40,9 @@ class TensibleVariable : public core::RefCounted {
   int64 SliceSize() const { return slice_size_; }
   template<typename T = void>
   T* GetSlice(int64_t id) const {
+    char** ptrs = ptrs_.load(std::memory_order_acquire);
     return reinterpret_cast<T*>
-      (ptrs_[id / segment_size_] + (id % segment_size_) * slice_size_);
+      (ptrs[id / segment_size_] + (id % segment_size_) * slice_size_);
   }
 
   void LockUpdate() {
@@ -87,7 +89,11 @@ class TensibleVariable : public core::RefCounted {
   };
   std::vector<PtrSpec> all_ptr_vec_;
 
-  char** ptrs_;
+  // Readers go through ptrs_ without any lock while Resize appends
+  // segments. A full segment array is copied into a larger one, which is
+  // published once its new segments are set, and the old arrays are kept
+  // alive, so a reader never sees a half built array.
+  std::atomic<char**> ptrs_;
 
   mutex update_mu_;
 
@@ -18,6 +18,7 @@ limitations under the License.
 #include "tensorflow/core/graph/optimizer_fusion_engine.h"
 #include "tensorflow/core/graph/optimizer_fusion_engine_impl.h"
 #include "tensorflow/core/graph/template_base.h"
+#include "tensorflow/core/graph/template_kv_sparse_segment_reduce.h"
 #include "tensorflow/core/graph/template_logicsum_base.h"
 #include "tensorflow/core/graph/template_select_then_scalar.h"
 #include "tensorflow/core/graph/template_select_then_scalar_in_grad.h"
@@ -40,6 +41,15 @@ bool OptimizeFusion(Graph* g) {
   templates.emplace_back(new TemplateSelectElseScalar());
   templates.emplace_back(new TemplateSelectElseScalarInGrad());
   templates.emplace_back(new TemplateSelectThenScalarInGrad());
+  // embedding_lookup_sparse of an EmbeddingVariable reads the rows through
+  // up to two Identity ops, which grappler may have removed.
+  for (const char* segment_op : {"SparseSegmentSum", "SparseSegmentMean",
+                                 "SparseSegmentSqrtN"}) {
+    for (int num_identities = 2; num_identities >= 0; --num_identities) {
+      templates.emplace_back(
+          new TemplateKvSparseSegmentReduce(segment_op, num_identities));
+    }
+  }
 
   for (auto& t : templates) {
     std::unique_ptr<OptimizerFusionImpl> opt(
@@ -635,6 +635,59 @@ TEST_F(OptimizerFusionTest, SparseInnerFlattenFuse) {
       "A(Const);B(Const);C(Const);D(Const);E(Const);F(Const);G(InputInt64);H(StridedSlice);I(StridedSlice);J(Const);K(Prod);L(Pack);M(ConcatV2);N(Const);O(SparseReshape);P(InputInt64);R(Identity);S(Identity)|A->H:1;B->H:2;C->H:3;D->I:1;E->I:2;F->I:3;G->H;G->I;G->O:1;H->M;I->K;J->K:1;K->L;L->M:1;M->O:2;N->M:2;O->R;O->S;P->O");
 }
 
+REGISTER_OP("InputInt32").Output("o: int32").SetIsStateful();
+REGISTER_OP("InputResource").Output("o: resource").SetIsStateful();
+
+static const char* kKvSparseSegmentMeanGraph =
+    "node { name: 'A' op: 'InputResource' }"
+    "node { name: 'B' op: 'InputInt64' }"
+    "node { name: 'C' op: 'Input' }"
+    "node { name: 'D' op: 'InputInt32' }"
+
+    "node { name: 'E' op: 'Unique'"
+    " attr { key: 'T' value { type: DT_INT64 } }"
+    " attr { key: 'out_idx' value { type: DT_INT32 } }"
+    " input: ['B'] }"
+
+    "node { name: 'F' op: 'KvResourceGather'"
+    " attr { key: 'dtype' value { type: DT_FLOAT } }"
+    " attr { key: 'Tkeys' value { type: DT_INT64 } }"
+    " input: ['A', 'E', 'C'] }"
+
+    "node { name: 'G' op: 'Identity'"
+    " attr { key: 'T' value { type: DT_FLOAT } }"
+    " input: ['F'] }"
+
+    "node { name: 'H' op: 'Identity'"
+    " attr { key: 'T' value { type: DT_FLOAT } }"
+    " input: ['G'] }"
+
+    "node { name: 'I' op: 'SparseSegmentMean'"
+    " attr { key: 'T' value { type: DT_FLOAT } }"
+    " input: ['H', 'E:1', 'D'] }"
+
+    "node { name: 'J' op: 'Identity'"
+    " attr { key: 'T' value { type: DT_FLOAT } }"
+    " input: ['I'] }";
+
+TEST_F(OptimizerFusionTest, KvSparseSegmentReduceFuse) {
+  InitGraph(kKvSparseSegmentMeanGraph);
+
+  EXPECT_EQ(
+      DoFusion(),
+      "A(InputResource);B(InputInt64);C(Input);D(InputInt32);E(Unique);F(KvResourceGather);G(Identity);H(Identity);I(SparseSegmentMean);I/kv_sparse_segment_reduce(KvResourceSparseSegmentReduce);J(Identity)|A->I/kv_sparse_segment_reduce;B->I/kv_sparse_segment_reduce:1;C->I/kv_sparse_segment_reduce:3;D->I/kv_sparse_segment_reduce:2;E->F:1;E:1->I:1;F->G;G->H;H->I;I/kv_sparse_segment_reduce->J");
+}
+
+TEST_F(OptimizerFusionTest, KvSparseSegmentReduceUniqueMoreConsumers) {
+  // The gradient of KvResourceGather reads the unique ids as well.
+  InitGraph(strings::StrCat(kKvSparseSegmentMeanGraph,
+      "node { name: 'K' op: 'Identity'"
+      " attr { key: 'T' value { type: DT_INT64 } }"
+      " input: ['E'] }"));
+
+  EXPECT_EQ(DoFusion(), OriginalGraph());
+}
+
 #ifndef GOOGLE_CUDA
 TEST_F(OptimizerFusionTest, MSBatchMatMulFuse2Heads) {
   InitGraph(
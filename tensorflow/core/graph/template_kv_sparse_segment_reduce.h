@@ -0,0 +1,176 @@
+/* Copyright 2022 The DeepRec Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_GRAPH_TEMPLATE_KV_SPARSE_SEGMENT_REDUCE_H_
+#define TENSORFLOW_CORE_GRAPH_TEMPLATE_KV_SPARSE_SEGMENT_REDUCE_H_
+
+#include "tensorflow/core/framework/node_def_util.h"
+#include "tensorflow/core/graph/template_base.h"
+#include "tensorflow/core/util/device_name_utils.h"
+
+namespace tensorflow {
+
+// Fuses the lookup embedding_lookup_sparse builds for a single
+// EmbeddingVariable without weights,
+//   Unique -> KvResourceGather -> Identity x num_identities ->
+//   SparseSegmentSum/Mean/SqrtN
+// into a KvResourceSparseSegmentReduce. The unique ids and the gathered
+// rows must have no other consumers, which rules out training graphs as
+// the gradient of KvResourceGather reads the unique ids.
+class TemplateKvSparseSegmentReduce : public TemplateBase {
+ public:
+  TemplateKvSparseSegmentReduce(const std::string& segment_op,
+                                int num_identities)
+      : segment_op_(segment_op), num_identities_(num_identities) {
+    const TempNode n0 = {
+      .key = "unique",
+      .op = "Unique",
+      .inputs = {"0"},
+      .outputs = {{"gather"}, {"segment_reduce"}}
+    };
+    temp_nodes_.emplace_back(n0);
+
+    std::string last_key = "gather";
+    const TempNode n1 = {
+      .key = "gather",
+      .op = "KvResourceGather",
+      .inputs = {"1", "unique", "2"},
+      .outputs = {{num_identities > 0 ? "identity_0" : "segment_reduce"}}
+    };
+    temp_nodes_.emplace_back(n1);
+
+    for (int i = 0; i < num_identities; ++i) {
+      const std::string key = strings::StrCat("identity_", i);
+      const TempNode n = {
+        .key = key,
+        .op = "Identity",
+        .inputs = {last_key},
+        .outputs = {{i + 1 < num_identities ?
+            strings::StrCat("identity_", i + 1) : "segment_reduce"}}
+      };
+      temp_nodes_.emplace_back(n);
+      last_key = key;
+    }
+
+    const TempNode n2 = {
+      .key = "segment_reduce",
+      .op = segment_op,
+      .inputs = {last_key, "unique", "3"},
+      .outputs = {{"0"}}
+    };
+    temp_nodes_.emplace_back(n2);
+
+    first_key_ = "unique";
+    num_inputs_ = 4;
+    num_outputs_ = 1;
+  }
+
+  const string name() override {
+    return strings::StrCat("kv_sparse_segment_reduce_", segment_op_, "_",
+                           num_identities_);
+  }
+
+  bool add_subgraph(std::map<std::string, MatchedNode>& nodes,
+      std::string name_prefix, Graph* g,
+      std::vector<const Edge*>& inputs,
+      std::vector<std::vector<const Edge*>>& outputs) override {
+    const Node* unique = nodes["unique"].node;
+    const Node* gather = nodes["gather"].node;
+    const Node* segment_reduce = nodes["segment_reduce"].node;
+
+    // The fused op only has CPU kernels for float and double rows, and
+    // returns the positions of the unique ids as int32.
+    DataType dtype, out_idx;
+    if (!GetNodeAttr(gather->attrs(), "dtype", &dtype).ok() ||
+        (dtype != DT_FLOAT && dtype != DT_DOUBLE) ||
+        !GetNodeAttr(unique->attrs(), "out_idx", &out_idx).ok() ||
+        out_idx != DT_INT32) {
+      return false;
+    }
+    DeviceNameUtils::ParsedName device;
+    const std::string& device_name = gather->assigned_device_name().empty() ?
+        gather->requested_device() : gather->assigned_device_name();
+    if (DeviceNameUtils::ParseFullName(device_name, &device) &&
+        device.has_type && device.type != DEVICE_CPU) {
+      return false;
+    }
+
+    NodeDef fused_def;
+    fused_def.set_op("KvResourceSparseSegmentReduce");
+    fused_def.set_name(segment_reduce->name() + "/kv_sparse_segment_reduce");
+    fused_def.set_device(gather->def().device());
+    add_input(fused_def, inputs[1]);
+    add_input(fused_def, inputs[0]);
+    add_input(fused_def, inputs[3]);
+    add_input(fused_def, inputs[2]);
+
+    AttrValue combiner;
+    if (segment_op_ == "SparseSegmentSum") {
+      combiner.set_s("sum");
+    } else if (segment_op_ == "SparseSegmentSqrtN") {
+      combiner.set_s("sqrtn");
+    } else {
+      combiner.set_s("mean");
+    }
+    auto* attr = fused_def.mutable_attr();
+    (*attr)["combiner"] = combiner;
+    for (const char* key : {"dtype", "Tkeys", "is_use_default_value_tensor",
+                            "is_inference"}) {
+      const AttrValue* value = gather->attrs().Find(key);
+      if (value != nullptr) (*attr)[key] = *value;
+    }
+    const AttrValue* segment_type =
+        segment_reduce->attrs().Find("Tsegmentids");
+    if (segment_type != nullptr) (*attr)["Tsegmentids"] = *segment_type;
+
+    Status status;
+    Node* fused_node = g->AddNode(fused_def, &status);
+    if (status != Status::OK()) {
+      VLOG(1) << status.error_message();
+      return false;
+    }
+    fused_node->set_assigned_device_name(gather->assigned_device_name());
+
+    add_iedge(g, fused_node, 0, inputs[1]);
+    add_iedge(g, fused_node, 1, inputs[0]);
+    add_iedge(g, fused_node, 2, inputs[3]);
+    add_iedge(g, fused_node, 3, inputs[2]);
+    add_oedges(g, fused_node, 0, outputs[0]);
+    return true;
+  }
+
+  bool CheckDynamicInputs(
+      const Node* node, const TempNode* temp_node, int dy_mode,
+      std::vector<const Edge*>& fused_op_inputs,
+      std::map<const std::string, TempNode>& temp_node_map,
+      std::map<std::string, MatchedNode>& matched_node_map) override {
+    return false;
+  }
+
+  bool CheckDynamicOutputs(
+      const Node* node, const TempNode* temp_node, int dy_mode,
+      std::vector<std::vector<const Edge*>>& fused_op_outputs,
+      std::map<const std::string, TempNode>& temp_node_map,
+      std::map<std::string, MatchedNode>& matched_node_map) override {
+    return false;
+  }
+
+ private:
+  std::string segment_op_;
+  int num_identities_;
+};
+
+}  // namespace tensorflow
+#endif  // TENSORFLOW_CORE_GRAPH_TEMPLATE_KV_SPARSE_SEGMENT_REDUCE_H_
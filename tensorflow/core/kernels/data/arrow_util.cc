@@ -330,13 +330,14 @@ int GetArrowFileBufferSizeFromEnv() {
 
 ::arrow::Status OpenParquetReader(
     std::unique_ptr<::parquet::arrow::FileReader>* reader,
-    const std::shared_ptr<::arrow::io::RandomAccessFile>& file) {
+    const std::shared_ptr<::arrow::io::RandomAccessFile>& file,
+    const std::shared_ptr<::parquet::FileMetaData>& metadata) {
   auto config = ::parquet::ReaderProperties();
   config.enable_buffered_stream();
   config.set_buffer_size(GetArrowFileBufferSizeFromEnv());
   ARROW_RETURN_NOT_OK(::parquet::arrow::FileReader::Make(
       ::arrow::default_memory_pool(),
-      ::parquet::ParquetFileReader::Open(file, config), reader));
+      ::parquet::ParquetFileReader::Open(file, config, metadata), reader));
   // If ARROW_NUM_THREADS > 0, specified number of threads will be used.
   // If ARROW_NUM_THREADS = 0, no threads will be used.
   // If ARROW_NUM_THREADS < 0, all threads will be used.
@@ -57,9 +57,12 @@ int GetArrowFileBufferSizeFromEnv();
     std::shared_ptr<::arrow::io::RandomAccessFile>* file,
     const std::string& filename);
 
+// Metadata of an already opened reader of the same file may be passed
+// in to avoid parsing the footer again.
 ::arrow::Status OpenParquetReader(
     std::unique_ptr<::parquet::arrow::FileReader>* reader,
-    const std::shared_ptr<::arrow::io::RandomAccessFile>& file);
+    const std::shared_ptr<::arrow::io::RandomAccessFile>& file,
+    const std::shared_ptr<::parquet::FileMetaData>& metadata = nullptr);
 
 ::arrow::Status GetParquetDataFrameFields(
     std::vector<std::string>* field_names,
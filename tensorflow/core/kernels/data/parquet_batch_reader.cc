@@ -14,17 +14,263 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow/core/kernels/data/parquet_batch_reader.h"
 
+#include <cmath>
 #include <memory>
 #include <numeric>
 #include <string>
 #include <vector>
 
 #include "absl/strings/match.h"
+#include "arrow/util/parallel.h"
+#include "parquet/statistics.h"
 #include "tensorflow/core/kernels/data/arrow_util.h"
+#include "tensorflow/core/lib/strings/numbers.h"
 
 namespace tensorflow {
 namespace data {
 
+namespace {
+
+enum class PredicateOp { EQUAL, NOT_EQUAL, IN, RANGE, LESS, LESS_EQUAL,
+                         GREATER, GREATER_EQUAL };
+
+Status ParsePredicateOp(const ParquetPredicate& predicate, PredicateOp* op) {
+  size_t num_values = predicate.values.size();
+  size_t expected_num_values = 1;
+  if (predicate.op == "==") {
+    *op = PredicateOp::EQUAL;
+  } else if (predicate.op == "!=") {
+    *op = PredicateOp::NOT_EQUAL;
+  } else if (predicate.op == "in") {
+    *op = PredicateOp::IN;
+    expected_num_values = num_values > 0 ? num_values : 1;
+  } else if (predicate.op == "range") {
+    *op = PredicateOp::RANGE;
+    expected_num_values = 2;
+  } else if (predicate.op == "<") {
+    *op = PredicateOp::LESS;
+  } else if (predicate.op == "<=") {
+    *op = PredicateOp::LESS_EQUAL;
+  } else if (predicate.op == ">") {
+    *op = PredicateOp::GREATER;
+  } else if (predicate.op == ">=") {
+    *op = PredicateOp::GREATER_EQUAL;
+  } else {
+    return errors::InvalidArgument("Unsupported predicate op `", predicate.op,
+                                   "` on field ", predicate.field);
+  }
+  if (TF_PREDICT_FALSE(num_values != expected_num_values)) {
+    return errors::InvalidArgument("Predicate `", predicate.op, "` on field ",
+                                   predicate.field, " expects ",
+                                   expected_num_values, " values, got ",
+                                   num_values);
+  }
+  return Status::OK();
+}
+
+bool ParsePredicateValue(const string& str, int64* value) {
+  return strings::safe_strto64(str, value);
+}
+
+bool ParsePredicateValue(const string& str, uint64* value) {
+  return strings::safe_strtou64(str, value);
+}
+
+bool ParsePredicateValue(const string& str, double* value) {
+  return strings::safe_strtod(str, value);
+}
+
+bool ParsePredicateValue(const string& str, string* value) {
+  *value = str;
+  return true;
+}
+
+// Reads the bounds of column chunk statistics in the domain used to
+// compare predicate values. Returns false if they are not usable.
+bool GetStatisticsMinMax(const ::parquet::Statistics& stats, int64* min,
+                         int64* max) {
+  switch (stats.physical_type()) {
+    case ::parquet::Type::INT32: {
+      auto& typed = static_cast<const ::parquet::Int32Statistics&>(stats);
+      *min = typed.min();
+      *max = typed.max();
+      return true;
+    }
+    case ::parquet::Type::INT64: {
+      auto& typed = static_cast<const ::parquet::Int64Statistics&>(stats);
+      *min = typed.min();
+      *max = typed.max();
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+// Unsigned columns are stored as signed physical types and their
+// statistics use the unsigned sort order.
+bool GetStatisticsMinMax(const ::parquet::Statistics& stats, uint64* min,
+                         uint64* max) {
+  switch (stats.physical_type()) {
+    case ::parquet::Type::INT32: {
+      auto& typed = static_cast<const ::parquet::Int32Statistics&>(stats);
+      *min = static_cast<uint32>(typed.min());
+      *max = static_cast<uint32>(typed.max());
+      return true;
+    }
+    case ::parquet::Type::INT64: {
+      auto& typed = static_cast<const ::parquet::Int64Statistics&>(stats);
+      *min = static_cast<uint64>(typed.min());
+      *max = static_cast<uint64>(typed.max());
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+bool GetStatisticsMinMax(const ::parquet::Statistics& stats, double* min,
+                         double* max) {
+  switch (stats.physical_type()) {
+    case ::parquet::Type::FLOAT: {
+      auto& typed = static_cast<const ::parquet::FloatStatistics&>(stats);
+      *min = typed.min();
+      *max = typed.max();
+      break;
+    }
+    case ::parquet::Type::DOUBLE: {
+      auto& typed = static_cast<const ::parquet::DoubleStatistics&>(stats);
+      *min = typed.min();
+      *max = typed.max();
+      break;
+    }
+    default:
+      return false;
+  }
+  return !std::isnan(*min) && !std::isnan(*max);
+}
+
+bool GetStatisticsMinMax(const ::parquet::Statistics& stats, string* min,
+                         string* max) {
+  if (stats.physical_type() != ::parquet::Type::BYTE_ARRAY) {
+    return false;
+  }
+  auto& typed = static_cast<const ::parquet::ByteArrayStatistics&>(stats);
+  min->assign(reinterpret_cast<const char*>(typed.min().ptr),
+              typed.min().len);
+  max->assign(reinterpret_cast<const char*>(typed.max().ptr),
+              typed.max().len);
+  return true;
+}
+
+class RowGroupFilter {
+ public:
+  virtual ~RowGroupFilter() {}
+
+  // Returns false only if the statistics of the row group show that none
+  // of its rows satisfies the predicate.
+  virtual bool MayMatch(const ::parquet::RowGroupMetaData& row_group) const = 0;
+};
+
+template <typename C>
+class TypedRowGroupFilter : public RowGroupFilter {
+ public:
+  TypedRowGroupFilter(int column_index, PredicateOp op,
+                      const std::vector<C>& values)
+      : column_index_(column_index), op_(op), values_(values) {}
+
+  bool MayMatch(const ::parquet::RowGroupMetaData& row_group) const override {
+    auto column = row_group.ColumnChunk(column_index_);
+    if (!column->is_stats_set()) {
+      return true;
+    }
+    std::shared_ptr<::parquet::Statistics> stats = column->statistics();
+    C min, max;
+    if (!stats || !stats->HasMinMax() ||
+        !GetStatisticsMinMax(*stats, &min, &max)) {
+      return true;
+    }
+    switch (op_) {
+      case PredicateOp::EQUAL:
+      case PredicateOp::IN:
+        for (const C& v : values_) {
+          if (!(v < min) && !(max < v)) {
+            return true;
+          }
+        }
+        return false;
+      case PredicateOp::NOT_EQUAL:
+        // Only a row group holding nothing but the value can be skipped.
+        return min < values_[0] || values_[0] < max;
+      case PredicateOp::RANGE:
+        return !(max < values_[0]) && !(values_[1] < min);
+      case PredicateOp::LESS:
+        return min < values_[0];
+      case PredicateOp::LESS_EQUAL:
+        return !(values_[0] < min);
+      case PredicateOp::GREATER:
+        return values_[0] < max;
+      case PredicateOp::GREATER_EQUAL:
+        return !(max < values_[0]);
+    }
+    return true;
+  }
+
+ private:
+  const int column_index_;
+  const PredicateOp op_;
+  const std::vector<C> values_;
+};
+
+template <typename C>
+Status MakeTypedRowGroupFilter(const ParquetPredicate& predicate,
+                               int column_index, PredicateOp op,
+                               std::unique_ptr<RowGroupFilter>* filter) {
+  std::vector<C> values(predicate.values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (TF_PREDICT_FALSE(
+            !ParsePredicateValue(predicate.values[i], &values[i]))) {
+      return errors::InvalidArgument("Invalid value `", predicate.values[i],
+                                     "` in predicate on field ",
+                                     predicate.field);
+    }
+  }
+  filter->reset(new TypedRowGroupFilter<C>(column_index, op, values));
+  return Status::OK();
+}
+
+Status MakeRowGroupFilter(const ParquetPredicate& predicate, DataType dtype,
+                          int column_index,
+                          std::unique_ptr<RowGroupFilter>* filter) {
+  PredicateOp op;
+  TF_RETURN_IF_ERROR(ParsePredicateOp(predicate, &op));
+  switch (dtype) {
+    case DT_INT8:
+    case DT_INT32:
+    case DT_INT64:
+      return MakeTypedRowGroupFilter<int64>(predicate, column_index, op,
+                                            filter);
+    case DT_UINT8:
+    case DT_UINT32:
+    case DT_UINT64:
+      return MakeTypedRowGroupFilter<uint64>(predicate, column_index, op,
+                                             filter);
+    case DT_FLOAT:
+    case DT_DOUBLE:
+      return MakeTypedRowGroupFilter<double>(predicate, column_index, op,
+                                             filter);
+    case DT_STRING:
+      return MakeTypedRowGroupFilter<string>(predicate, column_index, op,
+                                             filter);
+    default:
+      return errors::InvalidArgument("Predicate on field ", predicate.field,
+                                     " of type ", DataTypeString(dtype),
+                                     " not supported");
+  }
+}
+
+}  // namespace
+
 class ParquetBatchReader::Impl {
  public:
   Impl(const string& filename, const int64 batch_size,
@@ -32,7 +278,8 @@ class ParquetBatchReader::Impl {
        const DataTypeVector& field_dtypes,
        const std::vector<int32>& field_ragged_ranks,
        const int64 partition_count, const int64 partition_index,
-       const bool drop_remainder)
+       const bool drop_remainder,
+       const std::vector<ParquetPredicate>& predicates)
       : filename_(filename),
         batch_size_(batch_size),
         field_names_(field_names),
@@ -40,10 +287,12 @@ class ParquetBatchReader::Impl {
         field_ragged_ranks_(field_ragged_ranks),
         partition_count_(partition_count),
         partition_index_(partition_index),
-        drop_remainder_(drop_remainder) {}
+        drop_remainder_(drop_remainder),
+        predicates_(predicates),
+        opened_(false) {}
 
   Status Open() {
-    if (TF_PREDICT_TRUE(batch_reader_)) {
+    if (TF_PREDICT_TRUE(opened_)) {
       return Status::OK();
     }
     if (TF_PREDICT_FALSE(partition_index_ >= partition_count_)) {
@@ -58,18 +307,58 @@ class ParquetBatchReader::Impl {
 
     std::shared_ptr<::arrow::io::RandomAccessFile> file;
     TF_RETURN_IF_ARROW_ERROR(ArrowUtil::OpenArrowFile(&file, filename_));
-    TF_RETURN_IF_ARROW_ERROR(ArrowUtil::OpenParquetReader(&reader_, file));
+    std::unique_ptr<::parquet::arrow::FileReader> reader;
+    TF_RETURN_IF_ARROW_ERROR(ArrowUtil::OpenParquetReader(&reader, file));
+    std::shared_ptr<::parquet::FileMetaData> metadata =
+        reader->parquet_reader()->metadata();
 
-    int num_row_groups = reader_->num_row_groups();
-    for (int g = partition_index_; g < num_row_groups; g += partition_count_) {
-      row_group_indices_.push_back(g);
-    }
     std::shared_ptr<::arrow::Schema> schema;
-    TF_RETURN_IF_ARROW_ERROR(reader_->GetSchema(&schema));
+    TF_RETURN_IF_ARROW_ERROR(reader->GetSchema(&schema));
     if (TF_PREDICT_FALSE(!schema->HasDistinctFieldNames())) {
       return errors::InvalidArgument(filename_,
                                      " must has distinct column names");
     }
+
+    // Skip row groups by column statistics before reading any data.
+    std::vector<std::unique_ptr<RowGroupFilter>> filters;
+    for (const auto& predicate : predicates_) {
+      int field_index = schema->GetFieldIndex(predicate.field);
+      int column_index = metadata->schema()->ColumnIndex(predicate.field);
+      if (TF_PREDICT_FALSE(field_index < 0 || column_index < 0)) {
+        return errors::NotFound("No column called `", predicate.field,
+                                "` found in ", filename_);
+      }
+      DataType dtype;
+      int32 ragged_rank = 0;
+      TF_RETURN_IF_ERROR(ArrowUtil::MakeDataTypeAndRaggedRankFromArrowDataType(
+          schema->field(field_index)->type(), &dtype, &ragged_rank));
+      if (TF_PREDICT_FALSE(ragged_rank != 0)) {
+        return errors::InvalidArgument("Predicate on ragged field ",
+                                       predicate.field, " not supported");
+      }
+      filters.emplace_back();
+      TF_RETURN_IF_ERROR(MakeRowGroupFilter(predicate, dtype, column_index,
+                                            &filters.back()));
+    }
+    int num_row_groups = reader->num_row_groups();
+    for (int g = partition_index_; g < num_row_groups; g += partition_count_) {
+      std::unique_ptr<::parquet::RowGroupMetaData> row_group =
+          metadata->RowGroup(g);
+      bool selected = true;
+      for (const auto& filter : filters) {
+        if (!filter->MayMatch(*row_group)) {
+          selected = false;
+          break;
+        }
+      }
+      if (selected) {
+        row_group_indices_.push_back(g);
+      }
+    }
+    if (!filters.empty()) {
+      VLOG(1) << "Selected " << row_group_indices_.size() << " of "
+              << num_row_groups << " row groups in " << filename_;
+    }
     for (size_t i = 0; i < field_names_.size(); ++i) {
       auto& cname = field_names_[i];
       int column_index = schema->GetFieldIndex(cname);
@@ -97,30 +386,77 @@ class ParquetBatchReader::Impl {
             actual_ragged_rank, ", which should be ", expected_ragged_rank);
       }
     }
-    reader_->set_batch_size(batch_size_);
 
-    TF_RETURN_IF_ARROW_ERROR(reader_->GetRecordBatchReader(
-        row_group_indices_, column_indices_, &batch_reader_));
+    // Every column gets its own reader over the same row groups, so that
+    // the columns can be decoded concurrently while their batches stay
+    // aligned. The readers share the file and its parsed metadata.
+    if (!row_group_indices_.empty()) {
+      for (size_t i = 0; i < column_indices_.size(); ++i) {
+        std::unique_ptr<::parquet::arrow::FileReader> column_reader;
+        TF_RETURN_IF_ARROW_ERROR(
+            ArrowUtil::OpenParquetReader(&column_reader, file, metadata));
+        if (column_indices_.size() > 1) {
+          column_reader->set_use_threads(false);
+        }
+        column_reader->set_batch_size(batch_size_);
+        std::unique_ptr<::arrow::RecordBatchReader> batch_reader;
+        TF_RETURN_IF_ARROW_ERROR(column_reader->GetRecordBatchReader(
+            row_group_indices_, {column_indices_[i]}, &batch_reader));
+        readers_.push_back(std::move(column_reader));
+        batch_readers_.push_back(std::move(batch_reader));
+      }
+    }
+    opened_ = true;
     return Status::OK();
   }
 
   Status Read(std::vector<Tensor>* output_tensors) {
-    // Read next batch from parquet file.
-    std::shared_ptr<::arrow::RecordBatch> batch;
-    TF_RETURN_IF_ARROW_ERROR(batch_reader_->ReadNext(&batch));
-    if (TF_PREDICT_FALSE(!batch)) {
+    if (TF_PREDICT_FALSE(batch_readers_.empty())) {
       return errors::OutOfRange("Reached end of parquet file ", filename_);
     }
-    if (TF_PREDICT_FALSE(drop_remainder_ && batch->num_rows() < batch_size_)) {
+
+    // Read and convert next batch of every column from parquet file.
+    const int num_columns = batch_readers_.size();
+    std::vector<std::shared_ptr<::arrow::RecordBatch>> batches(num_columns);
+    std::vector<std::vector<Tensor>> column_tensors(num_columns);
+    std::vector<Status> column_status(num_columns);
+    auto read_column = [&](int i) {
+      ARROW_RETURN_NOT_OK(batch_readers_[i]->ReadNext(&batches[i]));
+      if (batches[i] && (!drop_remainder_ ||
+                         batches[i]->num_rows() >= batch_size_)) {
+        column_status[i] = ArrowUtil::MakeTensorsFromArrowArray(
+            field_dtypes_[i], field_ragged_ranks_[i], batches[i]->column(0),
+            &column_tensors[i]);
+      }
+      return ::arrow::Status::OK();
+    };
+    // ARROW_NUM_THREADS=0 keeps the reads on the calling thread.
+    TF_RETURN_IF_ARROW_ERROR(::arrow::internal::OptionalParallelFor(
+        num_columns > 1 &&
+            ArrowUtil::UpdateArrowCpuThreadPoolCapacityFromEnv() != 0,
+        num_columns, read_column));
+
+    if (TF_PREDICT_FALSE(!batches[0])) {
+      return errors::OutOfRange("Reached end of parquet file ", filename_);
+    }
+    const int64 num_rows = batches[0]->num_rows();
+    for (int i = 1; i < num_columns; ++i) {
+      if (TF_PREDICT_FALSE(!batches[i] || batches[i]->num_rows() != num_rows)) {
+        return errors::Internal("Column ", field_names_[i], " of ", filename_,
+                                " is not aligned with column ",
+                                field_names_[0]);
+      }
+    }
+    if (TF_PREDICT_FALSE(drop_remainder_ && num_rows < batch_size_)) {
       return errors::OutOfRange("Reached end of parquet file ", filename_,
                                 " after dropping reminder batch");
     }
 
-    // Populate tensors from record batch.
-    auto arrays = batch->columns();
-    for (size_t i = 0; i < arrays.size(); ++i) {
-      TF_RETURN_IF_ERROR(ArrowUtil::MakeTensorsFromArrowArray(
-          field_dtypes_[i], field_ragged_ranks_[i], arrays[i], output_tensors));
+    // Populate tensors from record batches.
+    for (int i = 0; i < num_columns; ++i) {
+      TF_RETURN_IF_ERROR(column_status[i]);
+      output_tensors->insert(output_tensors->end(), column_tensors[i].begin(),
+                             column_tensors[i].end());
     }
 
     return Status::OK();
@@ -135,8 +471,10 @@ class ParquetBatchReader::Impl {
   int64 partition_count_;
   int64 partition_index_;
   bool drop_remainder_;
-  std::unique_ptr<::parquet::arrow::FileReader> reader_;
-  std::unique_ptr<::arrow::RecordBatchReader> batch_reader_;
+  std::vector<ParquetPredicate> predicates_;
+  bool opened_;
+  std::vector<std::unique_ptr<::parquet::arrow::FileReader>> readers_;
+  std::vector<std::unique_ptr<::arrow::RecordBatchReader>> batch_readers_;
   std::vector<int> row_group_indices_;
   std::vector<int> column_indices_;
 };
@@ -145,10 +483,11 @@ ParquetBatchReader::ParquetBatchReader(
     const string& filename, const int64 batch_size,
     const std::vector<string>& field_names, const DataTypeVector& field_dtypes,
     const std::vector<int32>& field_ragged_ranks, const int64 partition_count,
-    const int64 partition_index, const bool drop_remainder)
+    const int64 partition_index, const bool drop_remainder,
+    const std::vector<ParquetPredicate>& predicates)
     : pimpl_(new ParquetBatchReader::Impl(
           filename, batch_size, field_names, field_dtypes, field_ragged_ranks,
-          partition_count, partition_index, drop_remainder)) {}
+          partition_count, partition_index, drop_remainder, predicates)) {}
 
 Status ParquetBatchReader::Open() { return pimpl_->Open(); }
 
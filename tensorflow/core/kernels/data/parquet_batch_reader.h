@@ -24,6 +24,17 @@ limitations under the License.
 namespace tensorflow {
 namespace data {
 
+// A predicate on a non-ragged column. Row groups whose statistics show
+// that no row can satisfy it are skipped, rows of the other row groups
+// are not filtered.
+//  op: "==", "<", "<=", ">", ">=" with one value, "in" with any number of
+//      values, "range" with an inclusive lower and upper bound.
+struct ParquetPredicate {
+  string field;
+  string op;
+  std::vector<string> values;
+};
+
 class ParquetBatchReader {
  public:
   ParquetBatchReader(const string& filename, const int64 batch_size,
@@ -31,7 +42,8 @@ class ParquetBatchReader {
                      const DataTypeVector& field_dtypes,
                      const std::vector<int32>& field_ragged_ranks,
                      const int64 partition_count, const int64 partition_index,
-                     const bool drop_remainder);
+                     const bool drop_remainder,
+                     const std::vector<ParquetPredicate>& predicates = {});
 
   Status Open();
 
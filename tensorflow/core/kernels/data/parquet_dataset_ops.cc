@@ -38,7 +38,8 @@ class ParquetTabularDatasetOp::Dataset : public DatasetBase {
           const DataTypeVector& field_dtypes,
           const std::vector<int32>& field_ragged_ranks,
           const int64 partition_count, const int64 partition_index,
-          const bool drop_remainder)
+          const bool drop_remainder,
+          const std::vector<ParquetPredicate>& predicates)
       : DatasetBase(DatasetContext(ctx)),
         filename_(std::move(filename)),
         batch_size_(batch_size),
@@ -47,7 +48,8 @@ class ParquetTabularDatasetOp::Dataset : public DatasetBase {
         field_ragged_ranks_(std::move(field_ragged_ranks)),
         partition_count_(partition_count),
         partition_index_(partition_index),
-        drop_remainder_(drop_remainder) {
+        drop_remainder_(drop_remainder),
+        predicates_(predicates) {
     int64 num_outputs = field_names.size();
     for (int64 i = 0; i < field_names.size(); ++i) {
       output_dtypes_.push_back(std::move(field_dtypes[i]));
@@ -64,7 +66,7 @@ class ParquetTabularDatasetOp::Dataset : public DatasetBase {
     reader_ = absl::make_unique<ParquetBatchReader>(
         filename_, batch_size_, field_names_, field_dtypes_,
         field_ragged_ranks_, partition_count_, partition_index_,
-        drop_remainder_);
+        drop_remainder_, predicates_);
   }
 
   Status Open() {
@@ -107,6 +109,26 @@ class ParquetTabularDatasetOp::Dataset : public DatasetBase {
     b->BuildAttrValue(partition_index_, &partition_index);
     AttrValue drop_remainder;
     b->BuildAttrValue(drop_remainder_, &drop_remainder);
+    std::vector<string> predicate_fields_vec;
+    std::vector<string> predicate_ops_vec;
+    std::vector<string> predicate_values_vec;
+    std::vector<int32> predicate_value_counts_vec;
+    for (const auto& predicate : predicates_) {
+      predicate_fields_vec.push_back(predicate.field);
+      predicate_ops_vec.push_back(predicate.op);
+      predicate_values_vec.insert(predicate_values_vec.end(),
+                                  predicate.values.begin(),
+                                  predicate.values.end());
+      predicate_value_counts_vec.push_back(predicate.values.size());
+    }
+    AttrValue predicate_fields;
+    b->BuildAttrValue(predicate_fields_vec, &predicate_fields);
+    AttrValue predicate_ops;
+    b->BuildAttrValue(predicate_ops_vec, &predicate_ops);
+    AttrValue predicate_values;
+    b->BuildAttrValue(predicate_values_vec, &predicate_values);
+    AttrValue predicate_value_counts;
+    b->BuildAttrValue(predicate_value_counts_vec, &predicate_value_counts);
     TF_RETURN_IF_ERROR(
         b->AddDataset(this, {{0, filename}, {1, batch_size}}, {},
                       {{"field_names", field_names},
@@ -114,7 +136,11 @@ class ParquetTabularDatasetOp::Dataset : public DatasetBase {
                        {"field_ragged_ranks", field_ragged_ranks},
                        {"partition_count", partition_count},
                        {"partition_index", partition_index},
-                       {"drop_remainder", drop_remainder}},
+                       {"drop_remainder", drop_remainder},
+                       {"predicate_fields", predicate_fields},
+                       {"predicate_ops", predicate_ops},
+                       {"predicate_values", predicate_values},
+                       {"predicate_value_counts", predicate_value_counts}},
                       output));
     return Status::OK();
   }
@@ -129,6 +155,7 @@ class ParquetTabularDatasetOp::Dataset : public DatasetBase {
   const int64 partition_count_;
   const int64 partition_index_;
   const bool drop_remainder_;
+  const std::vector<ParquetPredicate> predicates_;
   DataTypeVector output_dtypes_;
   std::vector<PartialTensorShape> output_shapes_;
   std::unique_ptr<ParquetBatchReader> reader_;
@@ -189,6 +216,42 @@ ParquetTabularDatasetOp::ParquetTabularDatasetOp(OpKernelConstruction* ctx)
   OP_REQUIRES_OK(ctx, ctx->GetAttr("partition_count", &partition_count_));
   OP_REQUIRES_OK(ctx, ctx->GetAttr("partition_index", &partition_index_));
   OP_REQUIRES_OK(ctx, ctx->GetAttr("drop_remainder", &drop_remainder_));
+
+  std::vector<string> predicate_fields;
+  std::vector<string> predicate_ops;
+  std::vector<string> predicate_values;
+  std::vector<int32> predicate_value_counts;
+  OP_REQUIRES_OK(ctx, ctx->GetAttr("predicate_fields", &predicate_fields));
+  OP_REQUIRES_OK(ctx, ctx->GetAttr("predicate_ops", &predicate_ops));
+  OP_REQUIRES_OK(ctx, ctx->GetAttr("predicate_values", &predicate_values));
+  OP_REQUIRES_OK(ctx, ctx->GetAttr("predicate_value_counts",
+                                   &predicate_value_counts));
+  OP_REQUIRES(ctx,
+              predicate_ops.size() == predicate_fields.size() &&
+                  predicate_value_counts.size() == predicate_fields.size(),
+              errors::InvalidArgument(
+                  "predicate_fields, predicate_ops and predicate_value_counts "
+                  "must have the same length"));
+  size_t offset = 0;
+  for (size_t i = 0; i < predicate_fields.size(); ++i) {
+    OP_REQUIRES(ctx,
+                predicate_value_counts[i] >= 0 &&
+                    offset + predicate_value_counts[i] <=
+                        predicate_values.size(),
+                errors::InvalidArgument(
+                    "predicate_value_counts does not match predicate_values"));
+    ParquetPredicate predicate;
+    predicate.field = predicate_fields[i];
+    predicate.op = predicate_ops[i];
+    predicate.values.assign(
+        predicate_values.begin() + offset,
+        predicate_values.begin() + offset + predicate_value_counts[i]);
+    offset += predicate_value_counts[i];
+    predicates_.push_back(std::move(predicate));
+  }
+  OP_REQUIRES(ctx, offset == predicate_values.size(),
+              errors::InvalidArgument(
+                  "predicate_value_counts does not match predicate_values"));
 }
 
 void ParquetTabularDatasetOp::MakeDataset(OpKernelContext* ctx,
@@ -203,7 +266,8 @@ void ParquetTabularDatasetOp::MakeDataset(OpKernelContext* ctx,
 
   Dataset* ds = new Dataset(
       ctx, filename, batch_size, field_names_, field_dtypes_,
-      field_ragged_ranks_, partition_count_, partition_index_, drop_remainder_);
+      field_ragged_ranks_, partition_count_, partition_index_, drop_remainder_,
+      predicates_);
   OP_REQUIRES_OK(ctx, ds->Open());
   *output = ds;
 }
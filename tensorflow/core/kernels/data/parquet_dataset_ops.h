@@ -35,6 +35,7 @@ class ParquetTabularDatasetOp : public DatasetOpKernel {
   int64 partition_count_;
   int64 partition_index_;
   bool drop_remainder_;
+  std::vector<ParquetPredicate> predicates_;
 };
 
 }  // namespace data
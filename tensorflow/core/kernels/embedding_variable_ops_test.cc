@@ -2,6 +2,7 @@
 
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
 #include "tensorflow/core/graph/graph.h"
 #include "tensorflow/core/kernels/variable_ops.h"
 #include "tensorflow/core/graph/node_builder.h"
@@ -24,6 +25,7 @@
 #include "tensorflow/core/kernels/ops_testutil.h"
 #include "tensorflow/core/kernels/ops_util.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/util/tensor_slice_reader_cache.h"
@@ -36,7 +38,9 @@
 #include <sys/resource.h>
 #include "tensorflow/core/framework/embedding/kv_interface.h"
 #include "tensorflow/core/framework/embedding/cache.h"
+#include "tensorflow/core/framework/embedding/cache_factory.h"
 #include "tensorflow/core/kernels/kv_variable_ops.h"
+#include "tensorflow/core/kernels/training_ali_ops_cpu.h"
 #ifdef TENSORFLOW_USE_JEMALLOC
 #include "jemalloc/jemalloc.h"
 #endif
@@ -393,6 +397,76 @@ TEST(EmbeddingVariableTest, TestEVExportLargeLockless) {
   }
 }
 
+TEST(EmbeddingVariableTest, TestEVExportParallel) {
+  int64 value_size = 8;
+  Tensor value(DT_FLOAT, TensorShape({value_size}));
+  test::FillValues<float>(&value, std::vector<float>(value_size, 9.0));
+  auto storage_manager = new embedding::StorageManager<int64, float>(
+      "EmbeddingVar", embedding::StorageConfig());
+  auto variable = new EmbeddingVar<int64, float>("EmbeddingVar",
+      storage_manager, EmbeddingConfig(0, 0, 1, 1, "", 5));
+  variable->Init(value, 1);
+
+  int64 ev_size = 300000;
+  for (int64 i = 0; i < ev_size; i++) {
+    ValuePtr<float>* value_ptr = nullptr;
+    variable->LookupOrCreateKey(i, &value_ptr);
+    typename TTypes<float>::Flat vflat = variable->flat(value_ptr);
+    vflat(0) = i;
+  }
+
+  thread::ThreadPool pool(Env::Default(), "dump", 8);
+  DeviceBase::CpuWorkerThreads worker_threads;
+  worker_threads.num_threads = 8;
+  worker_threads.workers = &pool;
+  Tensor part_offset_tensor(DT_INT32,  TensorShape({kSavedPartitionNum + 1}));
+  {
+    BundleWriter writer(Env::Default(), Prefix("serial"));
+    TF_ASSERT_OK(DumpEmbeddingValues(variable, "var/part_0", &writer,
+                                     &part_offset_tensor));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  {
+    BundleWriter writer(Env::Default(), Prefix("parallel"));
+    TF_ASSERT_OK(DumpEmbeddingValues(variable, "var/part_0", &writer,
+                                     &part_offset_tensor, &worker_threads));
+    TF_ASSERT_OK(writer.Finish());
+  }
+
+  BundleReader serial_reader(Env::Default(), Prefix("serial"));
+  BundleReader parallel_reader(Env::Default(), Prefix("parallel"));
+  TF_ASSERT_OK(serial_reader.status());
+  TF_ASSERT_OK(parallel_reader.status());
+  for (const string& name : AllTensorKeys(&serial_reader)) {
+    Tensor expected, actual;
+    TF_ASSERT_OK(serial_reader.Lookup(name, &expected));
+    TF_ASSERT_OK(parallel_reader.Lookup(name, &actual));
+    test::ExpectTensorEqual<uint8>(
+        test::AsTensor<uint8>(std::vector<uint8>(
+            expected.tensor_data().begin(), expected.tensor_data().end())),
+        test::AsTensor<uint8>(std::vector<uint8>(
+            actual.tensor_data().begin(), actual.tensor_data().end())));
+  }
+
+  // Keys are grouped by key % kSavedPartitionNum and values follow keys.
+  Tensor keys, values, offsets;
+  TF_ASSERT_OK(parallel_reader.Lookup("var/part_0-keys", &keys));
+  TF_ASSERT_OK(parallel_reader.Lookup("var/part_0-values", &values));
+  TF_ASSERT_OK(parallel_reader.Lookup("var/part_0-partition_offset",
+                                      &offsets));
+  auto keys_flat = keys.flat<int64>();
+  auto values_matrix = values.matrix<float>();
+  auto offsets_flat = offsets.flat<int32>();
+  ASSERT_EQ(keys_flat.size(), ev_size);
+  ASSERT_EQ(offsets_flat(kSavedPartitionNum), ev_size);
+  for (int partid = 0; partid < kSavedPartitionNum; partid++) {
+    for (int i = offsets_flat(partid); i < offsets_flat(partid + 1); i++) {
+      ASSERT_EQ(keys_flat(i) % kSavedPartitionNum, partid);
+      ASSERT_EQ(values_matrix(i, 0), keys_flat(i));
+    }
+  }
+}
+
 void multi_insertion(EmbeddingVar<int64, float>* variable, int64 value_size){
   for (long j = 0; j < 5; j++) {
     ValuePtr<float>* value_ptr = nullptr;
@@ -497,10 +571,10 @@ TEST(EmbeddingVariableTest, TestBloomCounterInt64) {
 
   float *val = (float *)malloc((value_size+1)*sizeof(float));
 
-  std::vector<int64> hash_val1= {17, 7, 48, 89, 9, 20, 56};
-  std::vector<int64> hash_val2= {58, 14, 10, 90, 28, 14, 67};
-  std::vector<int64> hash_val3= {64, 63, 9, 77, 7, 38, 11};
-  std::vector<int64> hash_val4= {39, 10, 79, 28, 58, 55, 60};
+  std::vector<int64> hash_val1= {80, 81, 85, 86, 87, 91, 92};
+  std::vector<int64> hash_val2= {72, 73, 74, 75, 76, 77, 78};
+  std::vector<int64> hash_val3= {65, 66, 69, 72, 75, 78, 79};
+  std::vector<int64> hash_val4= {48, 51, 53, 55, 58, 60, 62};
 
   std::map<int64, int> tab;
   for (auto it: hash_val1)
@@ -569,10 +643,10 @@ TEST(EmbeddingVariableTest, TestBloomCounterInt32) {
 
   float *val = (float *)malloc((value_size+1)*sizeof(float));
 
-  std::vector<int64> hash_val1= {17, 7, 48, 89, 9, 20, 56};
-  std::vector<int64> hash_val2= {58, 14, 10, 90, 28, 14, 67};
-  std::vector<int64> hash_val3= {64, 63, 9, 77, 7, 38, 11};
-  std::vector<int64> hash_val4= {39, 10, 79, 28, 58, 55, 60};
+  std::vector<int64> hash_val1= {80, 81, 85, 86, 87, 91, 92};
+  std::vector<int64> hash_val2= {72, 73, 74, 75, 76, 77, 78};
+  std::vector<int64> hash_val3= {65, 66, 69, 72, 75, 78, 79};
+  std::vector<int64> hash_val4= {48, 51, 53, 55, 58, 60, 62};
 
   std::map<int64, int> tab;
   for (auto it: hash_val1)
@@ -641,10 +715,10 @@ TEST(EmbeddingVariableTest, TestBloomCounterInt16) {
 
   float *val = (float *)malloc((value_size+1)*sizeof(float));
 
-  std::vector<int64> hash_val1= {17, 7, 48, 89, 9, 20, 56};
-  std::vector<int64> hash_val2= {58, 14, 10, 90, 28, 14, 67};
-  std::vector<int64> hash_val3= {64, 63, 9, 77, 7, 38, 11};
-  std::vector<int64> hash_val4= {39, 10, 79, 28, 58, 55, 60};
+  std::vector<int64> hash_val1= {64, 69, 71, 76, 81, 86, 91};
+  std::vector<int64> hash_val2= {40, 41, 42, 43, 44, 45, 46};
+  std::vector<int64> hash_val3= {37, 43, 49, 50, 56, 62, 63};
+  std::vector<int64> hash_val4= {0, 5, 10, 14, 19, 23, 28};
 
   std::map<int64, int> tab;
   for (auto it: hash_val1)
@@ -714,10 +788,10 @@ TEST(EmbeddingVariableTest, TestBloomCounterInt8) {
 
   float *val = (float *)malloc((value_size+1)*sizeof(float));
 
-  std::vector<int64> hash_val1= {17, 7, 48, 89, 9, 20, 56};
-  std::vector<int64> hash_val2= {58, 14, 10, 90, 28, 14, 67};
-  std::vector<int64> hash_val3= {64, 63, 9, 77, 7, 38, 11};
-  std::vector<int64> hash_val4= {39, 10, 79, 28, 58, 55, 60};
+  std::vector<int64> hash_val1= {69, 76, 86, 96, 103, 113, 123};
+  std::vector<int64> hash_val2= {9, 11, 13, 40, 42, 44, 46};
+  std::vector<int64> hash_val3= {5, 17, 18, 30, 31, 43, 56};
+  std::vector<int64> hash_val4= {64, 69, 74, 87, 92, 110, 115};
 
   std::map<int64, int> tab;
   for (auto it: hash_val1)
@@ -953,6 +1027,188 @@ BENCHMARK(BM_HYBRID_LOCKLESS)
     ->Arg(8)
     ->Arg(16);
 
+TEST(EmbeddingVariableTest, TestBatchLookupOrCreate) {
+  int64 value_size = 16;
+  Tensor value(DT_FLOAT, TensorShape({value_size}));
+  test::FillValues<float>(&value, std::vector<float>(value_size, 3.0));
+  auto storage_manager = new embedding::StorageManager<int64, float>(
+      "EmbeddingVar", embedding::StorageConfig());
+  auto variable = new EmbeddingVar<int64, float>("EmbeddingVar",
+      storage_manager, EmbeddingConfig(/*emb_index = */0,
+                                       /*primary_emb_index = */0,
+                                       /*block_num = */1, /*slot_num = */0,
+                                       /*name = */"", /*steps_to_live = */0,
+                                       /*filter_freq = */0,
+                                       /*max_freq = */999999,
+                                       /*l2_weight_threshold = */-1.0,
+                                       /*layout = */"normal",
+                                       /*max_element_size = */0,
+                                       /*false_positive_probability = */-1.0,
+                                       /*counter_type = */DT_UINT64,
+                                       /*default_value_dim = */1,
+                                       /*default_value_no_permission = */.0,
+                                       /*record_freq = */true));
+  variable->Init(value, 1);
+  ASSERT_FALSE(variable->HasFeatureFilter());
+
+  // Existing key, new keys and a duplicated new key in one batch.
+  float* existing_val = new float[value_size];
+  variable->LookupOrCreate(5, existing_val, nullptr);
+  int64 num = 6;
+  int64 keys[] = {5, 1, 2, 1, 100, 5};
+  std::vector<float*> default_values(num, variable->GetDefaultValuePtr());
+  int32 counts[] = {1, 2, 1, 1, 3, 1};
+  float* output = new float[num * value_size];
+  variable->BatchLookupOrCreate(keys, output, num,
+                                default_values.data(), counts);
+  ASSERT_EQ(variable->Size(), 4);
+  for (int64 i = 0; i < num * value_size; ++i) {
+    ASSERT_EQ(output[i], 3.0);
+  }
+  ValuePtr<float>* value_ptr = nullptr;
+  TF_CHECK_OK(variable->LookupKey(5, &value_ptr));
+  ASSERT_EQ(value_ptr->GetFreq(), 3);
+  TF_CHECK_OK(variable->LookupKey(1, &value_ptr));
+  ASSERT_EQ(value_ptr->GetFreq(), 3);
+  TF_CHECK_OK(variable->LookupKey(100, &value_ptr));
+  ASSERT_EQ(value_ptr->GetFreq(), 3);
+  delete []existing_val;
+  delete []output;
+}
+
+void BM_BATCH_LOOKUP_LOCKLESS(int iters, int batch) {
+  testing::StopTiming();
+  testing::UseRealTime();
+
+  int64 value_size = 32;
+  Tensor value(DT_FLOAT, TensorShape({value_size}));
+  test::FillValues<float>(&value, std::vector<float>(value_size, 1.0));
+  auto storage_manager = new embedding::StorageManager<int64, float>(
+      "EmbeddingVar", embedding::StorageConfig());
+  auto variable = new EmbeddingVar<int64, float>("EmbeddingVar",
+      storage_manager);
+  variable->Init(value, 1);
+  const int64 num_keys = 1000000;
+  int64* keys = (int64*)malloc(sizeof(int64) * num_keys);
+  srand((unsigned)time(NULL));
+  for (int64 i = 0; i < num_keys; i++) {
+    keys[i] = rand() % 200000;
+  }
+  float* output = (float*)malloc(sizeof(float) * num_keys * value_size);
+  std::vector<float*> default_values(num_keys,
+                                     variable->GetDefaultValuePtr());
+
+  testing::StartTiming();
+  while (iters--) {
+    if (batch) {
+      variable->BatchLookupOrCreate(keys, output, num_keys,
+                                    default_values.data(), nullptr);
+    } else {
+      for (int64 i = 0; i < num_keys; i++) {
+        variable->LookupOrCreate(keys[i], output + i * value_size, nullptr);
+      }
+    }
+  }
+  testing::StopTiming();
+  free(keys);
+  free(output);
+}
+
+BENCHMARK(BM_BATCH_LOOKUP_LOCKLESS)
+    ->Arg(0)
+    ->Arg(1);
+
+TEST(EmbeddingVariableTest, TestBloomFilterBatchLookup) {
+  int value_size = 10;
+  Tensor value(DT_FLOAT, TensorShape({value_size}));
+  test::FillValues<float>(&value, std::vector<float>(value_size, 10.0));
+  EmbeddingVar<int64, float>* vars[2];
+  for (int k = 0; k < 2; ++k) {
+    auto storage_manager = new embedding::StorageManager<int64, float>(
+        "EmbeddingVar", embedding::StorageConfig());
+    vars[k] = new EmbeddingVar<int64, float>("EmbeddingVar",
+        storage_manager,
+        EmbeddingConfig(0, 0, 1, 1, "", 5, 3, 99999, -1.0,
+            "normal", 1000, 0.01, DT_UINT16));
+    vars[k]->Init(value, 1);
+  }
+
+  const int64 num = 16;
+  std::vector<int64> keys(num);
+  std::vector<int32> counts(num);
+  for (int64 i = 0; i < num; ++i) {
+    keys[i] = i * 7;
+    counts[i] = i % 3 + 1;
+  }
+  std::vector<float*> default_values(num, vars[0]->GetDefaultValuePtr());
+  std::vector<float> expected(num * value_size);
+  std::vector<float> output(num * value_size);
+  for (int step = 0; step < 3; ++step) {
+    for (int64 i = 0; i < num; ++i) {
+      vars[0]->LookupOrCreate(keys[i], expected.data() + i * value_size,
+                              nullptr, counts[i]);
+    }
+    vars[1]->BatchLookupOrCreateWithFilter(keys.data(), output.data(), num,
+        default_values.data(), counts.data());
+    ASSERT_EQ(vars[0]->Size(), vars[1]->Size());
+    for (int64 i = 0; i < num * value_size; ++i) {
+      ASSERT_EQ(expected[i], output[i]);
+    }
+  }
+  ASSERT_EQ(vars[1]->Size(), 16);
+}
+
+void BM_BLOOM_COUNTER(int iters, int mode) {
+  testing::StopTiming();
+  testing::UseRealTime();
+
+  EmbeddingConfig config(0, 0, 1, 1, "", 0, 10, 99999, -1.0,
+      "normal", 10000000, 0.01, DT_UINT16);
+  const int64 num_keys = 1000000;
+  std::vector<int64> keys(num_keys);
+  std::vector<int64> freqs(num_keys);
+  srand((unsigned)time(NULL));
+  for (int64 i = 0; i < num_keys; i++) {
+    keys[i] = rand();
+  }
+  embedding::BlockedBloomCounter<int64, uint16> blocked(
+      config.num_counter, config.kHashFunc);
+  // Unblocked layout which probes kHashFunc independent positions.
+  std::vector<uint16> flat(config.num_counter, 0);
+  auto flat_freq = [&config, &flat](int64 key) {
+    std::vector<int64> hash_val;
+    for (int64 i = 0; i < config.kHashFunc; i++) {
+      hash_val.emplace_back(Hash64Combine(key, i) % config.num_counter);
+    }
+    uint16 min_freq = flat[hash_val[0]];
+    for (auto it : hash_val) {
+      min_freq = std::min(flat[it], min_freq);
+    }
+    return min_freq;
+  };
+
+  testing::StartTiming();
+  while (iters--) {
+    if (mode == 0) {
+      for (int64 i = 0; i < num_keys; i++) {
+        freqs[i] = flat_freq(keys[i]);
+      }
+    } else if (mode == 1) {
+      for (int64 i = 0; i < num_keys; i++) {
+        freqs[i] = blocked.GetFreq(keys[i]);
+      }
+    } else {
+      blocked.BatchGetFreq(keys.data(), num_keys, freqs.data());
+    }
+  }
+  testing::StopTiming();
+}
+
+BENCHMARK(BM_BLOOM_COUNTER)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(2);
+
 
 TEST(EmbeddingVariableTest, TestAllocate) {
   int value_len = 8;
@@ -1056,6 +1312,49 @@ TEST(EmbeddingVariableTest, TestBatchCommitofDBKV) {
   }
 }
 
+TEST(EmbeddingVariableTest, TestCompactValuePtr) {
+  int64 value_len = 8;
+  float default_value[8] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+  ValuePtr<float>* value_ptr =
+      new CompactValuePtr<float>(cpu_allocator(), value_len * 2);
+  ASSERT_EQ(value_ptr->GetValue(0, 0), nullptr);
+  float* primary = value_ptr->GetOrAllocate(
+      cpu_allocator(), value_len, default_value, 0, 0);
+  float* slot = value_ptr->GetOrAllocate(
+      cpu_allocator(), value_len, default_value, 1, value_len);
+  ASSERT_EQ(primary + value_len, slot);
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(primary) % 16, 0);
+  ASSERT_EQ(value_ptr->GetValue(1, value_len), slot);
+  for (int64 i = 0; i < value_len; i++) {
+    ASSERT_EQ(slot[i], 1.0);
+  }
+
+  value_ptr->SetStep(100);
+  ASSERT_EQ(value_ptr->GetStep(), 100);
+  value_ptr->SetStep(1LL << 40);
+  ASSERT_EQ(value_ptr->GetStep(), 0xffffffffLL);
+  std::vector<std::thread> freq_threads(4);
+  for (auto& t : freq_threads) {
+    t = std::thread([value_ptr]() {
+      for (int i = 0; i < 1000; i++) {
+        value_ptr->AddFreq();
+      }
+    });
+  }
+  for (auto& t : freq_threads) {
+    t.join();
+  }
+  ASSERT_EQ(value_ptr->GetFreq(), 4000);
+  value_ptr->SetFreq(1LL << 30);
+  value_ptr->AddFreq(10);
+  ASSERT_EQ(value_ptr->GetFreq(), (1 << 24) - 1);
+  // Step and frequency updates must not clear the slot flags.
+  ASSERT_EQ(value_ptr->GetValue(0, 0), primary);
+  ASSERT_EQ(value_ptr->GetValue(1, value_len), slot);
+  value_ptr->Destroy(cpu_allocator());
+  delete value_ptr;
+}
+
 void InsertAndCommit(KVInterface<int64, float>* hashmap) {
   for (int64 i = 0; i< 100; ++i) {
     const ValuePtr<float>* tmp =
@@ -1176,6 +1475,117 @@ TEST(EmbeddingVariableTest, TestLFUCache) {
   }
 }
 
+TEST(EmbeddingVariableTest, TestClockCache) {
+  BatchCache<int64>* cache = new ShardedClockCache<int64>(1);
+  int num_ids = 30;
+  int num_access = 100;
+  int num_evict = 50;
+  int64 ids[num_access] = {0};
+  int64 evict_ids[num_evict] = {0};
+  for (int i = 0; i < num_access; i++){
+    ids[i] = i % num_ids;
+  }
+  cache->add_to_rank(ids, num_access);
+  ASSERT_EQ(cache->size(), num_ids);
+  int64 size = cache->get_evic_ids(evict_ids, num_evict);
+  ASSERT_EQ(size, num_ids);
+  ASSERT_EQ(cache->size(), 0);
+  std::set<int64> evicted(evict_ids, evict_ids + size);
+  ASSERT_EQ(evicted.size(), num_ids);
+  for (int i = 0; i < num_ids; i++) {
+    ASSERT_EQ(evicted.count(i), 1);
+  }
+  delete cache;
+}
+
+TEST(EmbeddingVariableTest, TestClockCacheReservedIds) {
+  // -1 and -2 are the empty and deleted keys of the shard index.
+  BatchCache<int64>* cache = new ShardedClockCache<int64>(1, 1);
+  int64 ids[4] = {-1, -2, 5, -1};
+  cache->add_to_rank(ids, 4);
+  ASSERT_EQ(cache->size(), 3);
+  int64 evict_ids[4] = {0};
+  int64 size = cache->get_evic_ids(evict_ids, 4);
+  ASSERT_EQ(size, 3);
+  ASSERT_EQ(cache->size(), 0);
+  std::set<int64> evicted(evict_ids, evict_ids + size);
+  ASSERT_EQ(evicted, std::set<int64>({-2, -1, 5}));
+  delete cache;
+}
+
+TEST(EmbeddingVariableTest, TestApproxLFUCache) {
+  BatchCache<int64>* cache = new ShardedClockCache<int64>(
+      CacheFactory::kApproxLFUMaxCount, /*num_shards = */4);
+  int64 hot_ids[2] = {7, 9};
+  for (int i = 0; i < 10; i++) {
+    cache->add_to_rank(hot_ids, 2);
+  }
+  int num_cold = 20;
+  int64 cold_ids[num_cold] = {0};
+  for (int i = 0; i < num_cold; i++) {
+    cold_ids[i] = 100 + i;
+  }
+  cache->add_to_rank(cold_ids, num_cold);
+  int64 evict_ids[num_cold] = {0};
+  int64 size = cache->get_evic_ids(evict_ids, num_cold);
+  ASSERT_EQ(size, num_cold);
+  for (int i = 0; i < size; i++) {
+    ASSERT_GE(evict_ids[i], 100);
+  }
+  ASSERT_EQ(cache->size(), 2);
+  delete cache;
+}
+
+void CacheAddToRank(BatchCache<int64>* cache, int64* ids,
+    int64 num_ids, int64 batch_size) {
+  for (int64 i = 0; i + batch_size <= num_ids; i += batch_size) {
+    cache->add_to_rank(ids + i, batch_size);
+  }
+}
+
+void BM_CACHE_ADD_TO_RANK(int iters, int cache_strategy) {
+  testing::StopTiming();
+  testing::UseRealTime();
+
+  const int thread_num = 8;
+  const int64 num_ids = 1000000;
+  const int64 batch_size = 100000;
+  const size_t evict_size = 10000;
+  int64* ids = (int64*)malloc(sizeof(int64) * num_ids);
+  srand((unsigned)time(NULL));
+  for (int64 i = 0; i < num_ids; i++) {
+    ids[i] = rand() % 2000000;
+  }
+  BatchCache<int64>* cache = CacheFactory::Create<int64>(
+      static_cast<CacheStrategy>(cache_strategy), "BM_CACHE");
+
+  testing::StartTiming();
+  while (iters--) {
+    std::vector<std::thread> rank_threads(thread_num);
+    for (size_t i = 0 ; i < thread_num; i++) {
+      rank_threads[i] = std::thread(CacheAddToRank,
+          cache, ids, num_ids, batch_size);
+    }
+    // Evict concurrently, as the eviction thread of a multi-tier EV does.
+    int64 evict_ids[evict_size];
+    for (int i = 0; i < 10; i++) {
+      cache->get_evic_ids(evict_ids, evict_size);
+    }
+    for (auto &t : rank_threads) {
+      t.join();
+    }
+  }
+  testing::StopTiming();
+  delete cache;
+  free(ids);
+}
+
+BENCHMARK(BM_CACHE_ADD_TO_RANK)
+    ->Arg(CacheStrategy::LRU)
+    ->Arg(CacheStrategy::LFU)
+    ->Arg(CacheStrategy::CLOCK)
+    ->Arg(CacheStrategy::APPROX_LFU);
+
 TEST(EmbeddingVariableTest, TestCacheRestore) {
   int64 value_size = 4;
   Tensor value(DT_FLOAT, TensorShape({value_size}));
@@ -1216,6 +1626,53 @@ TEST(EmbeddingVariableTest, TestCacheRestore) {
   delete storage_manager;
 }
 
+TEST(EmbeddingVariableTest, TestEvictionManager) {
+  int64 value_size = 4;
+  Tensor value(DT_FLOAT, TensorShape({value_size}));
+  test::FillValues<float>(&value, std::vector<float>(value_size, 9.0));
+  std::vector<int64> size;
+  size.emplace_back(64 * value_size * sizeof(float));
+  auto storage_manager = new embedding::StorageManager<int64, float>(
+                 "EvictionManagerEV",
+                  embedding::StorageConfig(embedding::DRAM_SSDHASH,
+                                           testing::TmpDir(),
+                                           size, "normal_contiguous"));
+  auto variable = new EmbeddingVar<int64, float>("EvictionManagerEV",
+      storage_manager,
+      EmbeddingConfig(/*emb_index = */0, /*primary_emb_index = */0,
+                      /*block_num = */1, /*slot_num = */0,
+                      /*name = */"", /*steps_to_live = */0,
+                      /*filter_freq = */0, /*max_freq = */999999,
+                      /*l2_weight_threshold = */-1.0, /*layout = */"normal_contiguous",
+                      /*max_element_size = */0, /*false_positive_probability = */-1.0,
+                      /*counter_type = */DT_UINT64));
+  variable->Init(value, 1);
+  variable->InitCache(CacheStrategy::LRU);
+  const int64 num_keys = 1000;
+  Tensor indices(DT_INT64, TensorShape({num_keys}));
+  for (int64 i = 0; i < num_keys; i++) {
+    ValuePtr<float>* value_ptr = nullptr;
+    TF_CHECK_OK(variable->LookupOrCreateKey(i, &value_ptr));
+    indices.flat<int64>()(i) = i;
+  }
+  ASSERT_EQ(storage_manager->Size(0), num_keys);
+  // Updating the cache wakes up the eviction of the DRAM tier.
+  auto cache = variable->Cache();
+  storage_manager->Schedule([cache, indices]() {
+    cache->add_to_rank(indices);
+  });
+  for (int i = 0; i < 1000 && storage_manager->Size(0) > 64; i++) {
+    Env::Default()->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(storage_manager->Size(0), 64);
+  ASSERT_EQ(storage_manager->Size(1), num_keys - 64);
+  string metrics = embedding::EvictionManagerCreator::Create<int64, float>()
+      ->DebugString();
+  LOG(INFO) << metrics;
+  ASSERT_NE(metrics.find("EvictionManagerEV"), string::npos);
+  delete storage_manager;
+}
+
 void t1_gpu(KVInterface<int64, float>* hashmap) {
   for (int i = 0; i< 100; ++i) {
     hashmap->Insert(i, new NormalGPUValuePtr<float>(ev_allocator(), 100));
@@ -1437,6 +1894,52 @@ TEST(EmbeddingVariableTest, TestCPUGPUMalloc) {
 }
 #endif //GOOGLE_CUDA
 
+TEST(EmbeddingVariableTest, TestMemoryPoolConcurrentAllocate) {
+  int64 value_len = 8;
+  int thread_num = 8;
+  int64 allocs_per_thread = 1000;
+  auto mem_pool = new EmbeddingMemoryPool<float>(
+      cpu_allocator(), value_len, 100 * value_len * sizeof(float));
+  std::vector<std::vector<float*>> ptrs(thread_num);
+  auto alloc_fn = [mem_pool, &ptrs, allocs_per_thread](int id) {
+    for (int64 i = 0; i < allocs_per_thread; i += 10) {
+      std::vector<float*> batch = mem_pool->AllocateBatch(10);
+      ptrs[id].insert(ptrs[id].end(), batch.begin(), batch.end());
+    }
+  };
+  std::vector<std::thread> alloc_threads(thread_num);
+  for (int i = 0; i < thread_num; i++) {
+    alloc_threads[i] = std::thread(alloc_fn, i);
+  }
+  for (auto &t : alloc_threads) {
+    t.join();
+  }
+  std::set<float*> all_ptrs;
+  for (auto& thread_ptrs : ptrs) {
+    for (auto ptr : thread_ptrs) {
+      ASSERT_NE(ptr, nullptr);
+      all_ptrs.insert(ptr);
+    }
+  }
+  ASSERT_EQ(all_ptrs.size(), thread_num * allocs_per_thread);
+  ASSERT_EQ(mem_pool->NumAllocated(), thread_num * allocs_per_thread);
+  ASSERT_LE(mem_pool->Occupancy(), 1.0);
+
+  int64 num_blocks = mem_pool->NumBlocks();
+  for (auto& thread_ptrs : ptrs) {
+    mem_pool->DeallocateBatch(thread_ptrs.data(), thread_ptrs.size());
+  }
+  ASSERT_EQ(mem_pool->NumAllocated(), 0);
+  std::vector<float*> reused =
+      mem_pool->AllocateBatch(thread_num * allocs_per_thread);
+  for (auto ptr : reused) {
+    ASSERT_EQ(all_ptrs.count(ptr), 1);
+  }
+  ASSERT_EQ(mem_pool->NumBlocks(), num_blocks);
+  LOG(INFO) << mem_pool->DebugString();
+  delete mem_pool;
+}
+
 void malloc_free_use_allocator(Allocator* allocator){
   timespec start;
   timespec end;
@@ -1563,6 +2066,387 @@ TEST(KVInterfaceTest, TestSSDKVCompaction) {
   }
 }
 
+TEST(KVInterfaceTest, TestEmbFileShortRead) {
+  std::string path = io::JoinPath(testing::TmpDir(), "emb_file_short_");
+  EmbFile file(path, 0, 1 << 20);
+  std::vector<char> data(64, 'x');
+  file.Write(data.data(), data.size());
+  file.Flush();
+
+  std::vector<char> buf(32);
+  TF_EXPECT_OK(file.Read(buf.data(), 32, 32));
+  Status s = file.Read(buf.data(), 32, 48);
+  EXPECT_EQ(error::DATA_LOSS, s.code()) << s;
+
+  // The batch read falls back to single reads, which report the error.
+  std::vector<char> buf2(32);
+  char* vals[] = {buf.data(), buf2.data()};
+  size_t offsets[] = {32, 64};
+  int64 num_ops = 0;
+  s = file.ReadBatch(vals, 32, offsets, 2, &num_ops);
+  EXPECT_EQ(error::DATA_LOSS, s.code()) << s;
+  file.DeleteFile();
+}
+
+TEST(KVInterfaceTest, TestSSDKVBatchLookup) {
+  std::string temp_dir = testing::TmpDir();
+  auto hashmap = new SSDHashKV<int64, float>(
+      temp_dir, cpu_allocator());
+  hashmap->SetTotalDims(124);
+  std::vector<int64> ids;
+  for (int i = 0; i < 262144; i++) {
+    ids.emplace_back(i);
+  }
+  auto t1 = std::thread(SingleCommit, hashmap, ids, 3);
+  t1.join();
+  sleep(1);
+  // Keys are looked up in a shuffled order together with missing keys.
+  std::vector<int64> keys;
+  for (int i = 0; i < 1024; i++) {
+    keys.emplace_back((i * 7919) % 262144);
+    keys.emplace_back(262144 + i);
+  }
+  std::vector<ValuePtr<float>*> value_ptrs(keys.size());
+  TF_CHECK_OK(hashmap->BatchLookup(keys.data(), keys.size(),
+                                   value_ptrs.data()));
+  for (int i = 0; i < keys.size(); i++) {
+    if (keys[i] >= 262144) {
+      ASSERT_EQ(value_ptrs[i], nullptr);
+      continue;
+    }
+    float* v = (float*)value_ptrs[i]->GetPtr();
+    for (int j = 0; j < 124; j++) {
+      ASSERT_EQ(v[4+j], keys[i] + 3);
+    }
+  }
+  LOG(INFO) << hashmap->DebugString();
+}
+
+TEST(KVInterfaceTest, TestSSDKVValueCodec) {
+  // alloc_len 8, 2 slots. The slot values are 100x larger than the
+  // primary ones to check that int8 scales are per row.
+  int64 alloc_len = 8;
+  int64 total_dims = 16;
+  std::vector<std::pair<std::string, float>> codecs = {
+      {"fp32", 0.0}, {"bf16", 1.0 / 128}, {"fp16", 1.0 / 1024},
+      {"int8", 1.0 / 127}};
+  for (auto& codec : codecs) {
+    setenv("TF_SSDHASH_VALUE_TYPE", codec.first.c_str(), 1);
+    auto hashmap = new SSDHashKV<int64, float>(
+        testing::TmpDir(), cpu_allocator());
+    hashmap->SetAllocLen(alloc_len);
+    hashmap->SetTotalDims(total_dims);
+    std::vector<int64> keys;
+    std::vector<ValuePtr<float>*> value_ptrs;
+    for (int64 i = 0; i < 100; i++) {
+      ValuePtr<float>* tmp =
+          new NormalContiguousValuePtr<float>(cpu_allocator(), total_dims);
+      tmp->SetFreq(i);
+      float* v = (float*)((char*)tmp->GetPtr() + sizeof(FixedLengthHeader));
+      for (int64 j = 0; j < total_dims; j++) {
+        v[j] = (j < alloc_len ? 0.01 : 1.0) * (i - 50 + j);
+      }
+      keys.emplace_back(i);
+      value_ptrs.emplace_back(tmp);
+    }
+    TF_CHECK_OK(hashmap->BatchCommit(keys, value_ptrs));
+
+    std::vector<ValuePtr<float>*> lookup_ptrs(keys.size());
+    TF_CHECK_OK(hashmap->BatchLookup(keys.data(), keys.size(),
+                                     lookup_ptrs.data()));
+    for (int64 i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(lookup_ptrs[i]->GetFreq(), i);
+      float* v = (float*)((char*)lookup_ptrs[i]->GetPtr() +
+                          sizeof(FixedLengthHeader));
+      float row_max[2] = {0.0, 0.0};
+      for (int64 j = 0; j < total_dims; j++) {
+        float expected = (j < alloc_len ? 0.01 : 1.0) * (i - 50 + j);
+        row_max[j / alloc_len] =
+            std::max(row_max[j / alloc_len], std::fabs(expected));
+      }
+      for (int64 j = 0; j < total_dims; j++) {
+        float expected = (j < alloc_len ? 0.01 : 1.0) * (i - 50 + j);
+        float bound = codec.first == "int8" ?
+            row_max[j / alloc_len] * codec.second :
+            std::fabs(expected) * codec.second;
+        ASSERT_LE(std::fabs(v[j] - expected), bound + 1e-6)
+            << codec.first << " key " << i << " dim " << j;
+      }
+      delete lookup_ptrs[i];
+    }
+    delete hashmap;
+  }
+  unsetenv("TF_SSDHASH_VALUE_TYPE");
+}
+
+void BM_SSD_VALUE_CODEC(int iters, int codec_type) {
+  testing::StopTiming();
+  int64 alloc_len = 64;
+  int64 total_dims = alloc_len * 3;
+  int64 num_records = 4096;
+  ValueCodec<float> codec(static_cast<ValueCodecType>(codec_type),
+                          alloc_len);
+  std::vector<float> values(num_records * total_dims);
+  for (int64 i = 0; i < values.size(); i++) {
+    values[i] = std::sin(i * 0.37) * (1 + i % 7);
+  }
+  int64 record_len = codec.EncodedSize(total_dims);
+  std::vector<char> encoded(num_records * record_len);
+  std::vector<float> decoded(values.size());
+  testing::UseRealTime();
+  testing::StartTiming();
+  for (int it = 0; it < iters; it++) {
+    for (int64 i = 0; i < num_records; i++) {
+      codec.Encode(values.data() + i * total_dims, total_dims,
+                   encoded.data() + i * record_len);
+      codec.Decode(encoded.data() + i * record_len, total_dims,
+                   decoded.data() + i * total_dims);
+    }
+  }
+  testing::StopTiming();
+  float max_rel_error = 0.0;
+  for (int64 i = 0; i < values.size(); i++) {
+    max_rel_error = std::max(max_rel_error,
+        std::fabs(decoded[i] - values[i]) / (1 + std::fabs(values[i])));
+  }
+  testing::BytesProcessed(static_cast<int64>(iters) * values.size() *
+                          sizeof(float));
+  LOG(INFO) << "codec " << codec_type << ": " << record_len
+            << " bytes per record instead of " << total_dims * sizeof(float)
+            << ", max relative error " << max_rel_error;
+}
+BENCHMARK(BM_SSD_VALUE_CODEC)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(3);
+
+void ExpectRowsNear(const std::vector<float>& actual,
+                    const std::vector<float>& expected,
+                    const std::string& name) {
+  for (int64 j = 0; j < actual.size(); j++) {
+    ASSERT_NEAR(actual[j], expected[j], 1e-5 * (1 + std::fabs(expected[j])))
+        << name << " dim " << actual.size() << " value " << j;
+  }
+}
+
+TEST(EmbeddingVariableTest, TestKvSparseApplyRowParity) {
+  typedef TTypes<float>::Flat Flat;
+  for (int64 dim : {4, 8, 13, 16, 32, 64, 100}) {
+    std::vector<float> grad(dim), var(dim), accum(dim), slot(dim);
+    for (int64 j = 0; j < dim; j++) {
+      grad[j] = std::sin(j * 0.7) * 0.5;
+      var[j] = std::cos(j * 0.3);
+      accum[j] = 0.1 + 0.01 * j;
+      slot[j] = std::sin(j * 1.3) * 0.01;
+    }
+    Eigen::array<Eigen::DenseIndex, 1> dims({dim});
+    Flat g(grad.data(), dims);
+
+    // Adagrad, as in KvSparseApplyAdagradOp before the row kernels.
+    {
+      std::vector<float> var_ref(var), accum_ref(accum);
+      Flat v(var_ref.data(), dims), a(accum_ref.data(), dims);
+      a += g.square();
+      v -= g.constant(0.1f) * g * a.rsqrt();
+      std::vector<float> var_out(var), accum_out(accum);
+      functor::KvApplyDispatchDim(dim, [&](auto k) {
+        functor::KvSparseApplyAdagradRow<float, decltype(k)::value>::Compute(
+            var_out.data(), accum_out.data(), grad.data(), 0.1f, dim);
+      });
+      ExpectRowsNear(var_out, var_ref, "adagrad var");
+      ExpectRowsNear(accum_out, accum_ref, "adagrad accum");
+    }
+
+    // Adam
+    {
+      float beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8, alpha = 0.01;
+      std::vector<float> var_ref(var), m_ref(slot), v_ref(accum);
+      Flat var_i(var_ref.data(), dims), m_a(m_ref.data(), dims),
+          v_a(v_ref.data(), dims);
+      m_a += (g - m_a) * (1.0f - beta1);
+      v_a += (g.square() - v_a) * (1.0f - beta2);
+      var_i -= (m_a * alpha) / (v_a.sqrt() + epsilon);
+      std::vector<float> var_out(var), m_out(slot), v_out(accum);
+      functor::KvApplyDispatchDim(dim, [&](auto k) {
+        functor::KvSparseApplyAdamRow<float, decltype(k)::value>::Compute(
+            var_out.data(), m_out.data(), v_out.data(), grad.data(), alpha,
+            beta1, beta2, epsilon, dim);
+      });
+      ExpectRowsNear(var_out, var_ref, "adam var");
+      ExpectRowsNear(m_out, m_ref, "adam m");
+      ExpectRowsNear(v_out, v_ref, "adam v");
+    }
+
+    // Ftrl, with and without l2 shrinkage, for both lr_power branches and
+    // for l1 below and above the norm of linear.
+    for (float lr_power : {-0.5f, -0.7f}) {
+      for (float l1 : {0.01f, 100.0f}) {
+        for (bool shrinkage : {false, true}) {
+          float lr = 0.05, l2 = 0.2, l2_shrinkage = shrinkage ? 0.3 : 0.0;
+          std::vector<float> var_ref(var), accum_ref(accum), linear_ref(slot);
+          Flat v(var_ref.data(), dims), a(accum_ref.data(), dims),
+              l(linear_ref.data(), dims);
+          Eigen::Tensor<float, 1, Eigen::RowMajor> gt =
+              g + 2.0f * l2_shrinkage * v;
+          Eigen::Tensor<float, 1, Eigen::RowMajor> new_a = a + gt.square();
+          l += gt - (new_a.pow(-lr_power) - a.pow(-lr_power)) / lr * v;
+          Eigen::Tensor<float, 0, Eigen::RowMajor> sqrsum =
+              l.square().sum().sqrt();
+          float norm = sqrsum(0);
+          if (norm > l1) {
+            v = (l1 - norm) /
+                ((new_a.pow(-lr_power) / lr + 2.0f * l2) * norm) * l;
+          } else {
+            v = v.constant(0.0f);
+          }
+          a += g.square();
+          std::vector<float> var_out(var), accum_out(accum),
+              linear_out(slot);
+          functor::KvApplyDispatchDim(dim, [&](auto k) {
+            functor::KvSparseApplyFtrlRow<float, decltype(k)::value>::Compute(
+                var_out.data(), accum_out.data(), linear_out.data(),
+                grad.data(), lr, l1, l2, l2_shrinkage, lr_power, shrinkage,
+                dim);
+          });
+          ExpectRowsNear(var_out, var_ref, "ftrl var");
+          ExpectRowsNear(accum_out, accum_ref, "ftrl accum");
+          ExpectRowsNear(linear_out, linear_ref, "ftrl linear");
+        }
+      }
+    }
+  }
+}
+
+// Adam update of 4096 rows, through the row kernels (fused) or through
+// the Eigen row expressions the KV apply ops used before.
+void BM_KV_SPARSE_APPLY_ADAM(int iters, int dim, bool fused) {
+  testing::StopTiming();
+  typedef TTypes<float>::Flat Flat;
+  int64 num_rows = 4096;
+  std::vector<float> grad(num_rows * dim), var(num_rows * dim),
+      m(num_rows * dim, 0.0), v(num_rows * dim, 0.0);
+  for (int64 i = 0; i < grad.size(); i++) {
+    grad[i] = std::sin(i * 0.37) * 0.1;
+    var[i] = std::cos(i * 0.11);
+  }
+  float beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8, alpha = 0.001;
+  Eigen::array<Eigen::DenseIndex, 1> dims({dim});
+  testing::UseRealTime();
+  testing::StartTiming();
+  for (int it = 0; it < iters; it++) {
+    if (fused) {
+      functor::KvApplyDispatchDim(dim, [&](auto k) {
+        for (int64 r = 0; r < num_rows; r++) {
+          functor::KvSparseApplyAdamRow<float, decltype(k)::value>::Compute(
+              &var[r * dim], &m[r * dim], &v[r * dim], &grad[r * dim],
+              alpha, beta1, beta2, epsilon, dim);
+        }
+      });
+    } else {
+      for (int64 r = 0; r < num_rows; r++) {
+        Flat var_i(&var[r * dim], dims), m_a(&m[r * dim], dims),
+            v_a(&v[r * dim], dims);
+        TTypes<float>::ConstFlat g(&grad[r * dim], dims);
+        m_a += (g - m_a) * (1.0f - beta1);
+        v_a += (g.square() - v_a) * (1.0f - beta2);
+        var_i -= (m_a * alpha) / (v_a.sqrt() + epsilon);
+      }
+    }
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * num_rows);
+}
+
+void BM_KV_SPARSE_APPLY_ADAM_EIGEN(int iters, int dim) {
+  BM_KV_SPARSE_APPLY_ADAM(iters, dim, false);
+}
+void BM_KV_SPARSE_APPLY_ADAM_FUSED(int iters, int dim) {
+  BM_KV_SPARSE_APPLY_ADAM(iters, dim, true);
+}
+BENCHMARK(BM_KV_SPARSE_APPLY_ADAM_EIGEN)
+    ->Arg(8)
+    ->Arg(16)
+    ->Arg(32)
+    ->Arg(64);
+BENCHMARK(BM_KV_SPARSE_APPLY_ADAM_FUSED)
+    ->Arg(8)
+    ->Arg(16)
+    ->Arg(32)
+    ->Arg(64);
+
+TEST(EmbeddingVariableTest, TestSelectHotKeys) {
+  std::vector<int64> keys = {10, 11, 12, 13, 14, 15};
+  std::vector<int64> freqs = {3, 50, 7, 50, 1, 9};
+  std::vector<int64> hot_keys, hot_freqs;
+  SelectHotKeys(keys, freqs, 3, &hot_keys, &hot_freqs);
+  EXPECT_EQ(std::vector<int64>({11, 13, 15}), hot_keys);
+  EXPECT_EQ(std::vector<int64>({50, 50, 9}), hot_freqs);
+
+  SelectHotKeys(keys, freqs, 100, &hot_keys, &hot_freqs);
+  EXPECT_EQ(std::vector<int64>({11, 13, 15, 12, 10, 14}), hot_keys);
+  SelectHotKeys(keys, freqs, 0, &hot_keys, &hot_freqs);
+  EXPECT_TRUE(hot_keys.empty());
+}
+
+class KvSparseSegmentReduceOpTest : public OpsTestBase {
+ protected:
+  void MakeOp() {
+    TF_ASSERT_OK(NodeDefBuilder("segment_reduce",
+                                "KvResourceSparseSegmentReduce")
+                     .Input(FakeInput(DT_RESOURCE))
+                     .Input(FakeInput(DT_INT64))
+                     .Input(FakeInput(DT_INT32))
+                     .Input(FakeInput(DT_FLOAT))
+                     .Attr("combiner", "sum")
+                     .Attr("dtype", DT_FLOAT)
+                     .Attr("Tkeys", DT_INT64)
+                     .Finalize(node_def()));
+    TF_ASSERT_OK(InitOp());
+  }
+
+  // Runs the op over keys 1, 2 and 3 of an EV whose rows are all ones.
+  Status RunWithSegmentIds(const std::vector<int32>& segment_ids) {
+    Tensor value(DT_FLOAT, TensorShape({2}));
+    test::FillValues<float>(&value, {1.0, 1.0});
+    auto storage_manager = new embedding::StorageManager<int64, float>(
+        "ev", embedding::StorageConfig());
+    auto ev = new EmbeddingVar<int64, float>("ev", storage_manager);
+    TF_CHECK_OK(ev->Init(value, 1));
+    AddResourceInput("", "ev", ev);
+    AddInputFromArray<int64>(TensorShape({3}), {1, 2, 3});
+    AddInputFromArray<int32>(TensorShape({3}), segment_ids);
+    AddInputFromArray<float>(TensorShape({2}), {0.0, 0.0});
+    return RunOpKernel();
+  }
+};
+
+TEST_F(KvSparseSegmentReduceOpTest, Reduce) {
+  MakeOp();
+  TF_ASSERT_OK(RunWithSegmentIds({0, 0, 2}));
+  Tensor expected(allocator(), DT_FLOAT, TensorShape({3, 2}));
+  test::FillValues<float>(&expected, {2.0, 2.0, 0.0, 0.0, 1.0, 1.0});
+  test::ExpectTensorEqual<float>(expected, *GetOutput(0));
+}
+
+TEST_F(KvSparseSegmentReduceOpTest, NegativeSegmentIds) {
+  MakeOp();
+  Status s = RunWithSegmentIds({0, 0, -1});
+  EXPECT_EQ(error::INVALID_ARGUMENT, s.code());
+  EXPECT_TRUE(str_util::StrContains(s.error_message(),
+                                    "segment ids must be >= 0"))
+      << s;
+}
+
+TEST_F(KvSparseSegmentReduceOpTest, UnsortedSegmentIds) {
+  MakeOp();
+  Status s = RunWithSegmentIds({0, 100000000, 1});
+  EXPECT_EQ(error::INVALID_ARGUMENT, s.code());
+  EXPECT_TRUE(str_util::StrContains(s.error_message(),
+                                    "segment ids are not increasing"))
+      << s;
+}
+
 } // namespace
 } // namespace embedding
 } // namespace tensorflow
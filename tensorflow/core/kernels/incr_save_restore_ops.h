@@ -15,7 +15,11 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_KERNELS_INCR_SAVE_RESTORE_OPS_H_
 #define TENSORFLOW_CORE_KERNELS_INCR_SAVE_RESTORE_OPS_H_
 
+#include <algorithm>
+#include <set>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "tensorflow/core/framework/bounds_check.h"
@@ -37,8 +41,13 @@ limitations under the License.
 #include "tensorflow/core/util/tensor_slice_reader.h"
 #include "tensorflow/core/lib/core/blocking_counter.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/lib/core/bits.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
+// Touched indices with their update counts, an open addressing table
+// with linear probing. A count of 0 marks an empty slot, so no key value
+// has to be reserved, and key and count share a cache line.
 template <typename T>
 class ThreadSafeHashMap {
  public:
@@ -50,38 +59,187 @@ class ThreadSafeHashMap {
     mutex_lock l(lock_);
     auto indices_flat = indices.flat<T>();
     for (int64 idx = start; idx < end; idx++) {
-      auto indice = indices_flat(idx);
-      auto it = hash_map_.find(indice);
-      if (it == hash_map_.end()) {
-        hash_map_[indice] = 1;
-      } else {
-        it->second = it->second + 1;
+      if ((size_ + 1) * 2 > slots_.size()) {
+        Grow();
+      }
+      Slot* slot = FindSlot(indices_flat(idx));
+      if (slot->count == 0) {
+        slot->key = indices_flat(idx);
+        size_++;
       }
+      slot->count++;
     }
   }
 
   void Swap(std::unordered_map<T, uint64>& out) {
     mutex_lock l(lock_);
-    hash_map_.swap(out);
+    out.clear();
+    out.reserve(size_);
+    for (auto& slot : slots_) {
+      if (slot.count != 0) {
+        out[slot.key] = slot.count;
+      }
+    }
+    ClearLocked();
   }
 
   void GetKeys(std::set<T>& key_set) {
     mutex_lock l(lock_);
-    for (auto it : hash_map_) {
-      key_set.insert(it.first);
+    for (auto& slot : slots_) {
+      if (slot.count != 0) {
+        key_set.insert(slot.key);
+      }
+    }
+  }
+
+  void AppendKeys(std::vector<T>* keys) {
+    mutex_lock l(lock_);
+    keys->reserve(keys->size() + size_);
+    for (auto& slot : slots_) {
+      if (slot.count != 0) {
+        keys->push_back(slot.key);
+      }
     }
   }
 
+  int64 Size() {
+    mutex_lock l(lock_);
+    return size_;
+  }
+
   void Clear() {
     mutex_lock l(lock_);
-    hash_map_.clear();
+    ClearLocked();
   }
 
  private:
-  std::unordered_map<T, uint64> hash_map_;
+  struct Slot {
+    T key;
+    uint64 count;
+  };
+
+  static constexpr size_t kMinSlots = 1024;
+
+  // The slots are kept between checkpoints, the same keys come back.
+  void ClearLocked() {
+    if (size_ > 0) {
+      std::fill(slots_.begin(), slots_.end(), Slot{T(), 0});
+      size_ = 0;
+    }
+  }
+
+  Slot* FindSlot(T key) {
+    const size_t mask = slots_.size() - 1;
+    size_t pos = (static_cast<uint64>(key) * 0x9E3779B97F4A7C15ULL) >> shift_;
+    while (slots_[pos].count != 0 && slots_[pos].key != key) {
+      pos = (pos + 1) & mask;
+    }
+    return &slots_[pos];
+  }
+
+  void Grow() {
+    std::vector<Slot> old_slots(std::max(kMinSlots, slots_.size() * 2),
+                                Slot{T(), 0});
+    old_slots.swap(slots_);
+    shift_ = 64 - Log2Floor64(slots_.size());
+    for (auto& slot : old_slots) {
+      if (slot.count != 0) {
+        *FindSlot(slot.key) = slot;
+      }
+    }
+  }
+
+  std::vector<Slot> slots_;
+  int64 size_ = 0;
+  int shift_ = 64;
   mutex lock_;
 };
 
+namespace incr_internal {
+
+// Flips the sign bit, so signed keys sort by their unsigned bits.
+template <typename T>
+inline typename std::make_unsigned<T>::type RadixKey(T key) {
+  typedef typename std::make_unsigned<T>::type U;
+  return static_cast<U>(key) ^
+         (static_cast<U>(std::is_signed<T>::value) << (sizeof(T) * 8 - 1));
+}
+
+// LSD radix sort of keys[0, n) by the 8 bit digits below digit_end, tmp
+// holds n keys. Digits that all keys share are skipped.
+template <typename T>
+void RadixSortDigits(T* keys, T* tmp, int64 n, int digit_end) {
+  T* in = keys;
+  T* out = tmp;
+  for (int digit = 0; digit < digit_end && n > 0; digit++) {
+    const int shift = digit * 8;
+    int64 offsets[257] = {0};
+    for (int64 i = 0; i < n; i++) {
+      offsets[((RadixKey(in[i]) >> shift) & 0xFF) + 1]++;
+    }
+    if (offsets[((RadixKey(in[0]) >> shift) & 0xFF) + 1] == n) {
+      continue;
+    }
+    for (int b = 0; b < 256; b++) {
+      offsets[b + 1] += offsets[b];
+    }
+    for (int64 i = 0; i < n; i++) {
+      out[offsets[(RadixKey(in[i]) >> shift) & 0xFF]++] = in[i];
+    }
+    std::swap(in, out);
+  }
+  if (in != keys) {
+    std::copy(in, in + n, keys);
+  }
+}
+
+}  // namespace incr_internal
+
+// Sorts keys ascending. The keys are split into 256 buckets by their top
+// byte first, the buckets are then sorted in parallel on workers if set.
+template <typename T>
+void RadixSort(std::vector<T>* keys, thread::ThreadPool* workers = nullptr) {
+  using incr_internal::RadixKey;
+  const int64 n = keys->size();
+  constexpr int kDigits = sizeof(T);
+  constexpr int kTopShift = (kDigits - 1) * 8;
+  std::vector<T> sorted(n);
+  int64 offsets[257] = {0};
+  for (T key : *keys) {
+    offsets[(RadixKey(key) >> kTopShift) + 1]++;
+  }
+  for (int b = 0; b < 256; b++) {
+    offsets[b + 1] += offsets[b];
+  }
+  int64 next[256];
+  std::copy(offsets, offsets + 256, next);
+  for (T key : *keys) {
+    sorted[next[RadixKey(key) >> kTopShift]++] = key;
+  }
+
+  auto sort_buckets = [&sorted, keys, &offsets](int64 start, int64 end) {
+    for (int64 b = start; b < end; b++) {
+      T* begin = sorted.data() + offsets[b];
+      const int64 size = offsets[b + 1] - offsets[b];
+      if (size < 64) {
+        std::sort(begin, begin + size, [](T l, T r) {
+          return RadixKey(l) < RadixKey(r);
+        });
+        continue;
+      }
+      T* tmp = keys->data() + offsets[b];
+      incr_internal::RadixSortDigits(begin, tmp, size, kDigits - 1);
+    }
+  };
+  if (workers != nullptr && n >= (1 << 16)) {
+    Shard(workers->NumThreads(), workers, 256, n / 256 * kDigits,
+          sort_buckets);
+  } else {
+    sort_buckets(0, 256);
+  }
+  keys->swap(sorted);
+}
+
 template <typename T>
 class ParallelHashMap {
  public:
@@ -100,6 +258,11 @@ class ParallelHashMap {
         std::min(part_count_, thread_pool.workers->NumThreads()), parts);
 
     int part_count = parts.size();
+    if (part_count == 1) {
+      // Not worth a round trip through the thread pool.
+      hash_maps_[0].Update(indices, parts[0].first, parts[0].second);
+      return;
+    }
     BlockingCounter counter(part_count);
     for (int i = 0; i < part_count; i++) {
       int64 start = parts[i].first;
@@ -144,6 +307,17 @@ class ParallelHashMap {
     }
   }
 
+  // Touched keys, ascending and unique.
+  void GetSortedKeys(std::vector<T>* keys,
+                     thread::ThreadPool* workers = nullptr) {
+    keys->clear();
+    for (size_t i = 0; i < part_count_; i++) {
+      hash_maps_[i].AppendKeys(keys);
+    }
+    RadixSort(keys, workers);
+    keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+  }
+
   void SplitParallelParts(int64 total_num, int64 part_count,
       std::vector<std::pair<int64, int64>>& parts) {
     if (total_num == 0) {
@@ -375,10 +549,8 @@ class IndicesIncrRecorder: public ResourceBase {
     size_t bytes_limit = 8 << 20;
     char* dump_buffer = (char*)malloc(sizeof(char) * bytes_limit);
 
-    std::set<K> incr_keys_set;
-    incr_indices_.GetKeys(incr_keys_set);
     std::vector<K> incr_keys;
-    incr_keys.assign(incr_keys_set.begin(), incr_keys_set.end());
+    incr_indices_.GetSortedKeys(&incr_keys);
 
     IncrKeyDumpIterator<K> key_dump_iter(incr_keys);
     Status st = SaveTensorWithFixedBuffer(tensor_name + "-sparse_incr_keys",
@@ -410,19 +582,18 @@ class IndicesIncrRecorder: public ResourceBase {
     size_t bytes_limit = 8 << 20;
     char* dump_buffer = (char*)malloc(sizeof(char) * bytes_limit);
 
-    std::set<K> incr_keys;
-    incr_indices_.GetKeys(incr_keys);
+    std::vector<K> incr_keys;
+    incr_indices_.GetSortedKeys(&incr_keys,
+        context->device()->tensorflow_cpu_worker_threads()->workers);
 
     std::vector<std::vector<K> > incr_keys_parts;
     incr_keys_parts.resize(kSavedPartitionNum);
 
     for (auto& ik : incr_keys) {
-      for (int partid = 0; partid < kSavedPartitionNum; partid++) {
-        if (ik % kSavedPartitionNum == partid &&
-            emb_var->GetFreq(ik) >= emb_var->MinFreq()) {
-          incr_keys_parts[partid].push_back(ik);
-          break;
-        }
+      int partid = ik % kSavedPartitionNum;
+      // Keys of a negative remainder match no partition.
+      if (partid >= 0 && emb_var->GetFreq(ik) >= emb_var->MinFreq()) {
+        incr_keys_parts[partid].push_back(ik);
       }
     }
 
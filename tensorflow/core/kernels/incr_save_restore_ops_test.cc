@@ -35,6 +35,7 @@ limitations under the License.
 #include "tensorflow/core/kernels/ops_testutil.h"
 #include "tensorflow/core/kernels/ops_util.h"
 #include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/util/tensor_slice_reader_cache.h"
@@ -115,6 +116,50 @@ TEST(ParallelHashMapTest, TestGetKeys) {
   EXPECT_TRUE(keys.find(3) != keys.end());
 }
 
+TEST(ParallelHashMapTest, TestGetSortedKeys) {
+  ParallelHashMap<int64> parallel_hashmap(2, 4);
+  Tensor t(DT_INT64, TensorShape({9}));
+  test::FillValues<int64>(&t, {5, -3, 7, 5, 1LL << 40, -3, 2, 7, 9});
+
+  std::unique_ptr<Device> device(
+      DeviceFactory::NewDevice("CPU", {}, "/job:a/replica:0/task:0"));
+
+  OpKernelContext::Params params;
+  params.device = device.get();
+  params.frame_iter = FrameAndIter(0, 0);
+  std::unique_ptr<OpKernelContext> context(new OpKernelContext(&params, 3));
+
+  parallel_hashmap.Update(t, context.get());
+  parallel_hashmap.Update(t, context.get());
+
+  std::vector<int64> keys;
+  parallel_hashmap.GetSortedKeys(&keys);
+  EXPECT_EQ(std::vector<int64>({-3, 2, 5, 7, 9, 1LL << 40}), keys);
+
+  std::unordered_map<int64, uint64> out_indices;
+  parallel_hashmap.Swap(out_indices);
+  EXPECT_EQ(6, out_indices.size());
+  EXPECT_EQ(4, out_indices[5]);
+  EXPECT_EQ(2, out_indices[9]);
+  parallel_hashmap.GetSortedKeys(&keys);
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST(ParallelHashMapTest, TestRadixSort) {
+  random::PhiloxRandom philox(7, 11);
+  random::SimplePhilox rnd(&philox);
+  for (int64 n : {0, 1, 100, 100000}) {
+    std::vector<int64> keys(n);
+    for (auto& key : keys) {
+      key = static_cast<int64>(rnd.Rand64()) >> (n % 3 * 20);
+    }
+    std::vector<int64> expected = keys;
+    std::sort(expected.begin(), expected.end());
+    RadixSort(&keys);
+    EXPECT_EQ(expected, keys);
+  }
+}
+
 TEST(IndicesIncrRecorderTest, TestUpdateAndSwap) {
   Tensor t(DT_INT32, TensorShape({5}));
   test::FillValues<int32>(&t, {1, 2, 3, 2, 3});
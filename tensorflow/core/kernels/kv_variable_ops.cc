@@ -34,6 +34,7 @@ limitations under the License.
 #include "tensorflow/core/kernels/training_op_helpers.h"
 #include "tensorflow/core/kernels/variable_ops.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/gtl/flatmap.h"
 #include "tensorflow/core/platform/mem.h"
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/types.h"
@@ -190,6 +191,21 @@ class InitializeKvVariableOp : public OpKernel {
       layout_ = "light";
     }
 
+    std::string requested_layout;
+    OP_REQUIRES_OK(c, c->GetAttr("layout", &requested_layout));
+    if (requested_layout == "compact") {
+      // COMPACT keeps all slots inline like NORMAL_CONTIGUOUS, so it is
+      // only used where that layout would be, on a single DRAM tier.
+      if (layout_ != "normal" &&
+          storage_type_ == embedding::StorageType::DRAM) {
+        layout_ = "compact";
+      } else {
+        LOG(WARNING) << "layout compact is only supported on DRAM storage "
+                     << "without counter filter or embedding blocks, use "
+                     << layout_ << " instead.";
+      }
+    }
+
     CHECK(block_num_ == 1 || layout_ != "normal_contiguous");
 
     if (steps_to_live_ == kEmbeddingVarUseDB ||
@@ -602,22 +618,52 @@ class KvResourceGatherOp : public OpKernel {
               "MultiLevel EV's Cache size ", ev->CacheSize(),
               " should large than IDs in batch ", N));
       const size_t slice_bytes = slice_elems * sizeof(TValue);
-      auto do_work = [this, indices_flat,
-           out_base, slice_elems, c, default_v, ev, counts] (
-               int64 start, int64 limit) {
-        for (int64 i = start; i < limit; ++i) {
-          TValue* default_v_ptr = get_default_v_fn_(
-              default_v, indices_flat(i), i, ev->GetDefaultValueDim(),
-              ev->ValueLen());
-          int32 count = get_count_fn_(counts, i);
-          OP_REQUIRES_OK(c, lookup_fn_(ev, indices_flat(i),
-              out_base + i * slice_elems, default_v_ptr, count));
-        }
-      };
       auto worker_threads = c->device()->tensorflow_cpu_worker_threads();
-      Shard(worker_threads->num_threads,
-            worker_threads->workers, indices_size,
-            slice_bytes, do_work);
+      if (!is_inference_) {
+        // Every key of a shard is looked up or created through the batched
+        // path, without feature filter it goes to the storage directly.
+        const bool has_filter = ev->HasFeatureFilter();
+        auto do_batch_work = [this, indices_flat,
+             out_base, slice_elems, default_v, ev, counts, has_filter] (
+                 int64 start, int64 limit) {
+          std::vector<TValue*> default_values(limit - start);
+          for (int64 i = start; i < limit; ++i) {
+            default_values[i - start] = get_default_v_fn_(
+                default_v, indices_flat(i), i, ev->GetDefaultValueDim(),
+                ev->ValueLen());
+          }
+          const int32* shard_counts =
+              (counts == nullptr) ? nullptr : counts + start;
+          if (has_filter) {
+            ev->BatchLookupOrCreateWithFilter(&indices_flat(start),
+                out_base + start * slice_elems, limit - start,
+                default_values.data(), shard_counts);
+          } else {
+            ev->BatchLookupOrCreate(&indices_flat(start),
+                out_base + start * slice_elems, limit - start,
+                default_values.data(), shard_counts);
+          }
+        };
+        Shard(worker_threads->num_threads,
+              worker_threads->workers, indices_size,
+              slice_bytes, do_batch_work);
+      } else {
+        auto do_work = [this, indices_flat,
+             out_base, slice_elems, c, default_v, ev, counts] (
+                 int64 start, int64 limit) {
+          for (int64 i = start; i < limit; ++i) {
+            TValue* default_v_ptr = get_default_v_fn_(
+                default_v, indices_flat(i), i, ev->GetDefaultValueDim(),
+                ev->ValueLen());
+            int32 count = get_count_fn_(counts, i);
+            OP_REQUIRES_OK(c, lookup_fn_(ev, indices_flat(i),
+                out_base + i * slice_elems, default_v_ptr, count));
+          }
+        };
+        Shard(worker_threads->num_threads,
+              worker_threads->workers, indices_size,
+              slice_bytes, do_work);
+      }
 
       if (ev->IsMultiLevel()) {
         embedding::BatchCache<TKey>* cache = ev->Cache();
@@ -658,6 +704,349 @@ TF_CALL_REAL_NUMBER_TYPES(REGISTER_GATHER_ALL_INDICES)
 #undef REGISTER_GATHER_ALL_INDICES
 #undef REGISTER_GATHER_FULL
 
+enum class SegmentCombiner { kSum, kMean, kSqrtN };
+
+Status GetSegmentCombiner(OpKernelConstruction* c,
+                          SegmentCombiner* combiner) {
+  std::string name;
+  TF_RETURN_IF_ERROR(c->GetAttr("combiner", &name));
+  if (name == "sum") {
+    *combiner = SegmentCombiner::kSum;
+  } else if (name == "mean") {
+    *combiner = SegmentCombiner::kMean;
+  } else if (name == "sqrtn") {
+    *combiner = SegmentCombiner::kSqrtN;
+  } else {
+    return errors::InvalidArgument("Unsupported combiner ", name);
+  }
+  return Status::OK();
+}
+
+template <typename T>
+T SegmentScale(SegmentCombiner combiner, int64 count) {
+  switch (combiner) {
+    case SegmentCombiner::kMean:
+      return T(1) / static_cast<T>(count);
+    case SegmentCombiner::kSqrtN:
+      return T(1) / std::sqrt(static_cast<T>(count));
+    default:
+      return T(1);
+  }
+}
+
+// Unique, KvResourceGather and SparseSegmentSum/Mean/SqrtN in one pass.
+// The rows of the unique keys are added into the output segments straight
+// from the EV storage, only EVs with feature filter or multi-level storage
+// copy them into a buffer first, as KvResourceGather does.
+template <typename TKey, typename TValue, typename TSegment>
+class KvResourceSparseSegmentReduceOp : public OpKernel {
+ public:
+  explicit KvResourceSparseSegmentReduceOp(OpKernelConstruction* c)
+      : OpKernel(c) {
+    OP_REQUIRES_OK(c, GetSegmentCombiner(c, &combiner_));
+    OP_REQUIRES_OK(c, c->GetAttr("is_inference", &is_inference_));
+    bool is_inference;
+    TF_CHECK_OK(ReadBoolFromEnvVar(kInferenceMode, false, &is_inference));
+    is_inference_ |= is_inference;
+    OP_REQUIRES_OK(c,
+        c->GetAttr("is_use_default_value_tensor",
+          &is_use_default_value_tensor_));
+  }
+
+  void Compute(OpKernelContext* c) override {
+    EmbeddingVar<TKey, TValue>* ev = nullptr;
+    OP_REQUIRES_OK(c, LookupResource(c, HandleFromInput(c, 0), &ev));
+    core::ScopedUnref unref_me(ev);
+    const Tensor& indices = c->input(1);
+    const Tensor& segment_ids = c->input(2);
+    OP_REQUIRES(c, TensorShapeUtils::IsVector(indices.shape()),
+        errors::InvalidArgument("indices should be a vector."));
+    OP_REQUIRES(c, indices.shape() == segment_ids.shape(),
+        errors::InvalidArgument("segment_ids and indices should have "
+                                "the same size."));
+    const int64 N = indices.NumElements();
+    const int64 value_len = ev->ValueLen();
+    auto indices_flat = indices.flat<TKey>();
+    auto segment_flat = segment_ids.flat<TSegment>();
+
+    // The output and segment_starts are sized by the last segment id, so
+    // the ids are checked before anything is allocated.
+    for (int64 i = 0; i < N; ++i) {
+      OP_REQUIRES(c, segment_flat(i) >= 0,
+          errors::InvalidArgument("segment ids must be >= 0, got ",
+                                  segment_flat(i), " at ", i));
+      OP_REQUIRES(c, i == 0 || segment_flat(i - 1) <= segment_flat(i),
+          errors::InvalidArgument("segment ids are not increasing at ", i));
+    }
+
+    // segment_starts[s] is the first index of segment s, segments without
+    // indices start where the next one does.
+    const int64 num_segments =
+        (N > 0) ? static_cast<int64>(segment_flat(N - 1)) + 1 : 0;
+    std::vector<int64> segment_starts(num_segments + 1, N);
+    int64 next_segment = 0;
+    for (int64 i = 0; i < N; ++i) {
+      const int64 segment = segment_flat(i);
+      for (; next_segment <= segment; ++next_segment) {
+        segment_starts[next_segment] = i;
+      }
+    }
+
+    Tensor* unique_idx = nullptr;
+    OP_REQUIRES_OK(c, c->allocate_output(2, indices.shape(), &unique_idx));
+    auto unique_idx_flat = unique_idx->flat<int32>();
+    gtl::FlatMap<TKey, int32> key_to_idx(N);
+    std::vector<TKey> keys;
+    std::vector<int32> counts;
+    for (int64 i = 0; i < N; ++i) {
+      auto it = key_to_idx.insert(
+          {indices_flat(i), static_cast<int32>(keys.size())});
+      if (it.second) {
+        keys.push_back(indices_flat(i));
+        counts.push_back(0);
+      }
+      unique_idx_flat(i) = it.first->second;
+      ++counts[it.first->second];
+    }
+    const int64 num_unique = keys.size();
+    Tensor* unique_keys = nullptr;
+    OP_REQUIRES_OK(c, c->allocate_output(1, TensorShape({num_unique}),
+                                         &unique_keys));
+    std::copy(keys.begin(), keys.end(), unique_keys->flat<TKey>().data());
+
+    Tensor* out = nullptr;
+    OP_REQUIRES_OK(c, c->allocate_output(0,
+        TensorShape({num_segments, value_len}), &out));
+    if (N == 0) return;
+
+    TValue* default_v = is_use_default_value_tensor_ ?
+        (TValue*)c->input(3).data() : ev->GetDefaultValuePtr();
+    const int64 default_value_dim = ev->GetDefaultValueDim();
+    auto default_value_of = [this, default_v, default_value_dim,
+                             value_len] (TKey key, int64 index) {
+      return is_use_default_value_tensor_ ?
+          default_v + value_len * index :
+          default_v + value_len * (key % default_value_dim);
+    };
+
+    auto worker_threads = c->device()->tensorflow_cpu_worker_threads();
+    const int64 row_bytes = value_len * sizeof(TValue);
+    std::vector<const TValue*> rows(num_unique);
+    Tensor unique_values;
+    if (!ev->IsMultiLevel() && !ev->HasFeatureFilter()) {
+      auto lookup_rows = [this, ev, &keys, &rows, &default_value_of] (
+          int64 start, int64 limit) {
+        if (is_inference_) {
+          ev->BatchLookupRows(&keys[start], &rows[start], limit - start);
+          return;
+        }
+        std::vector<TValue*> default_values(limit - start);
+        for (int64 i = start; i < limit; ++i) {
+          default_values[i - start] = default_value_of(keys[i], i);
+        }
+        ev->BatchLookupOrCreateRows(&keys[start],
+            const_cast<TValue**>(&rows[start]), limit - start,
+            default_values.data(), nullptr);
+      };
+      Shard(worker_threads->num_threads, worker_threads->workers,
+            num_unique, row_bytes, lookup_rows);
+    } else {
+      OP_REQUIRES(c, !ev->IsMultiLevel() || ev->CacheSize() >= num_unique,
+          errors::InvalidArgument(
+              "MultiLevel EV's Cache size ", ev->CacheSize(),
+              " should large than IDs in batch ", num_unique));
+      OP_REQUIRES_OK(c, c->allocate_temp(DataTypeToEnum<TValue>::v(),
+          TensorShape({num_unique, value_len}), &unique_values));
+      TValue* values = unique_values.flat<TValue>().data();
+      const bool has_filter = ev->HasFeatureFilter();
+      mutex mu;
+      Status lookup_status;
+      auto lookup_values = [this, ev, values, value_len, has_filter, &keys,
+                            &counts, &rows, &default_value_of, &mu,
+                            &lookup_status] (int64 start, int64 limit) {
+        std::vector<TValue*> default_values(limit - start);
+        for (int64 i = start; i < limit; ++i) {
+          default_values[i - start] = default_value_of(keys[i], i);
+          rows[i] = values + i * value_len;
+        }
+        if (is_inference_) {
+          for (int64 i = start; i < limit; ++i) {
+            Status s = ev->Lookup(keys[i], values + i * value_len,
+                                  default_values[i - start]);
+            if (!s.ok()) {
+              mutex_lock l(mu);
+              lookup_status.Update(s);
+            }
+          }
+        } else if (has_filter) {
+          ev->BatchLookupOrCreateWithFilter(&keys[start],
+              values + start * value_len, limit - start,
+              default_values.data(), &counts[start]);
+        } else {
+          ev->BatchLookupOrCreate(&keys[start],
+              values + start * value_len, limit - start,
+              default_values.data(), nullptr);
+        }
+      };
+      Shard(worker_threads->num_threads, worker_threads->workers,
+            num_unique, row_bytes, lookup_values);
+      OP_REQUIRES_OK(c, lookup_status);
+      if (ev->IsMultiLevel()) {
+        const Tensor ranked_keys = *unique_keys;
+        ev->storage_manager()->Schedule([ev, ranked_keys]() {
+          embedding::BatchCache<TKey>* cache = ev->Cache();
+          cache->add_to_rank(ranked_keys);
+        });
+      }
+    }
+
+    typedef Eigen::Map<Eigen::Array<TValue, Eigen::Dynamic, 1>> RowMap;
+    typedef Eigen::Map<
+        const Eigen::Array<TValue, Eigen::Dynamic, 1>> ConstRowMap;
+    TValue* out_base = out->flat<TValue>().data();
+    const int32* idx = unique_idx_flat.data();
+    auto combine = [this, out_base, idx, value_len, &rows,
+                    &segment_starts] (int64 start, int64 limit) {
+      for (int64 s = start; s < limit; ++s) {
+        RowMap out_row(out_base + s * value_len, value_len);
+        const int64 begin = segment_starts[s];
+        const int64 end = segment_starts[s + 1];
+        if (begin == end) {
+          out_row.setZero();
+          continue;
+        }
+        out_row = ConstRowMap(rows[idx[begin]], value_len);
+        for (int64 i = begin + 1; i < end; ++i) {
+          out_row += ConstRowMap(rows[idx[i]], value_len);
+        }
+        if (combiner_ != SegmentCombiner::kSum) {
+          out_row *= SegmentScale<TValue>(combiner_, end - begin);
+        }
+      }
+    };
+    Shard(worker_threads->num_threads, worker_threads->workers,
+          num_segments, row_bytes * (N / num_segments + 1), combine);
+  }
+
+ private:
+  SegmentCombiner combiner_;
+  bool is_inference_;
+  bool is_use_default_value_tensor_;
+};
+
+// Adds the scaled gradient of every segment into the unique keys of its
+// indices, one unique key at a time so that the sums need no locking.
+template <typename T, typename TSegment>
+class KvResourceSparseSegmentReduceGradOp : public OpKernel {
+ public:
+  explicit KvResourceSparseSegmentReduceGradOp(OpKernelConstruction* c)
+      : OpKernel(c) {
+    OP_REQUIRES_OK(c, GetSegmentCombiner(c, &combiner_));
+  }
+
+  void Compute(OpKernelContext* c) override {
+    const Tensor& grad = c->input(0);
+    const Tensor& unique_idx = c->input(1);
+    const Tensor& segment_ids = c->input(2);
+    const int32 num_unique = c->input(3).scalar<int32>()();
+    OP_REQUIRES(c, TensorShapeUtils::IsMatrix(grad.shape()),
+        errors::InvalidArgument("grad should be a matrix."));
+    OP_REQUIRES(c, unique_idx.shape() == segment_ids.shape(),
+        errors::InvalidArgument("segment_ids and unique_idx should have "
+                                "the same size."));
+    OP_REQUIRES(c, num_unique >= 0,
+        errors::InvalidArgument("num_unique should not be negative."));
+    const int64 N = unique_idx.NumElements();
+    const int64 num_segments = grad.dim_size(0);
+    const int64 value_len = grad.dim_size(1);
+    auto idx = unique_idx.flat<int32>();
+    auto segment_flat = segment_ids.flat<TSegment>();
+
+    // The indices grouped by unique key, counting sort on unique_idx.
+    std::vector<int64> key_starts(num_unique + 1, 0);
+    std::vector<int64> segment_sizes(num_segments, 0);
+    for (int64 i = 0; i < N; ++i) {
+      OP_REQUIRES(c, idx(i) >= 0 && idx(i) < num_unique,
+          errors::InvalidArgument("unique_idx ", idx(i), " at ", i,
+                                  " is out of range [0, ", num_unique, ")"));
+      OP_REQUIRES(c, segment_flat(i) >= 0 && segment_flat(i) < num_segments,
+          errors::InvalidArgument("segment id ", segment_flat(i), " at ", i,
+                                  " is out of range [0, ", num_segments,
+                                  ")"));
+      ++key_starts[idx(i) + 1];
+      ++segment_sizes[segment_flat(i)];
+    }
+    for (int64 k = 0; k < num_unique; ++k) {
+      key_starts[k + 1] += key_starts[k];
+    }
+    std::vector<int64> key_segments(N);
+    std::vector<int64> next(key_starts.begin(), key_starts.end() - 1);
+    for (int64 i = 0; i < N; ++i) {
+      key_segments[next[idx(i)]++] = segment_flat(i);
+    }
+
+    Tensor* out = nullptr;
+    OP_REQUIRES_OK(c, c->allocate_output(0,
+        TensorShape({num_unique, value_len}), &out));
+    if (num_unique == 0) return;
+
+    typedef Eigen::Map<Eigen::Array<T, Eigen::Dynamic, 1>> RowMap;
+    typedef Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>> ConstRowMap;
+    T* out_base = out->flat<T>().data();
+    const T* grad_base = grad.flat<T>().data();
+    auto accumulate = [this, out_base, grad_base, value_len, &key_starts,
+                       &key_segments, &segment_sizes] (
+        int64 start, int64 limit) {
+      for (int64 k = start; k < limit; ++k) {
+        RowMap out_row(out_base + k * value_len, value_len);
+        out_row.setZero();
+        for (int64 i = key_starts[k]; i < key_starts[k + 1]; ++i) {
+          const int64 segment = key_segments[i];
+          out_row += ConstRowMap(grad_base + segment * value_len, value_len) *
+              SegmentScale<T>(combiner_, segment_sizes[segment]);
+        }
+      }
+    };
+    auto worker_threads = c->device()->tensorflow_cpu_worker_threads();
+    Shard(worker_threads->num_threads, worker_threads->workers, num_unique,
+          value_len * sizeof(T) * (N / num_unique + 1), accumulate);
+  }
+
+ private:
+  SegmentCombiner combiner_;
+};
+
+#define REGISTER_SEGMENT_REDUCE(ktype, vtype, stype)                  \
+  REGISTER_KERNEL_BUILDER(Name("KvResourceSparseSegmentReduce")       \
+                              .Device(DEVICE_CPU)                     \
+                              .TypeConstraint<vtype>("dtype")         \
+                              .TypeConstraint<ktype>("Tkeys")         \
+                              .TypeConstraint<stype>("Tsegmentids"),  \
+                          KvResourceSparseSegmentReduceOp<            \
+                              ktype, vtype, stype>)
+
+#define REGISTER_SEGMENT_REDUCE_GRAD(vtype, stype)                    \
+  REGISTER_KERNEL_BUILDER(Name("KvResourceSparseSegmentReduceGrad")   \
+                              .Device(DEVICE_CPU)                     \
+                              .TypeConstraint<vtype>("T")             \
+                              .TypeConstraint<stype>("Tsegmentids"),  \
+                          KvResourceSparseSegmentReduceGradOp<        \
+                              vtype, stype>)
+
+#define REGISTER_SEGMENT_REDUCE_ALL(type)                             \
+  REGISTER_SEGMENT_REDUCE(int32, type, int32);                        \
+  REGISTER_SEGMENT_REDUCE(int32, type, int64);                        \
+  REGISTER_SEGMENT_REDUCE(int64, type, int32);                        \
+  REGISTER_SEGMENT_REDUCE(int64, type, int64);                        \
+  REGISTER_SEGMENT_REDUCE_GRAD(type, int32);                          \
+  REGISTER_SEGMENT_REDUCE_GRAD(type, int64)
+
+TF_CALL_float(REGISTER_SEGMENT_REDUCE_ALL)
+TF_CALL_double(REGISTER_SEGMENT_REDUCE_ALL)
+#undef REGISTER_SEGMENT_REDUCE_ALL
+#undef REGISTER_SEGMENT_REDUCE_GRAD
+#undef REGISTER_SEGMENT_REDUCE
+
 #if GOOGLE_CUDA
 #if !TENSORFLOW_USE_GPU_EV
 template <typename TKey, typename TValue>
@@ -1507,6 +1896,110 @@ TF_CALL_REAL_NUMBER_TYPES(REGISTER_KERNELS_ALL_INDEX)
 #undef REGISTER_KERNELS_ALL_INDEX
 #undef REGISTER_KERNELS
 
+// Op that outputs the handle of an export iterator, created empty on the
+// first run. KvResourceExportIteratorInit fills it.
+template<typename TKey, typename TValue>
+class KvResourceExportIteratorOp : public OpKernel {
+ public:
+  explicit KvResourceExportIteratorOp(OpKernelConstruction *ctx)
+      : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("chunk_size", &chunk_size_));
+    OP_REQUIRES(ctx, chunk_size_ > 0, errors::InvalidArgument(
+        "chunk_size must be positive, got ", chunk_size_));
+  }
+
+  void Compute(OpKernelContext *ctx) override {
+    ContainerInfo cinfo;
+    OP_REQUIRES_OK(ctx, cinfo.Init(ctx->resource_manager(), def()));
+    EVExportIteratorBase *iter = nullptr;
+    OP_REQUIRES_OK(ctx,
+        ctx->resource_manager()->LookupOrCreate<EVExportIteratorBase>(
+            cinfo.container(), cinfo.name(), &iter,
+            [this](EVExportIteratorBase **ptr) {
+              *ptr = new EVExportIterator<TKey, TValue>(chunk_size_);
+              return Status::OK();
+            }));
+    iter->Unref();
+    OP_REQUIRES_OK(ctx, MakeResourceHandleToOutput(
+        ctx, 0, cinfo.container(), cinfo.name(),
+        MakeTypeIndex<EVExportIteratorBase>()));
+  }
+
+ private:
+  int64 chunk_size_;
+};
+
+// Op that takes a new snapshot of an EmbeddingVar into an export iterator.
+template<typename TKey, typename TValue>
+class KvResourceExportIteratorInitOp : public OpKernel {
+ public:
+  explicit KvResourceExportIteratorInitOp(OpKernelConstruction *ctx)
+      : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext *ctx) override {
+    EVExportIteratorBase *base = nullptr;
+    OP_REQUIRES_OK(ctx, LookupResource(ctx, HandleFromInput(ctx, 0), &base));
+    core::ScopedUnref unref_iter(base);
+    auto *iter = dynamic_cast<EVExportIterator<TKey, TValue> *>(base);
+    OP_REQUIRES(ctx, iter != nullptr, errors::InvalidArgument(
+        "The export iterator was made for another key or value type"));
+    EmbeddingVar<TKey, TValue> *ev = nullptr;
+    OP_REQUIRES_OK(ctx, LookupResource(ctx, HandleFromInput(ctx, 1), &ev));
+    core::ScopedUnref unref_me(ev);
+    iter->Reset(ev);
+  }
+};
+
+#define REGISTER_KERNELS(ktype, vtype)                                 \
+  REGISTER_KERNEL_BUILDER(Name("KvResourceExportIterator")             \
+                            .Device(DEVICE_CPU)                        \
+                            .TypeConstraint<ktype>("Tkeys")            \
+                            .TypeConstraint<vtype>("Tvalues"),         \
+                          KvResourceExportIteratorOp<ktype, vtype>);   \
+  REGISTER_KERNEL_BUILDER(Name("KvResourceExportIteratorInit")         \
+                            .Device(DEVICE_CPU)                        \
+                            .TypeConstraint<ktype>("Tkeys")            \
+                            .TypeConstraint<vtype>("Tvalues"),         \
+                          KvResourceExportIteratorInitOp<ktype, vtype>);
+#define REGISTER_KERNELS_ALL_INDEX(type)                               \
+  REGISTER_KERNELS(int32, type)                                        \
+  REGISTER_KERNELS(int64, type)
+TF_CALL_REAL_NUMBER_TYPES(REGISTER_KERNELS_ALL_INDEX)
+#undef REGISTER_KERNELS_ALL_INDEX
+#undef REGISTER_KERNELS
+
+// Op that outputs the next chunk of an export iterator, empty tensors once
+// the iterator is exhausted.
+class KvResourceExportNextChunkOp : public OpKernel {
+ public:
+  explicit KvResourceExportNextChunkOp(OpKernelConstruction *ctx)
+      : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("Tkeys", &key_dtype_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("Tvalues", &value_dtype_));
+  }
+
+  void Compute(OpKernelContext *ctx) override {
+    EVExportIteratorBase *iter = nullptr;
+    OP_REQUIRES_OK(ctx, LookupResource(ctx, HandleFromInput(ctx, 0), &iter));
+    core::ScopedUnref unref_me(iter);
+    OP_REQUIRES(ctx, iter->key_dtype() == key_dtype_ &&
+                     iter->value_dtype() == value_dtype_,
+        errors::InvalidArgument(
+            "The export iterator exports ", DataTypeString(iter->key_dtype()),
+            " keys and ", DataTypeString(iter->value_dtype()),
+            " values, but the op expects ", DataTypeString(key_dtype_),
+            " keys and ", DataTypeString(value_dtype_), " values"));
+    OP_REQUIRES_OK(ctx, iter->NextChunk(ctx));
+  }
+
+ private:
+  DataType key_dtype_;
+  DataType value_dtype_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("KvResourceExportNextChunk").Device(DEVICE_CPU),
+                        KvResourceExportNextChunkOp);
+
 #if GOOGLE_CUDA
 #if !TENSORFLOW_USE_GPU_EV
 #define REGISTER_KERNELS(ktype, vtype)                         \
@@ -2211,6 +2704,84 @@ TF_CALL_REAL_NUMBER_TYPES(REGISTER_KERNELS_ALL_INDEX)
 #undef REGISTER_KERNELS_ALL_INDEX
 #undef REGISTER_EV_GET_FREQUENCY
 
+// Op that outputs the most frequent keys of an EmbeddingVar and the load
+// of the table, the sum of the frequencies of all its keys.
+template <typename TKey, typename TValue>
+class KvResourceHotKeysOp : public OpKernel {
+ public:
+  explicit KvResourceHotKeysOp(OpKernelConstruction* c) : OpKernel(c) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    EmbeddingVar<TKey, TValue>* ev = nullptr;
+    OP_REQUIRES_OK(ctx, LookupResource(ctx, HandleFromInput(ctx, 0), &ev));
+    core::ScopedUnref unref_me(ev);
+    const Tensor& k_tensor = ctx->input(1);
+    OP_REQUIRES(ctx, TensorShapeUtils::IsScalar(k_tensor.shape()),
+        errors::InvalidArgument("k must be a scalar, got shape ",
+                                k_tensor.shape().DebugString()));
+    const int64 k = k_tensor.scalar<int64>()();
+    OP_REQUIRES(ctx, k >= 0,
+        errors::InvalidArgument("k must be non-negative, got ", k));
+
+    std::vector<TKey> keys;
+    std::vector<TValue*> values;
+    std::vector<int64> versions;
+    std::vector<int64> freqs;
+    embedding::Iterator* it = nullptr;
+    ev->GetSnapshot(&keys, &values, &versions, &freqs, &it);
+    OP_REQUIRES(ctx, keys.empty() || freqs.size() == keys.size(),
+        errors::FailedPrecondition(
+            "The EmbeddingVariable records no frequency, enable a counter "
+            "filter or record_freq"));
+    if (it != nullptr) {
+      FixedLengthHeader header;
+      ev->storage_manager()->iterator_mutex_lock();
+      for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        TKey key;
+        it->Key(reinterpret_cast<char*>(&key), sizeof(TKey));
+        it->Freq(reinterpret_cast<char*>(&header), sizeof(int64));
+        keys.push_back(key);
+        freqs.push_back(*reinterpret_cast<int64*>(&header));
+      }
+      ev->storage_manager()->iterator_mutex_unlock();
+      delete it;
+    }
+
+    std::vector<TKey> hot_keys;
+    std::vector<int64> hot_freqs;
+    SelectHotKeys(keys, freqs, k, &hot_keys, &hot_freqs);
+
+    Tensor* keys_out = nullptr;
+    Tensor* freqs_out = nullptr;
+    Tensor* total_freq_out = nullptr;
+    Tensor* size_out = nullptr;
+    const int64 n = hot_keys.size();
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0, {n}, &keys_out));
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(1, {n}, &freqs_out));
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(2, {}, &total_freq_out));
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(3, {}, &size_out));
+    std::copy(hot_keys.begin(), hot_keys.end(), keys_out->flat<TKey>().data());
+    std::copy(hot_freqs.begin(), hot_freqs.end(),
+              freqs_out->flat<int64>().data());
+    total_freq_out->scalar<int64>()() =
+        std::accumulate(freqs.begin(), freqs.end(), int64{0});
+    size_out->scalar<int64>()() = keys.size();
+  }
+};
+
+#define REGISTER_KERNELS(ktype, vtype)                          \
+  REGISTER_KERNEL_BUILDER(Name("KvResourceHotKeys")             \
+                            .Device(DEVICE_CPU)                 \
+                            .TypeConstraint<ktype>("Tkeys")     \
+                            .TypeConstraint<vtype>("Tvalues"),  \
+                          KvResourceHotKeysOp<ktype, vtype>);
+#define REGISTER_KERNELS_ALL_INDEX(type)                        \
+  REGISTER_KERNELS(int32, type)                                 \
+  REGISTER_KERNELS(int64, type)
+TF_CALL_REAL_NUMBER_TYPES(REGISTER_KERNELS_ALL_INDEX)
+#undef REGISTER_KERNELS_ALL_INDEX
+#undef REGISTER_KERNELS
+
 template <typename TKey, typename TValue>
 class EVGetVersionOp : public OpKernel {
  public:
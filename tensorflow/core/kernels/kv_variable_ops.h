@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef TENSORFLOW_KERNELS_KV_VARIABLE_OPS_H_
 #define TENSORFLOW_KERNELS_KV_VARIABLE_OPS_H_
 
+#include <numeric>
+
 #include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/bounds_check.h"
 #include "tensorflow/core/framework/embedding/embedding_var.h"
@@ -32,6 +34,7 @@ limitations under the License.
 #include "tensorflow/core/lib/random/random.h"
 #include "tensorflow/core/lib/random/random_distributions.h"
 #include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
 using GPUDevice = Eigen::GpuDevice;
@@ -40,104 +43,80 @@ namespace {
   const int kSavedPartitionNum = 1000;
 }
 
+// Iterates list[index[i]] so that the partitioned order of a snapshot can be
+// written without copying the snapshot. An empty list yields nothing.
 template<class T>
-class EVKeyDumpIterator: public  DumpIterator<T> {
+class EVIndexedDumpIterator: public  DumpIterator<T> {
  public:
-  EVKeyDumpIterator(std::vector<T>& key_list):key_list_(key_list) {
-    keys_idx_ = 0;
+  EVIndexedDumpIterator(const std::vector<T>& list,
+      const std::vector<int64>& index)
+      : list_(list), index_(index) {
+    idx_ = 0;
+    end_ = list.empty() ? 0 : index.size();
   }
 
   bool HasNext() const {
-    return keys_idx_ < key_list_.size();
+    return idx_ < end_;
   }
 
   T Next() {
-    return key_list_[keys_idx_++];
+    return list_[index_[idx_++]];
   }
 
  private:
-  int64 keys_idx_;
-  std::vector<T>& key_list_;
+  const std::vector<T>& list_;
+  const std::vector<int64>& index_;
+  int64 idx_;
+  int64 end_;
 };
 
 template<class K, class T>
 class EVValueDumpIterator: public  DumpIterator<T> {
  public:
-  EVValueDumpIterator(EmbeddingVar<K, T>*& ev,
-      std::vector<T* >& valueptr_list)
+  EVValueDumpIterator(EmbeddingVar<K, T>* ev,
+      const std::vector<K>& key_list,
+      const std::vector<T* >& valueptr_list,
+      const std::vector<int64>& index)
         : ev_(ev),
-          valueptr_list_(valueptr_list) {
+          key_list_(key_list),
+          valueptr_list_(valueptr_list),
+          index_(index),
+          value_len_(ev->ValueLen()) {
     keys_idx_ = 0;
     col_idx_ = 0;
+    value_ = nullptr;
   }
 
   bool HasNext() const {
-    if (keys_idx_ < valueptr_list_.size()) {
-      if (keys_idx_ < valueptr_list_.size() - 1)
-        return true;
-      else
-        return col_idx_ < ev_->ValueLen();
-    } else
-      return false;
+    return keys_idx_ < index_.size();
   }
 
   T Next() {
-    if (col_idx_ >= ev_->ValueLen()) {
-      keys_idx_++;
+    if (col_idx_ == 0) {
+      int64 i = index_[keys_idx_];
+      value_ = valueptr_list_[i];
+      if (value_ == nullptr) {
+        // feature filter is disabled, save the default value
+        value_ = ev_->GetDefaultValue(key_list_[i]);
+      }
+    }
+    T v = value_[col_idx_++];
+    if (col_idx_ == value_len_) {
       col_idx_ = 0;
+      keys_idx_++;
     }
-    Eigen::array<Eigen::DenseIndex, 1> dims({ev_->ValueLen()});
-    typename TTypes<T>::Flat value_flat =
-      typename TTypes<T>::Flat(valueptr_list_[keys_idx_], dims);
-    return value_flat(col_idx_++);
+    return v;
   }
 
  private:
   EmbeddingVar<K, T>* ev_;
-  std::vector<T* >& valueptr_list_;
+  const std::vector<K>& key_list_;
+  const std::vector<T* >& valueptr_list_;
+  const std::vector<int64>& index_;
+  const int64 value_len_;
   int64 keys_idx_;
   int64 col_idx_;
-};
-
-template<class T>
-class EVVersionDumpIterator: public  DumpIterator<T> {
- public:
-  EVVersionDumpIterator(std::vector<T >& version_list)
-      : version_list_(version_list) {
-    keys_idx_ = 0;
-  }
-
-  bool HasNext() const {
-    return keys_idx_ < version_list_.size();
-  }
-
-  T Next() {
-    return version_list_[keys_idx_++];
-  }
-
- private:
-  std::vector<T>& version_list_;
-  int64 keys_idx_;
-};
-
-template<class T>
-class EVFreqDumpIterator: public  DumpIterator<T> {
- public:
-  EVFreqDumpIterator(std::vector<T>& freq_list) : freq_list_(freq_list) {
-    keys_idx_ = 0;
-  }
-
-  bool HasNext() const {
-    return keys_idx_ < freq_list_.size();
-  }
-
-  T Next() {
-    return freq_list_[keys_idx_++];
-  }
-
- private:
-  std::vector<T>& freq_list_;
-  int64 keys_idx_;
+  T* value_;
 };
 
 template<class T>
@@ -171,17 +150,104 @@ Status GetInputEmbeddingVar(OpKernelContext* ctx, int input,
   }
 }
 
+// Buckets the snapshot by key % kSavedPartitionNum with a parallel counting
+// sort. Instead of copying the snapshot, index (resp. filter_index) receives
+// the positions of the saved (resp. filtered) entries in partition order, and
+// part_offset / part_filter_offset the kSavedPartitionNum + 1 boundaries.
+template <class K, class V>
+void PartitionEmbeddingSnapshot(const std::vector<K>& key_list,
+    const std::vector<V* >& valueptr_list, int64 filter_freq,
+    const DeviceBase::CpuWorkerThreads* worker_threads,
+    std::vector<int64>* index, std::vector<int64>* filter_index,
+    std::vector<int64>* part_offset, std::vector<int64>* part_filter_offset) {
+  const int64 kMinBlockSize = 1 << 16;
+  const int64 total = key_list.size();
+  int64 num_blocks = 1;
+  if (worker_threads != nullptr) {
+    num_blocks = std::max(int64{1}, std::min(
+        static_cast<int64>(worker_threads->num_threads),
+        total / kMinBlockSize));
+  }
+  const int64 block_size = (total + num_blocks - 1) / num_blocks;
+
+  // 0: saved, 1: filtered, -1: only forward, no backward, bypass
+  auto category = [&valueptr_list, filter_freq](int64 i) {
+    if (valueptr_list[i] == reinterpret_cast<V*>(-1)) {
+      return -1;
+    } else if (valueptr_list[i] == nullptr && filter_freq) {
+      return 1;
+    }
+    return 0;
+  };
+  auto for_each_block = [&](std::function<void(int64, int64, int64)> fn) {
+    auto work = [&](int64 start, int64 limit) {
+      for (int64 b = start; b < limit; ++b) {
+        fn(b, b * block_size, std::min(total, (b + 1) * block_size));
+      }
+    };
+    if (num_blocks == 1) {
+      work(0, 1);
+    } else {
+      Shard(worker_threads->num_threads, worker_threads->workers,
+            num_blocks, block_size * 100, work);
+    }
+  };
+
+  // counts[(block * kSavedPartitionNum + partid) * 2 + category]
+  std::vector<int64> counts(num_blocks * kSavedPartitionNum * 2, 0);
+  for_each_block([&](int64 b, int64 begin, int64 end) {
+    int64* block_counts = counts.data() + b * kSavedPartitionNum * 2;
+    for (int64 i = begin; i < end; ++i) {
+      int64 partid = key_list[i] % kSavedPartitionNum;
+      int c = category(i);
+      // Negative keys were never assigned to a partition, keep skipping them.
+      if (partid < 0 || c < 0) continue;
+      block_counts[partid * 2 + c]++;
+    }
+  });
+
+  // Turn the counts into the write positions of each block and partition.
+  part_offset->resize(kSavedPartitionNum + 1);
+  part_filter_offset->resize(kSavedPartitionNum + 1);
+  int64 pos[2] = {0, 0};
+  for (int64 partid = 0; partid < kSavedPartitionNum; ++partid) {
+    (*part_offset)[partid] = pos[0];
+    (*part_filter_offset)[partid] = pos[1];
+    for (int64 b = 0; b < num_blocks; ++b) {
+      for (int c = 0; c < 2; ++c) {
+        int64& cnt = counts[(b * kSavedPartitionNum + partid) * 2 + c];
+        int64 n = cnt;
+        cnt = pos[c];
+        pos[c] += n;
+      }
+    }
+  }
+  (*part_offset)[kSavedPartitionNum] = pos[0];
+  (*part_filter_offset)[kSavedPartitionNum] = pos[1];
+
+  index->resize(pos[0]);
+  filter_index->resize(pos[1]);
+  int64* out[2] = {index->data(), filter_index->data()};
+  for_each_block([&](int64 b, int64 begin, int64 end) {
+    int64* block_pos = counts.data() + b * kSavedPartitionNum * 2;
+    for (int64 i = begin; i < end; ++i) {
+      int64 partid = key_list[i] % kSavedPartitionNum;
+      int c = category(i);
+      if (partid < 0 || c < 0) continue;
+      out[c][block_pos[partid * 2 + c]++] = i;
+    }
+  });
+}
+
 template <class K, class V>
 Status DumpEmbeddingValues(EmbeddingVar<K, V>* ev,
     const string& tensor_key, BundleWriter* writer,
-    Tensor* part_offset_tensor) {
+    Tensor* part_offset_tensor,
+    const DeviceBase::CpuWorkerThreads* worker_threads = nullptr) {
   std::vector<K> tot_key_list;
   std::vector<V* > tot_valueptr_list;
   std::vector<int64> tot_version_list;
   std::vector<int64> tot_freq_list;
-  std::vector<K> tot_key_filter_list;
-  std::vector<int64> tot_freq_filter_list;
-  std::vector<int64> tot_version_filter_list;
   embedding::Iterator* it = nullptr;
   int64 total_size = ev->GetSnapshot(&tot_key_list,
       &tot_valueptr_list, &tot_version_list, &tot_freq_list, &it);
@@ -194,206 +260,109 @@ Status DumpEmbeddingValues(EmbeddingVar<K, V>* ev,
     }
   }
 
-  std::vector<std::vector<K> > key_list_parts;
-  std::vector<std::vector<V* > > valueptr_list_parts;
-  std::vector<std::vector<int64 > > version_list_parts;
-  std::vector<std::vector<int64 > > freq_list_parts;
-
-  std::vector<std::vector<K> > key_filter_list_parts;
-  std::vector<std::vector<int64 > > version_filter_list_parts;
-  std::vector<std::vector<int64 > > freq_filter_list_parts;
-
-  std::vector<K> partitioned_tot_key_list;
-  std::vector<V* > partitioned_tot_valueptr_list;
-  std::vector<int64> partitioned_tot_version_list;
-  std::vector<int64> partitioned_tot_freq_list;
-  std::vector<K> partitioned_tot_key_filter_list;
-  std::vector<int64> partitioned_tot_version_filter_list;
-  std::vector<int64> partitioned_tot_freq_filter_list;
-  std::vector<int64> part_filter_offset;
-
-  key_list_parts.resize(kSavedPartitionNum);
-  valueptr_list_parts.resize(kSavedPartitionNum);
-  version_list_parts.resize(kSavedPartitionNum);
-  freq_list_parts.resize(kSavedPartitionNum);
-  key_filter_list_parts.resize(kSavedPartitionNum);
-  version_filter_list_parts.resize(kSavedPartitionNum);
-  freq_filter_list_parts.resize(kSavedPartitionNum);
-  part_filter_offset.resize(kSavedPartitionNum + 1);
-  //partitioned_tot_key_list.resize(tot_key_list.size());
-  //partitioned_tot_valueptr_list.resize(tot_valueptr_list.size());
-
   // save the ev with kSavedPartitionNum piece of tensor
   // so that we can dynamically load ev with changed partition number
-  int64 filter_freq = ev->MinFreq();
-  for (size_t i = 0; i < tot_key_list.size(); i++) {
-    for (int partid = 0; partid < kSavedPartitionNum; partid++) {
-      if (tot_key_list[i] % kSavedPartitionNum == partid) {
-        if (tot_valueptr_list[i] == reinterpret_cast<V*>(-1)) {
-            // only forward, no backward, bypass
-        } else if (tot_valueptr_list[i] == nullptr) {
-          if (filter_freq) {
-            key_filter_list_parts[partid].push_back(tot_key_list[i]);
-          } else {
-            key_list_parts[partid].push_back(tot_key_list[i]);
-            valueptr_list_parts[partid].push_back(
-                ev->GetDefaultValue(tot_key_list[i]));
-          }
-        } else {
-          key_list_parts[partid].push_back(tot_key_list[i]);
-          valueptr_list_parts[partid].push_back(tot_valueptr_list[i]);
-        }
-        break;
-      }
-    }
-  }
-
-  for (size_t i = 0; i < tot_version_list.size(); i++) {
-    for (int partid = 0; partid < kSavedPartitionNum; partid++) {
-      if (tot_key_list[i] % kSavedPartitionNum == partid) {
-        if (tot_valueptr_list[i] == nullptr) {
-          version_filter_list_parts[partid].push_back(tot_version_list[i]);
-        } else {
-          version_list_parts[partid].push_back(tot_version_list[i]);
-        }
-        break;
-      }
-    }
-  }
-  
-  for (size_t i = 0; i < tot_freq_list.size(); i++) {
-    for (int partid = 0; partid < kSavedPartitionNum; partid++) {
-      if (tot_key_list[i] % kSavedPartitionNum == partid) {
-        if (tot_valueptr_list[i] == nullptr) {
-          freq_filter_list_parts[partid].push_back(tot_freq_list[i]);
-        } else {
-          freq_list_parts[partid].push_back(tot_freq_list[i]);
-        }
-        break;
-      }
-    }
-  }
-  // LOG(INFO) << "EV:" << tensor_key << ", key_list_parts:" << key_list_parts.size();
+  std::vector<int64> index;
+  std::vector<int64> filter_index;
+  std::vector<int64> part_offset;
+  std::vector<int64> part_filter_offset;
+  PartitionEmbeddingSnapshot(tot_key_list, tot_valueptr_list,
+      ev->MinFreq(), worker_threads, &index, &filter_index,
+      &part_offset, &part_filter_offset);
 
   auto part_offset_flat = part_offset_tensor->flat<int32>();
-  part_offset_flat(0) = 0;
-  part_filter_offset[0] = 0;
-  int ptsize = 0;
-  for (int partid = 0; partid < kSavedPartitionNum; partid++) {
-    std::vector<K>& key_list = key_list_parts[partid];
-    std::vector<V* >& valueptr_list = valueptr_list_parts[partid];
-    std::vector<int64>& version_list = version_list_parts[partid];
-    std::vector<int64>& freq_list = freq_list_parts[partid];
-    std::vector<K>& key_filter_list = key_filter_list_parts[partid];
-    std::vector<int64>& version_filter_list =
-      version_filter_list_parts[partid];
-    std::vector<int64>& freq_filter_list = freq_filter_list_parts[partid];
-
-    ptsize += key_list.size();
-    for (int inpid = 0; inpid < key_list.size(); inpid++) {
-      partitioned_tot_key_list.push_back(key_list[inpid]);
-      partitioned_tot_valueptr_list.push_back(valueptr_list[inpid]);
-    }
-    for (int inpid = 0; inpid < version_list.size(); inpid++) {
-      partitioned_tot_version_list.push_back(version_list[inpid]);
-    }
-    for (int inpid = 0; inpid < freq_list.size(); inpid++) {
-      partitioned_tot_freq_list.push_back(freq_list[inpid]);
-    }
-    for (int inpid = 0; inpid < key_filter_list.size(); inpid++) {
-      partitioned_tot_key_filter_list.push_back(key_filter_list[inpid]);
-    }
-    for (int inpid = 0; inpid < version_filter_list.size(); inpid++) {
-      partitioned_tot_version_filter_list.push_back(version_filter_list[inpid]);
-    }
-    for (int inpid = 0; inpid < freq_filter_list.size(); inpid++) {
-      partitioned_tot_freq_filter_list.push_back(freq_filter_list[inpid]);
-    }
-
-    part_offset_flat(partid + 1) = part_offset_flat(partid) + key_list.size();
-    part_filter_offset[partid + 1] = part_filter_offset[partid] + key_filter_list.size();
+  for (int i = 0; i < kSavedPartitionNum + 1; i++) {
+    part_offset_flat(i) = part_offset[i];
   }
   // TODO: DB iterator not support partition_offset
   writer->Add(tensor_key + "-partition_offset", *part_offset_tensor);
-  for(int i = 0; i <  kSavedPartitionNum + 1; i++) {
+  for (int i = 0; i < kSavedPartitionNum + 1; i++) {
     part_offset_flat(i) = part_filter_offset[i];
   }
   writer->Add(tensor_key + "-partition_filter_offset", *part_offset_tensor);
 
-  VLOG(1) << "EV before partition:" << tensor_key << ", keysize:" <<  tot_key_list.size()
-          << ", valueptr size:" << tot_valueptr_list.size();
-  VLOG(1) << "EV after partition:" << tensor_key << ", ptsize:" << ptsize
-          << ", keysize:"<<  partitioned_tot_key_list.size()
-          <<", valueptr size:" << partitioned_tot_valueptr_list.size();
+  VLOG(1) << "EV before partition:" << tensor_key << ", keysize:"
+          << tot_key_list.size() << ", valueptr size:"
+          << tot_valueptr_list.size();
+  VLOG(1) << "EV after partition:" << tensor_key << ", ptsize:"
+          << index.size() << ", filtered size:" << filter_index.size();
+
+  const int64 version_size = tot_version_list.empty() ? 0 : index.size();
+  const int64 freq_size = tot_freq_list.empty() ? 0 : index.size();
+  const int64 version_filter_size =
+      tot_version_list.empty() ? 0 : filter_index.size();
+  const int64 freq_filter_size =
+      tot_freq_list.empty() ? 0 : filter_index.size();
 
   size_t bytes_limit = 8 << 20;
   char* dump_buffer = (char*)malloc(sizeof(char) * bytes_limit);
   Status st;
 
-  EVKeyDumpIterator<K> ev_key_dump_iter(partitioned_tot_key_list);
+  EVIndexedDumpIterator<K> ev_key_dump_iter(tot_key_list, index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-keys", writer, dump_buffer,
                                  bytes_limit, &ev_key_dump_iter,
-                                 TensorShape({partitioned_tot_key_list.size() + iterator_size}),
+                                 TensorShape({index.size() + iterator_size}),
                                  it);
   if (!st.ok()) {
     free(dump_buffer);
     return st;
   }
 
-  EVValueDumpIterator<K, V> ev_value_dump_iter(ev, partitioned_tot_valueptr_list);
+  EVValueDumpIterator<K, V> ev_value_dump_iter(ev, tot_key_list,
+      tot_valueptr_list, index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-values", writer, dump_buffer,
       bytes_limit, &ev_value_dump_iter,
-      TensorShape({partitioned_tot_key_list.size() + iterator_size, ev->ValueLen()}),
+      TensorShape({index.size() + iterator_size, ev->ValueLen()}),
       it, ev->storage_manager()->GetOffset(ev->GetEmbeddingIndex()));
   if (!st.ok()) {
     free(dump_buffer);
     return st;
   }
 
-  EVVersionDumpIterator<int64> ev_version_dump_iter(partitioned_tot_version_list);
+  EVIndexedDumpIterator<int64> ev_version_dump_iter(tot_version_list, index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-versions", writer, dump_buffer,
       bytes_limit, &ev_version_dump_iter,
-      TensorShape({partitioned_tot_version_list.size() + iterator_size}),
+      TensorShape({version_size + iterator_size}),
       it, -3);
   if (!st.ok()) {
     free(dump_buffer);
     return st;
   }
 
-  EVFreqDumpIterator<int64> ev_freq_dump_iter(partitioned_tot_freq_list);
+  EVIndexedDumpIterator<int64> ev_freq_dump_iter(tot_freq_list, index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-freqs", writer, dump_buffer,
       bytes_limit, &ev_freq_dump_iter,
-      TensorShape({partitioned_tot_freq_list.size() + iterator_size}),
+      TensorShape({freq_size + iterator_size}),
       it, -2);
   if (!st.ok()) {
     free(dump_buffer);
     return st;
   }
 
-  EVKeyDumpIterator<K> ev_key_filter_dump_iter(partitioned_tot_key_filter_list);
+  EVIndexedDumpIterator<K> ev_key_filter_dump_iter(tot_key_list, filter_index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-keys_filtered",
       writer, dump_buffer, bytes_limit, &ev_key_filter_dump_iter,
-      TensorShape({partitioned_tot_key_filter_list.size()}));
+      TensorShape({filter_index.size()}));
   if (!st.ok()) {
     free(dump_buffer);
     return st;
   }
 
-  EVVersionDumpIterator<int64> ev_version_filter_dump_iter(
-      partitioned_tot_version_filter_list);
+  EVIndexedDumpIterator<int64> ev_version_filter_dump_iter(
+      tot_version_list, filter_index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-versions_filtered",
       writer, dump_buffer, bytes_limit, &ev_version_filter_dump_iter,
-      TensorShape({partitioned_tot_version_filter_list.size()}));
+      TensorShape({version_filter_size}));
   if (!st.ok()) {
     free(dump_buffer);
     return st;
   }
 
-  EVFreqDumpIterator<int64> ev_freq_filter_dump_iter(
-      partitioned_tot_freq_filter_list);
+  EVIndexedDumpIterator<int64> ev_freq_filter_dump_iter(
+      tot_freq_list, filter_index);
   st = SaveTensorWithFixedBuffer(tensor_key + "-freqs_filtered",
       writer, dump_buffer, bytes_limit, &ev_freq_filter_dump_iter,
-      TensorShape({partitioned_tot_freq_filter_list.size()}));
+      TensorShape({freq_filter_size}));
   if (!st.ok()) {
     free(dump_buffer);
     return st;
@@ -408,6 +377,230 @@ Status DumpEmbeddingValues(EmbeddingVar<K, V>* ev,
   return Status::OK();
 }
 
+// Keeps the k most frequent keys of keys/freqs, most frequent first. Ties
+// are broken by the smaller key, so every shard picks the same keys.
+template <class K>
+void SelectHotKeys(const std::vector<K>& keys,
+    const std::vector<int64>& freqs, int64 k,
+    std::vector<K>* hot_keys, std::vector<int64>* hot_freqs) {
+  std::vector<int64> order(keys.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto hotter = [&keys, &freqs](int64 l, int64 r) {
+    return freqs[l] > freqs[r] || (freqs[l] == freqs[r] && keys[l] < keys[r]);
+  };
+  k = std::min<int64>(std::max<int64>(k, 0), order.size());
+  if (k < order.size()) {
+    std::nth_element(order.begin(), order.begin() + k, order.end(), hotter);
+  }
+  std::sort(order.begin(), order.begin() + k, hotter);
+  hot_keys->clear();
+  hot_freqs->clear();
+  for (int64 i = 0; i < k; ++i) {
+    hot_keys->push_back(keys[order[i]]);
+    hot_freqs->push_back(freqs[order[i]]);
+  }
+}
+
+// Export of an EmbeddingVar in fixed size chunks of keys, values, versions
+// and freqs, so the exported table never has to fit in memory at once.
+class EVExportIteratorBase : public ResourceBase {
+ public:
+  // Allocates outputs 0 to 3 of ctx with the next chunk, empty once all
+  // rows were returned. Safe to call from several consumers at a time.
+  virtual Status NextChunk(OpKernelContext* ctx) = 0;
+  virtual DataType key_dtype() const = 0;
+  virtual DataType value_dtype() const = 0;
+};
+
+// Reset() takes a snapshot of the keys and value pointers of the in-memory
+// tiers, their values are copied chunk by chunk. Rows of the SSD and
+// LevelDB tiers are read through the storage Iterator, one chunk under the
+// iterator lock at a time. Like a checkpoint save, it expects no shrink or
+// eviction while a snapshot is exported.
+template <class K, class V>
+class EVExportIterator : public EVExportIteratorBase {
+ public:
+  explicit EVExportIterator(int64 chunk_size)
+      : ev_(nullptr), it_(nullptr), chunk_size_(chunk_size), cursor_(0),
+        with_versions_(false), with_freqs_(false) {}
+
+  ~EVExportIterator() override {
+    mutex_lock l(mu_);
+    Release();
+  }
+
+  string DebugString() const override {
+    return "EVExportIterator";
+  }
+
+  DataType key_dtype() const override { return DataTypeToEnum<K>::v(); }
+  DataType value_dtype() const override { return DataTypeToEnum<V>::v(); }
+
+  void Reset(EmbeddingVar<K, V>* ev) {
+    mutex_lock l(mu_);
+    Release();
+    ev->Ref();
+    ev_ = ev;
+    ev_->GetSnapshot(&keys_, &values_, &versions_, &freqs_, &it_);
+    with_versions_ = ev_->RecordsVersion();
+    with_freqs_ = ev_->RecordsFreq();
+
+    // Same rows as DumpEmbeddingValues: forward only rows are skipped, and
+    // unadmitted rows too when the feature filter is on.
+    const bool filter = ev_->MinFreq() != 0;
+    int64 n = 0;
+    for (int64 i = 0; i < keys_.size(); ++i) {
+      if (values_[i] == reinterpret_cast<V*>(-1) ||
+          (values_[i] == nullptr && filter)) {
+        continue;
+      }
+      keys_[n] = keys_[i];
+      values_[n] = values_[i];
+      if (!versions_.empty()) versions_[n] = versions_[i];
+      if (!freqs_.empty()) freqs_[n] = freqs_[i];
+      ++n;
+    }
+    keys_.resize(n);
+    values_.resize(n);
+    if (!versions_.empty()) versions_.resize(n);
+    if (!freqs_.empty()) freqs_.resize(n);
+
+    if (it_ != nullptr) {
+      ev_->storage_manager()->iterator_mutex_lock();
+      it_->SeekToFirst();
+      ev_->storage_manager()->iterator_mutex_unlock();
+    }
+    cursor_ = 0;
+  }
+
+  Status NextChunk(OpKernelContext* ctx) override {
+    tf_shared_lock l(mu_);
+    if (ev_ == nullptr) {
+      return errors::FailedPrecondition(
+          "The export iterator was not initialized");
+    }
+    const int64 value_len = ev_->ValueLen();
+    const int64 size = keys_.size();
+    const int64 start = cursor_.fetch_add(chunk_size_);
+    if (start < size) {
+      const int64 n = std::min(chunk_size_, size - start);
+      Tensor* keys_out = nullptr;
+      Tensor* values_out = nullptr;
+      Tensor* versions_out = nullptr;
+      Tensor* freqs_out = nullptr;
+      TF_RETURN_IF_ERROR(AllocateChunk(ctx, n, value_len, with_versions_,
+          with_freqs_, &keys_out, &values_out, &versions_out, &freqs_out));
+      std::copy_n(keys_.data() + start, n, keys_out->flat<K>().data());
+      V* values = values_out->flat<V>().data();
+      for (int64 i = 0; i < n; ++i) {
+        const V* value = values_[start + i];
+        if (value == nullptr) {
+          value = ev_->GetDefaultValue(keys_[start + i]);
+        }
+        memcpy(values + i * value_len, value, value_len * sizeof(V));
+      }
+      if (with_versions_) {
+        std::copy_n(versions_.data() + start, n,
+                    versions_out->flat<int64>().data());
+      }
+      if (with_freqs_) {
+        std::copy_n(freqs_.data() + start, n, freqs_out->flat<int64>().data());
+      }
+      return Status::OK();
+    }
+    return NextIteratorChunk(ctx, value_len);
+  }
+
+ private:
+  static Status AllocateChunk(OpKernelContext* ctx, int64 n, int64 value_len,
+      bool with_versions, bool with_freqs, Tensor** keys, Tensor** values,
+      Tensor** versions, Tensor** freqs) {
+    TF_RETURN_IF_ERROR(ctx->allocate_output(0, TensorShape({n}), keys));
+    TF_RETURN_IF_ERROR(ctx->allocate_output(
+        1, TensorShape({n, value_len}), values));
+    TF_RETURN_IF_ERROR(ctx->allocate_output(
+        2, TensorShape({with_versions ? n : 0}), versions));
+    return ctx->allocate_output(3, TensorShape({with_freqs ? n : 0}), freqs);
+  }
+
+  Status NextIteratorChunk(OpKernelContext* ctx, int64 value_len)
+      SHARED_LOCKS_REQUIRED(mu_) {
+    std::vector<K> keys;
+    std::vector<V> values;
+    std::vector<int64> versions;
+    std::vector<int64> freqs;
+    if (it_ != nullptr) {
+      mutex_lock l(it_mu_);
+      const int64 value_offset =
+          ev_->storage_manager()->GetOffset(ev_->GetEmbeddingIndex());
+      int64 version = 0;
+      int64 freq = 0;
+      ev_->storage_manager()->iterator_mutex_lock();
+      for (; it_->Valid() && keys.size() < chunk_size_; it_->Next()) {
+        K key;
+        it_->Key(reinterpret_cast<char*>(&key), sizeof(K));
+        keys.push_back(key);
+        values.resize(values.size() + value_len);
+        it_->Value(reinterpret_cast<char*>(values.data() + values.size() -
+                                           value_len),
+                   value_len * sizeof(V), value_offset * sizeof(V));
+        if (with_versions_) {
+          it_->Version(reinterpret_cast<char*>(&version), sizeof(int64));
+          versions.push_back(version);
+        }
+        if (with_freqs_) {
+          it_->Freq(reinterpret_cast<char*>(&freq), sizeof(int64));
+          freqs.push_back(freq);
+        }
+      }
+      ev_->storage_manager()->iterator_mutex_unlock();
+    }
+
+    const int64 n = keys.size();
+    Tensor* keys_out = nullptr;
+    Tensor* values_out = nullptr;
+    Tensor* versions_out = nullptr;
+    Tensor* freqs_out = nullptr;
+    TF_RETURN_IF_ERROR(AllocateChunk(ctx, n, value_len, with_versions_,
+        with_freqs_, &keys_out, &values_out, &versions_out, &freqs_out));
+    std::copy(keys.begin(), keys.end(), keys_out->flat<K>().data());
+    std::copy(values.begin(), values.end(), values_out->flat<V>().data());
+    std::copy(versions.begin(), versions.end(),
+              versions_out->flat<int64>().data());
+    std::copy(freqs.begin(), freqs.end(), freqs_out->flat<int64>().data());
+    return Status::OK();
+  }
+
+  void Release() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    delete it_;
+    it_ = nullptr;
+    if (ev_ != nullptr) {
+      ev_->Unref();
+      ev_ = nullptr;
+    }
+    keys_.clear();
+    values_.clear();
+    versions_.clear();
+    freqs_.clear();
+  }
+
+  mutex mu_;
+  EmbeddingVar<K, V>* ev_ GUARDED_BY(mu_);
+  std::vector<K> keys_;
+  std::vector<V*> values_;
+  std::vector<int64> versions_;
+  std::vector<int64> freqs_;
+  embedding::Iterator* it_;
+  // Serializes the consumers reading through it_.
+  mutex it_mu_;
+  int64 chunk_size_;
+  // Next row of the snapshot to hand out.
+  std::atomic<int64> cursor_;
+  // Whether the chunks carry versions and freqs, as the snapshot does.
+  bool with_versions_;
+  bool with_freqs_;
+};
+
 namespace {
 const static string part_str = "part_";
 }
@@ -137,7 +137,8 @@ class SaveV2 : public OpKernel {
     else
       OP_REQUIRES_OK(context, variable->Shrink(global_step_scalar));
     OP_REQUIRES_OK(context, DumpEmbeddingValues(variable, tensor_name,
-          &writer, &part_offset_tensor));
+          &writer, &part_offset_tensor,
+          context->device()->tensorflow_cpu_worker_threads()));
   }
 
   void Compute(OpKernelContext* context) override {
@@ -13,25 +13,231 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
 #include <string>
-#include <iostream>
-#include <fstream>
-#include <sys/time.h>
+#include <vector>
 
-#include "tensorflow/core/example/feature.pb.h"
 #include "tensorflow/core/framework/kernel_def_builder.h"
-#include "tensorflow/core/framework/resource_mgr.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
 #include "tensorflow/core/lib/core/threadpool.h"
-#include "tensorflow/core/lib/strings/str_util.h"
-#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
 
+namespace {
+
+// The records are serialized Int64List, Int32List, FloatList or KvList
+// protos (see example/feature.proto). All of them only hold repeated
+// scalars, so they are decoded straight from the wire format instead of
+// being parsed into messages: a record costs one pass over its bytes and
+// no allocation.
+
+// Field numbers of the decoded protos.
+constexpr int kListValueField = 1;  // {Int64,Int32,Float}List.value
+constexpr int kKvIdField = 1;       // KvList.id
+constexpr int kKvValueField = 5;    // KvList.value
+constexpr int kNoField = -1;
+
+// Rows are decoded in blocks of consecutive records, a few per worker
+// thread, so that uneven records still balance.
+constexpr int64 kBlocksPerThread = 4;
+const int64 kDecodeCostPerRecord = 5000;  // very unreliable estimate.
+
+inline bool ReadVarint(const uint8** p, const uint8* end, uint64* value) {
+  const uint8* ptr = *p;
+  if (ptr < end && *ptr < 0x80) {
+    *value = *ptr;
+    *p = ptr + 1;
+    return true;
+  }
+  uint64 result = 0;
+  for (int shift = 0; shift < 64 && ptr < end; shift += 7) {
+    const uint64 byte = *ptr++;
+    result |= (byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *value = result;
+      *p = ptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline float ReadFloat(const uint8* p) {
+  const uint32 bits = static_cast<uint32>(p[0]) |
+                      (static_cast<uint32>(p[1]) << 8) |
+                      (static_cast<uint32>(p[2]) << 16) |
+                      (static_cast<uint32>(p[3]) << 24);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Decodes `record`, calling `on_varint(value)` for every element of the
+// varint field `varint_field` and `on_float(value)` for every element of
+// the float field `float_field`, whether packed or not. Other fields are
+// skipped. Returns false if `record` is malformed.
+template <typename OnVarint, typename OnFloat>
+bool DecodeRepeatedScalars(StringPiece record, int varint_field,
+                           int float_field, OnVarint on_varint,
+                           OnFloat on_float) {
+  const uint8* p = reinterpret_cast<const uint8*>(record.data());
+  const uint8* const end = p + record.size();
+  while (p < end) {
+    uint64 tag;
+    if (!ReadVarint(&p, end, &tag)) return false;
+    const int64 field = static_cast<int64>(tag >> 3);
+    switch (tag & 7) {
+      case 0: {  // varint
+        uint64 value;
+        if (!ReadVarint(&p, end, &value)) return false;
+        if (field == varint_field) on_varint(value);
+        break;
+      }
+      case 1:  // fixed64
+        if (end - p < 8) return false;
+        p += 8;
+        break;
+      case 2: {  // length delimited, packed repeated fields
+        uint64 length;
+        if (!ReadVarint(&p, end, &length) ||
+            length > static_cast<uint64>(end - p)) {
+          return false;
+        }
+        const uint8* const field_end = p + length;
+        if (field == varint_field) {
+          while (p < field_end) {
+            uint64 value;
+            if (!ReadVarint(&p, field_end, &value)) return false;
+            on_varint(value);
+          }
+        } else if (field == float_field) {
+          if (length % 4 != 0) return false;
+          for (; p < field_end; p += 4) {
+            on_float(ReadFloat(p));
+          }
+        } else {
+          p = field_end;
+        }
+        break;
+      }
+      case 5:  // fixed32
+        if (end - p < 4) return false;
+        if (field == float_field) on_float(ReadFloat(p));
+        p += 4;
+        break;
+      default:  // groups are not used by these protos
+        return false;
+    }
+  }
+  return true;
+}
+
+// Decoded rows of consecutive records [start, limit).
+template <typename V>
+struct DecodedBlock {
+  int64 start = 0;
+  int64 limit = 0;
+  std::vector<int64> row_ends;
+  std::vector<int64> ids;
+  std::vector<V> values;
+  Status status;
+};
+
+// Cuts [0, batch_size) into blocks and runs `decode(block)` on each of
+// them in parallel.
+template <typename V, typename DecodeFn>
+void DecodeBlocks(OpKernelContext* ctx, int64 batch_size,
+                  std::vector<DecodedBlock<V>>* blocks, DecodeFn decode) {
+  auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
+  const int64 num_blocks = std::max<int64>(
+      1, std::min<int64>(batch_size,
+                         worker_threads.num_threads * kBlocksPerThread));
+  const int64 block_size = (batch_size + num_blocks - 1) / num_blocks;
+  blocks->resize(num_blocks);
+  for (int64 i = 0; i < num_blocks; ++i) {
+    (*blocks)[i].start = std::min(batch_size, i * block_size);
+    (*blocks)[i].limit = std::min(batch_size, (i + 1) * block_size);
+  }
+  Shard(worker_threads.num_threads, worker_threads.workers, num_blocks,
+        block_size * kDecodeCostPerRecord,
+        [blocks, &decode](int64 start, int64 limit) {
+          for (int64 i = start; i < limit; ++i) {
+            decode(&(*blocks)[i]);
+          }
+        });
+}
+
+// Returns the first error of `blocks`, and in `offsets` the position of
+// each block in the output, `offsets->back()` being the total count.
+template <typename V>
+Status PrefixSumBlocks(const std::vector<DecodedBlock<V>>& blocks,
+                       std::vector<int64>* offsets) {
+  offsets->resize(blocks.size() + 1);
+  (*offsets)[0] = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    TF_RETURN_IF_ERROR(blocks[i].status);
+    (*offsets)[i + 1] = (*offsets)[i] + blocks[i].ids.size();
+  }
+  return Status::OK();
+}
+
+// Copies the decoded blocks into the sparse outputs, in parallel.
+template <typename V>
+void AssembleSparse(OpKernelContext* ctx,
+                    const std::vector<DecodedBlock<V>>& blocks,
+                    const std::vector<int64>& offsets, bool id_as_value,
+                    int64* indices, V* values) {
+  auto assemble = [&](int64 start, int64 limit) {
+    for (int64 i = start; i < limit; ++i) {
+      const DecodedBlock<V>& block = blocks[i];
+      int64* block_indices = indices + offsets[i] * 2;
+      V* block_values = values + offsets[i];
+      int64 begin = 0;
+      for (int64 row = block.start; row < block.limit; ++row) {
+        const int64 row_end = block.row_ends[row - block.start];
+        for (int64 j = begin; j < row_end; ++j) {
+          block_indices[2 * j] = row;
+          block_indices[2 * j + 1] = block.ids[j];
+        }
+        begin = row_end;
+      }
+      if (id_as_value) {
+        std::copy(block.ids.begin(), block.ids.end(), block_values);
+      } else {
+        std::copy(block.values.begin(), block.values.end(), block_values);
+      }
+    }
+  };
+  auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
+  const int64 cost = offsets.back() / std::max<size_t>(1, blocks.size()) * 4;
+  Shard(worker_threads.num_threads, worker_threads.workers, blocks.size(),
+        std::max<int64>(cost, 1), assemble);
+}
+
+Status SparseDecodeInputs(OpKernelContext* ctx,
+                          TTypes<string>::ConstVec* input_vec,
+                          int64* max_id) {
+  const Tensor* input_tensor;
+  TF_RETURN_IF_ERROR(ctx->input("input", &input_tensor));
+  const Tensor* max_id_tensor;
+  TF_RETURN_IF_ERROR(ctx->input("max_id", &max_id_tensor));
+  if (!TensorShapeUtils::IsVector(input_tensor->shape())) {
+    return errors::InvalidArgument("input must be a vector, got shape: ",
+                                   input_tensor->shape().DebugString());
+  }
+  *input_vec = input_tensor->vec<string>();
+  *max_id = max_id_tensor->scalar<int64>()();
+  return Status::OK();
+}
+
+}  // namespace
+
 class SparseDecodeOp : public OpKernel {
  public:
   explicit SparseDecodeOp(OpKernelConstruction* ctx)
@@ -41,60 +247,52 @@ class SparseDecodeOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* ctx) override {
-    const Tensor* input_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("input", &input_tensor));
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(input_tensor->shape()),
-                errors::InvalidArgument("input must be a vector, got shape: ",
-                                        input_tensor->shape().DebugString()));
-
-    const auto input_vec = input_tensor->vec<string>();
+    TTypes<string>::ConstVec input_vec(nullptr, 0);
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, SparseDecodeInputs(ctx, &input_vec, &max_id));
     const int64 batch_size = input_vec.dimension(0);
 
-    int64 tensorLen = 0;
-    int offset_[batch_size + 1];
-    offset_[0] = 0;
-    for (int batch_id = 0; batch_id < batch_size; ++batch_id) {
-        Int64List int64_list;
-        int64_list.ParseFromString(input_vec(batch_id));
-        tensorLen += int64_list.value_size();
-        offset_[batch_id + 1] = tensorLen;
-    }
-
-    Tensor indices(DT_INT64, TensorShape({tensorLen, 2}));
-    Tensor values(DT_INT64, TensorShape({tensorLen}));
-    Tensor dense_shape(DT_INT64, TensorShape({2}));
-    auto indices_ = indices.matrix<int64>();
-    auto values_ = values.vec<int64>();
-    auto dense_shape_ = dense_shape.flat<int64>();
-
-    auto doWork = [input_vec, &offset_, &indices_, &values_] (int64 start_i,
-                                                              int64 limit_i) {
-        for (int batch_id = start_i; batch_id < limit_i; ++batch_id) {
-            Int64List int64_list;
-            int64_list.ParseFromString(input_vec(batch_id));
-            int64 col_len = int64_list.value_size();
-            const int64 offset = offset_[batch_id];
-            for(int index = 0; index < col_len; ++index) {
-                const int64& value = int64_list.value(index);
-                indices_(index + offset, 0) = batch_id;
-                indices_(index + offset, 1) = value;
-                values_(index + offset) = value;
-            }
+    // Decode every record once, into the block holding it.
+    std::vector<DecodedBlock<int64>> blocks;
+    DecodeBlocks<int64>(ctx, batch_size, &blocks,
+                        [&input_vec](DecodedBlock<int64>* block) {
+      block->row_ends.reserve(block->limit - block->start);
+      auto on_id = [block](uint64 id) {
+        block->ids.push_back(static_cast<int64>(id));
+      };
+      auto on_float = [](float) {};
+      for (int64 batch_id = block->start; batch_id < block->limit;
+           ++batch_id) {
+        if (!DecodeRepeatedScalars(input_vec(batch_id), kListValueField,
+                                   kNoField, on_id, on_float)) {
+          block->status = errors::InvalidArgument(
+              "Failed to parse Int64List of input ", batch_id);
+          return;
         }
-    };
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost,
-          doWork);
+        block->row_ends.push_back(block->ids.size());
+      }
+    });
+
+    std::vector<int64> offsets;
+    OP_REQUIRES_OK(ctx, PrefixSumBlocks(blocks, &offsets));
+    const int64 tensorLen = offsets.back();
 
+    Tensor* indices;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0, TensorShape({tensorLen, 2}),
+                                             &indices));
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(1, TensorShape({tensorLen}),
+                                             &values));
+    Tensor* dense_shape;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(2, TensorShape({2}),
+                                             &dense_shape));
+    AssembleSparse<int64>(ctx, blocks, offsets, true,
+                          indices->matrix<int64>().data(),
+                          values->vec<int64>().data());
+
+    auto dense_shape_ = dense_shape->flat<int64>();
     dense_shape_(0) = batch_size;
     dense_shape_(1) = max_id;
-    ctx->set_output(0, indices);
-    ctx->set_output(1, values);
-    ctx->set_output(2, dense_shape);
   }
 };
 
@@ -107,76 +305,76 @@ class KV2SparseDecodeOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* ctx) override {
-    const Tensor* input_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("input", &input_tensor));
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(input_tensor->shape()),
-                errors::InvalidArgument("input must be a vector, got shape: ",
-                                        input_tensor->shape().DebugString()));
-
-    const auto input_vec = input_tensor->vec<string>();
+    TTypes<string>::ConstVec input_vec(nullptr, 0);
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, SparseDecodeInputs(ctx, &input_vec, &max_id));
     const int64 batch_size = input_vec.dimension(0);
 
-    int64 tensorLen = 0;
-    int offset_[batch_size + 1];
-    offset_[0] = 0;
-    for (int batch_id = 0; batch_id < batch_size; ++batch_id) {
-        KvList kv_list;
-        kv_list.ParseFromString(input_vec(batch_id));
-        tensorLen += kv_list.value_size();
-        offset_[batch_id + 1] = tensorLen;
-    }
-
-    Tensor indices(DT_INT64, TensorShape({tensorLen, 2}));
-    Tensor values(DT_FLOAT, TensorShape({tensorLen}));
-    Tensor dense_shape(DT_INT64, TensorShape({2}));
-    auto indices_ = indices.matrix<int64>();
-    auto values_ = values.vec<float>();
-    auto dense_shape_ = dense_shape.flat<int64>();
-
-    auto doWork = [input_vec, &offset_, &indices_, &values_] (int64 start_i,
-                                                              int64 limit_i) {
-        for (int batch_id = start_i; batch_id < limit_i; ++batch_id) {
-            KvList kv_list;
-            kv_list.ParseFromString(input_vec(batch_id));
-            int64 col_len = kv_list.value_size();
-            const int64 offset = offset_[batch_id];
-            for(int index = 0; index < col_len; ++index) {
-                indices_(index + offset, 0) = batch_id;
-                indices_(index + offset, 1) = kv_list.id(index);
-                values_(index + offset) = kv_list.value(index);
-            }
+    std::vector<DecodedBlock<float>> blocks;
+    DecodeBlocks<float>(ctx, batch_size, &blocks,
+                        [&input_vec](DecodedBlock<float>* block) {
+      block->row_ends.reserve(block->limit - block->start);
+      auto on_id = [block](uint64 id) {
+        block->ids.push_back(static_cast<int64>(id));
+      };
+      auto on_value = [block](float value) {
+        block->values.push_back(value);
+      };
+      for (int64 batch_id = block->start; batch_id < block->limit;
+           ++batch_id) {
+        if (!DecodeRepeatedScalars(input_vec(batch_id), kKvIdField,
+                                   kKvValueField, on_id, on_value)) {
+          block->status = errors::InvalidArgument(
+              "Failed to parse KvList of input ", batch_id);
+          return;
         }
-    };
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost,
-          doWork);
+        if (block->ids.size() != block->values.size()) {
+          block->status = errors::InvalidArgument(
+              "KvList of input ", batch_id, " has different numbers of ids "
+              "and values.");
+          return;
+        }
+        block->row_ends.push_back(block->ids.size());
+      }
+    });
+
+    std::vector<int64> offsets;
+    OP_REQUIRES_OK(ctx, PrefixSumBlocks(blocks, &offsets));
+    const int64 tensorLen = offsets.back();
 
+    Tensor* indices;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0, TensorShape({tensorLen, 2}),
+                                             &indices));
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(1, TensorShape({tensorLen}),
+                                             &values));
+    Tensor* dense_shape;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(2, TensorShape({2}),
+                                             &dense_shape));
+    AssembleSparse<float>(ctx, blocks, offsets, false,
+                          indices->matrix<int64>().data(),
+                          values->vec<float>().data());
+
+    auto dense_shape_ = dense_shape->flat<int64>();
     dense_shape_(0) = batch_size;
     dense_shape_(1) = max_id;
-    ctx->set_output(0, indices);
-    ctx->set_output(1, values);
-    ctx->set_output(2, dense_shape);
   }
 };
 
-class DenseDecodeFloatOp : public OpKernel {
+// The width of the output is the number of values of the first record,
+// every record must have as many values.
+template <typename T>
+class DenseDecodeOp : public OpKernel {
  public:
-  explicit DenseDecodeFloatOp(OpKernelConstruction* ctx)
+  explicit DenseDecodeOp(OpKernelConstruction* ctx)
     : OpKernel(ctx) {
     }
-  ~DenseDecodeFloatOp() {
+  ~DenseDecodeOp() {
   }
 
   void Compute(OpKernelContext* ctx) override {
     const Tensor* input_tensor;
     OP_REQUIRES_OK(ctx, ctx->input("input", &input_tensor));
-    //const Tensor* max_id_tensor;
-    //OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    //int64 max_id = max_id_tensor->scalar<int64>()();
     OP_REQUIRES(ctx, TensorShapeUtils::IsVector(input_tensor->shape()),
                 errors::InvalidArgument("input must be a vector, got shape: ",
                                         input_tensor->shape().DebugString()));
@@ -184,79 +382,83 @@ class DenseDecodeFloatOp : public OpKernel {
     const auto input_vec = input_tensor->vec<string>();
     const int64 batch_size = input_vec.dimension(0);
 
-    FloatList float_list;
-    float_list.ParseFromString(input_vec(0));
-    int64 max_id = float_list.value_size();
-
-    Tensor values(DT_FLOAT, TensorShape({max_id * batch_size}));
-    auto values_ = values.vec<float>();
-
-    auto doWork = [input_vec, max_id, &values_] (int64 start_i, int64 limit_i) {
-        for (int batch_id = start_i; batch_id < limit_i; ++batch_id) {
-            FloatList float_list;
-            float_list.ParseFromString(input_vec(batch_id));
-            const int64 offset = batch_id * max_id;
-            for(int index = 0; index < max_id; ++index) {
-                values_(index + offset) = float_list.value(index);;
-            }
-        }
-    };
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost,
-          doWork);
-
-    ctx->set_output(0, values);
-  }
-};
-
-class DenseDecodeInt32Op : public OpKernel {
- public:
-  explicit DenseDecodeInt32Op(OpKernelConstruction* ctx)
-    : OpKernel(ctx) {
+    int64 max_id = 0;
+    if (batch_size > 0) {
+      OP_REQUIRES(ctx, Decode(input_vec(0), nullptr, 0, &max_id),
+                  errors::InvalidArgument("Failed to parse input 0"));
     }
-  ~DenseDecodeInt32Op() {
-  }
 
-  void Compute(OpKernelContext* ctx) override {
-    const Tensor* input_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("input", &input_tensor));
-    //const Tensor* max_id_tensor;
-    //OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    //int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(input_tensor->shape()),
-                errors::InvalidArgument("input must be a vector, got shape: ",
-                                        input_tensor->shape().DebugString()));
-
-    const auto input_vec = input_tensor->vec<string>();
-    const int64 batch_size = input_vec.dimension(0);
-
-    Int32List int32_list;
-    int32_list.ParseFromString(input_vec(0));
-    int64 max_id = int32_list.value_size();
-
-    Tensor values(DT_INT32, TensorShape({max_id * batch_size}));
-    auto values_ = values.vec<int32>();
-
-    auto doWork = [input_vec, max_id, &values_] (int64 start_i, int64 limit_i) {
-        for (int batch_id = start_i; batch_id < limit_i; ++batch_id) {
-            Int32List int32_list;
-            int32_list.ParseFromString(input_vec(batch_id));
-            const int64 offset = batch_id * max_id;
-            for(int index = 0; index < max_id; ++index) {
-                values_(index + offset) = int32_list.value(index);;
+    Tensor* values;
+    OP_REQUIRES_OK(ctx,
+                   ctx->allocate_output(0, TensorShape({max_id * batch_size}),
+                                        &values));
+    T* values_ = values->flat<T>().data();
+
+    // Each record is decoded once, straight into its row.
+    mutex mu;
+    Status status;
+    auto doWork = [&input_vec, max_id, values_, &mu, &status] (
+        int64 start_i, int64 limit_i) {
+        for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
+            int64 count = 0;
+            if (!Decode(input_vec(batch_id), values_ + batch_id * max_id,
+                        max_id, &count)) {
+                mutex_lock l(mu);
+                status.Update(errors::InvalidArgument(
+                    "Failed to parse input ", batch_id));
+                return;
+            }
+            if (count != max_id) {
+                mutex_lock l(mu);
+                status.Update(errors::InvalidArgument(
+                    "Input ", batch_id, " has ", count, " values, expect ",
+                    max_id, " values as input 0"));
+                return;
             }
         }
     };
     auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost,
-          doWork);
-
-    ctx->set_output(0, values);
+    Shard(worker_threads.num_threads, worker_threads.workers, batch_size,
+          kDecodeCostPerRecord, doWork);
+    OP_REQUIRES_OK(ctx, status);
   }
+
+ private:
+  // Writes at most `capacity` values of `record` to `out` and counts all
+  // of them in `count`.
+  static bool Decode(StringPiece record, T* out, int64 capacity,
+                     int64* count);
 };
 
+template <>
+bool DenseDecodeOp<float>::Decode(StringPiece record, float* out,
+                                  int64 capacity, int64* count) {
+  int64 n = 0;
+  bool ok = DecodeRepeatedScalars(
+      record, kNoField, kListValueField, [](uint64) {},
+      [out, capacity, &n](float value) {
+        if (n < capacity) out[n] = value;
+        ++n;
+      });
+  *count = n;
+  return ok;
+}
+
+template <>
+bool DenseDecodeOp<int32>::Decode(StringPiece record, int32* out,
+                                  int64 capacity, int64* count) {
+  int64 n = 0;
+  bool ok = DecodeRepeatedScalars(
+      record, kListValueField, kNoField,
+      [out, capacity, &n](uint64 value) {
+        if (n < capacity) out[n] = static_cast<int32>(value);
+        ++n;
+      },
+      [](float) {});
+  *count = n;
+  return ok;
+}
+
 class KV2DenseDecodeOp : public OpKernel {
  public:
   explicit KV2DenseDecodeOp(OpKernelConstruction* ctx)
@@ -266,47 +468,57 @@ class KV2DenseDecodeOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* ctx) override {
-    const Tensor* input_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("input", &input_tensor));
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(input_tensor->shape()),
-                errors::InvalidArgument("input must be a vector, got shape: ",
-                                        input_tensor->shape().DebugString()));
-
-    const auto input_vec = input_tensor->vec<string>();
+    TTypes<string>::ConstVec input_vec(nullptr, 0);
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, SparseDecodeInputs(ctx, &input_vec, &max_id));
     const int64 batch_size = input_vec.dimension(0);
 
     Tensor* values;
     OP_REQUIRES_OK(ctx,
                    ctx->allocate_output(0, TensorShape({batch_size * max_id}),
                    &values));
-    auto values_ = values->vec<float>();
-
-    auto doWork = [input_vec, max_id, &values_] (int64 start_i, int64 limit_i) {
-        for (int batch_id = start_i; batch_id < limit_i; ++batch_id) {
-            KvList kv_list;
-            kv_list.ParseFromString(input_vec(batch_id));
-            int64 col_len = kv_list.value_size();
-            const int64 offset = batch_id * max_id;
-            for (int index = 0; index < max_id; ++index) {
-                values_(index + offset) = 0.0;
+    float* values_ = values->flat<float>().data();
+
+    // Ids and values are separate fields of KvList that may come in any
+    // order, both are held aside until the record is decoded, in buffers
+    // reused by all the records of a shard.
+    mutex mu;
+    Status status;
+    auto doWork = [&input_vec, max_id, values_, &mu, &status] (
+        int64 start_i, int64 limit_i) {
+        std::vector<int64> ids;
+        std::vector<float> vals;
+        for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
+            float* row = values_ + batch_id * max_id;
+            std::fill(row, row + max_id, 0.0f);
+            ids.clear();
+            vals.clear();
+            bool ok = DecodeRepeatedScalars(
+                input_vec(batch_id), kKvIdField, kKvValueField,
+                [&ids](uint64 id) { ids.push_back(static_cast<int64>(id)); },
+                [&vals](float value) { vals.push_back(value); });
+            if (!ok || vals.size() != ids.size()) {
+                mutex_lock l(mu);
+                status.Update(errors::InvalidArgument(
+                    "Failed to parse KvList of input ", batch_id));
+                return;
             }
-            for (int index = 0; index < col_len; ++index) {
-                const int64& key = kv_list.id(index);
-                if (key < max_id) {
-                    values_(key + offset) = kv_list.value(index);
+            for (size_t i = 0; i < ids.size(); ++i) {
+                const int64 key = ids[i];
+                if (key >= 0 && key < max_id) {
+                    row[key] = vals[i];
                 } else {
-                    LOG(WARNING) << "KV's key(" << key << ") is larger than max_col("
-                                 << max_id << ").";
+                    LOG(WARNING) << "KV's key(" << key
+                                 << ") is larger than max_col(" << max_id
+                                 << ").";
                 }
             }
         }
     };
     auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doWork);
+    Shard(worker_threads.num_threads, worker_threads.workers, batch_size,
+          kDecodeCostPerRecord, doWork);
+    OP_REQUIRES_OK(ctx, status);
   }
 };
 
@@ -316,11 +528,11 @@ REGISTER_KERNEL_BUILDER(Name("SparseDecode")
 REGISTER_KERNEL_BUILDER(Name("DenseDecode")
                             .Device(DEVICE_CPU)
                             .TypeConstraint<float>("T"),
-                        DenseDecodeFloatOp);
+                        DenseDecodeOp<float>);
 REGISTER_KERNEL_BUILDER(Name("DenseDecode")
                             .Device(DEVICE_CPU)
                             .TypeConstraint<int32>("T"),
-                        DenseDecodeInt32Op);
+                        DenseDecodeOp<int32>);
 REGISTER_KERNEL_BUILDER(Name("KV2SparseDecode")
                             .Device(DEVICE_CPU),
                         KV2SparseDecodeOp);
@@ -0,0 +1,241 @@
+/* Copyright 2016 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/kernel_benchmark_testlib.h"
+#include "tensorflow/core/example/feature.pb.h"
+#include "tensorflow/core/framework/fake_input.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/graph/node_builder.h"
+#include "tensorflow/core/kernels/ops_testutil.h"
+#include "tensorflow/core/kernels/ops_util.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/public/session_options.h"
+
+namespace tensorflow {
+
+namespace {
+
+string Int64Record(const std::vector<int64>& values) {
+  Int64List list;
+  for (int64 v : values) list.add_value(v);
+  return list.SerializeAsString();
+}
+
+string KvRecord(const std::vector<int64>& ids,
+                const std::vector<float>& values) {
+  KvList list;
+  for (int64 id : ids) list.add_id(id);
+  for (float v : values) list.add_value(v);
+  return list.SerializeAsString();
+}
+
+class SparseDecodeTest : public OpsTestBase {
+ protected:
+  void CreateOp(const string& op, const DataTypeVector& types) {
+    TF_ASSERT_OK(NodeDefBuilder("op", op)
+                     .Input(FakeInput(DT_STRING))
+                     .Input(FakeInput(DT_INT64))
+                     .Attr("T", types)
+                     .Finalize(node_def()));
+    TF_ASSERT_OK(InitOp());
+  }
+};
+
+TEST_F(SparseDecodeTest, Int64List) {
+  CreateOp("SparseDecode", {DT_INT64, DT_INT64, DT_INT64});
+  AddInputFromArray<string>(
+      TensorShape({3}),
+      {Int64Record({3, 1 << 20}), Int64Record({}), Int64Record({-7})});
+  AddInputFromArray<int64>(TensorShape({}), {100});
+  TF_ASSERT_OK(RunOpKernel());
+
+  Tensor expected_indices(allocator(), DT_INT64, {3, 2});
+  test::FillValues<int64>(&expected_indices, {0, 3, 0, 1 << 20, 2, -7});
+  test::ExpectTensorEqual<int64>(expected_indices, *GetOutput(0));
+  Tensor expected_values(allocator(), DT_INT64, {3});
+  test::FillValues<int64>(&expected_values, {3, 1 << 20, -7});
+  test::ExpectTensorEqual<int64>(expected_values, *GetOutput(1));
+  Tensor expected_shape(allocator(), DT_INT64, {2});
+  test::FillValues<int64>(&expected_shape, {3, 100});
+  test::ExpectTensorEqual<int64>(expected_shape, *GetOutput(2));
+}
+
+TEST_F(SparseDecodeTest, UnpackedInt64List) {
+  CreateOp("SparseDecode", {DT_INT64, DT_INT64, DT_INT64});
+  // value = 1 and value = 300, each as its own varint field.
+  const string unpacked("\x08\x01\x08\xac\x02", 5);
+  AddInputFromArray<string>(TensorShape({1}), {unpacked});
+  AddInputFromArray<int64>(TensorShape({}), {1000});
+  TF_ASSERT_OK(RunOpKernel());
+
+  Tensor expected_values(allocator(), DT_INT64, {2});
+  test::FillValues<int64>(&expected_values, {1, 300});
+  test::ExpectTensorEqual<int64>(expected_values, *GetOutput(1));
+}
+
+TEST_F(SparseDecodeTest, Malformed) {
+  CreateOp("SparseDecode", {DT_INT64, DT_INT64, DT_INT64});
+  const string truncated = Int64Record({1, 2, 300});
+  AddInputFromArray<string>(
+      TensorShape({2}),
+      {Int64Record({1}), truncated.substr(0, truncated.size() - 1)});
+  AddInputFromArray<int64>(TensorShape({}), {1000});
+  EXPECT_EQ(error::INVALID_ARGUMENT, RunOpKernel().code());
+}
+
+TEST_F(SparseDecodeTest, KvList) {
+  CreateOp("KV2SparseDecode", {DT_INT64, DT_FLOAT, DT_INT64});
+  AddInputFromArray<string>(
+      TensorShape({2}),
+      {KvRecord({2, 5}, {0.5, -1.5}), KvRecord({1}, {2.0})});
+  AddInputFromArray<int64>(TensorShape({}), {6});
+  TF_ASSERT_OK(RunOpKernel());
+
+  Tensor expected_indices(allocator(), DT_INT64, {3, 2});
+  test::FillValues<int64>(&expected_indices, {0, 2, 0, 5, 1, 1});
+  test::ExpectTensorEqual<int64>(expected_indices, *GetOutput(0));
+  Tensor expected_values(allocator(), DT_FLOAT, {3});
+  test::FillValues<float>(&expected_values, {0.5, -1.5, 2.0});
+  test::ExpectTensorEqual<float>(expected_values, *GetOutput(1));
+}
+
+TEST_F(SparseDecodeTest, KvListDense) {
+  CreateOp("KV2DenseDecode", {DT_FLOAT});
+  AddInputFromArray<string>(
+      TensorShape({2}),
+      {KvRecord({2, 0}, {0.5, -1.5}), KvRecord({1, 9}, {2.0, 3.0})});
+  AddInputFromArray<int64>(TensorShape({}), {3});
+  TF_ASSERT_OK(RunOpKernel());
+
+  Tensor expected(allocator(), DT_FLOAT, {6});
+  test::FillValues<float>(&expected, {-1.5, 0, 0.5, 0, 2.0, 0});
+  test::ExpectTensorEqual<float>(expected, *GetOutput(0));
+}
+
+TEST_F(SparseDecodeTest, KvListDenseValuesFirst) {
+  CreateOp("KV2DenseDecode", {DT_FLOAT});
+  // Concatenated messages merge, so the values are serialized before the
+  // ids of the record.
+  AddInputFromArray<string>(
+      TensorShape({1}), {KvRecord({}, {0.5, -1.5}) + KvRecord({2, 0}, {})});
+  AddInputFromArray<int64>(TensorShape({}), {3});
+  TF_ASSERT_OK(RunOpKernel());
+
+  Tensor expected(allocator(), DT_FLOAT, {3});
+  test::FillValues<float>(&expected, {-1.5, 0, 0.5});
+  test::ExpectTensorEqual<float>(expected, *GetOutput(0));
+}
+
+TEST_F(SparseDecodeTest, FloatListDense) {
+  TF_ASSERT_OK(NodeDefBuilder("op", "DenseDecode")
+                   .Input(FakeInput(DT_STRING))
+                   .Input(FakeInput(DT_INT64))
+                   .Attr("T", DT_FLOAT)
+                   .Finalize(node_def()));
+  TF_ASSERT_OK(InitOp());
+  FloatList row0, row1;
+  row0.add_value(1.0);
+  row0.add_value(2.0);
+  row1.add_value(-3.0);
+  row1.add_value(4.5);
+  AddInputFromArray<string>(
+      TensorShape({2}), {row0.SerializeAsString(), row1.SerializeAsString()});
+  AddInputFromArray<int64>(TensorShape({}), {0});
+  TF_ASSERT_OK(RunOpKernel());
+
+  Tensor expected(allocator(), DT_FLOAT, {4});
+  test::FillValues<float>(&expected, {1.0, 2.0, -3.0, 4.5});
+  test::ExpectTensorEqual<float>(expected, *GetOutput(0));
+}
+
+static Graph* SparseDecode(const Tensor& records_t) {
+  Graph* g = new Graph(OpRegistry::Global());
+  Tensor max_id(DT_INT64, TensorShape({}));
+  max_id.flat<int64>()(0) = 1 << 30;
+  Node* node;
+  TF_CHECK_OK(NodeBuilder(g->NewName("op"), "SparseDecode")
+                  .Input(test::graph::Constant(g, records_t))
+                  .Input(test::graph::Constant(g, max_id))
+                  .Attr("T", {DT_INT64, DT_INT64, DT_INT64})
+                  .Finalize(g, &node));
+  return g;
+}
+
+Tensor Int64Records(int batch, int cols) {
+  Tensor records_t(DT_STRING, TensorShape({batch}));
+  auto records = records_t.flat<string>();
+  for (int i = 0; i < batch; ++i) {
+    Int64List list;
+    for (int j = 0; j < cols; ++j) {
+      list.add_value((i * 7919 + j * 104729) % (1 << 30));
+    }
+    records(i) = list.SerializeAsString();
+  }
+  return records_t;
+}
+
+}  // namespace
+
+static void BM_SparseDecode(int iters, int batch, int threads) {
+  testing::StopTiming();
+  const int cols = 50;
+  testing::ItemsProcessed(static_cast<int64>(iters) * batch * cols);
+  testing::UseRealTime();
+  Tensor records_t = Int64Records(batch, cols);
+  SessionOptions opts;
+  opts.config.set_intra_op_parallelism_threads(threads);
+  opts.config.set_inter_op_parallelism_threads(threads);
+  testing::StartTiming();
+  test::Benchmark("cpu", SparseDecode(records_t), &opts).Run(iters);
+}
+BENCHMARK(BM_SparseDecode)
+    ->ArgPair(128, 1)
+    ->ArgPair(4096, 1)
+    ->ArgPair(4096, 16);
+
+// The decode SparseDecode used to do: count every record with protobuf,
+// then parse it again to read the values.
+static void BM_SparseDecodeProtobuf(int iters, int batch) {
+  testing::StopTiming();
+  const int cols = 50;
+  testing::ItemsProcessed(static_cast<int64>(iters) * batch * cols);
+  Tensor records_t = Int64Records(batch, cols);
+  auto records = records_t.flat<string>();
+  std::vector<int64> values;
+  testing::StartTiming();
+  for (int it = 0; it < iters; ++it) {
+    int64 len = 0;
+    for (int i = 0; i < batch; ++i) {
+      Int64List list;
+      list.ParseFromString(records(i));
+      len += list.value_size();
+    }
+    values.resize(len);
+    int64 offset = 0;
+    for (int i = 0; i < batch; ++i) {
+      Int64List list;
+      list.ParseFromString(records(i));
+      for (int64 v : list.value()) values[offset++] = v;
+    }
+  }
+}
+BENCHMARK(BM_SparseDecodeProtobuf)->Arg(128)->Arg(4096);
+
+}  // namespace tensorflow
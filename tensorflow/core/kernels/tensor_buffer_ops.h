@@ -34,97 +34,137 @@ limitations under the License.
 #include "third_party/eigen3/Eigen/Core"
 #include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstddef>
-#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace tensorflow {
 
 #define TF_RESOURCE_DEBUG_STRING_CONST const
 
+// A bounded multi-producer multi-consumer buffer of records.
+//
+// Records live in a ring of `capacity` slots. Every slot carries a sequence
+// number that tells whether it may be written or read in the current lap,
+// so producers and consumers claim slots with one CAS on the tail or head
+// counter and take no lock on the fast path. A thread that finds the ring
+// full (or empty) spins for a while and then parks on a condition
+// variable. The other side only takes the lock when some thread is parked,
+// and wakes one parked thread per record.
 class TensorBuf : public ResourceBase {
  public:
   explicit TensorBuf(int64 capacity)
-      : capacity_(capacity), is_cancelled_(false), is_closed_(false) {}
+      : capacity_(capacity),
+        slots_(new Slot[capacity]),
+        head_(0),
+        tail_(0),
+        is_cancelled_(false),
+        is_closed_(false),
+        num_parked_puts_(0),
+        num_parked_takes_(0) {
+    for (uint64 i = 0; i < capacity_; ++i) {
+      slots_[i].seq.store(2 * i, std::memory_order_relaxed);
+    }
+  }
 
   ~TensorBuf() { Cancel(); }
 
   Status Put(const std::vector<Tensor>& record, int64 timeout_millis) {
-    std::unique_lock<std::mutex> lock(mu_);
-
-    bool should_retry = !put_cv_.wait_for(
-        lock, std::chrono::milliseconds(timeout_millis),
-        [this]() { return buffer_.size() < capacity_ || is_cancelled_; });
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(timeout_millis);
+    bool pushed = false;
+    bool should_retry = !Wait(&num_parked_puts_, &put_cv_, &deadline, [&]() {
+      if (is_cancelled_.load(std::memory_order_acquire)) {
+        return true;
+      }
+      pushed = TryPush(record);
+      return pushed;
+    });
     if (should_retry) {
-      lock.unlock();
       LOG(WARNING) << "Prefetching was ignored since timeout.";
       return Status::OK();
     }
 
-    if (TF_PREDICT_FALSE(is_cancelled_)) {
-      lock.unlock();
+    if (TF_PREDICT_FALSE(!pushed)) {
       return Status(errors::Cancelled("Session was closed."));
     }
 
-    buffer_.push_back(std::move(record));
-
-    lock.unlock();
-    take_cv_.notify_all();
-
+    Wake(&num_parked_takes_, &take_cv_, 1);
     return Status::OK();
   }
 
   Status Take(std::vector<Tensor>* record) {
-    std::unique_lock<std::mutex> lock(mu_);
-
-    take_cv_.wait(lock, [this]() { return !buffer_.empty() || is_cancelled_; });
-
-    if (TF_PREDICT_FALSE(is_closed_ && buffer_.empty())) {
-      lock.unlock();
-      return Status(errors::OutOfRange("EOF reached."));
-    }
+    std::vector<std::vector<Tensor> > records;
+    TF_RETURN_IF_ERROR(TakeMany(1, &records));
+    *record = std::move(records.front());
+    return Status::OK();
+  }
 
-    if (TF_PREDICT_FALSE(is_cancelled_ && buffer_.empty())) {
-      lock.unlock();
+  // Waits until at least one record is buffered, then takes up to
+  // `max_records` records in FIFO order without waiting for more.
+  Status TakeMany(int64 max_records,
+                  std::vector<std::vector<Tensor> >* records) {
+    records->clear();
+    std::vector<Tensor> record;
+    bool popped = false;
+    Wait(&num_parked_takes_, &take_cv_, nullptr, [&]() {
+      popped = TryPop(&record);
+      return popped || is_cancelled_.load(std::memory_order_acquire);
+    });
+
+    // Records buffered before a cancellation are still handed out.
+    if (TF_PREDICT_FALSE(!popped && !TryPop(&record))) {
+      if (is_closed_.load(std::memory_order_acquire)) {
+        return Status(errors::OutOfRange("EOF reached."));
+      }
       return Status(errors::Cancelled("Session was closed."));
     }
 
-    *record = std::move(buffer_.front());
-    buffer_.pop_front();
-
-    lock.unlock();
-    put_cv_.notify_all();
+    records->push_back(std::move(record));
+    while (static_cast<int64>(records->size()) < max_records &&
+           TryPop(&record)) {
+      records->push_back(std::move(record));
+    }
 
+    Wake(&num_parked_puts_, &put_cv_, records->size());
     return Status::OK();
   }
 
   Status Cancel(bool is_cancelled = true) {
-    std::unique_lock<std::mutex> lock(mu_);
-
-    is_cancelled_ = is_cancelled;
-
-    lock.unlock();
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      is_cancelled_.store(is_cancelled, std::memory_order_release);
+    }
     put_cv_.notify_all();
     take_cv_.notify_all();
     return Status::OK();
   }
 
   Status Close() {
-    std::unique_lock<std::mutex> lock(mu_);
-
-    is_cancelled_ = true;
-    is_closed_ = true;
-
-    lock.unlock();
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      is_closed_.store(true, std::memory_order_release);
+      is_cancelled_.store(true, std::memory_order_release);
+    }
     put_cv_.notify_all();
     take_cv_.notify_all();
     return Status::OK();
   }
 
   Status GetSize(Tensor* size) {
-    std::unique_lock<std::mutex> lock(mu_);
-    size->scalar<int32>().setConstant(static_cast<int64>(buffer_.size()));
+    const uint64 head = head_.load(std::memory_order_acquire);
+    const uint64 tail = tail_.load(std::memory_order_acquire);
+    // Both counters are read without a lock, so the difference is only a
+    // snapshot and may briefly fall outside [0, capacity].
+    int64 buffered = static_cast<int64>(tail - head);
+    buffered = std::max<int64>(0, std::min<int64>(buffered, capacity_));
+    size->scalar<int32>().setConstant(buffered);
     return Status::OK();
   }
 
@@ -151,10 +191,124 @@ class TensorBuf : public ResourceBase {
   }
 
  private:
-  std::deque<std::vector<Tensor> > buffer_;
-  std::size_t capacity_;
-  bool is_cancelled_;
-  bool is_closed_;
+  // Number of failed attempts before a waiting thread parks, and after how
+  // many of them it starts yielding its time slice between attempts.
+  static const int kSpinAttempts = 256;
+  static const int kSpinAttemptsBeforeYield = 64;
+
+  // The slot of ring position pos is slots_[pos % capacity_]. It may be
+  // written when seq == 2 * pos and read when seq == 2 * pos + 1, and a
+  // reader hands it to the next lap by setting seq to 2 * (pos + capacity_).
+  // Doubling keeps the two states apart even when capacity_ is 1.
+  struct Slot {
+    std::atomic<uint64> seq;
+    std::vector<Tensor> record;
+  };
+
+  bool TryPush(const std::vector<Tensor>& record) {
+    uint64 pos = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos % capacity_];
+      const uint64 seq = slot->seq.load(std::memory_order_acquire);
+      const int64 diff = static_cast<int64>(seq - 2 * pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->record = record;
+    slot->seq.store(2 * pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool TryPop(std::vector<Tensor>* record) {
+    uint64 pos = head_.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+      slot = &slots_[pos % capacity_];
+      const uint64 seq = slot->seq.load(std::memory_order_acquire);
+      const int64 diff = static_cast<int64>(seq - (2 * pos + 1));
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    *record = std::move(slot->record);
+    slot->record.clear();
+    slot->seq.store(2 * (pos + capacity_), std::memory_order_release);
+    return true;
+  }
+
+  // Retries `ready` until it returns true, spinning first and then parking
+  // on `cv`. `ready` may have side effects and is evaluated under mu_ once
+  // parked, so a state change made under mu_ is never missed. Returns false
+  // if `deadline` passed first.
+  template <typename Predicate>
+  bool Wait(std::atomic<int64>* num_parked, std::condition_variable* cv,
+            const std::chrono::steady_clock::time_point* deadline,
+            const Predicate& ready) {
+    for (int i = 0; i < kSpinAttempts; ++i) {
+      if (ready()) {
+        return true;
+      }
+      if (i >= kSpinAttemptsBeforeYield) {
+        std::this_thread::yield();
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(mu_);
+    num_parked->fetch_add(1, std::memory_order_seq_cst);
+    // Pairs with the fence in Wake: either the waker sees this thread
+    // parked, or this thread sees the waker's record below.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool is_ready = true;
+    if (deadline != nullptr) {
+      is_ready = cv->wait_until(lock, *deadline, ready);
+    } else {
+      cv->wait(lock, ready);
+    }
+    num_parked->fetch_sub(1, std::memory_order_relaxed);
+    return is_ready;
+  }
+
+  void Wake(std::atomic<int64>* num_parked, std::condition_variable* cv,
+            size_t num_records) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64 parked = num_parked->load(std::memory_order_relaxed);
+    if (parked == 0) {
+      return;
+    }
+    // A parked thread holds mu_ from registering until it sleeps, so taking
+    // mu_ here orders the notification after its last check.
+    { std::lock_guard<std::mutex> lock(mu_); }
+    const int64 num_wakeups =
+        std::min<int64>(parked, static_cast<int64>(num_records));
+    for (int64 i = 0; i < num_wakeups; ++i) {
+      cv->notify_one();
+    }
+  }
+
+  const uint64 capacity_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<uint64> head_;
+  alignas(64) std::atomic<uint64> tail_;
+  alignas(64) std::atomic<bool> is_cancelled_;
+  std::atomic<bool> is_closed_;
+  std::atomic<int64> num_parked_puts_;
+  std::atomic<int64> num_parked_takes_;
   std::mutex mu_;
   std::condition_variable take_cv_;
   std::condition_variable put_cv_;
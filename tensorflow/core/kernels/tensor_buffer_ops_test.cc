@@ -0,0 +1,207 @@
+/* Copyright 2022 The DeepRec Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/kernels/tensor_buffer_ops.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+std::vector<Tensor> MakeRecord(int64 value) {
+  return {test::AsScalar<int64>(value)};
+}
+
+int64 RecordValue(const std::vector<Tensor>& record) {
+  return record[0].scalar<int64>()();
+}
+
+TEST(TensorBufTest, PutTakeInOrder) {
+  TensorBuf* buf = new TensorBuf(3);
+  core::ScopedUnref unref(buf);
+  for (int64 round = 0; round < 4; ++round) {
+    for (int64 i = 0; i < 3; ++i) {
+      TF_ASSERT_OK(buf->Put(MakeRecord(round * 3 + i), 1000));
+    }
+    Tensor size(DT_INT32, TensorShape({}));
+    TF_ASSERT_OK(buf->GetSize(&size));
+    EXPECT_EQ(3, size.scalar<int32>()());
+    for (int64 i = 0; i < 3; ++i) {
+      std::vector<Tensor> record;
+      TF_ASSERT_OK(buf->Take(&record));
+      EXPECT_EQ(round * 3 + i, RecordValue(record));
+    }
+  }
+}
+
+TEST(TensorBufTest, TakeMany) {
+  TensorBuf* buf = new TensorBuf(8);
+  core::ScopedUnref unref(buf);
+  for (int64 i = 0; i < 5; ++i) {
+    TF_ASSERT_OK(buf->Put(MakeRecord(i), 1000));
+  }
+  std::vector<std::vector<Tensor> > records;
+  TF_ASSERT_OK(buf->TakeMany(3, &records));
+  ASSERT_EQ(3, records.size());
+  TF_ASSERT_OK(buf->TakeMany(8, &records));
+  ASSERT_EQ(2, records.size());
+  EXPECT_EQ(3, RecordValue(records[0]));
+  EXPECT_EQ(4, RecordValue(records[1]));
+}
+
+TEST(TensorBufTest, PutTimesOutWhenFull) {
+  TensorBuf* buf = new TensorBuf(1);
+  core::ScopedUnref unref(buf);
+  TF_ASSERT_OK(buf->Put(MakeRecord(0), 1000));
+  // The record is dropped with a warning, as before.
+  TF_ASSERT_OK(buf->Put(MakeRecord(1), 10));
+  std::vector<Tensor> record;
+  TF_ASSERT_OK(buf->Take(&record));
+  EXPECT_EQ(0, RecordValue(record));
+}
+
+TEST(TensorBufTest, CancelWakesParkedThreads) {
+  TensorBuf* buf = new TensorBuf(1);
+  core::ScopedUnref unref(buf);
+  TF_ASSERT_OK(buf->Put(MakeRecord(0), 1000));
+  Status put_status;
+  std::thread producer([&]() {
+    put_status = buf->Put(MakeRecord(1), 60 * 1000);
+  });
+  std::vector<Tensor> record;
+  TF_ASSERT_OK(buf->Take(&record));
+  producer.join();
+  TF_ASSERT_OK(put_status);
+
+  TF_ASSERT_OK(buf->Take(&record));
+  EXPECT_EQ(1, RecordValue(record));
+  Status take_status;
+  std::thread consumer([&]() { take_status = buf->Take(&record); });
+  Env::Default()->SleepForMicroseconds(50 * 1000);
+  TF_ASSERT_OK(buf->Cancel());
+  consumer.join();
+  EXPECT_TRUE(errors::IsCancelled(take_status));
+  EXPECT_TRUE(errors::IsCancelled(buf->Put(MakeRecord(2), 1000)));
+
+  TF_ASSERT_OK(buf->Cancel(false));
+  TF_ASSERT_OK(buf->Put(MakeRecord(3), 1000));
+  TF_ASSERT_OK(buf->Take(&record));
+  EXPECT_EQ(3, RecordValue(record));
+}
+
+TEST(TensorBufTest, CloseDrainsThenReportsEOF) {
+  TensorBuf* buf = new TensorBuf(4);
+  core::ScopedUnref unref(buf);
+  TF_ASSERT_OK(buf->Put(MakeRecord(0), 1000));
+  TF_ASSERT_OK(buf->Put(MakeRecord(1), 1000));
+  TF_ASSERT_OK(buf->Close());
+  std::vector<std::vector<Tensor> > records;
+  TF_ASSERT_OK(buf->TakeMany(4, &records));
+  EXPECT_EQ(2, records.size());
+  std::vector<Tensor> record;
+  EXPECT_TRUE(errors::IsOutOfRange(buf->Take(&record)));
+}
+
+TEST(TensorBufTest, MultiProducerMultiConsumer) {
+  const int kThreads = 4;
+  const int64 kRecordsPerProducer = 10000;
+  TensorBuf* buf = new TensorBuf(4);
+  core::ScopedUnref unref(buf);
+  std::atomic<int64> sum(0);
+  std::atomic<int64> count(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([buf, t, kRecordsPerProducer]() {
+      for (int64 i = 0; i < kRecordsPerProducer; ++i) {
+        TF_CHECK_OK(buf->Put(MakeRecord(t * kRecordsPerProducer + i),
+                             60 * 1000));
+      }
+    });
+    threads.emplace_back([buf, &sum, &count]() {
+      std::vector<std::vector<Tensor> > records;
+      while (buf->TakeMany(3, &records).ok()) {
+        for (auto& record : records) {
+          sum += RecordValue(record);
+        }
+        count += records.size();
+      }
+    });
+  }
+  const int64 total = kThreads * kRecordsPerProducer;
+  while (count.load() < total) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  TF_ASSERT_OK(buf->Close());
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(total, count.load());
+  EXPECT_EQ(total * (total - 1) / 2, sum.load());
+}
+
+// Producers and consumers hammer a small buffer, records taken one at a
+// time (batch == 1) or in batches.
+void BenchmarkPutTake(int iters, int num_threads, int batch) {
+  testing::StopTiming();
+  TensorBuf* buf = new TensorBuf(16);
+  core::ScopedUnref unref(buf);
+  const int64 per_producer = iters / num_threads + 1;
+  const int64 total = per_producer * num_threads;
+  std::atomic<int64> taken(0);
+  testing::ItemsProcessed(total);
+  testing::StartTiming();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([buf, per_producer]() {
+      for (int64 i = 0; i < per_producer; ++i) {
+        TF_CHECK_OK(buf->Put(MakeRecord(i), 60 * 1000));
+      }
+    });
+    threads.emplace_back([buf, batch, total, &taken]() {
+      std::vector<std::vector<Tensor> > records;
+      while (taken.load(std::memory_order_relaxed) < total &&
+             buf->TakeMany(batch, &records).ok()) {
+        if ((taken += records.size()) >= total) {
+          buf->Close();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  testing::StopTiming();
+}
+
+void BM_TENSOR_BUF_PUT_TAKE(int iters, int num_threads) {
+  BenchmarkPutTake(iters, num_threads, 1);
+}
+
+void BM_TENSOR_BUF_PUT_TAKE_MANY(int iters, int num_threads) {
+  BenchmarkPutTake(iters, num_threads, 8);
+}
+
+BENCHMARK(BM_TENSOR_BUF_PUT_TAKE)->Arg(1)->Arg(4)->Arg(16);
+BENCHMARK(BM_TENSOR_BUF_PUT_TAKE_MANY)->Arg(1)->Arg(4)->Arg(16);
+
+}  // namespace
+}  // namespace tensorflow
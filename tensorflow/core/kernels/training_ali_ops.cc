@@ -28,6 +28,7 @@ limitations under the License.
 #include "tensorflow/core/kernels/training_op_helpers.h"
 #include "tensorflow/core/kernels/training_ali_op_helpers.h"
 #include "tensorflow/core/kernels/training_ali_ops.h"
+#include "tensorflow/core/kernels/training_ali_ops_cpu.h"
 #include "tensorflow/core/kernels/variable_ops.h"
 #include "tensorflow/core/util/work_sharder.h"
 
@@ -125,8 +126,15 @@ class KvSparseApplyAdagradOp : public OpKernel {
         auto grad_flat = grad.flat_outer_dims<T>();
         T lr_scalar = lr.scalar<T>()();
         Tstep gs = global_step.scalar<Tstep>()();
-        auto do_work = [this, ctx, &indices_vec, var, accum, &grad_flat,
-            &gs, &lr_scalar] (int64 start_i, int64 limit_i) {
+        auto do_work = [this, ctx, inner_dim, &indices_vec, var, accum,
+            &grad_flat, &gs, &lr_scalar] (int64 start_i, int64 limit_i) {
+          // Resolve the rows of the whole shard first, then update them in
+          // one pass with the row kernel specialized on inner_dim.
+          std::vector<int64> grad_ids;
+          std::vector<T*> var_rows, accum_rows;
+          grad_ids.reserve(limit_i - start_i);
+          var_rows.reserve(limit_i - start_i);
+          accum_rows.reserve(limit_i - start_i);
           for (int64 i = start_i; i < limit_i; i++) {
             const TKey index = indices_vec(i);
             ValuePtr<T>* value_ptr = nullptr;
@@ -134,13 +142,18 @@ class KvSparseApplyAdagradOp : public OpKernel {
             OP_REQUIRES_OK(ctx, var->LookupOrCreateKey(index, &value_ptr, &is_filter));
             var->UpdateVersion(value_ptr, gs);
             if (is_filter) {
-              auto a = accum->flat(value_ptr);
-              auto g = grad_flat.template chip<0>(i);
-              auto v = var->flat(value_ptr);
-              a += g.square();
-              v -= g.constant(lr_scalar) * g * a.rsqrt();
+              grad_ids.emplace_back(i);
+              var_rows.emplace_back(var->flat(value_ptr).data());
+              accum_rows.emplace_back(accum->flat(value_ptr).data());
             }
           }
+          functor::KvApplyDispatchDim(inner_dim, [&](auto dim) {
+            for (size_t r = 0; r < grad_ids.size(); r++) {
+              functor::KvSparseApplyAdagradRow<T, decltype(dim)::value>::
+                  Compute(var_rows[r], accum_rows[r],
+                          &grad_flat(grad_ids[r], 0), lr_scalar, inner_dim);
+            }
+          });
         };
         const int64 cost = 1000; //very unreliable estimate for cost per step.
         auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
@@ -590,69 +603,43 @@ class KvSparseApplyFtrlOp : public OpKernel {
         T lr_scalar = lr.scalar<T>()();
         T l1_scalar = l1.scalar<T>()();
         T l2_scalar = l2.scalar<T>()();
-        T l2_shrinkage_scalar;
+        T l2_shrinkage_scalar = static_cast<T>(0);
         if (has_l2_shrinkage) {
           l2_shrinkage_scalar = l2_shrinkage->scalar<T>()();
         }
         T lr_power_scalar = lr_power.scalar<T>()();
         auto do_work = [this, ctx, inner_dim, &var_,
                        &indices_vec, &accum_, &linear_, &grad_flat,
-                       &lr_scalar, &l1_scalar, &l2_scalar, &lr_power,
+                       &lr_scalar, &l1_scalar, &l2_scalar,
                        &l2_shrinkage_scalar, &lr_power_scalar]
                        (int64 start_i, int64 limit_i) {
-
+          std::vector<int64> grad_ids;
+          std::vector<T*> var_rows, accum_rows, linear_rows;
+          grad_ids.reserve(limit_i - start_i);
+          var_rows.reserve(limit_i - start_i);
+          accum_rows.reserve(limit_i - start_i);
+          linear_rows.reserve(limit_i - start_i);
           for (int64 i = start_i; i < limit_i; i++) {
             const TKey index = indices_vec(i);
             ValuePtr<T>* value_ptr = nullptr;
             bool is_filter = false;
             OP_REQUIRES_OK(ctx, var_->LookupOrCreateKey(index, &value_ptr, &is_filter));
             if (is_filter) {
-              auto var = var_->flat(value_ptr);
-              auto accum = accum_->flat(value_ptr);
-              auto linear = linear_->flat(value_ptr);
-              auto grad = grad_flat.template chip<0>(i);
-
-// Use a macro to implement the computation here due to the templating of the
-// eigen tensor library.
-#define COMPUTE_FTRL(grad_to_use)                                              \
-  auto new_accum = accum + grad_to_use.square();                               \
-  if (lr_power_scalar == static_cast<T>(-0.5)) {                               \
-    linear +=                                                                  \
-        grad_to_use - (new_accum.sqrt() - accum.sqrt()) / lr_scalar * var;     \
-  } else {                                                                     \
-    linear += grad_to_use - (new_accum.pow(-lr_power_scalar) -                 \
-                             accum.pow(-lr_power_scalar)) /                    \
-                                lr_scalar * var;                               \
-  }                                                                            \
-  Eigen::Tensor<T, 0, Eigen::RowMajor, long int> linear_sqrsum =               \
-            linear.square().sum().sqrt();                                      \
-  T linear_norm = linear_sqrsum(0);                                            \
-  if (linear_norm > l1_scalar) {                                               \
-    if (lr_power_scalar == static_cast<T>(-0.5)) {                             \
-       auto eta_rec = new_accum.sqrt() / lr_scalar;                            \
-       auto coef = (l1_scalar - linear_norm)  /                                \
-                     ((eta_rec + static_cast<T>(2) * l2_scalar) * linear_norm);\
-       var = coef * linear;                                                    \
-    } else {                                                                   \
-      auto eta_rec = new_accum.pow(-lr_power_scalar) / lr_scalar;              \
-      auto coef = (l1_scalar - linear_norm)  /                                 \
-                    ((eta_rec + static_cast<T>(2) * l2_scalar) * linear_norm); \
-      var = coef * linear;                                                     \
-    }                                                                          \
-  } else {                                                                     \
-    var = var.constant(static_cast<T>(0));                                     \
-  }                                                                            \
-  accum += grad.square();
-              if (has_l2_shrinkage) {
-                auto grad_with_shrinkage =
-                    grad + static_cast<T>(2) * l2_shrinkage_scalar * var;
-                COMPUTE_FTRL(grad_with_shrinkage);
-              } else {
-                COMPUTE_FTRL(grad);
-              }
+              grad_ids.emplace_back(i);
+              var_rows.emplace_back(var_->flat(value_ptr).data());
+              accum_rows.emplace_back(accum_->flat(value_ptr).data());
+              linear_rows.emplace_back(linear_->flat(value_ptr).data());
             }
           }
-#undef COMPUTE_FTRL
+          functor::KvApplyDispatchDim(inner_dim, [&](auto dim) {
+            for (size_t r = 0; r < grad_ids.size(); r++) {
+              functor::KvSparseApplyFtrlRow<T, decltype(dim)::value>::Compute(
+                  var_rows[r], accum_rows[r], linear_rows[r],
+                  &grad_flat(grad_ids[r], 0), lr_scalar, l1_scalar,
+                  l2_scalar, l2_shrinkage_scalar, lr_power_scalar,
+                  has_l2_shrinkage, inner_dim);
+            }
+          });
         };
 
         const int64 cost = 4500; //very unreliable estimate for cost per step.
@@ -1469,6 +1456,12 @@ class KvSparseApplyAdamOp : public OpKernel {
 
           int64 gs = global_step.scalar<int64>()();
 
+          std::vector<int64> grad_ids;
+          std::vector<T*> var_rows, m_rows, v_rows;
+          grad_ids.reserve(limit_i - start_i);
+          var_rows.reserve(limit_i - start_i);
+          m_rows.reserve(limit_i - start_i);
+          v_rows.reserve(limit_i - start_i);
           for (int64 i = start_i; i < limit_i; i++) {
             const Tindex index = indices_vec(i);
             ValuePtr<T>* value_ptr = nullptr;
@@ -1476,16 +1469,20 @@ class KvSparseApplyAdamOp : public OpKernel {
             OP_REQUIRES_OK(ctx, var->LookupOrCreateKey(index, &value_ptr, &is_filter));
             var->UpdateVersion(value_ptr, gs);
             if (is_filter) {
-              auto var_i = var->flat(value_ptr);
-              auto m_a = m->flat(value_ptr);
-              auto v_a = v->flat(value_ptr);
-
-              auto g = grad_flat.template chip<0>(i);
-              m_a += (g - m_a) * (static_cast<T>(1) - beta1_scalar);
-              v_a += (g.square() - v_a) * (static_cast<T>(1) - beta2_scalar);
-              var_i -= (m_a * alpha) / (v_a.sqrt() + epsilon_scalar);
+              grad_ids.emplace_back(i);
+              var_rows.emplace_back(var->flat(value_ptr).data());
+              m_rows.emplace_back(m->flat(value_ptr).data());
+              v_rows.emplace_back(v->flat(value_ptr).data());
             }
           }
+          functor::KvApplyDispatchDim(inner_dim, [&](auto dim) {
+            for (size_t r = 0; r < grad_ids.size(); r++) {
+              functor::KvSparseApplyAdamRow<T, decltype(dim)::value>::Compute(
+                  var_rows[r], m_rows[r], v_rows[r],
+                  &grad_flat(grad_ids[r], 0), alpha, beta1_scalar,
+                  beta2_scalar, epsilon_scalar, inner_dim);
+            }
+          });
         }
       };
 
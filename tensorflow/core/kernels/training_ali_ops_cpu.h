@@ -0,0 +1,271 @@
+/* Copyright 2022 The DeepRec Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+=======================================================================*/
+
+#ifndef TENSORFLOW_CORE_KERNELS_TRAINING_ALI_OPS_CPU_H_
+#define TENSORFLOW_CORE_KERNELS_TRAINING_ALI_OPS_CPU_H_
+
+#include <cmath>
+#include <type_traits>
+
+#include "tensorflow/core/platform/types.h"
+
+#if defined(__GNUC__) && (__GNUC__ > 6) && (__AVX512F__)
+#define KV_APPLY_USE_AVX512 1
+#endif
+#if defined(__GNUC__) && (__GNUC__ > 6) && (__AVX2__ || __AVX512F__)
+#define KV_APPLY_USE_AVX2 1
+#endif
+#if KV_APPLY_USE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace tensorflow {
+namespace functor {
+
+// Element-wise operations used by the row kernels below. A row is walked
+// with the widest packet first, then narrower ones, then one value at a
+// time, so the same update expression is instantiated for every width.
+template <typename T>
+struct KvApplyScalar {
+  typedef T Type;
+  static const int kSize = 1;
+  static T Load(const T* p) { return *p; }
+  static void Store(T* p, T v) { *p = v; }
+  static T Set1(T v) { return v; }
+  static T Add(T a, T b) { return a + b; }
+  static T Sub(T a, T b) { return a - b; }
+  static T Mul(T a, T b) { return a * b; }
+  static T Div(T a, T b) { return a / b; }
+  static T Sqrt(T a) { return std::sqrt(a); }
+  static T Sum(T a) { return a; }
+};
+
+#if KV_APPLY_USE_AVX512
+struct KvApplyPacket16f {
+  typedef __m512 Type;
+  static const int kSize = 16;
+  static __m512 Load(const float* p) { return _mm512_loadu_ps(p); }
+  static void Store(float* p, __m512 v) { _mm512_storeu_ps(p, v); }
+  static __m512 Set1(float v) { return _mm512_set1_ps(v); }
+  static __m512 Add(__m512 a, __m512 b) { return _mm512_add_ps(a, b); }
+  static __m512 Sub(__m512 a, __m512 b) { return _mm512_sub_ps(a, b); }
+  static __m512 Mul(__m512 a, __m512 b) { return _mm512_mul_ps(a, b); }
+  static __m512 Div(__m512 a, __m512 b) { return _mm512_div_ps(a, b); }
+  static __m512 Sqrt(__m512 a) { return _mm512_sqrt_ps(a); }
+  static float Sum(__m512 a) { return _mm512_reduce_add_ps(a); }
+};
+#endif  // KV_APPLY_USE_AVX512
+
+#if KV_APPLY_USE_AVX2
+struct KvApplyPacket8f {
+  typedef __m256 Type;
+  static const int kSize = 8;
+  static __m256 Load(const float* p) { return _mm256_loadu_ps(p); }
+  static void Store(float* p, __m256 v) { _mm256_storeu_ps(p, v); }
+  static __m256 Set1(float v) { return _mm256_set1_ps(v); }
+  static __m256 Add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+  static __m256 Sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+  static __m256 Mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+  static __m256 Div(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+  static __m256 Sqrt(__m256 a) { return _mm256_sqrt_ps(a); }
+  static float Sum(__m256 a) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a),
+                          _mm256_extractf128_ps(a, 1));
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(_mm_hadd_ps(s, s));
+  }
+};
+#endif  // KV_APPLY_USE_AVX2
+
+// Calls fn(P(), j) for consecutive chunks [j, j + P::kSize) covering a
+// row of kDim values, or dim values when kDim is 0. A fixed kDim lets
+// the compiler unroll the loops and drop the unused tails. Only float
+// rows are vectorized, and only when kVectorize is set.
+template <typename T, int kDim, bool kVectorize = true>
+struct KvApplyLoop {
+  template <typename Fn>
+  static void Run(int64 dim, const Fn& fn) {
+    const int64 n = kDim > 0 ? kDim : dim;
+    for (int64 j = 0; j < n; ++j) {
+      fn(KvApplyScalar<T>(), j);
+    }
+  }
+};
+
+template <int kDim>
+struct KvApplyLoop<float, kDim, true> {
+  template <typename Fn>
+  static void Run(int64 dim, const Fn& fn) {
+    const int64 n = kDim > 0 ? kDim : dim;
+    int64 j = 0;
+#if KV_APPLY_USE_AVX512
+    for (; j + KvApplyPacket16f::kSize <= n; j += KvApplyPacket16f::kSize) {
+      fn(KvApplyPacket16f(), j);
+    }
+#endif
+#if KV_APPLY_USE_AVX2
+    for (; j + KvApplyPacket8f::kSize <= n; j += KvApplyPacket8f::kSize) {
+      fn(KvApplyPacket8f(), j);
+    }
+#endif
+    for (; j < n; ++j) {
+      fn(KvApplyScalar<float>(), j);
+    }
+  }
+};
+
+// Calls fn(std::integral_constant<int, kDim>()) with kDim equal to dim
+// for the common embedding dims and 0 for the others.
+template <typename Fn>
+inline void KvApplyDispatchDim(int64 dim, const Fn& fn) {
+  switch (dim) {
+    case 4: fn(std::integral_constant<int, 4>()); break;
+    case 8: fn(std::integral_constant<int, 8>()); break;
+    case 16: fn(std::integral_constant<int, 16>()); break;
+    case 32: fn(std::integral_constant<int, 32>()); break;
+    case 64: fn(std::integral_constant<int, 64>()); break;
+    case 128: fn(std::integral_constant<int, 128>()); break;
+    default: fn(std::integral_constant<int, 0>()); break;
+  }
+}
+
+// accum += grad^2
+// var -= lr * grad / sqrt(accum)
+template <typename T, int kDim>
+struct KvSparseApplyAdagradRow {
+  static void Compute(T* var, T* accum, const T* grad, T lr, int64 dim) {
+    KvApplyLoop<T, kDim>::Run(dim, [=](auto p, int64 j) {
+      typedef decltype(p) P;
+      auto g = P::Load(grad + j);
+      auto a = P::Add(P::Load(accum + j), P::Mul(g, g));
+      P::Store(accum + j, a);
+      auto v = P::Sub(P::Load(var + j),
+                      P::Div(P::Mul(P::Set1(lr), g), P::Sqrt(a)));
+      P::Store(var + j, v);
+    });
+  }
+};
+
+// m += (grad - m) * (1 - beta1)
+// v += (grad^2 - v) * (1 - beta2)
+// var -= m * alpha / (sqrt(v) + epsilon)
+template <typename T, int kDim>
+struct KvSparseApplyAdamRow {
+  static void Compute(T* var, T* m, T* v, const T* grad, T alpha,
+                      T beta1, T beta2, T epsilon, int64 dim) {
+    const T one_minus_beta1 = static_cast<T>(1) - beta1;
+    const T one_minus_beta2 = static_cast<T>(1) - beta2;
+    KvApplyLoop<T, kDim>::Run(dim, [=](auto p, int64 j) {
+      typedef decltype(p) P;
+      auto g = P::Load(grad + j);
+      auto m_j = P::Load(m + j);
+      m_j = P::Add(m_j, P::Mul(P::Sub(g, m_j), P::Set1(one_minus_beta1)));
+      P::Store(m + j, m_j);
+      auto v_j = P::Load(v + j);
+      v_j = P::Add(v_j,
+                   P::Mul(P::Sub(P::Mul(g, g), v_j), P::Set1(one_minus_beta2)));
+      P::Store(v + j, v_j);
+      auto var_j = P::Sub(P::Load(var + j),
+          P::Div(P::Mul(m_j, P::Set1(alpha)),
+                 P::Add(P::Sqrt(v_j), P::Set1(epsilon))));
+      P::Store(var + j, var_j);
+    });
+  }
+};
+
+// Same update as the COMPUTE_FTRL expression of KvSparseApplyFtrlOp: the
+// l1 threshold is applied to the l2 norm of the whole linear row, and
+// with l2 shrinkage the shrunk gradient also feeds the new accumulator.
+// The row is walked twice, once to update linear and its norm and once
+// to write var and accum.
+template <typename T, int kDim>
+struct KvSparseApplyFtrlRow {
+  static void Compute(T* var, T* accum, T* linear, const T* grad,
+                      T lr, T l1, T l2, T l2_shrinkage, T lr_power,
+                      bool has_l2_shrinkage, int64 dim) {
+    if (lr_power == static_cast<T>(-0.5)) {
+      Run<KvApplyLoop<T, kDim>>(var, accum, linear, grad, lr, l1, l2,
+          l2_shrinkage, has_l2_shrinkage, dim,
+          [](auto p, auto x) {
+            return decltype(p)::Sqrt(x);
+          });
+    } else {
+      // pow has no packet form, go through the row one value at a time.
+      Run<KvApplyLoop<T, kDim, false>>(var, accum, linear, grad, lr, l1, l2,
+          l2_shrinkage, has_l2_shrinkage, dim,
+          [lr_power](KvApplyScalar<T>, T x) {
+            return std::pow(x, -lr_power);
+          });
+    }
+  }
+
+ private:
+  template <typename Loop, typename PowFn>
+  static void Run(T* var, T* accum, T* linear, const T* grad,
+                  T lr, T l1, T l2, T l2_shrinkage, bool has_l2_shrinkage,
+                  int64 dim, const PowFn& pow_fn) {
+    T sum_square = static_cast<T>(0);
+    Loop::Run(dim, [&](auto p, int64 j) {
+      typedef decltype(p) P;
+      auto var_j = P::Load(var + j);
+      auto a = P::Load(accum + j);
+      auto g = ShrunkGrad(p, grad + j, var_j, l2_shrinkage, has_l2_shrinkage);
+      auto new_a = P::Add(a, P::Mul(g, g));
+      auto l = P::Add(P::Load(linear + j),
+          P::Sub(g, P::Mul(P::Div(P::Sub(pow_fn(p, new_a), pow_fn(p, a)),
+                                  P::Set1(lr)),
+                           var_j)));
+      P::Store(linear + j, l);
+      sum_square += P::Sum(P::Mul(l, l));
+    });
+    const T linear_norm = std::sqrt(sum_square);
+    const bool keep = linear_norm > l1;
+    Loop::Run(dim, [&](auto p, int64 j) {
+      typedef decltype(p) P;
+      auto var_j = P::Load(var + j);
+      auto a = P::Load(accum + j);
+      if (keep) {
+        auto g = ShrunkGrad(p, grad + j, var_j, l2_shrinkage,
+                            has_l2_shrinkage);
+        auto eta_rec = P::Div(pow_fn(p, P::Add(a, P::Mul(g, g))),
+                              P::Set1(lr));
+        auto coef = P::Div(P::Set1(l1 - linear_norm),
+            P::Mul(P::Add(eta_rec, P::Set1(static_cast<T>(2) * l2)),
+                   P::Set1(linear_norm)));
+        P::Store(var + j, P::Mul(coef, P::Load(linear + j)));
+      } else {
+        P::Store(var + j, P::Set1(static_cast<T>(0)));
+      }
+      auto raw_g = P::Load(grad + j);
+      P::Store(accum + j, P::Add(a, P::Mul(raw_g, raw_g)));
+    });
+  }
+
+  template <typename P>
+  static typename P::Type ShrunkGrad(P, const T* grad,
+                                     typename P::Type var_j,
+                                     T l2_shrinkage, bool has_l2_shrinkage) {
+    auto g = P::Load(grad);
+    if (has_l2_shrinkage) {
+      g = P::Add(g, P::Mul(P::Set1(static_cast<T>(2) * l2_shrinkage), var_j));
+    }
+    return g;
+  }
+};
+
+}  // end namespace functor
+}  // end namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_KERNELS_TRAINING_ALI_OPS_CPU_H_
@@ -54,28 +54,29 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <utility>
 #include <vector>
+#if defined (__SSE2__)
+#include <immintrin.h>
+#endif
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/lib/core/errors.h"
-#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/platform/byte_order.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/util/work_sharder.h"
 
-#define OP_CHECK_STATUS(OBJ, MU, EXP, STATUS) \
-if (!TF_PREDICT_TRUE(EXP)) {                  \
-  mutex_lock l((MU));                         \
-  (OBJ) = (STATUS);                           \
-  return;                                     \
-}
-
 namespace tensorflow {
 
 #define ID_AUTO_DETECT_TAG -1048575 // hacking for auto detect column size
 
 namespace {
 
+const int64 kCostPerRecord = 5000; //very unreliable estimate for cost per step.
+
 bool DelimSupported(const char delim) {
     // Illegal delims are defined here.
     // These chars would be used in numbers.
@@ -84,33 +85,109 @@ bool DelimSupported(const char delim) {
             illegal_delims.find(delim) == StringPiece::npos);
 }
 
-inline bool GetValueOnTheFly(const char* input, size_t input_size, size_t* pos, int64* value)
-{
-  // on-the-fly strtoi processing.
-  // No overflow check here due to performance reason.
-  int64 sign = 1;
-  if (input[*pos] == '-') {
-    sign = -1;
-    ++(*pos);
-  } else if (input[*pos] == '+') {
-    ++(*pos);
+// Calls `on_field(begin, end, last)` for every field of `record` split at
+// `delim`, `last` being set for the field after the last delim. Delims are
+// located a vector register of bytes at a time, so that the fields are
+// found without testing every byte on its own.
+template <typename OnField>
+bool ForEachField(StringPiece record, const char delim, OnField on_field) {
+  const char* p = record.data();
+  const char* const end = p + record.size();
+  const char* field = p;
+#if defined (__AVX2__)
+  const __m256i delims32 = _mm256_set1_epi8(delim);
+  for (; end - p >= 32; p += 32) {
+    uint32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), delims32));
+    while (mask != 0) {
+      const char* found = p + __builtin_ctz(mask);
+      if (!on_field(field, found, false)) return false;
+      field = found + 1;
+      mask &= mask - 1;
+    }
   }
-  *value = 0;
-  if (input[*pos] >= '0' && input[*pos] <= '9') {
-    while (*pos < input_size && input[*pos] >= '0' && input[*pos] <= '9') {
-      (*value) = (*value) * 10 + input[*pos] - '0';
-      ++(*pos);
+#endif
+#if defined (__SSE2__)
+  const __m128i delims16 = _mm_set1_epi8(delim);
+  for (; end - p >= 16; p += 16) {
+    uint32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), delims16));
+    while (mask != 0) {
+      const char* found = p + __builtin_ctz(mask);
+      if (!on_field(field, found, false)) return false;
+      field = found + 1;
+      mask &= mask - 1;
     }
-    (*value) *= sign;
-    return true;
   }
-  return false;
+#endif
+  for (; p < end; ++p) {
+    if (*p == delim) {
+      if (!on_field(field, p, false)) return false;
+      field = p + 1;
+    }
+  }
+  return on_field(field, end, true);
+}
+
+// Returns true if the 8 bytes of `chunk` are all decimal digits.
+inline bool EightDigits(uint64 chunk) {
+  return (chunk & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL &&
+         ((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ==
+             0x3030303030303030ULL;
+}
+
+// Converts 8 digits loaded little endian, the first digit being the most
+// significant one.
+inline uint64 ParseEightDigits(uint64 chunk) {
+  chunk -= 0x3030303030303030ULL;
+  chunk = (chunk * 10) + (chunk >> 8);
+  chunk = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+           (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+          >> 32;
+  return chunk;
+}
+
+// Reads the digits at *p into `value`, returns the number of digits read.
+// No overflow check here due to performance reason.
+inline int64 ReadDigits(const char** p, const char* end, uint64* value) {
+  const char* begin = *p;
+  const char* ptr = begin;
+  uint64 v = *value;
+  if (port::kLittleEndian) {
+    while (end - ptr >= 8) {
+      uint64 chunk;
+      memcpy(&chunk, ptr, sizeof(chunk));
+      if (!EightDigits(chunk)) break;
+      v = v * 100000000ULL + ParseEightDigits(chunk);
+      ptr += 8;
+    }
+  }
+  while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+    v = v * 10 + (*ptr - '0');
+    ++ptr;
+  }
+  *value = v;
+  *p = ptr;
+  return ptr - begin;
+}
+
+inline bool ParseNumber(const char** p, const char* end, int64* value) {
+  const char* ptr = *p;
+  bool negative = false;
+  if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+    negative = (*ptr == '-');
+    ++ptr;
+  }
+  uint64 v = 0;
+  if (ReadDigits(&ptr, end, &v) == 0) return false;
+  *value = negative ? -static_cast<int64>(v) : static_cast<int64>(v);
+  *p = ptr;
+  return true;
 }
 
-inline bool GetValueOnTheFly(const char* input, size_t input_size, size_t* pos, int32* value)
-{
+inline bool ParseNumber(const char** p, const char* end, int32* value) {
   int64 v0;
-  if (GetValueOnTheFly(input, input_size, pos, &v0)) {
+  if (ParseNumber(p, end, &v0)) {
     // No overflow check here due to performance reason.
     *value = static_cast<int32>(v0);
     return true;
@@ -118,163 +195,229 @@ inline bool GetValueOnTheFly(const char* input, size_t input_size, size_t* pos,
   return false;
 }
 
-inline bool GetValueOnTheFly(const char* input, size_t input_size, size_t* pos, float* value)
-{
-  // on-the-fly strtof processing.
-  // No overflow check here due to performance reason.
-  const float log2_10 = std::log2(10.0f);
-  if (*pos < input_size) {
-    float fsign = 1.0f;
-    float ftail = 0.1f;
-    bool gotvalue = false;
-    if (input[*pos] == '-') {
-      fsign = -1.0f;
-      ++(*pos);
-    } else if (input[*pos] == '+') {
-      ++(*pos);
-    }
-    *value = 0.0f;
-    if (input[*pos] >= '0' && input[*pos] <= '9') {
-      gotvalue = true;
-    }
-    while (*pos < input_size && input[*pos] >= '0' && input[*pos] <= '9') {
-      (*value) = (*value) * 10.0f + static_cast<float>(input[*pos] - '0');
-      ++(*pos);
-    } // integer part
-    if (*pos < input_size && input[*pos] == '.') {
-      ++(*pos);
-      if (*pos < input_size && input[*pos] >= '0' && input[*pos] <= '9') {
-        gotvalue = true;
-      }
-      while (*pos < input_size && input[*pos] >= '0' && input[*pos] <= '9') {
-        (*value) += ftail * static_cast<float>(input[*pos] - '0');
-        ftail *= 0.1f;
-        ++(*pos);
-      }
-    } // fraction part
-    if (gotvalue) {
-      (*value) *= fsign;
+// Parses [sign]digits[.digits][(e|E)[sign]digits]. The significant digits
+// are gathered in an integer and scaled by an exact power of ten whenever
+// possible, which rounds like strtof for usual feature values.
+inline bool ParseNumber(const char** p, const char* end, float* value) {
+  static const double kPow10[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  // Digits past these do not fit in the mantissa, they only scale it.
+  const int64 kMaxDigits = 19;
+
+  const char* ptr = *p;
+  bool negative = false;
+  if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+    negative = (*ptr == '-');
+    ++ptr;
+  }
+  uint64 mantissa = 0;
+  int64 digits = 0;
+  int64 exponent = 0;
+  while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+    if (digits < kMaxDigits) {
+      mantissa = mantissa * 10 + (*ptr - '0');
+      if (mantissa != 0) ++digits;
     } else {
-      return false;
+      ++exponent;
     }
-    if (*pos < input_size && (input[*pos] == 'E' || input[*pos] == 'e')) {
-      ++(*pos);
-      if (*pos < input_size) {
-        int64 fexp_int = 0;
-        if (!GetValueOnTheFly(input, input_size, pos, &fexp_int)) {
-          return false;
-        }
-        (*value) *= std::exp2(static_cast<float>(fexp_int) * log2_10);
-        return true;
-      }
-    } else {
-      return true;
-    } // exponent part
+    ++ptr;
   }
-  return false;
-}
-
-template <typename T>
-bool SplitNum(StringPiece &record, const char delim, std::vector<T>& result) {
-  const char *input = record.data();
-  size_t input_size = record.size();
-  if (input_size && delim != '\0') {
-    // No more than this number.
-    result.reserve(input_size / 2 + 1);
-
-    size_t i = 0;
-    while(i < input_size) {
-      while (i < input_size && input[i] == ' ') {
-        ++i;
-      }
-      if (i < input_size) {
-        T value = static_cast<T>(0);
-        if (!GetValueOnTheFly(input, input_size, &i, &value)) {
-          return false;
-        }
-        result.push_back(value);
-        while (i < input_size && input[i] == ' ' && delim != ' ') {
-          ++i;
-        }
-        if (i == input_size || input[i] == delim) {
-          ++i;
-        } else {
-          return false;
-        }
-      } else if (delim == ' ') {
-        // If delim is ' ', it is OK for redundant spaces at the end of line.
-        return true;
-      } else {
-        // If delim is not ' ', only spaces found after a delim is irregular.
-        return false;
+  bool got_digit = (ptr != *p) && (ptr[-1] >= '0' && ptr[-1] <= '9');
+  if (ptr < end && *ptr == '.') {
+    ++ptr;
+    while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+      got_digit = true;
+      if (digits < kMaxDigits) {
+        mantissa = mantissa * 10 + (*ptr - '0');
+        if (mantissa != 0) ++digits;
+        --exponent;
       }
+      ++ptr;
     }
   }
+  if (!got_digit) return false;
+  if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+    ++ptr;
+    int64 exp_value;
+    if (!ParseNumber(&ptr, end, &exp_value)) return false;
+    exp_value = std::max<int64>(-100000, std::min<int64>(100000, exp_value));
+    exponent += exp_value;
+  }
+
+  double result = static_cast<double>(mantissa);
+  if (mantissa == 0) {
+    result = 0.0;
+  } else if (exponent >= -22 && exponent <= 22 &&
+             mantissa <= (1ULL << 53)) {
+    result = exponent < 0 ? result / kPow10[-exponent]
+                          : result * kPow10[exponent];
+  } else {
+    result *= std::pow(10.0, static_cast<double>(exponent));
+  }
+  *value = static_cast<float>(negative ? -result : result);
+  *p = ptr;
   return true;
 }
 
+inline void SkipSpaces(const char** p, const char* end) {
+  while (*p < end && **p == ' ') ++(*p);
+}
+
+// A field holds one number, with spaces allowed around it.
 template <typename T>
-bool SplitKv(StringPiece &record, const char delim,
-             std::vector<std::pair<int64, T> >& result) {
-  const char *input = record.data();
-  size_t input_size = record.size();
-
-  if (input_size && delim != '\0') {
-    // No more than this amount of kv pairs.
-    result.reserve(input_size / 4 + 1);
-
-    std::pair<int64, T> kv(0, static_cast<T>(0));
-    int64& key = kv.first;
-    T& value = kv.second;
-
-    size_t i = 0;
-    while(i < input_size) {
-      // parsing key phase
-      key = 0;
-      while (i < input_size && input[i] == ' ') {
-        ++i;
-      }
-      if (i < input_size) {
-        if (!GetValueOnTheFly(input, input_size, &i, &key)) {
-          return false;
-        }
-        while (i < input_size && input[i] == ' ' && delim != ' ') {
-          ++i;
-        }
-        if (input[i] == ':') {
-          ++i;
-        } else {
-          return false;
-        }
-      } else if (delim == ' ') {
-        // If delim is ' ', it is OK for redundant spaces at the end of line.
-        return true;
-      } else {
-        // If delim is not ' ', only spaces found after a delim is irregular.
-        return false;
-      } // key parsed, otherwise false returned.
-
-      // parsing value phase.
-      while (i < input_size && input[i] == ' ' && delim != ' ') {
-        ++i;
-      }
-      value = static_cast<T>(0);
-      if (!GetValueOnTheFly(input, input_size, &i, &value)) {
-        return false;
-      }
-      result.push_back(kv);
+inline bool ParseValueField(const char* p, const char* end, T* value) {
+  SkipSpaces(&p, end);
+  if (!ParseNumber(&p, end, value)) return false;
+  SkipSpaces(&p, end);
+  return p == end;
+}
+
+// A field holds "key:value", with spaces allowed around both of them.
+template <typename T>
+inline bool ParseKvField(const char* p, const char* end, int64* key,
+                         T* value) {
+  SkipSpaces(&p, end);
+  if (!ParseNumber(&p, end, key)) return false;
+  SkipSpaces(&p, end);
+  if (p == end || *p != ':') return false;
+  ++p;
+  SkipSpaces(&p, end);
+  if (!ParseNumber(&p, end, value)) return false;
+  SkipSpaces(&p, end);
+  return p == end;
+}
+
+// Parses every field of `record` with `parse_field(begin, end)`. Empty
+// fields are skipped when `delim` is ' ', so that spaces may repeat.
+// Otherwise only the empty field after a trailing delim is allowed, and a
+// record of spaces is irregular.
+template <typename ParseField>
+bool ParseRecord(StringPiece record, const char delim,
+                 ParseField parse_field) {
+  return ForEachField(record, delim,
+      [delim, &parse_field](const char* begin, const char* end, bool last) {
+        if (begin == end && (last || delim == ' ')) return true;
+        return parse_field(begin, end);
+      });
+}
+
+template <typename OnId>
+bool ParseIdRecord(StringPiece record, const char delim, OnId on_id) {
+  return ParseRecord(record, delim, [&on_id](const char* b, const char* e) {
+    int64 id;
+    if (!ParseValueField(b, e, &id)) return false;
+    on_id(id);
+    return true;
+  });
+}
+
+template <typename T, typename OnValue>
+bool ParseValueRecord(StringPiece record, const char delim,
+                      OnValue on_value) {
+  return ParseRecord(record, delim,
+                     [&on_value](const char* b, const char* e) {
+    T value;
+    if (!ParseValueField(b, e, &value)) return false;
+    on_value(value);
+    return true;
+  });
+}
+
+template <typename T, typename OnKv>
+bool ParseKvRecord(StringPiece record, const char delim, OnKv on_kv) {
+  return ParseRecord(record, delim, [&on_kv](const char* b, const char* e) {
+    int64 key;
+    T value;
+    if (!ParseKvField(b, e, &key, &value)) return false;
+    on_kv(key, value);
+    return true;
+  });
+}
 
-      while (i < input_size && input[i] == ' ' && delim != ' ') {
-        ++i;
+Status GetMaxId(OpKernelContext* ctx, int64* max_id) {
+  const Tensor* max_id_tensor;
+  TF_RETURN_IF_ERROR(ctx->input("max_id", &max_id_tensor));
+  *max_id = max_id_tensor->scalar<int64>()();
+  if (*max_id < 0 && *max_id != ID_AUTO_DETECT_TAG) {
+    return errors::InvalidArgument("invalid max_id setting: ", *max_id);
+  }
+  return Status::OK();
+}
+
+// The first pass over the records: `scan(batch_id, &count, &max_col)`
+// validates a record, counts its entries into `counts` if given, and
+// raises `max_col` to the number of columns it needs. The rows are
+// scanned in parallel, with one update of `max_col_id` per shard. An
+// invalid record is reported as `error_prefix` followed by its index.
+template <typename ScanFn>
+Status ScanRecords(OpKernelContext* ctx,
+                   const TTypes<string>::ConstFlat& records_t,
+                   const char* error_prefix, std::vector<int64>* counts,
+                   ScanFn scan, int64* max_col_id) {
+  mutex mu;
+  Status status;
+  *max_col_id = 0;
+  auto doScan = [&](int64 start_i, int64 limit_i) {
+    int64 shard_max = 0;
+    for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
+      int64 count = 0;
+      if (!TF_PREDICT_TRUE(scan(batch_id, &count, &shard_max))) {
+        mutex_lock l(mu);
+        status = errors::InvalidArgument(error_prefix, batch_id,
+                                         " is not valid : ",
+                                         records_t(batch_id));
+        return;
       }
-      if (i == input_size || input[i] == delim) {
-        ++i;
-      } else {
-        return false;
-      } // value parsed.
+      if (counts != nullptr) (*counts)[batch_id] = count;
     }
+    mutex_lock l(mu);
+    *max_col_id = std::max(*max_col_id, shard_max);
+  };
+  auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
+  Shard(worker_threads.num_threads, worker_threads.workers, records_t.size(),
+        kCostPerRecord, doScan);
+  return status;
+}
+
+Status ResolveMaxId(int64 max_col_id, int64* max_id) {
+  if (*max_id == ID_AUTO_DETECT_TAG) {
+    *max_id = max_col_id;
+  } else if (*max_id < max_col_id) {
+    return errors::InvalidArgument("max_id set as ", *max_id,
+        " but less then real maximum col id ", max_col_id);
+  }
+  return Status::OK();
+}
+
+// Turns `counts` into the offsets of the rows, `counts->back()` becoming
+// the total number of entries.
+void CountsToOffsets(std::vector<int64>* counts) {
+  int64 total = 0;
+  for (int64& count : *counts) {
+    const int64 c = count;
+    count = total;
+    total += c;
+  }
+  counts->push_back(total);
+}
+
+template <typename FillFn>
+void FillRecords(OpKernelContext* ctx, int64 batch_size, FillFn fill) {
+  auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
+  Shard(worker_threads.num_threads, worker_threads.workers, batch_size,
+        kCostPerRecord, fill);
+}
+
+// The sparse ops parse the column ids of a row into the first `count`
+// slots of its indices, sort them in place there and then spread them
+// backwards into (row, col) pairs, so no buffer is needed per row.
+inline void SpreadIndices(int64 batch_id, int64 count, int64* row_indices) {
+  for (int64 j = count - 1; j >= 0; --j) {
+    const int64 col = row_indices[j];
+    row_indices[2 * j] = batch_id;
+    row_indices[2 * j + 1] = col;
   }
-  return true;
 }
 
 } // namespace
@@ -297,132 +440,96 @@ class TransCsvID2SparseOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* ctx) override {
-    const Tensor* records;
-    OP_REQUIRES_OK(ctx, ctx->input("records", &records));
+    switch (dtype_) {
+      case DT_INT32:
+        ComputeInternal<int32>(ctx);
+        break;
+      case DT_INT64:
+        ComputeInternal<int64>(ctx);
+        break;
+      case DT_FLOAT:
+        ComputeInternal<float>(ctx);
+        break;
+      default:
+        ctx->SetStatus(errors::InvalidArgument(
+            "output data type ", dtype_, " not supported."));
+    }
+  }
 
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, (max_id >= 0 || max_id == ID_AUTO_DETECT_TAG),
-                errors::InvalidArgument("invalid max_id setting: ", max_id));
+ private:
+  DataType dtype_;
+  char delim_;
+  bool id_as_value_;
 
+  template <typename T>
+  void ComputeInternal(OpKernelContext* ctx) {
+    const Tensor* records;
+    OP_REQUIRES_OK(ctx, ctx->input("records", &records));
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, GetMaxId(ctx, &max_id));
     const Tensor* def_value;
     OP_REQUIRES_OK(ctx, ctx->input("default_value", &def_value));
+    const T def_value_ = def_value->scalar<T>()();
 
     auto records_t = records->flat<string>();
     const int64 batch_size = records_t.size();
-
-    std::vector<std::vector<int64>> cols_vec_(batch_size);
-
-    mutex mu;
-    size_t max_col_id GUARDED_BY(mu) = 0;
-    Status status GUARDED_BY(mu);
-
-    // Scan all the indicis and check the maximum column index in the matrix.
-    auto doScan = [this, &status, &mu, ctx, &records_t, &cols_vec_, &max_col_id]
-        (int64 start_i, int64 limit_i)
-    {
+    const char delim = delim_;
+
+    // Scan all the indicis and check the maximum column index in the
+    // matrix, a negative index has no column.
+    std::vector<int64> offsets(batch_size);
+    int64 max_col_id;
+    OP_REQUIRES_OK(ctx, ScanRecords(ctx, records_t, "Index record ", &offsets,
+        [&records_t, delim](int64 batch_id, int64* count, int64* max_col) {
+          bool negative = false;
+          bool ok = ParseIdRecord(records_t(batch_id), delim,
+              [&negative, count, max_col](int64 id) {
+                negative |= (id < 0);
+                ++(*count);
+                *max_col = std::max(*max_col, id + 1);
+              });
+          return ok && !negative;
+        }, &max_col_id));
+    OP_REQUIRES_OK(ctx, ResolveMaxId(max_col_id, &max_id));
+    CountsToOffsets(&offsets);
+
+    Tensor* indices;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0,
+        TensorShape({offsets[batch_size], 2}), &indices));
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(1,
+        TensorShape({offsets[batch_size]}), &values));
+    Tensor* dense_shape;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(2, TensorShape({2}),
+                                             &dense_shape));
+    int64* indices_ = indices->flat<int64>().data();
+    T* values_ = values->flat<T>().data();
+
+    const bool id_as_value = id_as_value_;
+    FillRecords(ctx, batch_size, [&](int64 start_i, int64 limit_i) {
       for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-        StringPiece record(records_t(batch_id));
-
-        OP_CHECK_STATUS(status, mu,
-            SplitNum<int64>(record, delim_, cols_vec_[batch_id]) == true,
-            errors::InvalidArgument("Index record ", batch_id,
-                                    " is not valid : ", records_t(batch_id)));
-        int64 cols_len = cols_vec_[batch_id].size();
-        if (cols_len > 0) {
-          std::sort(cols_vec_[batch_id].begin(), cols_vec_[batch_id].end());
-          if (cols_vec_[batch_id][cols_len-1] >= max_col_id) {
-            mutex_lock l(mu);
-            if (cols_vec_[batch_id][cols_len-1] >= max_col_id) {
-              max_col_id = cols_vec_[batch_id][cols_len-1] + 1;
-            }
-          }
+        const int64 offset = offsets[batch_id];
+        const int64 count = offsets[batch_id + 1] - offset;
+        int64* row_indices = indices_ + 2 * offset;
+        int64 n = 0;
+        ParseIdRecord(records_t(batch_id), delim,
+                      [row_indices, &n](int64 id) { row_indices[n++] = id; });
+        if (!std::is_sorted(row_indices, row_indices + count)) {
+          std::sort(row_indices, row_indices + count);
         }
+        T* row_values = values_ + offset;
+        for (int64 j = 0; j < count; ++j) {
+          row_values[j] = id_as_value ? static_cast<T>(row_indices[j])
+                                      : def_value_;
+        }
+        SpreadIndices(batch_id, count, row_indices);
       }
-    };
-
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doScan);
-    OP_REQUIRES_OK(ctx, status);
-
-    if (max_id == ID_AUTO_DETECT_TAG) {
-      max_id = max_col_id;
-    } else {
-      OP_REQUIRES(ctx, max_id >= max_col_id,
-                  errors::InvalidArgument("max_id set as ", max_id,
-                      " but less then real maximum col id ", max_col_id));
-    }
-
-    int64 offset_[batch_size + 1];
-    offset_[0] = 0;
-    for (int64 batch_id = 0; batch_id < batch_size; ++batch_id) {
-      offset_[batch_id + 1] = offset_[batch_id] + cols_vec_[batch_id].size();
-    }
-
-    Tensor indices(DT_INT64, TensorShape({offset_[batch_size], 2}));
-    Tensor values(dtype_, TensorShape({offset_[batch_size]}));
-    Tensor dense_shape(DT_INT64, TensorShape({2}));
-
-    auto doFill = [this, &status, &mu, &values, &indices, &offset_, &def_value, &cols_vec_]
-        (int64 start_i, int64 limit_i)
-    {
-      switch (dtype_) {
-        case DT_INT32:
-          Fill<int32>(values, indices, offset_, def_value, cols_vec_, start_i, limit_i);
-          break;
-        case DT_INT64:
-          Fill<int64>(values, indices, offset_, def_value, cols_vec_, start_i, limit_i);
-          break;
-        case DT_FLOAT:
-          Fill<float>(values, indices, offset_, def_value, cols_vec_, start_i, limit_i);
-          break;
-        default:
-          OP_CHECK_STATUS(status, mu, false,
-              errors::InvalidArgument("output data type ", dtype_, " not supported."));
-      }
-    };
+    });
 
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doFill);
-    OP_REQUIRES_OK(ctx, status);
-
-    auto dense_shape_ = dense_shape.flat<int64>();
+    auto dense_shape_ = dense_shape->flat<int64>();
     dense_shape_(0) = batch_size;
     dense_shape_(1) = max_id;
-    ctx->set_output(0, indices);
-    ctx->set_output(1, values);
-    ctx->set_output(2, dense_shape);
   }
-
- private:
-  DataType dtype_;
-  char delim_;
-  bool id_as_value_;
-
-  template <typename T>
-  void Fill(Tensor& values, Tensor& indices,
-            const int64* offset_, const Tensor* def_value,
-            const std::vector<std::vector<int64>>& cols_vec_,
-            const int64& start_i, const int64& limit_i) {
-    const T def_value_ = def_value->scalar<T>()();
-    auto values_ = values.vec<T>();
-    auto indices_ = indices.matrix<int64>();
-    for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-      const int64 cols_len = cols_vec_[batch_id].size();
-      const int64 offset = offset_[batch_id];
-
-      for (int64 index = 0; index < cols_len; ++index) {
-        indices_(index + offset, 0) = batch_id;
-        indices_(index + offset, 1) = cols_vec_[batch_id][index];
-        if (this->id_as_value_) {
-          values_(index + offset) = static_cast<T>(cols_vec_[batch_id][index]);
-        } else {
-          values_(index + offset) = def_value_;
-        }
-      }
-    }
-  };
 };
 
 class TransCsvID2DenseOp : public OpKernel {
@@ -443,90 +550,21 @@ class TransCsvID2DenseOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* ctx) override {
-    const Tensor* records;
-    OP_REQUIRES_OK(ctx, ctx->input("records", &records));
-
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, (max_id >= 0 || max_id == ID_AUTO_DETECT_TAG),
-                errors::InvalidArgument("invalid max_id setting: ", max_id));
-
-    const Tensor* def_value;
-    OP_REQUIRES_OK(ctx, ctx->input("default_value", &def_value));
-
-    auto records_t = records->flat<string>();
-    const int64 batch_size = records_t.size();
-
-    std::vector<std::vector<int64>> cols_vec_(batch_size);
-
-    mutex mu;
-    size_t max_col_id GUARDED_BY(mu) = 0;
-    Status status GUARDED_BY(mu);
-
-    // Scan all the indicis and check the maximum column index in the matrix.
-    auto doScan = [this, &status, &mu, ctx, &records_t, &cols_vec_, &max_col_id]
-        (int64 start_i, int64 limit_i)
-    {
-      for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-        StringPiece record(records_t(batch_id));
-
-        OP_CHECK_STATUS(status, mu,
-            SplitNum<int64>(record, delim_, cols_vec_[batch_id]) == true,
-            errors::InvalidArgument("Index record ", batch_id,
-                                    " is not valid : ", records_t(batch_id)));
-        int64 cols_len = cols_vec_[batch_id].size();
-        if (cols_len > 0) {
-          std::sort(cols_vec_[batch_id].begin(), cols_vec_[batch_id].end());
-          if (cols_vec_[batch_id][cols_len-1] >= max_col_id) {
-            mutex_lock l(mu);
-            if (cols_vec_[batch_id][cols_len-1] >= max_col_id) {
-              max_col_id = cols_vec_[batch_id][cols_len-1] + 1;
-            }
-          }
-        }
-      }
-    };
-
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doScan);
-    OP_REQUIRES_OK(ctx, status);
-
-    if (max_id == ID_AUTO_DETECT_TAG) {
-      max_id = max_col_id;
-    } else {
-      OP_REQUIRES(ctx, max_id >= max_col_id,
-                  errors::InvalidArgument("max_id set as ", max_id,
-                      " but less then real maximum col id ", max_col_id));
+    switch (dtype_) {
+      case DT_INT32:
+        ComputeInternal<int32>(ctx);
+        break;
+      case DT_INT64:
+        ComputeInternal<int64>(ctx);
+        break;
+      case DT_FLOAT:
+        ComputeInternal<float>(ctx);
+        break;
+      default:
+        ctx->SetStatus(errors::InvalidArgument(
+            "output data type ", dtype_, " not supported."));
     }
-
-    Tensor values(dtype_, TensorShape({batch_size, max_id}));
-
-    auto doFill = [this, &status, &mu, &values, &max_id, &def_value, &cols_vec_]
-        (int64 start_i, int64 limit_i)
-    {
-      switch (dtype_) {
-        case DT_INT32:
-          Fill<int32>(values, max_id, def_value, cols_vec_, start_i, limit_i);
-          break;
-        case DT_INT64:
-          Fill<int64>(values, max_id, def_value, cols_vec_, start_i, limit_i);
-          break;
-        case DT_FLOAT:
-          Fill<float>(values, max_id, def_value, cols_vec_, start_i, limit_i);
-          break;
-        default:
-          OP_CHECK_STATUS(status, mu, false,
-              errors::InvalidArgument("output data type ", dtype_, " not supported."));
-      }
-    };
-
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doFill);
-    OP_REQUIRES_OK(ctx, status);
-
-    ctx->set_output(0, values);
- }
+  }
 
  private:
   DataType dtype_;
@@ -534,28 +572,50 @@ class TransCsvID2DenseOp : public OpKernel {
   bool id_as_value_;
 
   template <typename T>
-  void Fill(Tensor& values, const int64& max_id, const Tensor* def_value,
-            const std::vector<std::vector<int64>>& cols_vec_,
-            const int64& start_i, const int64& limit_i) {
+  void ComputeInternal(OpKernelContext* ctx) {
+    const Tensor* records;
+    OP_REQUIRES_OK(ctx, ctx->input("records", &records));
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, GetMaxId(ctx, &max_id));
+    const Tensor* def_value;
+    OP_REQUIRES_OK(ctx, ctx->input("default_value", &def_value));
     const T def_value_ = def_value->scalar<T>()();
-    auto values_ = values.matrix<T>();
-
-    for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-      for (int64 index = 0; index < max_id; ++index) {
-        values_(batch_id, index) = static_cast<T>(0);
-      }
 
-      int64 cols_len = cols_vec_[batch_id].size();
-      for (int64 i = 0; i < cols_len; ++i) {
-        int64 index = cols_vec_[batch_id][i];
-        if (this->id_as_value_) {
-          values_(batch_id, index) = static_cast<T>(index);
-        } else {
-          values_(batch_id, index) = def_value_;
-        }
+    auto records_t = records->flat<string>();
+    const int64 batch_size = records_t.size();
+    const char delim = delim_;
+
+    // Scan all the indicis and check the maximum column index in the
+    // matrix, a negative index has no column.
+    int64 max_col_id;
+    OP_REQUIRES_OK(ctx, ScanRecords(ctx, records_t, "Index record ", nullptr,
+        [&records_t, delim](int64 batch_id, int64* count, int64* max_col) {
+          bool negative = false;
+          bool ok = ParseIdRecord(records_t(batch_id), delim,
+              [&negative, max_col](int64 id) {
+                negative |= (id < 0);
+                *max_col = std::max(*max_col, id + 1);
+              });
+          return ok && !negative;
+        }, &max_col_id));
+    OP_REQUIRES_OK(ctx, ResolveMaxId(max_col_id, &max_id));
+
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0,
+        TensorShape({batch_size, max_id}), &values));
+    T* values_ = values->flat<T>().data();
+
+    const bool id_as_value = id_as_value_;
+    FillRecords(ctx, batch_size, [&](int64 start_i, int64 limit_i) {
+      for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
+        T* row = values_ + batch_id * max_id;
+        std::fill(row, row + max_id, static_cast<T>(0));
+        ParseIdRecord(records_t(batch_id), delim, [&](int64 id) {
+          row[id] = id_as_value ? static_cast<T>(id) : def_value_;
+        });
       }
-    }
-  };
+    });
+  }
 };
 
 class TransCsvKV2SparseOp : public OpKernel {
@@ -599,103 +659,76 @@ class TransCsvKV2SparseOp : public OpKernel {
   void ComputeInternal(OpKernelContext* ctx) {
     const Tensor* records;
     OP_REQUIRES_OK(ctx, ctx->input("records", &records));
-
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, (max_id >= 0 || max_id == ID_AUTO_DETECT_TAG),
-                errors::InvalidArgument("invalid max_id setting: ", max_id));
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, GetMaxId(ctx, &max_id));
 
     auto records_t = records->flat<string>();
     const int64 batch_size = records_t.size();
-
-    std::vector<std::vector<std::pair<int64, T>>> cols_vec_(batch_size);
-
-    mutex mu;
-    size_t max_col_id GUARDED_BY(mu) = 0;
-    Status status GUARDED_BY(mu);
-
-    // Scan and store k/v pairs, check the maximum column index in the matrix.
-    auto doScan = [this, &status, &mu, ctx, &records_t, &cols_vec_, &max_col_id]
-        (int64 start_i, int64 limit_i)
-    {
+    const char delim = delim_;
+
+    // Scan k/v pairs, check the maximum column index in the matrix.
+    std::vector<int64> offsets(batch_size);
+    int64 max_col_id;
+    OP_REQUIRES_OK(ctx, ScanRecords(ctx, records_t, "kv in record ", &offsets,
+        [&records_t, delim](int64 batch_id, int64* count, int64* max_col) {
+          return ParseKvRecord<T>(records_t(batch_id), delim,
+              [count, max_col](int64 key, T value) {
+                ++(*count);
+                *max_col = std::max(*max_col, key + 1);
+              });
+        }, &max_col_id));
+    OP_REQUIRES_OK(ctx, ResolveMaxId(max_col_id, &max_id));
+    CountsToOffsets(&offsets);
+
+    Tensor* indices;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0,
+        TensorShape({offsets[batch_size], 2}), &indices));
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(1,
+        TensorShape({offsets[batch_size]}), &values));
+    Tensor* dense_shape;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(2, TensorShape({2}),
+                                             &dense_shape));
+    int64* indices_ = indices->flat<int64>().data();
+    T* values_ = values->flat<T>().data();
+
+    FillRecords(ctx, batch_size, [&](int64 start_i, int64 limit_i) {
+      // Rows whose keys are out of order are sorted by (key, value) here,
+      // the buffer is shared by all the rows of the shard.
+      std::vector<std::pair<int64, T>> unsorted;
       for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-        StringPiece record(records_t(batch_id));
-
-        OP_CHECK_STATUS(status, mu,
-                        SplitKv(record, delim_, cols_vec_[batch_id]) == true,
-                        errors::InvalidArgument("kv in record ", batch_id,
-                            " is not valid : ", records_t(batch_id)));
-        int64 cols_len = cols_vec_[batch_id].size();
-        if (cols_len > 0) {
-          std::sort(cols_vec_[batch_id].begin(), cols_vec_[batch_id].end());
-          if (cols_vec_[batch_id][cols_len-1].first >= max_col_id) {
-            mutex_lock l(mu);
-            if (cols_vec_[batch_id][cols_len-1].first >= max_col_id) {
-              max_col_id = cols_vec_[batch_id][cols_len-1].first + 1;
-            }
+        const int64 offset = offsets[batch_id];
+        const int64 count = offsets[batch_id + 1] - offset;
+        int64* row_indices = indices_ + 2 * offset;
+        T* row_values = values_ + offset;
+        int64 n = 0;
+        bool sorted = true;
+        ParseKvRecord<T>(records_t(batch_id), delim,
+            [row_indices, row_values, &n, &sorted](int64 key, T value) {
+              if (n > 0 && key <= row_indices[n - 1]) sorted = false;
+              row_indices[n] = key;
+              row_values[n] = value;
+              ++n;
+            });
+        if (!sorted) {
+          unsorted.clear();
+          for (int64 j = 0; j < count; ++j) {
+            unsorted.emplace_back(row_indices[j], row_values[j]);
+          }
+          std::sort(unsorted.begin(), unsorted.end());
+          for (int64 j = 0; j < count; ++j) {
+            row_indices[j] = unsorted[j].first;
+            row_values[j] = unsorted[j].second;
           }
         }
+        SpreadIndices(batch_id, count, row_indices);
       }
-    };
-
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doScan);
-    OP_REQUIRES_OK(ctx, status);
-
-    if (max_id == ID_AUTO_DETECT_TAG) {
-      max_id = max_col_id;
-    } else {
-      OP_REQUIRES(ctx, max_id >= max_col_id,
-                  errors::InvalidArgument("max_id set as ", max_id,
-                      " but less then real maximum col id ", max_col_id));
-    }
-
-    int64 offset_[batch_size + 1];
-    offset_[0] = 0;
-    for (int64 batch_id = 0; batch_id < batch_size; ++batch_id) {
-      offset_[batch_id + 1] = offset_[batch_id] + cols_vec_[batch_id].size();
-    }
-
-    Tensor indices(DT_INT64, TensorShape({offset_[batch_size], 2}));
-    Tensor values(dtype_, TensorShape({offset_[batch_size]}));
-    Tensor dense_shape(DT_INT64, TensorShape({2}));
+    });
 
-    auto doFill = [this, &values, &indices, &offset_, &cols_vec_]
-        (int64 start_i, int64 limit_i)
-    {
-      Fill(values, indices, offset_, cols_vec_, start_i, limit_i);
-    };
-
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doFill);
-    OP_REQUIRES_OK(ctx, status);
-
-    auto dense_shape_ = dense_shape.flat<int64>();
+    auto dense_shape_ = dense_shape->flat<int64>();
     dense_shape_(0) = batch_size;
     dense_shape_(1) = max_id;
-    ctx->set_output(0, indices);
-    ctx->set_output(1, values);
-    ctx->set_output(2, dense_shape);
   }
-
-  template <typename T>
-  void Fill(Tensor& values, Tensor& indices, const int64* offset_,
-            const std::vector<std::vector<std::pair<int64, T>>>& cols_vec_,
-            const int64& start_i, const int64& limit_i) {
-    auto values_ = values.vec<T>();
-    auto indices_ = indices.matrix<int64>();
-    for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-      const int64 cols_len = cols_vec_[batch_id].size();
-      const int64 offset = offset_[batch_id];
-
-      for (int64 index = 0; index < cols_len; ++index) {
-        indices_(index + offset, 0) = batch_id;
-        indices_(index + offset, 1) = cols_vec_[batch_id][index].first;
-        values_(index + offset) = cols_vec_[batch_id][index].second;
-      }
-    }
-  };
 };
 
 class TransCsvKV2DenseOp : public OpKernel {
@@ -739,92 +772,42 @@ class TransCsvKV2DenseOp : public OpKernel {
   void ComputeInternal(OpKernelContext* ctx) {
     const Tensor* records;
     OP_REQUIRES_OK(ctx, ctx->input("records", &records));
-
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, (max_id >= 0 || max_id == ID_AUTO_DETECT_TAG),
-                errors::InvalidArgument("invalid max_id setting: ", max_id));
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, GetMaxId(ctx, &max_id));
 
     auto records_t = records->flat<string>();
     const int64 batch_size = records_t.size();
-
-    std::vector<std::vector<std::pair<int64, T>>> cols_vec_(batch_size);
-
-    mutex mu;
-    size_t max_col_id GUARDED_BY(mu) = 0;
-    Status status GUARDED_BY(mu);
-
-    // Scan and store k/v pairs, check the maximum column index in the matrix.
-    auto doScan = [this, &status, &mu, ctx, &records_t, &cols_vec_, &max_col_id]
-        (int64 start_i, int64 limit_i)
-    {
+    const char delim = delim_;
+
+    // Scan k/v pairs, check the maximum column index in the matrix, a
+    // negative key has no column.
+    int64 max_col_id;
+    OP_REQUIRES_OK(ctx, ScanRecords(ctx, records_t, "kv in record ", nullptr,
+        [&records_t, delim](int64 batch_id, int64* count, int64* max_col) {
+          bool negative = false;
+          bool ok = ParseKvRecord<T>(records_t(batch_id), delim,
+              [&negative, max_col](int64 key, T value) {
+                negative |= (key < 0);
+                *max_col = std::max(*max_col, key + 1);
+              });
+          return ok && !negative;
+        }, &max_col_id));
+    OP_REQUIRES_OK(ctx, ResolveMaxId(max_col_id, &max_id));
+
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0,
+        TensorShape({batch_size, max_id}), &values));
+    T* values_ = values->flat<T>().data();
+
+    FillRecords(ctx, batch_size, [&](int64 start_i, int64 limit_i) {
       for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-        StringPiece record(records_t(batch_id));
-
-        OP_CHECK_STATUS(status, mu,
-                        SplitKv(record, delim_, cols_vec_[batch_id]) == true,
-                        errors::InvalidArgument("kv in record ", batch_id,
-                            " is not valid : ", records_t(batch_id)));
-        int64 cols_len = cols_vec_[batch_id].size();
-        if (cols_len > 0) {
-          std::sort(cols_vec_[batch_id].begin(), cols_vec_[batch_id].end());
-          if (cols_vec_[batch_id][cols_len-1].first >= max_col_id) {
-            mutex_lock l(mu);
-            if (cols_vec_[batch_id][cols_len-1].first >= max_col_id) {
-              max_col_id = cols_vec_[batch_id][cols_len-1].first + 1;
-            }
-          }
-        }
+        T* row = values_ + batch_id * max_id;
+        std::fill(row, row + max_id, static_cast<T>(0));
+        ParseKvRecord<T>(records_t(batch_id), delim,
+                         [row](int64 key, T value) { row[key] = value; });
       }
-    };
-
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doScan);
-    OP_REQUIRES_OK(ctx, status);
-
-    if (max_id == ID_AUTO_DETECT_TAG) {
-      max_id = max_col_id;
-    } else {
-      OP_REQUIRES(ctx, max_id >= max_col_id,
-                  errors::InvalidArgument("max_id set as ", max_id,
-                      " but less then real maximum col id ", max_col_id));
-    }
-
-    Tensor values(dtype_, TensorShape({batch_size, max_id}));
-
-    auto doFill = [this, &values, &max_id, &cols_vec_]
-        (int64 start_i, int64 limit_i)
-    {
-      Fill(values, max_id, cols_vec_, start_i, limit_i);
-    };
-
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doFill);
-    OP_REQUIRES_OK(ctx, status);
-
-    ctx->set_output(0, values);
+    });
   }
-
-  template <typename T>
-  void Fill(Tensor& values, const int64& max_id,
-            const std::vector<std::vector<std::pair<int64, T>>>& cols_vec_,
-            const int64& start_i, const int64& limit_i) {
-    auto values_ = values.matrix<T>();
-
-    for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-      for (int64 index = 0; index < max_id; ++index) {
-        values_(batch_id, index) = static_cast<T>(0);
-      }
-
-      int64 cols_len = cols_vec_[batch_id].size();
-      for (int64 i = 0; i < cols_len; ++i) {
-        int64 index = cols_vec_[batch_id][i].first;
-        T value = cols_vec_[batch_id][i].second;
-        values_(batch_id, index) = value;
-      }
-    }
-  };
 };
 
 class TransCsvToDenseOp : public OpKernel {
@@ -868,87 +851,39 @@ class TransCsvToDenseOp : public OpKernel {
   void ComputeInternal(OpKernelContext* ctx) {
     const Tensor* records;
     OP_REQUIRES_OK(ctx, ctx->input("records", &records));
-
-    const Tensor* max_id_tensor;
-    OP_REQUIRES_OK(ctx, ctx->input("max_id", &max_id_tensor));
-    int64 max_id = max_id_tensor->scalar<int64>()();
-    OP_REQUIRES(ctx, (max_id >= 0 || max_id == ID_AUTO_DETECT_TAG),
-                errors::InvalidArgument("invalid max_id setting: ", max_id));
+    int64 max_id;
+    OP_REQUIRES_OK(ctx, GetMaxId(ctx, &max_id));
 
     auto records_t = records->flat<string>();
     const int64 batch_size = records_t.size();
-
-    std::vector<std::vector<T>> cols_vec_(batch_size);
-
-    mutex mu;
-    size_t max_col_id GUARDED_BY(mu) = 0;
-    Status status GUARDED_BY(mu);
-
-    // Scan and store values, check the maximum column index in the matrix.
-    auto doScan = [this, &status, &mu, ctx, &records_t, &cols_vec_, &max_col_id]
-        (int64 start_i, int64 limit_i)
-    {
+    const char delim = delim_;
+
+    // Scan values, check the maximum column number in the matrix.
+    int64 max_col_id;
+    OP_REQUIRES_OK(ctx, ScanRecords(ctx, records_t, "values in record ", nullptr,
+        [&records_t, delim](int64 batch_id, int64* count, int64* max_col) {
+          bool ok = ParseValueRecord<T>(records_t(batch_id), delim,
+                                        [count](T value) { ++(*count); });
+          *max_col = std::max(*max_col, *count);
+          return ok;
+        }, &max_col_id));
+    OP_REQUIRES_OK(ctx, ResolveMaxId(max_col_id, &max_id));
+
+    Tensor* values;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0,
+        TensorShape({batch_size, max_id}), &values));
+    T* values_ = values->flat<T>().data();
+
+    FillRecords(ctx, batch_size, [&](int64 start_i, int64 limit_i) {
       for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-        StringPiece record(records_t(batch_id));
-
-        OP_CHECK_STATUS(status, mu,
-                        SplitNum(record, delim_, cols_vec_[batch_id]) == true,
-                        errors::InvalidArgument("values in record ", batch_id,
-                            " is not valid : ", records_t(batch_id)));
-        int64 cols_len = cols_vec_[batch_id].size();
-        if (cols_len > max_col_id) {
-          mutex_lock l(mu);
-          if (cols_len > max_col_id) {
-            max_col_id = cols_len;
-          }
-        }
+        T* row = values_ + batch_id * max_id;
+        int64 n = 0;
+        ParseValueRecord<T>(records_t(batch_id), delim,
+                            [row, &n](T value) { row[n++] = value; });
+        std::fill(row + n, row + max_id, static_cast<T>(0));
       }
-    };
-
-    auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
-    const int64 cost = 5000; //very unreliable estimate for cost per step.
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doScan);
-    OP_REQUIRES_OK(ctx, status);
-
-    if (max_id == ID_AUTO_DETECT_TAG) {
-      max_id = max_col_id;
-    } else {
-      OP_REQUIRES(ctx, max_id >= max_col_id,
-                  errors::InvalidArgument("max_id set as ", max_id,
-                      " but less then real maximum col id ", max_col_id));
-    }
-
-    Tensor values(dtype_, TensorShape({batch_size, max_id}));
-
-    auto doFill = [this, &values, &max_id, &cols_vec_]
-        (int64 start_i, int64 limit_i)
-    {
-      Fill(values, max_id, cols_vec_, start_i, limit_i);
-    };
-
-    Shard(worker_threads.num_threads, worker_threads.workers, batch_size, cost, doFill);
-    OP_REQUIRES_OK(ctx, status);
-
-    ctx->set_output(0, values);
+    });
   }
-
-  template <typename T>
-  void Fill(Tensor& values, const int64& max_id,
-            const std::vector<std::vector<T>>& cols_vec_,
-            const int64& start_i, const int64& limit_i) {
-    auto values_ = values.matrix<T>();
-
-    for (int64 batch_id = start_i; batch_id < limit_i; ++batch_id) {
-      int64 cols_len = cols_vec_[batch_id].size();
-      for (int64 i = 0; i < cols_len; ++i) {
-        T value = cols_vec_[batch_id][i];
-        values_(batch_id, i) = value;
-      }
-      for (int64 i = cols_len; i < max_id; ++i) {
-        values_(batch_id, i) = static_cast<T>(0);
-      }
-    }
-  };
 };
 
 
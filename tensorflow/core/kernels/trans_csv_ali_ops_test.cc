@@ -18,6 +18,9 @@
 #include "tensorflow/core/kernels/ops_testutil.h"
 #include "tensorflow/core/kernels/ops_util.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
 #include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/platform/test_benchmark.h"
@@ -27,6 +30,83 @@ namespace tensorflow {
 
 namespace {
 
+// Builds random records whose values are known, with spaces around the
+// fields, out of order ids and trailing delims, to check the kernels row
+// by row against what was written.
+class CsvFuzzer {
+ public:
+  explicit CsvFuzzer(char delim) : philox_(301, 17), rnd_(&philox_),
+                                   delim_(delim) {}
+
+  uint32 Uniform(uint32 n) { return rnd_.Uniform(n); }
+
+  // Fields longer than a vector register and empty rows both show up.
+  int64 RowSize() {
+    return rnd_.OneIn(8) ? 0 : rnd_.Uniform(rnd_.OneIn(4) ? 200 : 20);
+  }
+
+  string Spaces() {
+    return string(rnd_.OneIn(3) ? rnd_.Uniform(3) : 0, ' ');
+  }
+
+  string Id(int64 id) {
+    return strings::StrCat(rnd_.OneIn(10) ? "+" : "", id);
+  }
+
+  // A float in one of the notations the kernels accept, `value` gets what
+  // strtof makes of it.
+  string Float(float* value) {
+    const int64 mantissa = rnd_.Uniform64(100000000) *
+                           (rnd_.OneIn(3) ? -1 : 1);
+    string text;
+    switch (rnd_.Uniform(4)) {
+      case 0:
+        text = strings::StrCat(mantissa);
+        break;
+      case 1:
+        text = strings::Printf("%.6f", mantissa * 1e-6);
+        break;
+      case 2:
+        text = strings::Printf("%.4e", mantissa * 1e-4);
+        break;
+      default:
+        text = strings::Printf("%.9g", mantissa * 1e-12);
+        break;
+    }
+    *value = std::strtof(text.c_str(), nullptr);
+    return text;
+  }
+
+  string Field(const string& text) {
+    return delim_ == ' ' ? text : strings::StrCat(Spaces(), text, Spaces());
+  }
+
+  string Kv(const string& key, const string& value) {
+    if (delim_ == ' ') return strings::StrCat(key, ":", value);
+    return strings::StrCat(Spaces(), key, Spaces(), ":", Spaces(), value,
+                           Spaces());
+  }
+
+  string Join(const std::vector<string>& fields) {
+    string record = str_util::Join(fields, string(1, delim_).c_str());
+    if (!fields.empty() && rnd_.OneIn(5)) record += delim_;
+    return record;
+  }
+
+ private:
+  random::PhiloxRandom philox_;
+  random::SimplePhilox rnd_;
+  const char delim_;
+};
+
+void ExpectFloatsNear(const std::vector<float>& expected, const float* actual,
+                      const string& record) {
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-6 * std::fabs(expected[i]))
+        << "value " << i << " of record : " << record;
+  }
+}
+
 class TransCsvID2SparseTest : public OpsTestBase {
  protected:
 
@@ -192,6 +272,22 @@ TEST_F(TransCsvID2SparseTest, MaxIdNotBigEnough) {
   EXPECT_EQ(::tensorflow::error::INVALID_ARGUMENT, RunOpKernel().code());
 }
 
+TEST_F(TransCsvID2SparseTest, NegativeIndex) {
+  CreateOp(DT_INT64, true, ",");
+  TF_ASSERT_OK(InitOp());
+
+  // input records
+  AddInputFromArray<string>(TensorShape({3}), {"2,10", "-3", "8,0"});
+  // max_id
+  AddInputFromArray<int64>(TensorShape({}), {12});
+  // default value
+  AddInputFromArray<int64>(TensorShape({}), {0});
+
+  Status s = RunOpKernel();
+  EXPECT_EQ(::tensorflow::error::INVALID_ARGUMENT, s.code());
+  EXPECT_TRUE(str_util::StrContains(s.error_message(), "Index record 1 "))
+      << s;
+}
 
 class TransCsvID2DenseTest : public OpsTestBase {
  protected:
@@ -920,6 +1016,169 @@ TEST_F(TransCsvToDenseTest, MaxIdNotBigEnough) {
 }
 
 
+TEST_F(TransCsvID2SparseTest, Fuzz) {
+  CreateOp(DT_INT64, true, ",");
+  TF_ASSERT_OK(InitOp());
+
+  CsvFuzzer fuzzer(',');
+  const int64 batch_size = 300;
+  std::vector<string> records;
+  std::vector<std::vector<int64>> rows;
+  for (int64 i = 0; i < batch_size; ++i) {
+    std::vector<int64> ids(fuzzer.RowSize());
+    std::vector<string> fields;
+    for (int64& id : ids) {
+      id = fuzzer.Uniform(1 << 20);
+      fields.push_back(fuzzer.Field(fuzzer.Id(id)));
+    }
+    std::sort(ids.begin(), ids.end());
+    records.push_back(fuzzer.Join(fields));
+    rows.push_back(ids);
+  }
+  AddInputFromArray<string>(TensorShape({batch_size}), records);
+  AddInputFromArray<int64>(TensorShape({}), {1 << 20});
+  AddInputFromArray<int64>(TensorShape({}), {0});
+  TF_ASSERT_OK(RunOpKernel());
+
+  auto indices = GetOutput(0)->matrix<int64>();
+  auto values = GetOutput(1)->vec<int64>();
+  int64 offset = 0;
+  for (int64 i = 0; i < batch_size; ++i) {
+    for (int64 id : rows[i]) {
+      ASSERT_LT(offset, values.size());
+      EXPECT_EQ(i, indices(offset, 0)) << records[i];
+      EXPECT_EQ(id, indices(offset, 1)) << records[i];
+      EXPECT_EQ(id, values(offset)) << records[i];
+      ++offset;
+    }
+  }
+  EXPECT_EQ(offset, values.size());
+}
+
+TEST_F(TransCsvKV2SparseTest, Fuzz) {
+  CreateOp(DT_FLOAT, " ");
+  TF_ASSERT_OK(InitOp());
+
+  CsvFuzzer fuzzer(' ');
+  const int64 batch_size = 300;
+  std::vector<string> records;
+  std::vector<std::vector<std::pair<int64, float>>> rows;
+  for (int64 i = 0; i < batch_size; ++i) {
+    std::vector<std::pair<int64, float>> kvs(fuzzer.RowSize());
+    std::vector<string> fields;
+    for (auto& kv : kvs) {
+      kv.first = fuzzer.Uniform(1000);
+      const string value = fuzzer.Float(&kv.second);
+      fields.push_back(fuzzer.Kv(fuzzer.Id(kv.first), value));
+    }
+    std::sort(kvs.begin(), kvs.end());
+    records.push_back(fuzzer.Join(fields));
+    rows.push_back(kvs);
+  }
+  AddInputFromArray<string>(TensorShape({batch_size}), records);
+  AddInputFromArray<int64>(TensorShape({}), {-1048575});
+  TF_ASSERT_OK(RunOpKernel());
+
+  auto indices = GetOutput(0)->matrix<int64>();
+  const float* values = GetOutput(1)->flat<float>().data();
+  int64 offset = 0;
+  for (int64 i = 0; i < batch_size; ++i) {
+    std::vector<float> expected;
+    for (const auto& kv : rows[i]) {
+      const int64 j = offset + expected.size();
+      ASSERT_LT(j, indices.dimension(0));
+      EXPECT_EQ(i, indices(j, 0)) << records[i];
+      EXPECT_EQ(kv.first, indices(j, 1)) << records[i];
+      expected.push_back(kv.second);
+    }
+    ExpectFloatsNear(expected, values + offset, records[i]);
+    offset += expected.size();
+  }
+  EXPECT_EQ(offset, indices.dimension(0));
+}
+
+TEST_F(TransCsvKV2DenseTest, Fuzz) {
+  CreateOp(DT_FLOAT, ";");
+  TF_ASSERT_OK(InitOp());
+
+  CsvFuzzer fuzzer(';');
+  const int64 batch_size = 300;
+  const int64 max_id = 256;
+  std::vector<string> records;
+  std::vector<std::vector<float>> rows;
+  for (int64 i = 0; i < batch_size; ++i) {
+    std::vector<float> row(max_id, 0.0f);
+    std::vector<string> fields;
+    for (int64 j = fuzzer.RowSize(); j > 0; --j) {
+      const int64 key = fuzzer.Uniform(max_id);
+      const string value = fuzzer.Float(&row[key]);
+      fields.push_back(fuzzer.Kv(fuzzer.Id(key), value));
+    }
+    records.push_back(fuzzer.Join(fields));
+    rows.push_back(row);
+  }
+  AddInputFromArray<string>(TensorShape({batch_size}), records);
+  AddInputFromArray<int64>(TensorShape({}), {max_id});
+  TF_ASSERT_OK(RunOpKernel());
+
+  const float* values = GetOutput(0)->flat<float>().data();
+  for (int64 i = 0; i < batch_size; ++i) {
+    ExpectFloatsNear(rows[i], values + i * max_id, records[i]);
+  }
+}
+
+TEST_F(TransCsvToDenseTest, Fuzz) {
+  CreateOp(DT_FLOAT, "\t");
+  TF_ASSERT_OK(InitOp());
+
+  CsvFuzzer fuzzer('\t');
+  const int64 batch_size = 300;
+  const int64 max_id = 200;
+  std::vector<string> records;
+  std::vector<std::vector<float>> rows;
+  for (int64 i = 0; i < batch_size; ++i) {
+    std::vector<float> row(max_id, 0.0f);
+    std::vector<string> fields;
+    for (int64 j = 0, n = fuzzer.RowSize(); j < n; ++j) {
+      fields.push_back(fuzzer.Field(fuzzer.Float(&row[j])));
+    }
+    records.push_back(fuzzer.Join(fields));
+    rows.push_back(row);
+  }
+  AddInputFromArray<string>(TensorShape({batch_size}), records);
+  AddInputFromArray<int64>(TensorShape({}), {max_id});
+  TF_ASSERT_OK(RunOpKernel());
+
+  const float* values = GetOutput(0)->flat<float>().data();
+  for (int64 i = 0; i < batch_size; ++i) {
+    ExpectFloatsNear(rows[i], values + i * max_id, records[i]);
+  }
+}
+
+TEST_F(TransCsvID2DenseTest, FuzzInvalid) {
+  CreateOp(DT_INT64, false, ",");
+  TF_ASSERT_OK(InitOp());
+
+  // A long valid record, broken in its last field after the first 32
+  // bytes, which are parsed a vector register at a time.
+  CsvFuzzer fuzzer(',');
+  std::vector<string> fields;
+  for (int64 j = 0; j < 40; ++j) {
+    fields.push_back(fuzzer.Field(fuzzer.Id(fuzzer.Uniform(100))));
+  }
+  const string valid = str_util::Join(fields, ",");
+  AddInputFromArray<string>(TensorShape({3}),
+                            {valid, valid + ",1 2", valid + ",,"});
+  AddInputFromArray<int64>(TensorShape({}), {100});
+  AddInputFromArray<int64>(TensorShape({}), {1});
+
+  Status s = RunOpKernel();
+  EXPECT_EQ(::tensorflow::error::INVALID_ARGUMENT, s.code());
+  EXPECT_TRUE(str_util::StrContains(s.error_message(), "Index record "))
+      << s;
+}
+
+
 template <typename T>
 static Graph* CsvID2Sparse(Tensor& records_t) {
   Graph* g = new Graph(OpRegistry::Global());
@@ -1021,10 +1280,12 @@ static Graph* CsvKV2Dense(Tensor& records_t) {
 BM_INDEX(int64, Sparse, 128, 50, 100, 1);
 BM_INDEX(int64, Sparse, 1280, 50, 100, 1);
 BM_INDEX(int64, Sparse, 2000, 100, 2000, 1);
+BM_INDEX(int64, Sparse, 4096, 100, 2000, 1);
 
 BM_INDEX(int64, Sparse, 128, 50, 100, 16);
 BM_INDEX(int64, Sparse, 1280, 50, 100, 16);
 BM_INDEX(int64, Sparse, 2000, 100, 2000, 16);
+BM_INDEX(int64, Sparse, 4096, 100, 2000, 16);
 
 BM_INDEX(float, Sparse, 128, 50, 100, 1);
 BM_INDEX(float, Sparse, 1280, 50, 100, 1);
@@ -1037,6 +1298,7 @@ BM_INDEX(float, Sparse, 2000, 100, 2000, 16);
 BM_INDEX(int64, Dense, 128, 50, 4, 1);
 BM_INDEX(int64, Dense, 1280, 50, 4, 1);
 BM_INDEX(int64, Dense, 2000, 100, 5, 1);
+BM_INDEX(int64, Dense, 4096, 100, 5, 1);
 
 BM_INDEX(int64, Dense, 128, 50, 4, 16);
 BM_INDEX(int64, Dense, 1280, 50, 4, 16);
@@ -1079,14 +1341,17 @@ BM_INDEX(float, Dense, 2000, 100, 5, 16);
 BM_KV(float, Sparse, 128, 338, 4, 1);
 BM_KV(float, Sparse, 1280, 338, 4, 1);
 BM_KV(float, Sparse, 2000, 338, 5, 1);
+BM_KV(float, Sparse, 4096, 338, 5, 1);
 
 BM_KV(float, Sparse, 128, 338, 4, 16);
 BM_KV(float, Sparse, 1280, 338, 4, 16);
 BM_KV(float, Sparse, 2000, 338, 5, 16);
+BM_KV(float, Sparse, 4096, 338, 5, 16);
 
 BM_KV(float, Dense, 128, 338, 4, 1);
 BM_KV(float, Dense, 1280, 338, 4, 1);
 BM_KV(float, Dense, 2000, 338, 5, 1);
+BM_KV(float, Dense, 4096, 338, 5, 1);
 
 BM_KV(float, Dense, 128, 338, 4, 16);
 BM_KV(float, Dense, 1280, 338, 4, 16);
@@ -330,6 +330,84 @@ Produces an output tensor with shape `indices.shape + params.shape[1:]` where:
 
 )doc");
 
+REGISTER_OP("KvResourceSparseSegmentReduce")
+    .Input("resource: resource")
+    .Input("indices: Tkeys")
+    .Input("segment_ids: Tsegmentids")
+    .Input("default_value: dtype")
+    .Output("output: dtype")
+    .Output("unique_keys: Tkeys")
+    .Output("unique_idx: int32")
+    .Attr("combiner: {'sum', 'mean', 'sqrtn'} = 'mean'")
+    .Attr("is_use_default_value_tensor: bool = false")
+    .Attr("is_inference: bool = false")
+    .Attr("dtype: {float, double}")
+    .Attr("Tkeys: {int64, int32}")
+    .Attr("Tsegmentids: {int32, int64} = DT_INT32")
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeAndType handle_shape_and_type;
+      TF_RETURN_IF_ERROR(
+          ValidateVariableResourceHandle(c, &handle_shape_and_type));
+      ShapeHandle indices_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &indices_shape));
+      ShapeHandle segment_ids_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 1, &segment_ids_shape));
+      TF_RETURN_IF_ERROR(
+          c->Merge(indices_shape, segment_ids_shape, &indices_shape));
+      ShapeHandle out;
+      TF_RETURN_IF_ERROR(c->Concatenate(
+          c->Vector(InferenceContext::kUnknownDim),
+          handle_shape_and_type.shape, &out));
+      c->set_output(0, out);
+      c->set_output(1, c->Vector(InferenceContext::kUnknownDim));
+      c->set_output(2, indices_shape);
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Looks up `indices` in the variable pointed to by `resource` and reduces
+them into segments, like `Unique`, `KvResourceGather` and
+`SparseSegmentSum/Mean/SqrtN` in one op.
+
+Every key is looked up once, and its row is added straight into the
+output rows of its segments.
+
+segment_ids: Sorted ids of the output row of every index.
+default_value: Initial values of the new keys, like for KvResourceGather.
+output: `[segment_ids[-1] + 1, value_len]` reduced embeddings.
+unique_keys: The keys of `indices` in the order they first appear.
+unique_idx: The position of every index in `unique_keys`.
+)doc");
+
+REGISTER_OP("KvResourceSparseSegmentReduceGrad")
+    .Input("grad: T")
+    .Input("unique_idx: int32")
+    .Input("segment_ids: Tsegmentids")
+    .Input("num_unique: int32")
+    .Output("output: T")
+    .Attr("combiner: {'sum', 'mean', 'sqrtn'} = 'mean'")
+    .Attr("T: {float, double}")
+    .Attr("Tsegmentids: {int32, int64} = DT_INT32")
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle grad_shape;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &grad_shape));
+      ShapeHandle unused;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &unused));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 1, &unused));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 0, &unused));
+      DimensionHandle num_unique;
+      TF_RETURN_IF_ERROR(c->MakeDimForScalarInput(3, &num_unique));
+      c->set_output(0, c->Matrix(num_unique, c->Dim(grad_shape, 1)));
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Computes the gradient of KvResourceSparseSegmentReduce for its
+`unique_keys`, to be applied by the sparse apply ops of the variable.
+
+grad: Gradient of the `output` of KvResourceSparseSegmentReduce.
+num_unique: The size of `unique_keys`.
+output: `[num_unique, value_len]` gradient of every unique key.
+)doc");
+
 REGISTER_OP("KvResourceScatterAdd")
     .Input("resource: resource")
     .Input("indices: Tkeys")
@@ -518,6 +596,62 @@ versions: Vector of all versions present in the table.
 freqs: Vector of all freqs present in the table.
 )doc");
 
+REGISTER_OP("KvResourceExportIterator")
+    .Output("iterator_handle: resource")
+    .Attr("Tkeys: {int64, int32}")
+    .Attr("Tvalues: type")
+    .Attr("chunk_size: int = 65536")
+    .Attr("container: string = ''")
+    .Attr("shared_name: string = ''")
+    .SetIsStateful()
+    .SetShapeFn(shape_inference::ScalarShape)
+    .Doc(R"doc(
+Outputs the handle of an iterator exporting a kv resource chunk by chunk.
+
+iterator_handle: Handle to the export iterator.
+chunk_size: Maximum number of keys in a chunk.
+)doc");
+
+REGISTER_OP("KvResourceExportIteratorInit")
+    .Input("iterator_handle: resource")
+    .Input("resource_handle: resource")
+    .Attr("Tkeys: {int64, int32}")
+    .Attr("Tvalues: type")
+    .SetShapeFn(shape_inference::NoOutputs)
+    .Doc(R"doc(
+Takes a new snapshot of the kv resource into the export iterator.
+
+iterator_handle: Handle made by KvResourceExportIterator.
+resource_handle: Handle to the kvResource.
+)doc");
+
+REGISTER_OP("KvResourceExportNextChunk")
+    .Input("iterator_handle: resource")
+    .Output("keys: Tkeys")
+    .Output("values: Tvalues")
+    .Output("versions: int64")
+    .Output("freqs: int64")
+    .Attr("Tkeys: {int64, int32}")
+    .Attr("Tvalues: type")
+    .SetIsStateful()
+    .SetShapeFn([](InferenceContext* c) {
+      c->set_output(0, c->Vector(c->UnknownDim()));
+      c->set_output(1, c->Matrix(c->UnknownDim(), c->UnknownDim()));
+      c->set_output(2, c->Vector(c->UnknownDim()));
+      c->set_output(3, c->Vector(c->UnknownDim()));
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Outputs the next chunk of keys and values of an export iterator. Several
+consumers may read the same iterator, each chunk goes to one of them.
+
+iterator_handle: Handle made by KvResourceExportIterator.
+keys: Keys of the chunk, empty once every key was exported.
+values: Values of the chunk. Indexed in parallel with `keys`.
+versions: Versions of the chunk, empty if the table records none.
+freqs: Freqs of the chunk, empty if the table records none.
+)doc");
+
 REGISTER_OP("KvResourceGeneratePartitionedTensor")
     .Input("keys: Tkeys")
     .Input("values: Tvalues")
@@ -573,6 +707,35 @@ REGISTER_OP("EVGetVersion")
     })
     .Doc(R"doc()doc");
 
+REGISTER_OP("KvResourceHotKeys")
+    .Input("resource_handle: resource")
+    .Input("k: int64")
+    .Output("keys: Tkeys")
+    .Output("freqs: int64")
+    .Output("total_freq: int64")
+    .Output("size: int64")
+    .Attr("Tkeys: {int64, int32}")
+    .Attr("Tvalues: type")
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle unused;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 0, &unused));
+      c->set_output(0, c->Vector(c->UnknownDim()));
+      c->set_output(1, c->Vector(c->UnknownDim()));
+      c->set_output(2, c->Scalar());
+      c->set_output(3, c->Scalar());
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Outputs the k most frequent keys of the kv resource, and its load.
+
+resource_handle: Handle to the kvResource.
+k: Number of keys to output.
+keys: Most frequent keys, most frequent first.
+freqs: Frequencies of `keys`.
+total_freq: Sum of the frequencies of all keys, the lookups of the table.
+size: Number of keys in the table.
+)doc");
+
 REGISTER_OP("KvResourceLookupTier")
     .Input("resource_handle: resource")
     .Input("ids: Tkeys")
@@ -28,6 +28,10 @@ REGISTER_OP("ParquetTabularDatasetV1")
     .Attr("partition_count: int = 1")
     .Attr("partition_index: int = 0")
     .Attr("drop_remainder: bool = false")
+    .Attr("predicate_fields: list(string) = []")
+    .Attr("predicate_ops: list(string) = []")
+    .Attr("predicate_values: list(string) = []")
+    .Attr("predicate_value_counts: list(int) = []")
     .SetIsStateful()  // NOTE: Source dataset ops must be marked stateful to
                       // inhibit constant folding.
     .SetShapeFn([](shape_inference::InferenceContext* c) {
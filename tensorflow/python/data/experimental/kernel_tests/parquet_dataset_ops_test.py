@@ -192,6 +192,57 @@ class ParquetDatasetTest(test_base.DatasetTestBase):
       with self.assertRaises(tf.errors.OutOfRangeError):
         sess.run(batch)
 
+  def test_read_with_filters(self):
+    filename = os.path.join(self._workspace, 'test_filters.parquet')
+    df = pd.DataFrame({
+      'A': np.arange(200, dtype=np.int64),
+      'B': np.arange(200, dtype=np.float64) * 0.5,
+      'C': ['d%d' % (i // 50) for i in xrange(200)]})
+    df.to_parquet(filename, row_group_size=50)
+    # Row groups hold rows [0, 50), [50, 100), [100, 150) and [150, 200).
+    cases = [
+      ([('A', 'range', (60, 80))], list(xrange(50, 100))),
+      ([('A', '>=', 120), ('B', '<', 80.0)], list(xrange(100, 150))),
+      ([('C', 'in', ['d0', 'd3'])],
+       list(xrange(0, 50)) + list(xrange(150, 200))),
+      ([('C', '!=', 'd1')],
+       list(xrange(0, 50)) + list(xrange(100, 200))),
+      ([('C', '==', 'd9')], [])]
+    for filters, expected_rows in cases:
+      with tf.Graph().as_default() as graph:
+        ds = parquet_dataset_ops.ParquetDataset(
+          filename,
+          batch_size=50,
+          fields=['A', 'C'],
+          filters=filters)
+        batch = tf.data.make_one_shot_iterator(ds).get_next()
+
+      rows = []
+      with tf.Session(graph=graph) as sess:
+        while True:
+          try:
+            result = sess.run(batch)
+          except tf.errors.OutOfRangeError:
+            break
+          rows.extend(result['A'].tolist())
+          np.testing.assert_equal(
+            [c.decode() for c in result['C']],
+            df['C'][result['A']].to_numpy())
+      self.assertEqual(rows, expected_rows, filters)
+
+  def test_read_with_invalid_filters(self):
+    with tf.Graph().as_default() as graph:
+      ds = parquet_dataset_ops.ParquetDataset(
+        self._filename,
+        batch_size=32,
+        fields=['A'],
+        filters=[('A', 'like', 1)])
+      batch = tf.data.make_one_shot_iterator(ds).get_next()
+
+    with tf.Session(graph=graph) as sess:
+      with self.assertRaises(tf.errors.InvalidArgumentError):
+        sess.run(batch)
+
 
 if __name__ == "__main__":
     test.main()
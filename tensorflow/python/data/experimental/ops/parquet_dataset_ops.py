@@ -84,6 +84,39 @@ class DataFrameValueSpec(type_spec.BatchableTypeSpec):
     return self._field.output_classes
 
 
+def _parse_filters(filters):
+  """Converts filters to the predicate attrs of parquet_tabular_dataset_v1.
+
+  Args:
+    filters: List of `(field, op, value)` tuples. `op` is one of `==`, `!=`,
+      `<`, `<=`, `>`, `>=` with a scalar `value`, `in` with a list of values,
+      or `range` with an inclusive `(lower, upper)` tuple.
+
+  Returns:
+    Tuple of predicate fields, ops, values and value counts.
+  """
+  fields = []
+  predicate_ops = []
+  values = []
+  value_counts = []
+  for f in filters or []:
+    if len(f) != 3:
+      raise ValueError(f'Filter {f} must be a (field, op, value) tuple')
+    field, op, value = f
+    if op in ('in', 'range'):
+      value = list(value)
+    else:
+      value = [value]
+    if op == 'range' and len(value) != 2:
+      raise ValueError(f'Filter {f} must have a (lower, upper) range')
+    fields.append(field)
+    predicate_ops.append(op)
+    values.extend(
+      [v.decode() if isinstance(v, bytes) else str(v) for v in value])
+    value_counts.append(len(value))
+  return fields, predicate_ops, values, value_counts
+
+
 class _ParquetDataset(dataset_ops.DatasetSource):  # pylint: disable=abstract-method
   """A Parquet Dataset that reads batches from parquet files."""
 
@@ -91,7 +124,8 @@ class _ParquetDataset(dataset_ops.DatasetSource):  # pylint: disable=abstract-me
       self, filename, batch_size, fields,
       partition_count=1,
       partition_index=0,
-      drop_remainder=False):
+      drop_remainder=False,
+      filters=None):
     """Create a `ParquetDataset`.
 
     Args:
@@ -102,6 +136,8 @@ class _ParquetDataset(dataset_ops.DatasetSource):  # pylint: disable=abstract-me
       partition_index: (Optional.) Index of row group partitions.
       drop_remainder: (Optional.) If True, only keep batches with exactly
         `batch_size` samples.
+      filters: (Optional.) List of `(field, op, value)` predicates used to
+        skip row groups by their statistics.
     """
     self._filename = ops.convert_to_tensor(
       filename, dtype=dtypes.string, name='filename')
@@ -121,6 +157,8 @@ class _ParquetDataset(dataset_ops.DatasetSource):  # pylint: disable=abstract-me
     self._partition_count = partition_count
     self._partition_index = partition_index
     self._drop_remainder = drop_remainder
+    (self._predicate_fields, self._predicate_ops, self._predicate_values,
+     self._predicate_value_counts) = _parse_filters(filters)
 
     variant_tensor = gen_parquet_ops.parquet_tabular_dataset_v1(
       self._filename,
@@ -130,7 +168,11 @@ class _ParquetDataset(dataset_ops.DatasetSource):  # pylint: disable=abstract-me
       field_ragged_ranks=self._field_ragged_ranks,
       partition_count=self._partition_count,
       partition_index=self._partition_index,
-      drop_remainder=self._drop_remainder)
+      drop_remainder=self._drop_remainder,
+      predicate_fields=self._predicate_fields,
+      predicate_ops=self._predicate_ops,
+      predicate_values=self._predicate_values,
+      predicate_value_counts=self._predicate_value_counts)
     super().__init__(variant_tensor)
 
   @property
@@ -165,7 +207,8 @@ class ParquetDataset(dataset_ops.DatasetV2):  # pylint: disable=abstract-method
       partition_index=0,
       drop_remainder=False,
       num_parallel_reads=None,
-      num_sequential_reads=1):
+      num_sequential_reads=1,
+      filters=None):
     """Create a `ParquetDataset`.
 
     Args:
@@ -182,11 +225,18 @@ class ParquetDataset(dataset_ops.DatasetV2):  # pylint: disable=abstract-method
         sequentially.
       num_sequential_reads: (Optional.) A `tf.int64` scalar representing the
         number of batches to read in sequential. Defaults to 1.
+      filters: (Optional.) List of `(field, op, value)` predicates on
+        non-ragged fields. `op` is one of `==`, `!=`, `<`, `<=`, `>`, `>=`,
+        `in` with a list of values, or `range` with an inclusive
+        `(lower, upper)` tuple. Row groups whose statistics show that no
+        row satisfies all predicates are skipped, rows of the other row
+        groups are not filtered.
     """
     filenames, self._fields = parquet_filenames_and_fields(filenames, fields)
     self._partition_count = partition_count
     self._partition_index = partition_index
     self._drop_remainder = drop_remainder
+    self._filters = filters
 
     def _create_dataset(f):
       f = ops.convert_to_tensor(f, dtypes.string, name='filename')
@@ -195,7 +245,8 @@ class ParquetDataset(dataset_ops.DatasetV2):  # pylint: disable=abstract-method
         fields=self._fields,
         partition_count=self._partition_count,
         partition_index=self._partition_index,
-        drop_remainder=self._drop_remainder)
+        drop_remainder=self._drop_remainder,
+        filters=self._filters)
     self._impl = self._build_dataset(
       _create_dataset, filenames,
       num_parallel_reads=num_parallel_reads,
@@ -218,6 +269,10 @@ class ParquetDataset(dataset_ops.DatasetV2):  # pylint: disable=abstract-method
   def drop_remainder(self):
     return self._drop_remainder
 
+  @property
+  def filters(self):
+    return self._filters
+
   def _inputs(self):
     return self._impl._inputs()  # pylint: disable=protected-access
 
@@ -251,7 +306,8 @@ def read_parquet(
     partition_index=0,
     drop_remainder=False,
     num_parallel_reads=None,
-    num_sequential_reads=1):
+    num_sequential_reads=1,
+    filters=None):
   """Create a `ParquetDataset` from filenames dataset.
 
     Args:
@@ -266,6 +322,8 @@ def read_parquet(
         sequentially.
       num_sequential_reads: (Optional.) A `tf.int64` scalar representing the
         number of batches to read in sequential. Defaults to 1.
+      filters: (Optional.) List of `(field, op, value)` predicates used to
+        skip row groups by their statistics.
     """
   def _apply_fn(filenames):
     return ParquetDataset(
@@ -276,6 +334,7 @@ def read_parquet(
       partition_index=partition_index,
       drop_remainder=drop_remainder,
       num_parallel_reads=num_parallel_reads,
-      num_sequential_reads=num_sequential_reads)
+      num_sequential_reads=num_sequential_reads,
+      filters=filters)
 
   return _apply_fn
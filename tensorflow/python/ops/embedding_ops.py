@@ -17,6 +17,8 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+import os
+
 from six.moves import xrange  # pylint: disable=redefined-builtin
 
 from tensorflow.python.framework import constant_op
@@ -217,7 +219,20 @@ def _embedding_lookup_and_transform(params,
         raise ValueError("blocknums must be valid for dynamic embedding variable")
 
 
+      unique_idx = None
       if isinstance(params[0], kv_variable_ops.EmbeddingVariable):
+         if ev_init_value is None and counts is None:
+           # A hot id is looked up once on its partition, and its
+           # gradients are summed here before they are sent to it. The
+           # counts keep the frequencies of a filter, of record_freq and of
+           # the multi-tier cache right.
+           if (params[0]._filter_freq > 0 or params[0]._record_freq or
+               kv_variable_ops.is_multi_tier(params[0].storage_type)):
+             flat_ids, unique_idx, counts = array_ops.unique_with_counts(
+                 flat_ids)
+           else:
+             flat_ids, unique_idx = array_ops.unique(flat_ids)
+           original_indices = math_ops.range(array_ops.size(flat_ids))
          new_ids = flat_ids
          p_assignments = flat_ids % 1000 % np 
       elif partition_strategy == "mod":
@@ -271,6 +286,9 @@ def _embedding_lookup_and_transform(params,
         gather_blocknums = data_flow_ops.dynamic_partition(blocknums, p_assignments, np)
       if ev_init_value is not None:
         gather_ev_init_value = data_flow_ops.dynamic_partition(ev_init_value, p_assignments, np)
+      gather_counts = None
+      if counts is not None:
+        gather_counts = data_flow_ops.dynamic_partition(counts, p_assignments, np)
       # Similarly, partition the original indices.
       pindices = data_flow_ops.dynamic_partition(original_indices,
                                                  p_assignments, np)
@@ -300,7 +318,8 @@ def _embedding_lookup_and_transform(params,
               new_ev_init_value = None
             else:
               new_ev_init_value = gather_ev_init_value[p]
-            result = array_ops.gather(params[p], pids, ev_init_value=new_ev_init_value, counts=counts)
+            new_counts = None if gather_counts is None else gather_counts[p]
+            result = array_ops.gather(params[p], pids, ev_init_value=new_ev_init_value, counts=new_counts)
             if transform_fn:
               # If transform_fn is provided, the clip_by_norm precedes
               # the transform and hence must be co-located. See below
@@ -310,6 +329,8 @@ def _embedding_lookup_and_transform(params,
       # Stitch these back together
       ret = data_flow_ops.parallel_dynamic_stitch(
           pindices, partitioned_result, name=name)
+      if unique_idx is not None:
+        ret = array_ops.gather(ret, unique_idx)
 
       # Determine the static element shape.
       if isinstance(params[0], kv_variable_ops.EmbeddingVariable) or \
@@ -490,6 +511,22 @@ def _tile_combine_embedding(embeddings, segment_ids, column_ids, sp_shape):
   return embeddings
 
 
+def _use_fused_segment_reduce(params):
+  """Whether embedding_lookup_sparse uses KvResourceSparseSegmentReduce.
+
+  Set TF_EV_FUSED_SEGMENT_REDUCE=1 to look up and combine the ids of a
+  single EmbeddingVariable on CPU in one op. Inference graphs get the same
+  op from the fusion of the graph optimizer.
+  """
+  if os.environ.get("TF_EV_FUSED_SEGMENT_REDUCE", "0") != "1":
+    return False
+  if len(params) != 1 or \
+      not isinstance(params[0], kv_variable_ops.EmbeddingVariable):
+    return False
+  return (params[0].dtype.base_dtype in (dtypes.float32, dtypes.float64) and
+          "GPU" not in params[0].device.upper())
+
+
 @tf_export(v1=["nn.embedding_lookup_sparse"])
 def embedding_lookup_sparse(params,
                             sp_ids,
@@ -603,6 +640,17 @@ def embedding_lookup_sparse(params,
       segment_ids = math_ops.cast(segment_ids, dtypes.int32)
 
     ids = sp_ids.values
+    if (ignore_weights and blocknums is None and max_norm is None and
+        combiner in ("mean", "sqrtn", "sum") and
+        _use_fused_segment_reduce(params)):
+      with ops.colocate_with(params[0]):
+        embeddings = params[0].sparse_segment_reduce(
+            ids, segment_ids, combiner)
+      embeddings = array_ops.identity(embeddings, name=name)
+      ops.add_to_collections(ops.GraphKeys.ASYNC_EMBEDDING_OUTPUT_TENSORS,
+                             embeddings)
+      return embeddings
+
     if isinstance(params[0], kv_variable_ops.EmbeddingVariable) and params[0]._filter_freq > 0:
       ids, idx, counts = array_ops.unique_with_counts(ids)
     else:
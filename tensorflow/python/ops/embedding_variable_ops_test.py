@@ -22,6 +22,7 @@ from tensorflow.python.framework import test_util
 from tensorflow.python.ops import string_ops
 from tensorflow.python.ops.check_ops import assert_equal
 from tensorflow.python.platform import googletest
+from tensorflow.python.platform import test
 from tensorflow.python.ops import array_ops
 from tensorflow.python.ops import embedding_ops
 from tensorflow.python.ops import kv_variable_ops
@@ -239,6 +240,160 @@ class EmbeddingVariableTest(test_util.TensorFlowTestCase):
         self.assertAllEqual([0, 0, 0, 0, 0, 0], fetches[2])
         self.assertAllEqual([1, 1, 1, 1, 1, 1], fetches[3])
 
+  def testEmbeddingVariableForExportInChunks(self):
+    print("testEmbeddingVariableForExportInChunks")
+    with ops.device('/cpu:0'):
+      var = variable_scope.get_embedding_variable("var_1", embedding_dim=3,
+              initializer=init_ops.ones_initializer(dtypes.float32))
+      emb = embedding_ops.embedding_lookup(var, math_ops.cast([0,1,2,5,6,7], dtypes.int64))
+      init = variables.global_variables_initializer()
+      init_export, next_chunk = var.export_in_chunks(chunk_size=4)
+      with self.test_session() as sess:
+        sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_VAR_OPS))
+        sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_SLOT_OPS))
+        sess.run([init])
+        sess.run(emb)
+        for _ in range(2):
+          sess.run(init_export)
+          keys, sizes = [], []
+          while True:
+            fetches = sess.run(next_chunk)
+            sizes.append(len(fetches[0]))
+            if len(fetches[0]) == 0:
+              break
+            keys.extend(fetches[0])
+            self.assertAllEqual(np.ones((len(fetches[0]), 3)), fetches[1])
+            # Neither versions nor freqs are recorded by this variable.
+            self.assertEqual(0, len(fetches[2]))
+            self.assertEqual(0, len(fetches[3]))
+          self.assertAllEqual([4, 2, 0], sizes)
+          self.assertAllEqual([0, 1, 2, 5, 6, 7], sorted(keys))
+
+  def testEmbeddingVariableForExportInChunksWithConsumers(self):
+    print("testEmbeddingVariableForExportInChunksWithConsumers")
+    with ops.device('/cpu:0'):
+      var = variable_scope.get_embedding_variable("var_1", embedding_dim=3,
+              initializer=init_ops.ones_initializer(dtypes.float32))
+      emb = embedding_ops.embedding_lookup(var,
+              math_ops.cast(math_ops.range(100), dtypes.int64))
+      init = variables.global_variables_initializer()
+      # Both consumers read the iterator shared under the default name.
+      init_export, next_chunk_1 = var.export_in_chunks(chunk_size=7)
+      _, next_chunk_2 = var.export_in_chunks(chunk_size=7)
+      with self.test_session() as sess:
+        sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_VAR_OPS))
+        sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_SLOT_OPS))
+        sess.run([init])
+        sess.run(emb)
+        sess.run(init_export)
+        keys, num_chunks = [], 0
+        while True:
+          next_chunk = next_chunk_2 if num_chunks % 2 else next_chunk_1
+          fetches = sess.run(next_chunk)
+          if len(fetches[0]) == 0:
+            break
+          num_chunks += 1
+          self.assertLessEqual(len(fetches[0]), 7)
+          keys.extend(fetches[0])
+          self.assertAllEqual(np.ones((len(fetches[0]), 3)), fetches[1])
+        self.assertEqual(15, num_chunks)
+        self.assertAllEqual(list(range(100)), sorted(keys))
+
+  def testEmbeddingVariableForExportInChunksDRAMAndSSD(self):
+    print("testEmbeddingVariableForExportInChunksDRAMAndSSD")
+    db_directory = self.get_temp_dir()
+    os.environ["TF_SSDHASH_ASYNC_COMPACTION"] = "0"
+    try:
+      with ops.Graph().as_default() as g, ops.device('/cpu:0'):
+        storage_option = variables.StorageOption(
+                          storage_type=config_pb2.StorageType.DRAM_SSDHASH,
+                          storage_path=db_directory,
+                          storage_size=[1024])
+        ev_option = variables.EmbeddingVariableOption(
+                                  storage_option=storage_option)
+        var = variable_scope.get_embedding_variable("var_1",
+              embedding_dim=30,
+              initializer=init_ops.ones_initializer(dtypes.float32),
+              ev_option=ev_option)
+        ids = array_ops.placeholder(dtypes.int64, name="ids")
+        emb = embedding_ops.embedding_lookup(var, ids)
+        tiers = kv_variable_ops.lookup_tier(var,
+                    math_ops.cast(math_ops.range(20), dtypes.int64))
+        init = variables.global_variables_initializer()
+        init_export, next_chunk = var.export_in_chunks(chunk_size=3)
+        with self.test_session(graph=g) as sess:
+          sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_VAR_OPS))
+          sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_SLOT_OPS))
+          sess.run([init])
+          for i in range(0, 20, 4):
+            sess.run(emb, {ids: list(range(i, i + 4))})
+          time.sleep(1)
+          # Some of the keys were evicted to the SSD tier.
+          self.assertIn(1, sess.run(tiers))
+          for _ in range(2):
+            sess.run(init_export)
+            keys = []
+            while True:
+              fetches = sess.run(next_chunk)
+              if len(fetches[0]) == 0:
+                break
+              self.assertLessEqual(len(fetches[0]), 3)
+              keys.extend(fetches[0])
+              self.assertAllEqual(np.ones((len(fetches[0]), 30)), fetches[1])
+              # Multi-tier storage records freqs but not versions, on both
+              # the DRAM snapshot and the SSD iterator.
+              self.assertEqual(0, len(fetches[2]))
+              self.assertEqual(len(fetches[0]), len(fetches[3]))
+            self.assertAllEqual(list(range(20)), sorted(keys))
+    finally:
+      del os.environ["TF_SSDHASH_ASYNC_COMPACTION"]
+
+  def testEmbeddingVariableForHotKeys(self):
+    print("testEmbeddingVariableForHotKeys")
+    with ops.device('/cpu:0'):
+      ev_config = variables.EmbeddingVariableOption(filter_option=variables.CounterFilter(filter_freq=1))
+      var = variable_scope.get_embedding_variable("var_1", embedding_dim=3,
+              initializer=init_ops.ones_initializer(dtypes.float32),
+              ev_option=ev_config,
+              partitioner=partitioned_variables.fixed_size_partitioner(num_shards=2))
+      emb = embedding_ops.embedding_lookup(var, math_ops.cast([4,4,4,4,3,3,3,1,1,0], dtypes.int64))
+      init = variables.global_variables_initializer()
+      keys, freqs, shard_loads = kv_variable_ops.hot_keys(var, 2)
+      with self.test_session() as sess:
+        sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_VAR_OPS))
+        sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_SLOT_OPS))
+        sess.run([init])
+        self.assertAllEqual(np.ones((10, 3)), sess.run(emb))
+        fetches = sess.run([keys, freqs, shard_loads])
+        self.assertAllEqual([4, 3], fetches[0])
+        self.assertAllEqual([4, 3], fetches[1])
+        # Keys 0 and 4 are on the first partition, 1 and 3 on the second.
+        self.assertAllClose([0.5, 0.5], fetches[2])
+
+  def testEmbeddingVariableForHotKeysTiesAcrossShards(self):
+    print("testEmbeddingVariableForHotKeysTiesAcrossShards")
+    os.environ["TF_RECORD_FREQ"] = "1"
+    try:
+      with ops.Graph().as_default() as g, ops.device('/cpu:0'):
+        var = variable_scope.get_embedding_variable("var_1", embedding_dim=3,
+                initializer=init_ops.ones_initializer(dtypes.float32),
+                partitioner=partitioned_variables.fixed_size_partitioner(num_shards=2))
+        emb = embedding_ops.embedding_lookup(var, math_ops.cast([6,6,1,1,3,3,8], dtypes.int64))
+        init = variables.global_variables_initializer()
+        keys, freqs, _ = kv_variable_ops.hot_keys(var, 2)
+        with self.test_session(graph=g) as sess:
+          sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_VAR_OPS))
+          sess.run(ops.get_collection(ops.GraphKeys.EV_INIT_SLOT_OPS))
+          sess.run([init])
+          sess.run(emb)
+          fetches = sess.run([keys, freqs])
+          # Keys 1, 3 and 6 tie, the first partition holds 6 and comes first
+          # in the candidates: the smaller keys still win.
+          self.assertAllEqual([1, 3], fetches[0])
+          self.assertAllEqual([2, 2], fetches[1])
+    finally:
+      del os.environ["TF_RECORD_FREQ"]
+
   def testEmbeddingVariableForGetShape(self):
     print("testEmbeddingVariableForGetShape")
     var = variable_scope.get_embedding_variable("var_1",
@@ -1993,6 +2148,38 @@ class EmbeddingVariableTest(test_util.TensorFlowTestCase):
       self.assertAllEqual(np.array([3,1,2,0,2,0,1]), f)
       self.assertAllEqual(np.array([2,0,1,0,2,0,2]), v)
 
+  def testEmbeddingVariableForFusedSparseSegmentReduce(self):
+    print("testEmbeddingVariableForFusedSparseSegmentReduce")
+    def runTrainSteps(fused, combiner):
+      with ops.Graph().as_default(), ops.device("/cpu:0"):
+        var = variable_scope.get_embedding_variable("var_1",
+                  embedding_dim = 3,
+                  initializer=init_ops.ones_initializer(dtypes.float32))
+        sp_ids = sparse_tensor.SparseTensor(
+            indices=[[0,0],[0,1],[0,2],[2,0],[2,1],[3,0]],
+            values=math_ops.cast([1,2,1,3,2,5], dtypes.int64),
+            dense_shape=[4, 3])
+        env = {"TF_EV_FUSED_SEGMENT_REDUCE": "1"} if fused else {}
+        with test.mock.patch.dict(os.environ, env):
+          emb = embedding_ops.embedding_lookup_sparse(var, sp_ids, None,
+                                                      combiner=combiner)
+        if fused:
+          self.assertEqual("KvResourceSparseSegmentReduce",
+                           emb.op.inputs[0].op.type)
+        fun = math_ops.multiply(emb, [[1.0, 2.0, 3.0]], name='multiply')
+        loss = math_ops.reduce_sum(fun, name='reduce_sum')
+        opt = gradient_descent.GradientDescentOptimizer(0.1)
+        train_op = opt.minimize(loss)
+        init = variables.global_variables_initializer()
+        with self.test_session() as sess:
+          sess.run([init])
+          sess.run([train_op])
+          sess.run([train_op])
+          return sess.run(emb)
+    for combiner in ["sum", "mean", "sqrtn"]:
+      self.assertAllClose(runTrainSteps(False, combiner),
+                          runTrainSteps(True, combiner))
+
   def testEmbeddingVariableForInference(self):
     print("testEmbeddingVariableForInference")
     with ops.device("/cpu:0"):
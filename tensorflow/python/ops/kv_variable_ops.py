@@ -36,14 +36,27 @@ from tensorflow.python.ops import control_flow_ops
 from tensorflow.python.ops import gen_array_ops
 from tensorflow.python.ops import gen_kv_variable_ops
 from tensorflow.python.ops import math_ops
+from tensorflow.python.ops import nn_ops
 from tensorflow.python.ops import variables
 from tensorflow.python.ops import resource_variable_ops
+from tensorflow.python.ops import sort_ops
 from tensorflow.python.util import compat
 from tensorflow.python.util import deprecation
 
 __all__ = ["EmbeddingVariable"]
 
 
+def is_multi_tier(storage_type):
+  multi_level_list = [config_pb2.StorageType.LEVELDB,
+                      config_pb2.StorageType.SSDHASH,
+                      config_pb2.StorageType.DRAM_PMEM,
+                      config_pb2.StorageType.DRAM_LEVELDB,
+                      config_pb2.StorageType.DRAM_SSDHASH,
+                      config_pb2.StorageType.HBM_DRAM,
+                      config_pb2.StorageType.DRAM_PMEM_SSDHASH,
+                      config_pb2.StorageType.HBM_DRAM_SSDHASH]
+  return storage_type in multi_level_list
+
 
 class EmbeddingVariable(resource_variable_ops.ResourceVariable):
   """Embedding Variable based on resource variable.
@@ -293,6 +306,7 @@ class EmbeddingVariable(resource_variable_ops.ResourceVariable):
     self._default_value_dim = evconfig.default_value_dim
     self._default_value_no_permission = evconfig.default_value_no_permission
     self._storage_cache_strategy = evconfig.storage_cache_strategy
+    self._storage_layout = evconfig.storage_layout
 
     if self._primary is None:
       self._is_primary = True
@@ -396,7 +410,7 @@ class EmbeddingVariable(resource_variable_ops.ResourceVariable):
                     false_positive_probability = self._false_positive_probability,
                     counter_type = self._counter_type,
                     max_freq = 99999,
-                    layout = "",
+                    layout = self._storage_layout,
                     storage_type = self._storage_type,
                     storage_path = self._storage_path,
                     storage_size = self._storage_size,
@@ -407,17 +421,6 @@ class EmbeddingVariable(resource_variable_ops.ResourceVariable):
                     name=n)
             set_attr_ops = []
 
-            def is_multi_tier(storage_type):
-              multi_level_list = [config_pb2.StorageType.LEVELDB,
-                                  config_pb2.StorageType.SSDHASH,
-                                  config_pb2.StorageType.DRAM_PMEM,
-                                  config_pb2.StorageType.DRAM_LEVELDB,
-                                  config_pb2.StorageType.DRAM_SSDHASH,
-                                  config_pb2.StorageType.HBM_DRAM,
-                                  config_pb2.StorageType.DRAM_PMEM_SSDHASH,
-                                  config_pb2.StorageType.HBM_DRAM_SSDHASH]
-              return storage_type in multi_level_list
-
             if self._is_primary and is_multi_tier(self._storage_type):
               with ops.control_dependencies([self._init_op]):
                 self._set_cache_strategy_op = gen_kv_variable_ops.kv_resource_init_cache_strategy_op(
@@ -529,6 +532,7 @@ class EmbeddingVariable(resource_variable_ops.ResourceVariable):
     self._constraint = None
     self._is_sparse=False
     self._layout = init_op.get_attr("layout")
+    self._storage_layout = self._layout
     self._slot_num = init_op.get_attr("slot_num")
     self._emb_index = init_op.get_attr("emb_index")
     self._filter_freq = init_op.get_attr("filter_freq")
@@ -675,6 +679,26 @@ class EmbeddingVariable(resource_variable_ops.ResourceVariable):
     return gen_kv_variable_ops.kv_resource_export(self._handle,
 		    self._invalid_key_type, self.dtype)
 
+  def export_in_chunks(self, chunk_size=65536, shared_name=None):
+    """Exports the variable chunk by chunk.
+
+    Returns the op that takes a new snapshot of the variable, and the
+    keys, values, versions and freqs of the next chunk. The chunk tensors
+    can be run by several consumers at a time, keys is empty once the
+    whole snapshot was returned.
+    """
+    if shared_name is None:
+      shared_name = self._handle.op.name + "/export_iterator"
+    iterator = gen_kv_variable_ops.kv_resource_export_iterator(
+        Tkeys=self._invalid_key_type, Tvalues=self.dtype,
+        chunk_size=chunk_size, shared_name=shared_name)
+    init_op = gen_kv_variable_ops.kv_resource_export_iterator_init(
+        iterator, self._handle, Tkeys=self._invalid_key_type,
+        Tvalues=self.dtype)
+    next_chunk = gen_kv_variable_ops.kv_resource_export_next_chunk(
+        iterator, Tkeys=self._invalid_key_type, Tvalues=self.dtype)
+    return init_op, next_chunk
+
   @property
   def steps_to_live(self):
     return self._steps_to_live
@@ -796,6 +820,18 @@ class EmbeddingVariable(resource_variable_ops.ResourceVariable):
               name=name)
     return array_ops.identity(value)
 
+  def sparse_segment_reduce(self, indices, segment_ids, combiner, name=None):
+    """Unique, sparse_read and sparse_segment_{sum,mean,sqrt_n} in one op."""
+    with ops.name_scope(
+        "SparseSegmentReduce" if name is None else name) as name:
+      if self._trainable:
+        tape.variable_accessed(self)
+      default_value = ops.convert_to_tensor(1.0, dtype=self.dtype)
+      value, _, _ = gen_kv_variable_ops.kv_resource_sparse_segment_reduce(
+          self._handle, indices, segment_ids, default_value,
+          combiner=combiner, name=name)
+    return value
+
   def to_proto(self, export_scope=None):
     """Converts a `EmbeddingVariable` to a `VariableDef` protocol buffer.
 
@@ -976,6 +1012,42 @@ def lookup_tier(var, ids):
           pindices, partitioned_result)
     return ret
 
+def hot_keys(var, k):
+  """Returns the `k` most frequent keys of an EmbeddingVariable.
+
+  Returns `keys`, `freqs` and `shard_loads`: the hot keys, most frequent
+  first, their frequencies, and for each partition of `var` the share of
+  all lookups it served. The variable must record frequencies, with a
+  counter filter or `record_freq`.
+  """
+  if isinstance(var, EmbeddingVariable):
+    ev_list = [var]
+  elif isinstance(var, variables.PartitionedVariable):
+    ev_list = list(var)
+  else:
+    raise TypeError("hot_keys expects an EmbeddingVariable, got %s" % var)
+  shard_keys, shard_freqs, shard_totals = [], [], []
+  for val in ev_list:
+    with ops.colocate_with(val):
+      keys, freqs, total_freq, _ = gen_kv_variable_ops.kv_resource_hot_keys(
+          val._handle, k, Tkeys=val._invalid_key_type, Tvalues=val.dtype)
+    shard_keys.append(keys)
+    shard_freqs.append(freqs)
+    shard_totals.append(total_freq)
+  # A hot key of the whole variable is among the hot keys of its shard.
+  # The candidates are ordered by key first: top_k keeps the lower index
+  # first among equal freqs, so ties go to the smaller key as in a shard.
+  keys = array_ops.concat(shard_keys, 0)
+  by_key = sort_ops.argsort(keys, stable=True)
+  keys = array_ops.gather(keys, by_key)
+  freqs = array_ops.gather(array_ops.concat(shard_freqs, 0), by_key)
+  freqs, top = nn_ops.top_k(freqs, math_ops.minimum(
+      math_ops.cast(k, dtypes.int32), array_ops.size(freqs)))
+  keys = array_ops.gather(keys, top)
+  totals = math_ops.cast(array_ops.stack(shard_totals), dtypes.float64)
+  shard_loads = math_ops.div_no_nan(totals, math_ops.reduce_sum(totals))
+  return keys, freqs, shard_loads
+
 def identity(var):
   if "GPU" in var.device:
     with ops.device(var.device):
@@ -1045,3 +1117,19 @@ def _GatherV1Grad(op, grad):
   indices = array_ops.reshape(indices, size)
   return [ops.IndexedSlices(values, indices, params_shape), None, None, None]
 
+@ops.RegisterGradient("KvResourceSparseSegmentReduce")
+def _SparseSegmentReduceGrad(op, grad, *unused_grads):
+  """Gradient for fused unique, gather and sparse segment reduce op."""
+  handle = op.inputs[0]
+  while handle.op.type != "KvVarHandleOp":
+    handle = handle.op.inputs[0]
+  params_shape = ops.convert_to_tensor(
+      tensor_shape.TensorShape(handle.op.get_attr("shape")))
+  unique_keys = op.outputs[1]
+  num_unique = array_ops.size(unique_keys, out_type=dtypes.int32)
+  values = gen_kv_variable_ops.kv_resource_sparse_segment_reduce_grad(
+      grad, op.outputs[2], op.inputs[2], num_unique,
+      combiner=op.get_attr("combiner"))
+  return [ops.IndexedSlices(values, unique_keys, params_shape),
+          None, None, None]
+
@@ -2204,6 +2204,7 @@ def get_embedding_variable(name,
         storage_path = ev_option.storage_option.storage_path,
         storage_size = ev_option.storage_option.storage_size,
         storage_cache_strategy = ev_option.storage_option.cache_strategy,
+        storage_layout = ev_option.storage_option.layout,
         default_value_dim=ev_option.init.default_value_dim,
         default_value_no_permission=ev_option.init.default_value_no_permission),
         ht_partition_num=ev_option.ht_partition_num)
@@ -2269,6 +2270,7 @@ def get_embedding_variable_internal(name,
         storage_path=ev_option.storage_option.storage_path,
         storage_size=ev_option.storage_option.storage_size,
         storage_cache_strategy = ev_option.storage_option.cache_strategy,
+        storage_layout = ev_option.storage_option.layout,
         default_value_dim=ev_option.init.default_value_dim,
         default_value_no_permission=ev_option.init.default_value_no_permission),
       ht_partition_num=ev_option.ht_partition_num)
@@ -232,11 +232,13 @@ class StorageOption(object):
                storage_type=None,
                storage_path=None,
                storage_size=[1024*1024*1024],
-               cache_strategy = config_pb2.CacheStrategy.LFU):
+               cache_strategy = config_pb2.CacheStrategy.LFU,
+               layout=""):
     self.storage_type = storage_type
     self.storage_path = storage_path
     self.storage_size = storage_size
     self.cache_strategy = cache_strategy
+    self.layout = layout
     if not isinstance(storage_size, list):
         raise ValueError("storage_size should be list type")
     if len(storage_size) < 4:
@@ -320,6 +322,7 @@ class EmbeddingVariableConfig(object):
                storage_path=None,
                storage_size=None,
                storage_cache_strategy=config_pb2.CacheStrategy.LFU,
+               storage_layout="",
                default_value_dim=4096,
                default_value_no_permission=.0):
     self.steps_to_live = steps_to_live
@@ -343,6 +346,7 @@ class EmbeddingVariableConfig(object):
     self.storage_path = storage_path
     self.storage_size = storage_size
     self.storage_cache_strategy = storage_cache_strategy
+    self.storage_layout = storage_layout
     self.default_value_dim = default_value_dim
     self.default_value_no_permission = default_value_no_permission
 